@@ -79,3 +79,300 @@ byte BITSTRING::getBit(byte bitNum) {
   
   return result;
 }
+
+// *************  PROFILER  *******************
+// Counts clock cycles taken by sections of code, so the cost of each can be seen on the target itself.  On a 
+// Mega, Timer5 runs at full clock speed and overflows (every 4mS) extend it to 32 bits, so cycle-accurate; 
+// elsewhere falls back to micros() (4uS resolution).  Each probe keeps count/min/max/total and a log2 
+// histogram, from which percentiles are estimated
+//
+// Usage, eg to time WAKEUP's interrupt routine:
+//     PROFILER profiler;                        // In the sketch; nothing is allocated by the library
+//     profiler.init();                          // Once, at startup
+//     profiler.start(0);
+//     wakeup.timerISR();
+//     profiler.stop(0);
+//     ... profiler.percentile(0, 99) / CYCLESPERUS gives the 99th percentile in uS
+//
+// NB: takes over Timer5, so can't be used alongside the Servo library on a Mega
+//
+
+#ifdef TCNT5
+ISR(TIMER5_OVF_vect) {
+  PROFILER::_overflows++;
+}
+#endif
+
+void PROFILER::init() {
+#ifdef TCNT5
+  byte oldSREG = SREG;
+  
+  cli();
+  TCCR5A = 0;									// Normal mode, free-running
+  TCCR5B = 0;
+  TCNT5 = 0;
+  _overflows = 0;
+  TIFR5 = _BV(TOV5);
+  TIMSK5 = _BV(TOIE5);
+  TCCR5B = _BV(CS50);							// No prescale - counts clock cycles
+  SREG = oldSREG;
+#endif
+  
+  // Time an empty section to find the cost of measuring
+  _overhead = 0;
+  reset(0);
+  for (byte i = 0; i < 4; i++) {
+	  start(0);
+	  stop(0);
+  }
+  _overhead = probes[0].min;
+  
+  for (byte i = 0; i < MAXPROBES; i++) reset(i);
+}
+
+unsigned long PROFILER::cycles() {
+#ifdef TCNT5
+  unsigned int high, low;
+  byte oldSREG = SREG;
+  
+  cli();
+  high = _overflows;
+  low = TCNT5;
+  if ((TIFR5 & _BV(TOV5)) && low < 0x8000) high++;			// Overflowed but not yet serviced (interrupts are off)
+  SREG = oldSREG;
+  
+  return ((unsigned long)high << 16) | low;
+#else
+  return micros() * CYCLESPERUS;
+#endif
+}
+
+void PROFILER::start(byte probe) {
+  probes[probe].startAt = cycles();
+}
+
+void PROFILER::stop(byte probe, unsigned int tag) {
+  unsigned long taken = cycles() - probes[probe].startAt;
+  
+  record(probe, (taken > _overhead) ? taken - _overhead : 0, tag);
+}
+
+void PROFILER::record(byte probe, unsigned long taken, unsigned int tag) {
+  PROBE *p = &probes[probe];
+  unsigned long scaled = taken >> 6;
+  byte bucket = 0;
+  
+  while (scaled != 0 && bucket < PROFILEBUCKETS - 1) {		// Find highest bit set
+	  scaled >>= 1;
+	  bucket++;
+  }
+  if (p->hist[bucket] != 0xFFFF) p->hist[bucket]++;
+  
+  p->count++;
+  p->total += taken;
+  if (taken < p->min) p->min = taken;
+  if (taken >= p->max) {
+	  p->max = taken;
+	  p->maxTag = tag;
+  }
+}
+
+unsigned long PROFILER::percentile(byte probe, byte pct) {
+  PROBE *p = &probes[probe];
+  unsigned long total = 0, rank, below = 0, lower, upper;
+  byte bucket;
+  
+  for (bucket = 0; bucket < PROFILEBUCKETS; bucket++) total += p->hist[bucket];
+  if (total == 0) return 0;
+  rank = (total * pct + 99) / 100;							// Rank of the section sought, from 1
+  if (rank == 0) rank = 1;
+  
+  for (bucket = 0; below + p->hist[bucket] < rank; bucket++) below += p->hist[bucket];
+  
+  // Interpolate within the bucket, narrowed to what was actually seen
+  lower = (bucket == 0) ? 0 : 64UL << (bucket - 1);
+  upper = (bucket == PROFILEBUCKETS - 1) ? p->max : 64UL << bucket;
+  if (lower < p->min) lower = p->min;
+  if (upper > p->max) upper = p->max;
+  
+  return lower + (unsigned long)((unsigned long long)(upper - lower) * (rank - below) / p->hist[bucket]);
+}
+
+void PROFILER::reset(byte probe) {
+  PROBE *p = &probes[probe];
+  
+  p->count = 0;
+  p->total = 0;
+  p->min = 0xFFFFFFFF;
+  p->max = 0;
+  p->maxTag = 0;
+  for (byte i = 0; i < PROFILEBUCKETS; i++) p->hist[i] = 0;
+}
+
+volatile unsigned int PROFILER::_overflows;
+
+
+// *************  JSONSTREAM  *******************
+// Streaming ('SAX') JSON tokenizer.  Characters are fed in as they're read from file (or network), and the 
+// callback is called as each value is completed and as each object/array opens and closes, with the names
+// of all the enclosing objects/arrays to hand.  So a whole document is dealt with in one pass, in a fixed
+// amount of RAM and without ever going back over it.  
+//
+// Values in an array are given the array's name as their key, as are objects in an array.  No validation
+// is done: input is assumed to be well formed
+//
+
+void JSONSTREAM::init(void (*callback)(byte event, JSONSTREAM *json)) {
+  _callback = callback;
+  _tokenLen = 0;
+  _inString = _inBare = _escape = _haveKey = false;
+  _depth = 0;
+  _isArray = 0;
+  _key[0] = '\0';
+}
+
+void JSONSTREAM::put(const byte *buffer, unsigned int len) {
+  while (len--) put((char) *buffer++);
+}
+
+void JSONSTREAM::put(char c) {
+  if (_inString) {
+	  if (_escape) _escape = false;
+	  else if (c == '\\') { _escape = true; return; }
+	  else if (c == '"') {
+		  _inString = false;
+		  endToken();
+		  return;
+	  }
+	  if (_tokenLen < JSONMAXTOKEN - 1) _token[_tokenLen++] = c;
+	  return;
+  }
+  
+  switch (c) {
+	case '"':
+	  _inString = true;
+	  _tokenLen = 0;
+	  break;
+	case '{':
+	case '[':
+	  // Name is the key just read, or the enclosing array's name
+	  if (_depth < JSONMAXDEPTH) {
+		  strncpy(_names[_depth], (_haveKey) ? _key : keyAt(_depth - 1), JSONKEYLEN - 1);
+		  _names[_depth][JSONKEYLEN - 1] = '\0';
+		  if (_depth < 8) {
+			  if (c == '[') _isArray |= _BV(_depth); else _isArray &= ~_BV(_depth);
+		  }
+	  }
+	  _depth++;
+	  _haveKey = false;
+	  _callback(JSON_START, this);
+	  break;
+	case '}':
+	case ']':
+	  if (_inBare) endToken();
+	  _callback(JSON_END, this);
+	  if (_depth > 0) _depth--;
+	  _haveKey = false;
+	  break;
+	case ',':
+	case ':':
+	case ' ':
+	case '\t':
+	case '\r':
+	case '\n':
+	  if (_inBare) endToken();
+	  break;
+	default:
+	  if (!_inBare) {
+		  _inBare = true;
+		  _tokenLen = 0;
+	  }
+	  if (_tokenLen < JSONMAXTOKEN - 1) _token[_tokenLen++] = c;
+  }
+}
+
+void JSONSTREAM::endToken() {
+  _token[_tokenLen] = '\0';
+  _inBare = false;
+  
+  if (!isArray() && !_haveKey) {				// First string in a pair is the key
+	  memcpy(_key, _token, _tokenLen + 1);
+	  _haveKey = true;
+  }
+  else {
+	  _callback(JSON_VALUE, this);
+	  _haveKey = false;
+  }
+}
+
+const char *JSONSTREAM::key() {
+  return (_haveKey) ? _key : keyAt(_depth - 1);
+}
+
+const char *JSONSTREAM::value() {
+  return _token;
+}
+
+byte JSONSTREAM::depth() {
+  return (_depth > 0) ? _depth - 1 : 0;
+}
+
+const char *JSONSTREAM::keyAt(byte level) {
+  return (level < _depth && level < JSONMAXDEPTH) ? _names[level] : "";
+}
+
+boolean JSONSTREAM::isArray() {
+  return _depth > 0 && _depth <= 8 && (_isArray & _BV(_depth - 1));
+}
+
+// *************  EVENTQUEUE  *******************
+// Passes events (eg a sensor changing state) from interrupt routines to the main loop, in order, without
+// the main loop ever disabling interrupts.  Events are an id (eg device number) and a value.  Only one
+// writer each end: put() from ISRs of one priority (AVR ISRs don't nest) and get() from the main loop
+//
+
+void EVENTQUEUE::init() {
+  byte oldSREG = SREG;
+  
+  cli();
+  _head = _tail = 0;
+  _overflows = 0;
+  SREG = oldSREG;
+}
+
+boolean EVENTQUEUE::put(byte id, unsigned int value) {
+  byte head = _head;
+  
+  if ((byte)(head - _tail) >= EVENTQUEUELEN) {
+	_overflows++;
+	return false;
+  }
+  _events[head % EVENTQUEUELEN].id = id;
+  _events[head % EVENTQUEUELEN].value = value;
+  _head = head + 1;									// Publish only once the entry is complete
+  return true;
+}
+
+boolean EVENTQUEUE::get(byte &id, unsigned int &value) {
+  byte tail = _tail;
+  
+  if (tail == _head) return false;
+  id = _events[tail % EVENTQUEUELEN].id;
+  value = _events[tail % EVENTQUEUELEN].value;
+  _tail = tail + 1;									// Free the entry only once it has been read
+  return true;
+}
+
+byte EVENTQUEUE::available() {
+  return _head - _tail;
+}
+
+unsigned int EVENTQUEUE::overflows() {
+  unsigned int result;
+  byte oldSREG = SREG;
+  
+  cli();
+  result = _overflows;
+  SREG = oldSREG;
+  return result;
+}
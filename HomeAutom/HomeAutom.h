@@ -23,6 +23,22 @@
 #include "WProgram.h"
 
 #define FIFOLEN 128								// Must be multiple of 8; max 256
+#define MAXPROBES 8								// Sections timed by PROFILER; 66 bytes each
+#define PROFILEBUCKETS 20						// Log2 histogram of cycles: [0] < 64, [n] 64 x 2^(n-1) up to 64 x 2^n; top bucket holds the rest
+#define CYCLESPERUS (F_CPU / 1000000L)
+#define JSONMAXDEPTH 8							// Nesting of objects/arrays tracked by JSONSTREAM; deeper ones are parsed but not named
+#define JSONMAXTOKEN 20							// Longest key or value passed by JSONSTREAM, incl terminator; longer ones are truncated
+#define JSONKEYLEN 12							// Longest name kept for each level of nesting, incl terminator
+#define EVENTQUEUELEN 16						// Power of 2, max 128.  Events waiting for EVENTQUEUE::get(); any more are dropped (and counted)
+
+#if (EVENTQUEUELEN & (EVENTQUEUELEN - 1)) || EVENTQUEUELEN > 128
+#error EVENTQUEUELEN must be a power of 2 no greater than 128
+#endif
+
+// Events passed to the JSONSTREAM callback
+const byte JSON_VALUE = 0;						// key() and value() hold the pair
+const byte JSON_START = 1;						// Object or array opened; key() is its name
+const byte JSON_END = 2;						// Object or array closed; key() is its name
 //#define MAXSLEEPERS 8							// Must be multiple of 8; max 256
 //#define MAXPENDING 8
 //#define MAXHEARTBEAT 8250						// Round down from absolute max of 8,388,480 uS
@@ -50,6 +66,80 @@ private:
   byte *_buffer;
 };
 
+class PROFILER {
+public:
+  void init();									// Starts the cycle counter (Timer5 on Mega, else micros()) and clears all probes
+  unsigned long cycles();						// Clock cycles since init(); wraps after 268 secs
+  void start(byte probe);						// Mark start of section timed by probe
+  void stop(byte probe, unsigned int tag = 0);	// Mark end of section and record cycles taken.  Tag kept if slowest yet (eg device number)
+  void record(byte probe, unsigned long taken, unsigned int tag = 0);	// Record a time measured elsewhere
+  unsigned long percentile(byte probe, byte pct);	// Estimate of cycles within which pct% of sections ran, from histogram
+  void reset(byte probe);						// Clear one probe's figures
+  
+  struct PROBE {
+	unsigned long count;						// Sections timed
+	unsigned long long total;					// Sum of cycles; 64 bits so it doesn't wrap on long-running sections
+	unsigned long min;
+	unsigned long max;
+	unsigned int maxTag;						// Tag given with max
+	unsigned long startAt;						// cycles() at start()
+	unsigned int hist[PROFILEBUCKETS];			// Saturate at 65535
+  } probes[MAXPROBES];
+  
+  static volatile unsigned int _overflows;		// High word of cycles(); one Timer5, so shared.  Public for the Timer5 overflow ISR
+  
+private:
+  unsigned long _overhead;						// Cycles taken by start() + stop() themselves, deducted from each reading
+};
+
+extern PROFILER profiler;						// Defined by the sketch, if it profiles, so the probes take no RAM otherwise
+
+class JSONSTREAM {
+public:
+  void init(void (*callback)(byte event, JSONSTREAM *json));	// Ready to parse a new document
+  void put(char c);								// Feed the next character
+  void put(const byte *buffer, unsigned int len);	// Feed a block of characters
+  const char *key();							// Name of the value, or of the object/array started or ended.  In an array, the array's name
+  const char *value();							// Value as text (quotes removed) - only valid for JSON_VALUE
+  byte depth();									// Objects/arrays open around the current value (0 = top level object, once opened)
+  const char *keyAt(byte level);				// Name of the object/array at level (0 = outermost), or "" if not open
+  boolean isArray();							// True if the innermost open container is an array
+  
+private:
+  void endToken();								// Key or value complete
+  
+  void (*_callback)(byte event, JSONSTREAM *json);
+  char _token[JSONMAXTOKEN];					// Key or value being read
+  char _key[JSONMAXTOKEN];						// Latest key read in an object, waiting for its value
+  byte _tokenLen;
+  boolean _inString;
+  boolean _inBare;								// Reading an unquoted value (number, true, false, null)
+  boolean _escape;
+  boolean _haveKey;
+  byte _depth;									// Number of containers open
+  byte _isArray;								// Bit per level (up to 8): 1 = array, 0 = object
+  char _names[JSONMAXDEPTH][JSONKEYLEN];		// Name of each open container
+};
+
+class EVENTQUEUE {
+public:
+  void init();									// Empty the queue and clear the overflow count
+  boolean put(byte id, unsigned int value);		// Queue an event - safe from an ISR.  False (and counted) if full
+  boolean get(byte &id, unsigned int &value);	// Take the oldest event; false if none
+  byte available();								// Events waiting
+  unsigned int overflows();						// Events dropped since init()
+  
+private:
+  // Ring with one writer each end, as WAKEUP's pending queue: put() only moves _head and get() only moves _tail
+  volatile byte _head;							// Count of events put
+  volatile byte _tail;							// Count of events taken
+  volatile unsigned int _overflows;
+  struct _event {
+	byte id;
+	unsigned int value;
+  } volatile _events[EVENTQUEUELEN];			// Entry for count n is at [n % EVENTQUEUELEN]
+};
+
 
 
 
@@ -8,7 +8,7 @@
 // #define MCP23S17_WRITE B0100AAA0 
 
 // Assumes prior initialisation of SPI comms
-// For speed, direct access to SPI registers used in place of standard SPI.transfer method
+// For speed, inline SPIBUS (SpiDevice.h) used in place of standard SPI.transfer method
 
 /*
    Version history
@@ -17,6 +17,11 @@
    v1 - Mar 11 - dreamcat https://github.com/dreamcat4/Mcp23s17
    v2 - Oct 11 - Andrew Richards - https://github.com/andrewr123/arduino-ha
 		Modifications to add interrupt handling and allow use with standard SPI library
+   v3 - Andrew Richards
+		SPI via SPIBUS, with slave select driven through its port; slave_select_pin #define no longer needed
+		Shadow copies of the writable registers, so single pin changes no longer read the chip first.
+		beginTransaction()/apply() to batch many changes into one sequential burst
+		MCP23S17BUS to service all the chips on one slave select from a single interrupt
 
 		Licensing (for v2 code; no licensing specified for v1 code)
 	    ---------
@@ -37,6 +42,7 @@
 */
 	   
 #include "WConstants.h"
+#include "SpiDevice.h"
 #include "Mcp23s17.h"
 #include "wiring_private.h"
 
@@ -44,21 +50,14 @@
 
 //---------- public ----------------------------------------------------
 
-#ifdef slave_select_pin
-void MCP23S17::begin(uint8_t dummy)
-#else
 void MCP23S17::begin(uint8_t slave_select_pin)
-#endif
 {
   	setup_ss(slave_select_pin);
   	setup_device(0x00);
+  	read_shadow();
 }
 
-#ifdef slave_select_pin
-void MCP23S17::begin(uint8_t dummy, byte aaa_hw_addr)
-#else
 void MCP23S17::begin(uint8_t slave_select_pin, byte aaa_hw_addr)
-#endif
 {
 
   setup_ss(slave_select_pin);
@@ -71,32 +70,23 @@ void MCP23S17::begin(uint8_t slave_select_pin, byte aaa_hw_addr)
 
   // Remember the hardware address for this chip
   setup_device(aaa_hw_addr);
+  read_shadow();
 }
 
-#ifdef slave_select_pin
-void MCP23S17::beginInt(uint8_t dummy, uint8_t intMode)
-#else
 void MCP23S17::beginInt(uint8_t slave_select_pin, uint8_t intMode)
-#endif
 {
   	begin(slave_select_pin);
 	raiseInterruptWith(intMode);
   	intTest = 0;
   	intDirection = 0;
-  	intEnablePins = 0;
 }
 
-#ifdef slave_select_pin
-void MCP23S17::beginInt(uint8_t dummy, uint8_t intMode, byte aaa_hw_addr)
-#else
 void MCP23S17::beginInt(uint8_t slave_select_pin, uint8_t intMode, byte aaa_hw_addr)
-#endif
 {
   	begin(slave_select_pin, aaa_hw_addr);
 	raiseInterruptWith(intMode);
   	intTest = 0;
   	intDirection = 0;
-  	intEnablePins = 0;
 }
 
 void MCP23S17::pinMode(bool mode)
@@ -107,12 +97,12 @@ void MCP23S17::pinMode(bool mode)
   else
     input_pins = 0x0000;
 
-  write_addr(IODIR, input_pins);
+  write_reg(IODIR, input_pins);
 }
 
 void MCP23S17::port(uint16_t value)
 {
-  write_addr(GPIO,value);
+  write_reg(GPIO,value);
 }
 
 uint16_t MCP23S17::port()
@@ -122,18 +112,12 @@ uint16_t MCP23S17::port()
 
 void MCP23S17::pinMode(uint8_t pin, bool mode)
 {
-  if(mode == INPUT)
-    write_addr(IODIR, read_addr(IODIR) | 1<<pin );
-  else
-    write_addr(IODIR, read_addr(IODIR) & ~(1<<pin) );
+  update_reg(IODIR, 1<<pin, (mode == INPUT) ? 0xFFFF : 0x0000);
 }
 
 void MCP23S17::digitalWrite(uint8_t pin, bool value)
 {
-  if(value)
-    write_addr(GPIO, read_addr(GPIO) | 1<<pin );  
-  else
-    write_addr(GPIO, read_addr(GPIO) & ~(1<<pin) );  
+  update_reg(GPIO, 1<<pin, (value) ? 0xFFFF : 0x0000);
 }
 
 int MCP23S17::digitalRead(uint8_t pin)
@@ -148,46 +132,71 @@ void MCP23S17::intMode (byte pin, byte IOCMode) {
 	
 	switch (IOCMode) {				// Set appropriate control flags in MCP and (if RISING/FALLING) locally
 		case ONCHANGE:
-			write_addr (INTCON, read_addr(INTCON) & ~(1 << pin));	// IOCPREV
+			update_reg (INTCON, 1 << pin, 0x0000);	// IOCPREV
 			intTest &= ~(1 << pin);		// No test for direction needed
 			break;
 		case RISING:
-			write_addr (INTCON, read_addr(INTCON) & ~(1 << pin));	// IOCPREV
+			update_reg (INTCON, 1 << pin, 0x0000);	// IOCPREV
 			intTest |= (1 << pin);		// Test for direction against INTCAP needed after interrupt
 			intDirection |= (1 << pin);		// Was rising change if INTCAP is set
 			break;
 		case FALLING:
-			write_addr (INTCON, read_addr(INTCON) & ~(1 << pin));	// IOCPREV
+			update_reg (INTCON, 1 << pin, 0x0000);	// IOCPREV
 			intTest |= (1 << pin);		// Test for direction against INTCAP needed after interrupt
 			intDirection &= ~(1 << pin);	// Was falling change if INTCAP is clear
 			break;
 		case WHILEHIGH:
-			write_addr (INTCON, read_addr(INTCON) | (1 << pin));	// IOCDEFVAL
-			write_addr (DEFVAL, read_addr(DEFVAL) & ~(1 << pin));	// Interrupt if opposite to 0
+			update_reg (INTCON, 1 << pin, 0xFFFF);	// IOCDEFVAL
+			update_reg (DEFVAL, 1 << pin, 0x0000);	// Interrupt if opposite to 0
 			intTest &= ~(1 << pin);		// No test for direction needed
 			break;
 		case WHILELOW:
-			write_addr (INTCON, read_addr(INTCON) | (1 << pin));		// IOCDEFVAL
-			write_addr (DEFVAL, read_addr(DEFVAL) | (1 << pin));		// Interrupt if opposite to 1
+			update_reg (INTCON, 1 << pin, 0xFFFF);		// IOCDEFVAL
+			update_reg (DEFVAL, 1 << pin, 0xFFFF);		// Interrupt if opposite to 1
 			intTest &= ~(1 << pin);		// No test for direction needed
 			break;
 	}
 }
 
 void MCP23S17::intEnable (byte pin) {
-	intEnablePins |= 1 << pin;
-	write_addr (GPINTEN, read_addr(GPINTEN) | 1 << pin);		// Results in instant interrupt if enabling into int condition
-																// See section 1.7.5 of data sheet
+	update_reg (GPINTEN, 1 << pin, 0xFFFF);		// Results in instant interrupt if enabling into int condition
+												// See section 1.7.5 of data sheet
 }
 
 void MCP23S17::intDisable (byte pin) {
-	write_addr (GPINTEN, read_addr (GPINTEN) & ~(1 << pin));
-	intEnablePins &= ~(1 << pin);
+	update_reg (GPINTEN, 1 << pin, 0x0000);
 }
 
 void MCP23S17::intDisable () {
-	write_addr (GPINTEN, 0x0000);
-	intEnablePins = 0;
+	write_reg (GPINTEN, 0x0000);
+}
+
+void MCP23S17::beginTransaction () {
+	inTransaction = true;
+}
+
+void MCP23S17::apply () {		// Write everything changed since beginTransaction
+	byte first, last, numDirty = 0;
+	uint8_t oldSREG;
+	
+	oldSREG = SREG;
+	cli();
+	
+	inTransaction = false;
+	if (dirtyRegs) {
+		for (first = 0; !(dirtyRegs & (1 << first)); first++);
+		for (last = NUMREGS - 1; !(dirtyRegs & (1 << last)); last--);
+		for (byte reg = first; reg <= last; reg++) if (dirtyRegs & (1 << reg)) numDirty++;
+
+		// A burst costs 2 bytes plus 2 per register spanned (rewriting clean ones unchanged; INTF & INTCAP ignore writes),
+		// versus 4 bytes per register written separately
+		if (2 + 2 * (last - first + 1) <= 4 * numDirty) write_block(first, last);
+		else for (byte reg = first; reg <= last; reg++) if (dirtyRegs & (1 << reg)) write_addr(reg << 1, shadowReg[reg]);
+		
+		dirtyRegs = 0;
+	}
+	
+	SREG = oldSREG;
 }
 
 boolean MCP23S17::intFlag (byte pin) {
@@ -205,14 +214,11 @@ uint16_t MCP23S17::intCapture () {
 uint16_t MCP23S17::intValid () {   	// Optimised function to interpret interrupts on behalf of ISR
 					// Returns (for each pin) 1 for valid interrupt, 0 if invalid (condition not met)
 					// Pins with valid interrupt have interrupts disabled; remainder of pins unchanged
-					// If slave_select_pin declared as inbuild constant vs passed as variable, then takes:
+					// Slave select driven through its port (as an inbuilt constant pin gave, in place of ::digitalWrite)
 					// ~7uS vs ~ 10uS to test int flags and return if null
 					// ~25uS vs ~40uS to process interrupts
 					
-  uint16_t flagBits;		// Copy of INTF register interpreted using intDirection against INTCAP if intTest set
-  uint16_t intCaptured;		// Indicates what caused the interrupt - copy of INTCAP register
-  uint16_t intDirOK;		// 1 indicates change was same as desired direction (High - Low, or Low - High)
-  uint16_t intIgnore;		// 1 if the interrupt should be ignored
+  uint16_t flagBits;		// Copy of INTF register
 
   byte low_byte;
   byte high_byte;
@@ -223,23 +229,40 @@ uint16_t MCP23S17::intValid () {   	// Optimised function to interpret interrupt
   
   // Find out which pins triggered the interrupt - inline version of read_addr(INTF);
 
-  ::digitalWrite(slave_select_pin, LOW);
+  select();
 
-  SPDR = read_cmd; while (!(SPSR & (1<<SPIF)));
-  SPDR = INTF; while (!(SPSR & (1<<SPIF)));
-  SPDR = 0x00; while (!(SPSR & (1<<SPIF))); low_byte  = SPDR;
-  SPDR = 0x00; while (!(SPSR & (1<<SPIF))); high_byte = SPDR;
+  SPIBUS::transfer(read_cmd);
+  SPIBUS::transfer(INTF);
+  low_byte = SPIBUS::transfer(0x00);
+  high_byte = SPIBUS::transfer(0x00);
   flagBits = (uint16_t)high_byte<<8 | (uint16_t)low_byte;
   
-  ::digitalWrite(slave_select_pin, HIGH);
+  deselect();
   
   // In a multi-chip environment (with interrupt out lines commoned) then this chip might not
   // have raised the interrupt - in which case can quit early
   
-  if (flagBits == 0) {
-	SREG = oldSREG;		// Restore previous interrupt state
-    return flagBits;
-  }
+  if (flagBits != 0) flagBits = intProcess(flagBits);
+  
+  SREG = oldSREG;		// Restore previous interrupt state
+  
+  return flagBits;
+}
+
+
+uint16_t MCP23S17::intProcess (uint16_t flagBits) {	// Second half of intValid, given INTF (non-zero) as flagBits
+													// Returns flagBits interpreted using intDirection against INTCAP if intTest set
+  uint16_t intCaptured;		// Indicates what caused the interrupt - copy of INTCAP register
+  uint16_t intDirOK;		// 1 indicates change was same as desired direction (High - Low, or Low - High)
+  uint16_t intIgnore;		// 1 if the interrupt should be ignored
+  uint16_t &intEnablePins = shadowReg[GPINTEN >> 1];		// Shadow of GPINTEN; amended here as pins interrupt
+
+  byte low_byte;
+  byte high_byte;
+  uint8_t oldSREG;
+  
+  oldSREG = SREG;
+  cli();
 
   // Need to disable interrupts on valid int in pin(s).  But slightly complicated by modes . . 
   // If WHILEHIGH, WHILELOW or ONCHANGE then interrupt is unconditional (so intTest == 0), so
@@ -254,27 +277,27 @@ uint16_t MCP23S17::intValid () {   	// Optimised function to interpret interrupt
   if ((intTest & flagBits) == 0)  {	    // TRUE if all interrupts are unconditional
 	intEnablePins ^= flagBits;			// Clear pins that interrupted
 	
-	::digitalWrite(slave_select_pin, LOW);
+	select();
 
-    SPDR = write_cmd; while (!(SPSR & (1<<SPIF)));
-    SPDR = GPINTEN; while (!(SPSR & (1<<SPIF)));
-    SPDR = (byte)(intEnablePins & 0x00ff); while (!(SPSR & (1<<SPIF))); 
-    SPDR = (byte)(intEnablePins >> 8); while (!(SPSR & (1<<SPIF))); 
+    SPIBUS::transfer(write_cmd);
+    SPIBUS::transfer(GPINTEN);
+    SPIBUS::transfer((byte)(intEnablePins & 0x00ff)); 
+    SPIBUS::transfer((byte)(intEnablePins >> 8)); 
 
-    ::digitalWrite(slave_select_pin, HIGH);
+    deselect();
   }
 
   // Clear the interrupt out (and get values for any conditional tests).  Inline version of read_addr (INTCAP)
 
-  ::digitalWrite(slave_select_pin, LOW);
+  select();
 
-  SPDR = read_cmd; while (!(SPSR & (1<<SPIF)));
-  SPDR = INTCAP; while (!(SPSR & (1<<SPIF)));
-  SPDR = 0x00; while (!(SPSR & (1<<SPIF))); low_byte  = SPDR;
-  SPDR = 0x00; while (!(SPSR & (1<<SPIF))); high_byte = SPDR;
+  SPIBUS::transfer(read_cmd);
+  SPIBUS::transfer(INTCAP);
+  low_byte = SPIBUS::transfer(0x00);
+  high_byte = SPIBUS::transfer(0x00);
   intCaptured = (uint16_t)high_byte<<8 | (uint16_t)low_byte; 
     
-  ::digitalWrite(slave_select_pin, HIGH);
+  deselect();
     
   // If any conditional interrupts, then do the tests and disable the pins that caused a valid interrupt, 
   // Tests are a combination of:
@@ -289,14 +312,14 @@ uint16_t MCP23S17::intValid () {   	// Optimised function to interpret interrupt
 	  
 	  intEnablePins ^= flagBits;												 // Bitwise 1 if no interrupt or not valid
 
-	  ::digitalWrite(slave_select_pin, LOW);
+	  select();
 	
-	  SPDR = write_cmd; while (!(SPSR & (1<<SPIF)));
-	  SPDR = GPINTEN; while (!(SPSR & (1<<SPIF)));
-	  SPDR = (byte)(intEnablePins & 0x00ff); while (!(SPSR & (1<<SPIF))); 
-	  SPDR = (byte)(intEnablePins >> 8); while (!(SPSR & (1<<SPIF))); 
+	  SPIBUS::transfer(write_cmd);
+	  SPIBUS::transfer(GPINTEN);
+	  SPIBUS::transfer((byte)(intEnablePins & 0x00ff)); 
+	  SPIBUS::transfer((byte)(intEnablePins >> 8)); 
 	
-	  ::digitalWrite(slave_select_pin, HIGH); 
+	  deselect(); 
   }
   
   SREG = oldSREG;		// Restore previous interrupt state
@@ -305,6 +328,117 @@ uint16_t MCP23S17::intValid () {   	// Optimised function to interpret interrupt
 }
 
 
+//---------- MCP23S17BUS ----------------------------------------------
+// Owns all the chips (up to 8, distinguished by hardware address) sharing a slave select, with their INT outputs 
+// commoned onto one Arduino interrupt.  service() reads INTF of every chip in turn with the slave select driven 
+// directly through its port, and only spends time on chips that have something to report.  Each valid pin interrupt
+// is passed to that pin's handler - from within the ISR, so handlers should be short (eg wake a sleeper)
+// As an edge on the INT line is missed if another chip interrupts while earlier ones are being serviced, service()
+// keeps going until a pass finds no flags set (up to MAXBUSPASSES)
+
+void MCP23S17BUS::begin(uint8_t slave_select)
+{
+  ssPort = portOutputRegister(digitalPinToPort(slave_select));
+  ssMask = digitalPinToBitMask(slave_select);
+  numChips = 0;
+}
+
+byte MCP23S17BUS::addChip(MCP23S17 *chip)
+{
+  if (numChips >= MAXBUSCHIPS) return MAXBUSCHIPS;
+
+  chips[numChips] = chip;
+  for (byte pin = 0; pin < 16; pin++) handlers[numChips][pin] = NULL;
+  counts[numChips] = 0;
+
+  return numChips++;
+}
+
+void MCP23S17BUS::attachHandler(byte chipNum, byte pin, void (*handler)(byte chipNum, byte pin))
+{
+  uint8_t oldSREG;
+
+  if (chipNum >= numChips || pin > 15) return;
+
+  oldSREG = SREG;
+  cli();			// Pointer written in two halves
+  handlers[chipNum][pin] = handler;
+  SREG = oldSREG;
+}
+
+void MCP23S17BUS::detachHandler(byte chipNum, byte pin)
+{
+  attachHandler(chipNum, pin, NULL);
+}
+
+byte MCP23S17BUS::service()
+{
+  uint16_t flagBits[MAXBUSCHIPS];
+  uint16_t valid;
+  byte low_byte, high_byte;
+  byte events = 0;
+  byte passes = 0;
+  boolean anyFlags;
+  uint8_t oldSREG;
+
+  oldSREG = SREG;
+  cli();			// Protect following from interrupts (if not already within ISR)
+
+  do {
+	anyFlags = false;
+
+	// Find out which chips (and pins) interrupted - inline version of read_addr(INTF) for each chip
+	for (byte c = 0; c < numChips; c++) {
+	  *ssPort &= ~ssMask;
+
+	  SPIBUS::transfer(chips[c]->read_cmd);
+	  SPIBUS::transfer(MCP23S17::INTF);
+	  low_byte = SPIBUS::transfer(0x00);
+	  high_byte = SPIBUS::transfer(0x00);
+
+	  *ssPort |= ssMask;
+
+	  flagBits[c] = (uint16_t)high_byte<<8 | (uint16_t)low_byte;
+	  if (flagBits[c]) anyFlags = true;
+	}
+
+	// Clear the interrupts, keep the valid ones and dispatch
+	for (byte c = 0; c < numChips; c++) {
+	  if (flagBits[c] == 0) continue;
+
+	  valid = chips[c]->intProcess(flagBits[c]);
+	  for (byte pin = 0; valid; pin++, valid >>= 1) {
+		if (valid & 1) {
+		  counts[c]++;
+		  events++;
+		  if (handlers[c][pin]) handlers[c][pin](c, pin);
+		}
+	  }
+	}
+  } while (anyFlags && ++passes < MAXBUSPASSES);
+
+  SREG = oldSREG;		// Restore previous interrupt state
+
+  return events;
+}
+
+unsigned int MCP23S17BUS::intCount(byte chipNum, boolean reset)
+{
+  unsigned int count;
+  uint8_t oldSREG;
+
+  if (chipNum >= numChips) return 0;
+
+  oldSREG = SREG;
+  cli();
+  count = counts[chipNum];
+  if (reset) counts[chipNum] = 0;
+  SREG = oldSREG;
+
+  return count;
+}
+
+
 //------------------ protected -----------------------------------------------
 
 uint16_t MCP23S17::byte2uint16(byte high_byte, byte low_byte)
@@ -322,22 +456,16 @@ byte MCP23S17::uint16_low_byte(uint16_t uint16)
   return (byte)(uint16 & 0x00FF);
 }
 
-#ifdef slave_select_pin
-void MCP23S17::setup_ss(uint8_t dummy)
-{
-  // Set slave select (Chip Select) pin for Spi Bus, and start high (disabled)
-  ::pinMode(slave_select_pin,OUTPUT);
-  ::digitalWrite(slave_select_pin,HIGH);
-}
-#else
 void MCP23S17::setup_ss(uint8_t slave_select_pin)
 {
   // Set slave select (Chip Select) pin for Spi Bus, and start high (disabled)
   ::pinMode(slave_select_pin,OUTPUT);
   ::digitalWrite(slave_select_pin,HIGH);
-  this->slave_select_pin = slave_select_pin;
+
+  // Then drive it through its port, for speed
+  ss_port = portOutputRegister(digitalPinToPort(slave_select_pin));
+  ss_mask = digitalPinToBitMask(slave_select_pin);
 }
-#endif
 
 
 void MCP23S17::setup_device(uint8_t aaa_hw_addr)
@@ -350,10 +478,10 @@ void MCP23S17::setup_device(uint8_t aaa_hw_addr)
 
 void MCP23S17::raiseInterruptWith (byte mode) {
   	if (mode == HIGH) {
-	  	write_IOCON (read_addr(IOCON) | MIRROR | INTPOL);
+	  	write_IOCON ((byte)shadowReg[IOCON >> 1] | MIRROR | INTPOL);
   	}
     else {
-	    write_IOCON ( (read_addr(IOCON) | MIRROR) & ~INTPOL);
+	    write_IOCON ( ((byte)shadowReg[IOCON >> 1] | MIRROR) & ~INTPOL);
     }
 }
 
@@ -367,14 +495,14 @@ uint16_t MCP23S17::read_addr(byte addr)
   oldSREG = SREG;
   cli();			// Protect following from interrupts
 
-  ::digitalWrite(slave_select_pin, LOW);
+  select();
 
-  SPDR = read_cmd; while (!(SPSR & (1<<SPIF)));
-  SPDR = addr; while (!(SPSR & (1<<SPIF)));
-  SPDR = 0x00; while (!(SPSR & (1<<SPIF))); low_byte  = SPDR;
-  SPDR = 0x00; while (!(SPSR & (1<<SPIF))); high_byte = SPDR;
+  SPIBUS::transfer(read_cmd);
+  SPIBUS::transfer(addr);
+  low_byte = SPIBUS::transfer(0x00);
+  high_byte = SPIBUS::transfer(0x00);
 
-  ::digitalWrite(slave_select_pin, HIGH);
+  deselect();
 
   SREG = oldSREG;		// Restore previous interrupt state
 
@@ -390,14 +518,14 @@ void MCP23S17::write_addr(byte addr, uint16_t data)
   oldSREG = SREG;
   cli();
 
-  ::digitalWrite(slave_select_pin, LOW);
+  select();
 
-  SPDR = write_cmd; while (!(SPSR & (1<<SPIF)));
-  SPDR = addr; while (!(SPSR & (1<<SPIF)));
-  SPDR = uint16_low_byte(data); while (!(SPSR & (1<<SPIF)));
-  SPDR = uint16_high_byte(data); while (!(SPSR & (1<<SPIF)));
+  SPIBUS::transfer(write_cmd);
+  SPIBUS::transfer(addr);
+  SPIBUS::transfer(uint16_low_byte(data));
+  SPIBUS::transfer(uint16_high_byte(data));
 
-  ::digitalWrite(slave_select_pin, HIGH);
+  deselect();
 
   SREG = oldSREG;		// Restore previous interrupt state
 
@@ -411,14 +539,93 @@ void MCP23S17::write_IOCON(byte data)
   oldSREG = SREG;
   cli();
 
-  ::digitalWrite(slave_select_pin, LOW);
+  select();
+
+  SPIBUS::transfer(write_cmd);
+  SPIBUS::transfer(IOCON);
+  SPIBUS::transfer(data);
 
-  SPDR = write_cmd; while (!(SPSR & (1<<SPIF)));
-  SPDR = IOCON; while (!(SPSR & (1<<SPIF)));
-  SPDR = data; while (!(SPSR & (1<<SPIF)));
+  deselect();
 
-  ::digitalWrite(slave_select_pin, HIGH);
+  shadowReg[IOCON >> 1] = byte2uint16(data, data);		// IOCON appears at both addresses of the pair
 
   SREG = oldSREG;		// Restore previous interrupt state
 
 }
+
+
+void MCP23S17::write_reg(byte addr, uint16_t data)		// Write through the shadow; nothing sent if unchanged, or until apply() if in a transaction
+{
+  byte reg = addr >> 1;
+
+  if (reg == GPIO >> 1) reg = OLAT >> 1;			// Writes to GPIO go to the output latch
+  if (shadowReg[reg] == data) return;
+
+  shadowReg[reg] = data;
+  if (reg == OLAT >> 1) shadowReg[GPIO >> 1] = data;	// Keep in step, as a burst may span both
+  
+  if (inTransaction) dirtyRegs |= 1 << reg;
+  else write_addr(reg << 1, data);
+}
+
+
+void MCP23S17::update_reg(byte addr, uint16_t mask, uint16_t bits)	// Change the masked bits of a register to bits
+{
+  uint8_t oldSREG;
+
+  oldSREG = SREG;
+  cli();			// intValid may change GPINTEN from an ISR
+
+  write_reg(addr, (shadowReg[addr >> 1] & ~mask) | (bits & mask));
+
+  SREG = oldSREG;
+}
+
+
+void MCP23S17::write_block(byte first_reg, byte last_reg)		// Write shadow registers first_reg to last_reg in one sequential burst
+{
+  uint8_t oldSREG;
+
+  oldSREG = SREG;
+  cli();
+
+  select();
+
+  SPIBUS::transfer(write_cmd);
+  SPIBUS::transfer(first_reg << 1);
+  for (byte reg = first_reg; reg <= last_reg; reg++) {
+    SPIBUS::transfer(uint16_low_byte(shadowReg[reg]));
+    SPIBUS::transfer(uint16_high_byte(shadowReg[reg]));
+  }
+
+  deselect();
+
+  SREG = oldSREG;
+}
+
+
+void MCP23S17::read_shadow()		// Load shadow registers from the chip in one sequential burst (needs IOCON.SEQOP clear - the default)
+{
+  byte low_byte;
+  uint8_t oldSREG;
+
+  oldSREG = SREG;
+  cli();
+
+  select();
+
+  SPIBUS::transfer(read_cmd);
+  SPIBUS::transfer(IODIR);
+  for (byte reg = 0; reg < NUMREGS; reg++) {
+    low_byte = SPIBUS::transfer(0x00);
+    shadowReg[reg] = byte2uint16(SPIBUS::transfer(0x00), low_byte);
+  }
+
+  deselect();
+
+  shadowReg[GPIO >> 1] = shadowReg[OLAT >> 1];		// GPIO reads the pins; writes go to OLAT
+  dirtyRegs = 0;
+  inTransaction = false;
+
+  SREG = oldSREG;
+}
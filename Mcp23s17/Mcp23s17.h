@@ -9,6 +9,11 @@
     v1 - Mar 11 - dreamcat https://github.com/dreamcat4/Mcp23s17
     v2 - Oct 11 - Andrew Richards - https://github.com/andrewr123/arduino-ha
 	 Modifications to add interrupt handling and allow use with standard SPI library
+    v3 - Andrew Richards
+	 SPI via SPIBUS, with slave select driven through its port; slave_select_pin #define no longer needed
+	 Shadow copies of the writable registers, so single pin changes no longer read the chip first.
+	 beginTransaction()/apply() to batch many changes into one sequential burst
+	 MCP23S17BUS to service all the chips on one slave select from a single interrupt
 
     Licensing (for v2 code; no licensing specified for v1 code)
     ---------
@@ -32,8 +37,6 @@
 #ifndef Mcp23s17_h
 #define Mcp23s17_h
 
-//#define slave_select_pin 30     // Use of builtin constant enables fast digitalWrite
-
 // ********************  CONSTANTS  *********************
 
 // Public Constants
@@ -66,10 +69,15 @@ const static uint8_t WHILELOW = 5;		// INTCON == 1: raise interrupt if low (DEFV
 const static uint8_t DISABLED = 0x00;
 const static uint8_t ENABLED  = 0x01;
 
+#define MAXBUSCHIPS 8		// Chips sharing one slave select - limit of the 3-bit hardware address
+#define MAXBUSPASSES 4		// Passes over the chips in one MCP23S17BUS::service() while new interrupts keep arriving
+
 // ******************* CLASS *************************
 
 class MCP23S17
 {
+  friend class MCP23S17BUS;
+
   public:
     // You must specify the slave select pin
     void begin(uint8_t slave_select);
@@ -93,6 +101,11 @@ class MCP23S17
     void intDisable(byte pin);
     void intDisable();
 
+    // Batch changes: from beginTransaction() writes only update the shadow registers, then apply() 
+    // sends everything changed in one burst (or one write per register if that's shorter)
+    void beginTransaction();
+    void apply();
+
     boolean intFlag (byte pin);
     uint16_t intFlag ();
     uint16_t intCapture ();
@@ -124,6 +137,8 @@ class MCP23S17
     const static uint8_t IODIRB = 0x01;
     const static uint8_t IODIR  = IODIRA;
 
+    const static uint8_t IPOL   = 0x02;		// Input polarity
+
     const static uint8_t GPINTEN = 0x04;  	// Interrupt enable pins
 
     const static uint8_t DEFVAL  = 0x06;  	// If GPINTEN and IOCDEF then interrupt on opposite
@@ -142,12 +157,18 @@ class MCP23S17
     const static uint8_t GPIOB  = 0x13;
     const static uint8_t GPIO   = GPIOA;
 
-    #ifndef slave_select_pin
-    	uint8_t slave_select_pin;
-    #endif
+    const static uint8_t OLAT   = 0x14;		// Output latch - written by writes to GPIO
+
+    const static uint8_t NUMREGS = 11;		// Register pairs, IODIR to OLAT
+
+    volatile uint8_t *ss_port;	// Slave select as port & bit, to avoid the overhead of ::digitalWrite
+    uint8_t ss_mask;
     uint16_t intTest;			// 0 = no interpretation (accept interrupt), 1 = interpet by comparing INTCAP against intDirection
     uint16_t intDirection;		// Set in intEnable, then (if intTest == 1) used to interpret INTCAP when IOCMode == RISING (1) or FALLING (0)
-    uint16_t intEnablePins;		// Set/unset in intEnable/intDisable; amended in intValid.  Copy of GPINTEN
+    uint16_t shadowReg[NUMREGS];	// Copy of each register pair (indexed by addr >> 1) as last read or written.  Only the writable ones 
+    								// are kept up to date; GPIO holds the same as OLAT
+    uint16_t dirtyRegs;			// Bit per register pair changed in shadowReg but not yet written
+    boolean inTransaction;		// Set by beginTransaction, cleared by apply
 
     byte aaa_hw_addr;
 
@@ -155,17 +176,43 @@ class MCP23S17
     byte write_cmd;
 
     void setup_ss(uint8_t slave_select);
+    inline void select() { *ss_port &= ~ss_mask; }		// Only with interrupts disabled - not atomic for ports H-L
+    inline void deselect() { *ss_port |= ss_mask; }
     void setup_device(uint8_t aaa_hw_addr);
     void raiseInterruptWith (byte mode);
+    uint16_t intProcess (uint16_t flagBits);
 
     void write_addr(byte addr, uint16_t data);
     void write_IOCON(byte data);
+    void write_reg(byte addr, uint16_t data);
+    void update_reg(byte addr, uint16_t mask, uint16_t bits);
+    void write_block(byte first_reg, byte last_reg);
+    void read_shadow();
 
     uint16_t byte2uint16(byte high_byte, byte low_byte);
     byte uint16_high_byte(uint16_t uint16);
     byte uint16_low_byte(uint16_t uint16);
 };
 
+class MCP23S17BUS
+{
+  public:
+    void begin(uint8_t slave_select);
+    byte addChip(MCP23S17 *chip);		// Chip already begun (with beginInt) on this slave select.  Returns chip number, or MAXBUSCHIPS if full
+    void attachHandler(byte chipNum, byte pin, void (*handler)(byte chipNum, byte pin));
+    void detachHandler(byte chipNum, byte pin);
+    byte service();						// Call from the ISR on the commoned INT line.  Returns number of valid pin interrupts dispatched
+    unsigned int intCount(byte chipNum, boolean reset = false);		// Valid pin interrupts on chip since last reset
+
+  protected:
+    volatile uint8_t *ssPort;			// Slave select as port & bit, to avoid the overhead of ::digitalWrite
+    uint8_t ssMask;
+    byte numChips;
+    MCP23S17 *chips[MAXBUSCHIPS];
+    void (*handlers[MAXBUSCHIPS][16])(byte chipNum, byte pin);		// 32 bytes per chip; NULL if none
+    unsigned int counts[MAXBUSCHIPS];
+};
+
 #endif // Mcp23s17_h
 
 
@@ -3,10 +3,9 @@
 
 // Download these into your Sketches/libraries/ folder...
 
-// The Spi library by Cam Thompson. It was originally part of FPU library (micromegacorp.com)
-// Available from http://arduino.cc/playground/Code/Fpu or http://www.arduino.cc/playground/Code/Spi
-// Including Spi.h vv below initializea the MOSI, MISO, and SPI_CLK pins as per ATMEGA 328P
-#include <Spi.h>
+// The SPI library in this repository; its SpiDevice.h (SPIBUS) drives the SPI registers for Mcp23s17
+// SPI.begin() below initialises the MOSI, MISO, and SPI_CLK pins (328P or MEGA)
+#include <SPI.h>
 
 // Mcp23s17 library available from https://github.com/dreamcat4/Mcp23s17
 #include <Mcp23s17.h>
@@ -21,18 +20,21 @@
 
 // SINGLE DEVICE
 // Instantiate a single Mcp23s17 object
-MCP23S17 Mcp23s17 = MCP23S17( MCP23S17_SLAVE_SELECT_PIN );
+MCP23S17 Mcp23s17;
 
 // MULTIPLE DEVICES
 // Up to 8 MCP23S17 devices can share the same SPI bus and slave select pins.
 // Assign each chip a unique 3-bit device address (by setting the A2,A1,A0 pins)
-// Then below, device address is optional 2nd parameter to the constructor fn...
-// MCP23S17 Mcp23s17_0 = MCP23S17(MCP23S17_SLAVE_SELECT_PIN,0x0);
+// Then below, device address is optional 2nd parameter to begin...
+// Mcp23s17_0.begin(MCP23S17_SLAVE_SELECT_PIN,0x0);
 // ...
-// MCP23S17 Mcp23s17_7 = MCP23S17(MCP23S17_SLAVE_SELECT_PIN,0x7);
+// Mcp23s17_7.begin(MCP23S17_SLAVE_SELECT_PIN,0x7);
 
 void setup()
 {
+  SPI.begin();
+  Mcp23s17.begin(MCP23S17_SLAVE_SELECT_PIN);
+
   // Example usage
 
   // Set all pins to be outputs (by default they are all inputs)
@@ -45,6 +47,13 @@ void setup()
   Mcp23s17.digitalWrite(8,LOW);
   Mcp23s17.digitalWrite(12,HIGH);
 
+  // Batch several changes into a single SPI burst
+  Mcp23s17.beginTransaction();
+  Mcp23s17.digitalWrite(0,HIGH);
+  Mcp23s17.digitalWrite(1,HIGH);
+  Mcp23s17.pinMode(15,INPUT);
+  Mcp23s17.apply();
+
   // Read all pins at once, 16-bit value
   uint16_t pinstate = Mcp23s17.port();
 
@@ -20,43 +20,28 @@ void SPIClass::begin() {
   // a general purpose output port (it doesn't influence
   // SPI operations).
 
-  pinMode(SCK, OUTPUT);
-  pinMode(MOSI, OUTPUT);
-  pinMode(SS, OUTPUT);
-  
-  digitalWrite(SCK, LOW);
-  digitalWrite(MOSI, LOW);
-  digitalWrite(SS, HIGH);
-
   // Warning: if the SS pin ever becomes a LOW INPUT then SPI 
   // automatically switches to Slave, so the data direction of 
   // the SS pin MUST be kept as OUTPUT.
-//  SPCR |= _BV(MSTR);			// AR - removed
-//  SPCR |= _BV(SPE);			// AR - removed
-	SPCR = _BV(MSTR) | _BV(SPE);
+  SPIBUS::begin();			// AR - common driver; SCK & MOSI low, SS high, all outputs
 }
 
 void SPIClass::end() {
-  SPCR &= ~_BV(SPE);
+  SPIBUS::end();			// AR - common driver
 }
 
 void SPIClass::setBitOrder(uint8_t bitOrder)
 {
-  if(bitOrder == LSBFIRST) {
-    SPCR |= _BV(DORD);
-  } else {
-    SPCR &= ~(_BV(DORD));
-  }
+  SPIBUS::setBitOrder(bitOrder == LSBFIRST);			// AR - common driver
 }
 
 void SPIClass::setDataMode(uint8_t mode)
 {
-  SPCR = (SPCR & ~SPI_MODE_MASK) | mode;
+  SPIBUS::setDataMode(mode);			// AR - common driver
 }
 
 void SPIClass::setClockDivider(uint8_t rate)
 {
-  SPCR = (SPCR & ~SPI_CLOCK_MASK) | (rate & SPI_CLOCK_MASK);
-  SPSR = (SPSR & ~SPI_2XCLOCK_MASK) | ((rate >> 2) & SPI_2XCLOCK_MASK);
+  SPIBUS::setClockDivider(rate);			// AR - common driver
 }
 
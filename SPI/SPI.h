@@ -14,24 +14,7 @@
 #include <stdio.h>
 #include <WProgram.h>
 #include <avr/pgmspace.h>
-
-#define SPI_CLOCK_DIV4 0x00
-#define SPI_CLOCK_DIV16 0x01
-#define SPI_CLOCK_DIV64 0x02
-#define SPI_CLOCK_DIV128 0x03
-#define SPI_CLOCK_DIV2 0x04
-#define SPI_CLOCK_DIV8 0x05
-#define SPI_CLOCK_DIV32 0x06
-#define SPI_CLOCK_DIV64 0x07
-
-#define SPI_MODE0 0x00
-#define SPI_MODE1 0x04
-#define SPI_MODE2 0x08
-#define SPI_MODE3 0x0C
-
-#define SPI_MODE_MASK 0x0C  // CPOL = bit 3, CPHA = bit 2 on SPCR
-#define SPI_CLOCK_MASK 0x03  // SPR1 = bit 1, SPR0 = bit 0 on SPCR
-#define SPI_2XCLOCK_MASK 0x01  // SPI2X = bit 0 on SPSR
+#include "SpiDevice.h"			// AR added - SPI_CLOCK_DIVx, SPI_MODEx & SPIBUS
 
 class SPIClass {
 public:
@@ -53,17 +36,15 @@ public:
 extern SPIClass SPI;
 
 byte SPIClass::transfer(byte _data) {
-  SPDR = _data;
-  while (!(SPSR & _BV(SPIF)));
-  return SPDR;
+  return SPIBUS::transfer(_data);		// AR - common driver
 }
 
 void SPIClass::attachInterrupt() {
-  SPCR |= _BV(SPIE);
+  SPIBUS::attachInterrupt();			// AR - common driver
 }
 
 void SPIClass::detachInterrupt() {
-  SPCR &= ~_BV(SPIE);
+  SPIBUS::detachInterrupt();			// AR - common driver
 }
 
 #endif
@@ -25,6 +25,7 @@
 
 #include "WProgram.h"
 #include "SpiCT.h"
+#include "SpiDevice.h"
 #include "pins_arduino.h"
 
 //---------- constructor ----------------------------------------------------
@@ -45,23 +46,17 @@ SPI::SPI()
 
 void SPI::mode(byte config)
 {
-  byte tmp;
-
   // enable SPI master with configuration byte specified
-  SPCR = 0;
-  SPCR = (config & 0x7F) | (1<<SPE) | (1<<MSTR);
-  SPSR |= 0x01;			// AR - Double clock speed
-  tmp = SPSR;
-  tmp = SPDR;
+  SPIBUS::config(config, (config & SPI_CLOCK_MASK) | 0x04);		// AR - common driver; 0x04 = double clock speed (SPI2X), as before
+  SPIBUS::setBitOrder(config & _BV(DORD));
+  SPIBUS::clearComplete();
 }
 
 //------------------ transfer -----------------------------------------------
 
 byte SPI::transfer(byte value)
 {
-  SPDR = value;
-  while (!(SPSR & (1<<SPIF))) ;
-  return SPDR;
+  return SPIBUS::transfer(value);		// AR - common driver
 }
 
 //---------- preinstantiate SPI object --------------------------------------
@@ -0,0 +1,257 @@
+/*
+    Copyright (C) 2011  Andrew Richards
+    Header-only SPI driver, with slave select, mode & clock fixed at compile time
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// SPIBUS is the one place that drives the SPI registers; SPIClass (SPI.h), SPI (SpiCT.h), SPIQUEUE (SpiQueue.h) and 
+// MCP23S17 all use it.
+// SPIDEVICE<slave select pin, mode, clock divider> gives a device its own settings, applied on select(), and 
+// resolves its slave select to a single port write at compile time (sbi/cbi for ports A-G) - the gain 
+// digitalWrite gives up by looking the pin up at run time.  Pins mapped for the Mega (1280/2560) and 328.  Eg:
+//
+//    typedef SPIDEVICE<9, SPI_MODE0, SPI_CLOCK_DIV2> relays;
+//    relays::begin();
+//    relays::select(); relays::transfer(buffer, 4); relays::deselect();
+//
+
+#ifndef SpiDevice_h
+#define SpiDevice_h
+
+#include "WProgram.h"
+#include "pins_arduino.h"
+
+#define SPI_CLOCK_DIV4 0x00
+#define SPI_CLOCK_DIV16 0x01
+#define SPI_CLOCK_DIV128 0x03
+#define SPI_CLOCK_DIV2 0x04
+#define SPI_CLOCK_DIV8 0x05
+#define SPI_CLOCK_DIV32 0x06
+#define SPI_CLOCK_DIV64 0x07
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+#define SPI_MODE_MASK 0x0C  // CPOL = bit 3, CPHA = bit 2 on SPCR
+#define SPI_CLOCK_MASK 0x03  // SPR1 = bit 1, SPR0 = bit 0 on SPCR
+#define SPI_2XCLOCK_MASK 0x01  // SPI2X = bit 0 on SPSR
+
+// ****************  PINS  ****************
+// Port registers, and whether within reach of sbi/cbi (so a bit can be set without disabling interrupts)
+
+#define SPIPORT_A 0
+#define SPIPORT_B 1
+#define SPIPORT_C 2
+#define SPIPORT_D 3
+#define SPIPORT_E 4
+#define SPIPORT_F 5
+#define SPIPORT_G 6
+#define SPIPORT_H 7
+#define SPIPORT_J 8
+#define SPIPORT_K 9
+#define SPIPORT_L 10
+
+template <uint8_t PORT> struct SPIPORT;
+
+#define SPIPORTDEF(P) template <> struct SPIPORT<SPIPORT_##P> { \
+	static inline volatile uint8_t &out() { return PORT##P; } \
+	static inline volatile uint8_t &ddr() { return DDR##P; } \
+	enum { atomic = SPIPORT_##P <= SPIPORT_G }; \
+  };
+
+#ifdef PORTA
+  SPIPORTDEF(A)
+#endif
+#ifdef PORTB
+  SPIPORTDEF(B)
+#endif
+#ifdef PORTC
+  SPIPORTDEF(C)
+#endif
+#ifdef PORTD
+  SPIPORTDEF(D)
+#endif
+#ifdef PORTE
+  SPIPORTDEF(E)
+#endif
+#ifdef PORTF
+  SPIPORTDEF(F)
+#endif
+#ifdef PORTG
+  SPIPORTDEF(G)
+#endif
+#ifdef PORTH
+  SPIPORTDEF(H)
+#endif
+#ifdef PORTJ
+  SPIPORTDEF(J)
+#endif
+#ifdef PORTK
+  SPIPORTDEF(K)
+#endif
+#ifdef PORTL
+  SPIPORTDEF(L)
+#endif
+
+// Port & bit of each digital pin.  A pin not listed here gives a compile error
+
+template <uint8_t PIN> struct SPIPINMAP;
+
+#define SPIPINDEF(N, P, B) template <> struct SPIPINMAP<N> { enum { port = SPIPORT_##P, bit = B }; };
+
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+  SPIPINDEF(0, E, 0) SPIPINDEF(1, E, 1) SPIPINDEF(2, E, 4) SPIPINDEF(3, E, 5) SPIPINDEF(4, G, 5) SPIPINDEF(5, E, 3) SPIPINDEF(6, H, 3) SPIPINDEF(7, H, 4)
+  SPIPINDEF(8, H, 5) SPIPINDEF(9, H, 6) SPIPINDEF(10, B, 4) SPIPINDEF(11, B, 5) SPIPINDEF(12, B, 6) SPIPINDEF(13, B, 7) SPIPINDEF(14, J, 1) SPIPINDEF(15, J, 0)
+  SPIPINDEF(16, H, 1) SPIPINDEF(17, H, 0) SPIPINDEF(18, D, 3) SPIPINDEF(19, D, 2) SPIPINDEF(20, D, 1) SPIPINDEF(21, D, 0) SPIPINDEF(22, A, 0) SPIPINDEF(23, A, 1)
+  SPIPINDEF(24, A, 2) SPIPINDEF(25, A, 3) SPIPINDEF(26, A, 4) SPIPINDEF(27, A, 5) SPIPINDEF(28, A, 6) SPIPINDEF(29, A, 7) SPIPINDEF(30, C, 7) SPIPINDEF(31, C, 6)
+  SPIPINDEF(32, C, 5) SPIPINDEF(33, C, 4) SPIPINDEF(34, C, 3) SPIPINDEF(35, C, 2) SPIPINDEF(36, C, 1) SPIPINDEF(37, C, 0) SPIPINDEF(38, D, 7) SPIPINDEF(39, G, 2)
+  SPIPINDEF(40, G, 1) SPIPINDEF(41, G, 0) SPIPINDEF(42, L, 7) SPIPINDEF(43, L, 6) SPIPINDEF(44, L, 5) SPIPINDEF(45, L, 4) SPIPINDEF(46, L, 3) SPIPINDEF(47, L, 2)
+  SPIPINDEF(48, L, 1) SPIPINDEF(49, L, 0) SPIPINDEF(50, B, 3) SPIPINDEF(51, B, 2) SPIPINDEF(52, B, 1) SPIPINDEF(53, B, 0) SPIPINDEF(54, F, 0) SPIPINDEF(55, F, 1)
+  SPIPINDEF(56, F, 2) SPIPINDEF(57, F, 3) SPIPINDEF(58, F, 4) SPIPINDEF(59, F, 5) SPIPINDEF(60, F, 6) SPIPINDEF(61, F, 7) SPIPINDEF(62, K, 0) SPIPINDEF(63, K, 1)
+  SPIPINDEF(64, K, 2) SPIPINDEF(65, K, 3) SPIPINDEF(66, K, 4) SPIPINDEF(67, K, 5) SPIPINDEF(68, K, 6) SPIPINDEF(69, K, 7)
+#else
+  SPIPINDEF(0, D, 0) SPIPINDEF(1, D, 1) SPIPINDEF(2, D, 2) SPIPINDEF(3, D, 3) SPIPINDEF(4, D, 4) SPIPINDEF(5, D, 5) SPIPINDEF(6, D, 6) SPIPINDEF(7, D, 7)
+  SPIPINDEF(8, B, 0) SPIPINDEF(9, B, 1) SPIPINDEF(10, B, 2) SPIPINDEF(11, B, 3) SPIPINDEF(12, B, 4) SPIPINDEF(13, B, 5) SPIPINDEF(14, C, 0) SPIPINDEF(15, C, 1)
+  SPIPINDEF(16, C, 2) SPIPINDEF(17, C, 3) SPIPINDEF(18, C, 4) SPIPINDEF(19, C, 5)
+#endif
+
+template <uint8_t PIN> struct SPIPIN {
+  typedef SPIPORT<SPIPINMAP<PIN>::port> port;
+  enum { mask = 1 << SPIPINMAP<PIN>::bit };
+
+  static inline void high() {
+	if (port::atomic) port::out() |= mask;
+	else { uint8_t oldSREG = SREG; cli(); port::out() |= mask; SREG = oldSREG; }
+  }
+  static inline void low() {
+	if (port::atomic) port::out() &= ~mask;
+	else { uint8_t oldSREG = SREG; cli(); port::out() &= ~mask; SREG = oldSREG; }
+  }
+  static inline void output() {
+	if (port::atomic) port::ddr() |= mask;
+	else { uint8_t oldSREG = SREG; cli(); port::ddr() |= mask; SREG = oldSREG; }
+  }
+};
+
+// ****************  BUS  ****************
+
+class SPIBUS {
+public:
+  static inline void begin() {			// Master, with SCK, MOSI & hardware SS as outputs.  NB: hardware SS must stay an output, or SPI drops to slave
+	SPIPIN<SS>::high();
+	SPIPIN<SS>::output();
+	SPIPIN<SCK>::low();
+	SPIPIN<SCK>::output();
+	SPIPIN<MOSI>::low();
+	SPIPIN<MOSI>::output();
+	SPCR = _BV(MSTR) | _BV(SPE);
+  }
+  
+  static inline void end() { SPCR &= ~_BV(SPE); }
+  
+  static inline void config(uint8_t mode, uint8_t div) {		// Master, MSB first, with given mode & clock.  Disables SPI interrupt
+	SPCR = _BV(MSTR) | _BV(SPE) | (mode & SPI_MODE_MASK) | (div & SPI_CLOCK_MASK);
+	SPSR = (div >> 2) & SPI_2XCLOCK_MASK;
+  }
+  
+  // Settings changed one at a time, as SPIClass
+  static inline void setBitOrder(boolean lsbFirst) {
+	if (lsbFirst) SPCR |= _BV(DORD);
+	else SPCR &= ~_BV(DORD);
+  }
+  static inline void setDataMode(uint8_t mode) { SPCR = (SPCR & ~SPI_MODE_MASK) | (mode & SPI_MODE_MASK); }
+  static inline void setClockDivider(uint8_t div) {
+	SPCR = (SPCR & ~SPI_CLOCK_MASK) | (div & SPI_CLOCK_MASK);
+	SPSR = (SPSR & ~SPI_2XCLOCK_MASK) | ((div >> 2) & SPI_2XCLOCK_MASK);
+  }
+  
+  // Transfer complete interrupt (SPI_STC_vect), for drivers that send a byte at a time from it, as SPIQUEUE.  start() sends 
+  // without waiting; received() is the byte that came back, once the interrupt (or SPIF) says the transfer is complete
+  static inline void attachInterrupt() { SPCR |= _BV(SPIE); }
+  static inline void detachInterrupt() { SPCR &= ~_BV(SPIE); }
+  static inline void start(byte data) { SPDR = data; }
+  static inline byte received() { return SPDR; }
+  static inline void clearComplete() { (void) SPSR; (void) SPDR; }	// Reading SPSR then SPDR clears SPIF
+  
+  static inline byte transfer(byte data) {
+	SPDR = data;
+	while (!(SPSR & _BV(SPIF)));
+	return SPDR;
+  }
+  
+  static inline void transfer(byte *buf, unsigned int len) {	// Send buf, replacing it with the bytes received
+	byte in, out;
+	
+	if (len == 0) return;
+	SPDR = *buf;
+	while (--len) {						// Fetch the next byte while the current one shifts
+	  out = buf[1];
+	  while (!(SPSR & _BV(SPIF)));
+	  in = SPDR;
+	  SPDR = out;
+	  *buf++ = in;
+	}
+	while (!(SPSR & _BV(SPIF)));
+	*buf = SPDR;
+  }
+  
+  static inline void write(const byte *buf, unsigned int len) {	// Send buf, ignoring bytes received
+	if (len == 0) return;
+	SPDR = *buf++;
+	while (--len) {
+	  byte out = *buf++;
+	  while (!(SPSR & _BV(SPIF)));
+	  SPDR = out;
+	}
+	while (!(SPSR & _BV(SPIF)));
+  }
+  
+  static inline void read(byte *buf, unsigned int len) {		// Receive into buf, sending 0x00s
+	if (len == 0) return;
+	SPDR = 0x00;
+	while (--len) {
+	  while (!(SPSR & _BV(SPIF)));
+	  byte in = SPDR;
+	  SPDR = 0x00;
+	  *buf++ = in;
+	}
+	while (!(SPSR & _BV(SPIF)));
+	*buf = SPDR;
+  }
+};
+
+// ****************  DEVICE  ****************
+
+template <uint8_t SSPIN, uint8_t MODE = SPI_MODE0, uint8_t DIV = SPI_CLOCK_DIV4> class SPIDEVICE {
+public:
+  static inline void begin() {
+	SPIPIN<SSPIN>::high();
+	SPIPIN<SSPIN>::output();
+	SPIBUS::begin();
+  }
+  static inline void select() {			// Apply this device's settings, then select it
+	SPIBUS::config(MODE, DIV);
+	SPIPIN<SSPIN>::low();
+  }
+  static inline void deselect() { SPIPIN<SSPIN>::high(); }
+  static inline byte transfer(byte data) { return SPIBUS::transfer(data); }
+  static inline void transfer(byte *buf, unsigned int len) { SPIBUS::transfer(buf, len); }
+  static inline void write(const byte *buf, unsigned int len) { SPIBUS::write(buf, len); }
+  static inline void read(byte *buf, unsigned int len) { SPIBUS::read(buf, len); }
+};
+
+#endif
@@ -0,0 +1,99 @@
+/*
+    Copyright (C) 2011  Andrew Richards
+    Interrupt driven SPI transfer queue
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SpiQueue.h"
+#include "SpiDevice.h"
+#include "pins_arduino.h"
+
+SPIQUEUE spiQueue;
+
+ISR(SPI_STC_vect) {
+  spiQueue.transferISR();
+}
+
+boolean SPIQUEUE::queue(SPIXFER *xfer, uint8_t slaveSelect, const byte *tx, byte *rx, unsigned int len, void (*callback)(SPIXFER *xfer), void *context) {
+  byte oldSREG;
+  
+  if (len == 0) return false;
+  
+  xfer->tx = tx;
+  xfer->rx = rx;
+  xfer->len = len;
+  xfer->callback = callback;
+  xfer->context = context;
+  xfer->done = false;
+  xfer->_ssPort = portOutputRegister(digitalPinToPort(slaveSelect));
+  xfer->_ssMask = digitalPinToBitMask(slaveSelect);
+  xfer->_next = NULL;
+  
+  oldSREG = SREG;
+  cli();
+  if (_head) {
+	  _tail->_next = xfer;
+	  _tail = xfer;
+  }
+  else {
+	  _head = _tail = xfer;
+	  startNext();
+  }
+  SREG = oldSREG;
+  
+  return true;
+}
+
+boolean SPIQUEUE::isIdle() {
+  return _head == NULL;
+}
+
+void SPIQUEUE::waitIdle() {
+  while (_head);
+}
+
+void SPIQUEUE::startNext() {		// Interrupts disabled; _head not NULL
+  SPIXFER *xfer = _head;
+  
+  xfer->_idx = 0;
+  *xfer->_ssPort &= ~xfer->_ssMask;
+  SPIBUS::attachInterrupt();
+  SPIBUS::start((xfer->tx) ? xfer->tx[0] : 0x00);
+}
+
+void SPIQUEUE::transferISR() {
+  SPIXFER *xfer = _head;
+  byte in = SPIBUS::received();
+  
+  if (!xfer) return;			// Not ours
+  
+  if (xfer->rx) xfer->rx[xfer->_idx] = in;
+  if (++xfer->_idx < xfer->len) {
+	  SPIBUS::start((xfer->tx) ? xfer->tx[xfer->_idx] : 0x00);
+	  return;
+  }
+  
+  // Transfer complete; start next before the callback, which may queue another
+  *xfer->_ssPort |= xfer->_ssMask;
+  _head = xfer->_next;
+  if (_head) startNext();
+  else {
+	  _tail = NULL;
+	  SPIBUS::detachInterrupt();
+  }
+  
+  xfer->done = true;
+  if (xfer->callback) xfer->callback(xfer);
+}
@@ -0,0 +1,67 @@
+/*
+    Copyright (C) 2011  Andrew Richards
+    Interrupt driven SPI transfer queue
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Callers queue a transfer (slave select, bytes to send, buffer for bytes received, callback) and carry on; 
+// each byte is sent from the SPI transfer complete interrupt, and the callback is called (from the ISR) 
+// once the last one is done.  Transfers are run in the order queued, each with its own slave select.
+//
+// Assumes SPI already set up (eg SPI.begin()) with the mode & clock wanted.  While anything is queued the
+// SPI interrupt is enabled, so libraries that drive SPI directly (SdFat, Ethernet, MCP23S17) must not be 
+// used until waitIdle() - otherwise this ISR takes their bytes.  When idle the interrupt is off and they 
+// work as normal.
+//
+// Each byte costs an interrupt (~3uS at 16MHz), so a busy-wait is quicker for short transfers at 
+// SPI_CLOCK_DIV2; the gain is the CPU left free during long transfers or slow clocks
+
+#ifndef SpiQueue_h
+#define SpiQueue_h
+
+#include "WProgram.h"
+
+struct SPIXFER {						// Owned by caller; must stay in scope (and unchanged) until done
+  const byte *tx;						// Bytes to send; NULL sends 0x00s
+  byte *rx;								// Bytes received; NULL to discard
+  unsigned int len;
+  void (*callback)(SPIXFER *xfer);		// Called from ISR when complete; NULL if none
+  void *context;						// For use by callback
+  volatile boolean done;				// Set when complete
+  
+  // Private to SPIQUEUE
+  volatile uint8_t *_ssPort;
+  uint8_t _ssMask;
+  unsigned int _idx;
+  SPIXFER *_next;
+};
+
+class SPIQUEUE {
+public:
+  boolean queue(SPIXFER *xfer, uint8_t slaveSelect, const byte *tx, byte *rx, unsigned int len, void (*callback)(SPIXFER *xfer) = NULL, void *context = NULL);
+  boolean isIdle();
+  void waitIdle();						// Wait for everything queued to complete
+  void transferISR();					// Must be public to allow access from ISR; don't use
+  
+private:
+  void startNext();
+  
+  SPIXFER *volatile _head;				// Transfer in progress
+  SPIXFER *volatile _tail;				// Last queued
+};
+
+extern SPIQUEUE spiQueue;
+
+#endif
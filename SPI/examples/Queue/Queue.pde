@@ -0,0 +1,62 @@
+/* Example of SPIQUEUE
+
+  Walks a bit along the outputs of an MCP23S17 (all pins outputs, hardware address 0) by queueing a write
+  to its output latch every 100mS, while loop() carries on counting.  Reports over Serial how many times 
+  loop() ran per second, and how many writes completed.
+
+  The circuit:
+  * MCP23S17 CS to digital pin 9; SI, SO & SCK to MOSI, MISO & SCK
+  * LEDs (with resistors) on the MCP23S17 outputs
+
+**************************/
+
+#include <SPI.h>
+#include <SpiQueue.h>
+
+const uint8_t slaveSelectPin = 9;
+
+byte setIodir[] = { 0x40, 0x00, 0x00, 0x00 };      // Write IODIR A & B: all outputs
+byte setOlat[] = { 0x40, 0x14, 0x00, 0x00 };       // Write OLAT A & B
+SPIXFER xfer;                                      // One transfer at a time, so one descriptor will do
+
+volatile unsigned int writes = 0;
+unsigned long loops = 0;
+unsigned long lastWrite = 0, lastReport = 0;
+uint16_t pattern = 1;
+
+void setup() {
+  Serial.begin(9600);
+
+  pinMode(slaveSelectPin, OUTPUT);
+  digitalWrite(slaveSelectPin, HIGH);
+  SPI.begin();
+  SPI.setClockDivider(SPI_CLOCK_DIV16);
+
+  spiQueue.queue(&xfer, slaveSelectPin, setIodir, NULL, sizeof(setIodir));
+  spiQueue.waitIdle();
+}
+
+void written(SPIXFER *xfer) {                      // Called from ISR
+  writes++;
+}
+
+void loop() {
+  loops++;
+
+  if (millis() - lastWrite >= 100 && xfer.done) {  // Don't touch setOlat until previous write done
+    lastWrite = millis();
+    pattern = (pattern << 1) | (pattern >> 15);
+    setOlat[2] = lowByte(pattern);
+    setOlat[3] = highByte(pattern);
+    spiQueue.queue(&xfer, slaveSelectPin, setOlat, NULL, sizeof(setOlat), written);
+  }
+
+  if (millis() - lastReport >= 1000) {
+    lastReport = millis();
+    Serial.print("loops/sec = ");
+    Serial.print(loops);
+    Serial.print(", writes = ");
+    Serial.println(writes);
+    loops = 0;
+  }
+}
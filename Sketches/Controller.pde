@@ -10,6 +10,9 @@
 #include <Udp.h>
 #include <OneWire.h>
 #include <DallasTemperature.h>
+#include <HomeAutom.h>
+#include <TimerOne.h>
+#include <Wakeup.h>
 
 /*********** DATA LOGGING/DEBUG *************/
 
@@ -18,6 +21,7 @@
 #define DEBUGREADINGS 1
 #define DEBUGEVAL 1
 #define DEBUGACTIONS 1
+#define DEBUGPROFILE 0                    // 1 adds PROFILER - 532 bytes of RAM (see RAM BUDGET)
 //#if DEBUGON
   byte logIP[4];                           // Populated on first read - client IP
   char logBuffer[UDP_TX_PACKET_MAX_SIZE];  // 64 bytes
@@ -26,8 +30,31 @@
   boolean debugR = false;
   boolean debugE = false;
   boolean debugA = false;
+  #define PgmSendLog(s) sendLog(strcpy_P(logBuffer, PSTR(s)))      // Literal from flash, via logBuffer
 //#endif
 
+/************ PROFILING *************/
+// Probes timed by PROFILER (HomeAutom library) - reported and reset by UDP command 'P'
+const byte probeHeartbeat = 0;                // Whole heartbeat: checkSensors + makeDecisions + takeAction
+const byte probeSensors = 1;
+const byte probeDecisions = 2;
+const byte probeActions = 3;
+const byte probeDeviceGet = 4;                // Each device read; tag is deviceIdx
+const byte probeEval = 5;                     // Each top-level evaluation (incl nested evals in lists); tag is evalIdx
+const byte probeWeb = 6;                      // Each step of an HTTP dialogue (see webService)
+const byte probeEvents = 7;                   // Sensor events taken from queue through to action; tag is deviceIdx of first
+const byte numProbes = 8;
+#if DEBUGPROFILE
+  PROFILER profiler;                          // 532 bytes; with DEBUGPROFILE 0 neither it nor any timing is compiled in
+  #define PROFILE_INIT() profiler.init()
+  #define PROFILE_START(probe) profiler.start(probe)
+  #define PROFILE_STOP(probe, tag) profiler.stop(probe, tag)
+#else
+  #define PROFILE_INIT()
+  #define PROFILE_START(probe)
+  #define PROFILE_STOP(probe, tag)
+#endif
+
 /************ ETHERNET STUFF ************/
 const byte maxArduinos = 8;
 byte mac[maxArduinos][6]; // = { 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED };
@@ -43,6 +70,58 @@ unsigned int UdpArdPort = 8890;
 #define const_HTTP_BUFSIZ 100
 #define const_Token_Bufsiz 20
 
+// Literal headers sent from flash, as PgmPrint does to Serial - string literals otherwise take RAM (see RAM BUDGET)
+#define PgmClientPrint(client, s) clientPrint_P(client, PSTR(s), false)
+#define PgmClientPrintln(client, s) clientPrint_P(client, PSTR(s), true)
+
+// HTTP dialogue is advanced a bounded step per loop() by webService, so a slow browser can't hold up the heartbeat
+const byte webIdle = 0;                     // Waiting for a request
+const byte webRequest = 1;                  // Reading request; up to webReadChunk bytes per step
+const byte webSending = 2;                  // Sending webFile; a const_SDCard_BUFSIZ slice per step
+const byte webWaiting = 3;                  // Holding ajax!W until changeVersion passes webSince, or webPollSecs pass.  Ties up the only TCP socket, so kept short
+const byte webPollSecs = 10;
+const byte webReadChunk = 64;
+byte webState = webIdle;
+Client webClient(MAX_SOCK_NUM);             // Connection being served
+char webMode;                               // ' ' = request line, 'G' = GET, 'P' = waiting for blank line in POST, 'D' = waiting for data line in POST, 'X' = other
+char webURL[const_HTTP_BUFSIZ];             // Request line, read straight in and split in place by webParseRequest
+char *webPath;                              // Into webURL; path after the '/', terminated
+char webLine[const_HTTP_BUFSIZ];            // Header or POST data line being read
+int webLineLen;
+int webContLen;                             // Of POST data
+SdFile webFile;                             // Being sent
+unsigned long webRemaining;                 // Bytes of webFile still to send
+boolean webStopAfter;                       // Close connection once webFile sent
+unsigned int webSince;                      // Version browser has seen, for webWaiting
+char webETag[24];                           // If-None-Match of GET, if any
+boolean webGzip;                            // GET has Accept-Encoding: gzip, so GZ/ sibling of a file may be sent instead
+unsigned long webWaitUntil;                 // millis()
+
+// Paths by prefix; first match wins, so catch-all last
+struct WEBROUTE {
+  const char *prefix;
+  byte len;
+  void (*handler)(Client client, char *rest);      // Given path after prefix
+} const webRoutes[] = { { "ajax!", 5, routeAjax }, { "?", 1, handleHTTPCmd }, { "", 0, routeFile } };
+const byte numWebRoutes = sizeof(webRoutes) / sizeof(webRoutes[0]);
+
+// Directories of the web root held open, so a path needs no SD seeks to find its directory; replaced in turn
+const byte maxWebDirs = 4;
+struct WEBDIR {
+  char name[13];                            // 8.3
+  SdFile dir;
+} webDirs[maxWebDirs];
+byte webDirNext = 0;
+
+// Content-Type by lower-case extension; 8.3, so 3 chars at most.  In flash, as the strings would otherwise take RAM
+struct MIMETYPE {
+  char extn[4];
+  char type[25];
+} const mimeTypes[] PROGMEM = { { "htm", "text/html" }, { "css", "text/css" }, { "js", "application/javascript" }, { "jso", "application/json" },
+                        { "xml", "application/xml" }, { "jpg", "image/jpeg" }, { "png", "image/png" }, { "gif", "image/gif" },
+                        { "ico", "image/x-icon" }, { "pdf", "application/pdf" }, { "bin", "application/octet-stream" } };
+const byte numMimeTypes = sizeof(mimeTypes) / sizeof(mimeTypes[0]);
+
 /************ SDCARD STUFF ************/
 Sd2Card card;
 SdVolume volume;
@@ -64,6 +143,46 @@ void error_P(const char* str) {
   while(1);
 }
 
+/************ READING LOG ************/
+// Changes of reading of devices with "log": "Y" in config, appended to a file per day - LOG/YYYYMMDD.BIN - served by ajax!L and read by Tools/logdump.
+// File is in 512-byte blocks to match the card: block 0 is a LOGINDEX, then LOGBLOCKs in time order, each holding records from one hour only.
+// Records are staged in logStage and added to their block on the card when logStage fills, when the block is full or the hour changes, and
+// every logSyncFreq heartbeats.  Only the block's header is kept in RAM (see RAM BUDGET); the records already written are left on the card
+const byte logVersion = 1;
+const int logBlockSize = 512;
+const unsigned int logBlockMagic = 0x4c42;          // "BL"
+const byte logStageRecs = 8;                        // Records held before being written
+const byte logSyncFreq = 30;                        // How often to write a part-filled logStage (secs * heartBeatSecs); most lost on reset
+struct LOGRECORD {
+  unsigned long at;                         // Secs since 1970 (Time library)
+  unsigned int ref;                         // devRef
+  unsigned int reading;
+};
+struct LOGINDEX {
+  char magic[4];                            // "HALG"
+  byte version;
+  byte recordSize;
+  byte arduino;                             // arduinoMe of writer
+  byte recsPerBlock;
+  unsigned int year;
+  byte month;
+  byte day;
+  unsigned int hourBlock[24];               // First block of each hour; 0 = none
+} logIndex;
+struct LOGBLOCK {                           // Header of each block; logRecsPerBlock LOGRECORDs follow, then zeros
+  unsigned int magic;
+  byte hour;
+  byte count;                               // Records in block, incl those still in logStage
+  unsigned int seq;                         // Block number in file
+  unsigned int sum;                         // Of all bytes of block, taking sum as 0
+} logBlock;
+const byte logRecsPerBlock = (logBlockSize - sizeof(LOGBLOCK)) / sizeof(LOGRECORD);      // 63
+LOGRECORD logStage[logStageRecs];           // Latest records of logBlock, not yet on card
+byte logStaged = 0;
+unsigned int logRecSum;                     // Of all bytes of logBlock's records, on card or staged
+SdFile logFile;
+unsigned int logDropped = 0;                // Readings not logged - time not set or card error
+
 /************ NTP TIME STUFF ************/
 
 #define CURRENT_YEAR 2011            // used for sense test
@@ -78,7 +197,7 @@ byte timeServer[4]; // = {64,90,182,55}, or { 192, 43, 244, 18}; time.nist.gov
 #define MAXTEMPDEVICES 1                // Only one temp device per pin at present
 #define const_TempRefreshInterval 10
 
-const byte maxTempSensors = 10;
+const byte maxTempSensors = 8;
 OneWire oneWire[maxTempSensors];
 DallasTemperature tempSensor[maxTempSensors] = {  DallasTemperature(&oneWire[0]), 
                                                   DallasTemperature(&oneWire[1]),
@@ -87,9 +206,7 @@ DallasTemperature tempSensor[maxTempSensors] = {  DallasTemperature(&oneWire[0])
                                                   DallasTemperature(&oneWire[4]),
                                                   DallasTemperature(&oneWire[5]),
                                                   DallasTemperature(&oneWire[6]),
-                                                  DallasTemperature(&oneWire[7]),
-                                                  DallasTemperature(&oneWire[8]),
-                                                  DallasTemperature(&oneWire[9])
+                                                  DallasTemperature(&oneWire[7])
                                                 };
 DeviceAddress tempDeviceAddress[maxTempSensors]; // Hold device addresses to speed things up - only one device per pin
 
@@ -98,10 +215,12 @@ DeviceAddress tempDeviceAddress[maxTempSensors]; // Hold device addresses to spe
 
 const byte maxFreqs = 8;
 const byte stackSize = 8;
-const int maxReadings = stackSize * 80;            // Max zones (xH and xL) = 16 * 2 + max windows = 32 + max doors = 16
-const byte maxDevices = 128;                       // 127 is limit (0 is reserved as null)
+const int maxReadings = stackSize * 48;            // Stacks of 48 devices, less what hist regions take from the top (see RAM BUDGET)
+const byte maxWindow = 32;                         // Longest history of readings per device; each takes whole multiples of stackSize in readingHistory
+const byte maxStats = 4;                           // Devices with RUNSTATS (78 bytes each; see RAM BUDGET)
+const byte maxDevices = 64;                        // 127 is limit (0 is reserved as null); 17 bytes each (see RAM BUDGET)
 const byte maxVars = 64;                           // 127 is limit
-const byte maxEvals = 64;                          // 256 is limit if argArray remains byte array
+const byte maxEvals = 96;                          // 256 is limit if argArray remains byte array; multiple of 16
 const byte maxElems = 32;
 const byte maxSensorTypes = 16;
 const byte maxArgs = 64;     
@@ -114,11 +233,98 @@ int numArgs = 0;
 const byte readFlag = 0x01;
 const byte writeFlag = 0x02;
 const byte pinNoOp = 127;
-byte p_freqIdx[maxDevices];                  // Indexes into deviceMap for polling @ different frequencies
+byte p_freqIdx[maxDevices];                  // Device indexes for polling @ different frequencies
 byte p_freqMarker[maxFreqs + 1];                        // Markers dividing up freqIdx into 8 polling segments
 
 int frequency[maxFreqs];                                  // Seconds between each scan, indexed by frequency
 
+// Device ref gives unique ref for device.  Decode format is an.nn.aaa, coded as follows (see convertRef).  The coded form is also the form held in config
+const unsigned int maskRef = (0xff * 256) + 0xff;                // Zero is NULL reference used to indicate evaluation not to write
+const unsigned int maskRegion = (B11100000 * 256) + 0x00;        // Up to 8 regions
+const unsigned int maskZone = (B00011100 * 256) + 0x00;      // Up to 8 zones per region.  NB: certain zones need rationalising
+const unsigned int maskLocation = (B00000011 * 256) + B11100000;  // Up to 32 locations per zone (0 reserved for whole zone).    NB: certain locations need rationalising
+const unsigned int maskSensor = B00010000;                               // 1 = sensor, 0 = actor
+const unsigned int maskDeviceType = 0x0f;                                // Up to 16 sensors & 16 actors
+const byte offsetRegion = 13;
+const byte offsetZone = 10;
+const byte offsetLocation = 5;
+const byte offsetSensor = 4;
+
+// Loaded from config, then accessed through the dev arrays (device only) or mapAccess (device or variable), stackAccess, evalAccess & argAccess.  
+// Global so that getConfig can save & restore them as a block
+// Devices held as a column per attribute, indexed by deviceIdx, so reading one is a single load
+unsigned int devRef[maxDevices];            // Coded device ref; region, zone, location, sensor & type decoded from it
+byte devArduino[maxDevices];                // Up to 8 Arduinos
+byte devPin[maxDevices];                    // Up to 128 pins/virtual pins.  Pin 127 (pinNoOp) is NOP
+byte devHandler[maxDevices];                // Up to 4 handler types per device type
+byte devPollFreq[maxDevices];               // Up to 8 polling frequencies
+byte devStatus[maxDevices];                 // valStatusStable, valStatusPending (sensor reading pending), valStatusTarget or valStatusUnset
+byte devStack[maxDevices];                  // StackMode = 0 - 8 bits of On/Off history (MSB = latest) for on/off device types (xTo, xF, xM, xP, P1, P2, P, p, D, L, R)
+                                            // Stackmode = 1 - 0-127 * stackSize as an index into readingHistory, with TOSIdx giving offset to current top of stack
+byte devTOSIdx[maxDevices];                 // Only applicable for StackMode = 1; gives offset on Stack * stackSize to latest reading in readingHistory
+byte devWindow[maxDevices];                 // Only applicable for StackMode = 1; readings kept in readingHistory ('window' in config, default stackSize)
+byte devFlags[maxDevices];                  // flagCascade | flagStackMode | flagStats | flagHist | flagLog
+const byte flagCascade = 0x01;              // 1 = cascade this reading to the next deviceIdx; 0 = no cascade
+const byte flagStackMode = 0x02;            // How to interpret Stack.  0 = bitmap, 1 = index
+const byte flagStats = 0x04;                // 1 = AV, MX, MN & ROC kept up to date in a RUNSTATS slot
+const byte flagHist = 0x08;                 // 1 = changes kept in a HISTLOG ('hist' in config)
+const byte flagLog = 0x10;                  // 1 = changes written to reading log on SD card
+unsigned int changeVersion = 0;             // Bumped on every change of reading or status; browser asks for changes since one it has seen
+unsigned int idxVersion[maxDevices + maxVars];      // changeVersion at last change of each device, then variable; 0 = never
+const byte devHashSize = 2 * maxDevices;     // Power of 2, > maxDevices, so never full
+byte devHash[devHashSize];                  // deviceIdx by devRef (see devHashSlot); 0 = empty.  Built on config load, not saved in config.bin
+
+inline boolean devSensor(byte deviceIdx) { return (devRef[deviceIdx] & maskSensor) != 0; }
+inline byte devType(byte deviceIdx) { return devRef[deviceIdx] & maskDeviceType; }
+inline boolean devCascade(byte deviceIdx) { return (devFlags[deviceIdx] & flagCascade) != 0; }
+inline boolean devStackMode(byte deviceIdx) { return (devFlags[deviceIdx] & flagStackMode) != 0; }
+
+unsigned int varReading[maxVars];           // Same format as reading, but for internal variables (indexed by 7 bit variable number - maskVar)
+unsigned int readingHistory [maxReadings];          // Only used if StackMode == 1. Interpretation varies dependent on deviceType:
+                                                    // For xH is temperature(C) x 10 (+/-), so 25.3 = 253 (negative values cast to unsigned)
+                                                    // For xo/xL (open/light) is measured voltage of sensor x 100, so 5v = 500
+                                                    // For xb is ID of button
+                                                    // For time holds day:hour:minute psuedo codes see dhmAccess, with MSG == 1
+
+// Rolling statistics over the window of a device with StackMode = 1, updated on each reading so AV, MX, MN & ROC don't trawl the window.  
+// Allocated by compileEvals to devices that evals take them from
+struct RUNSTATS {
+  byte deviceIdx;
+  byte seq;                                 // Sequence number of latest reading; reading n back has seq - n
+  long sum;                                 // Sum of readings in window
+  long xSum;                                // Sum of x * reading, x = 0 for oldest .. window - 1 for latest.  Gives least squares slope
+  byte maxQ[maxWindow];                     // Monotonic deques of seq: readings that could yet be the max (min) of the window, oldest first
+  byte minQ[maxWindow];
+  byte maxFirst, maxLen, minFirst, minLen;
+} runStats[maxStats];
+byte numStats = 0;
+
+// Long history of devices with 'hist' in config: each change of reading, with its time, kept in the device's region of a shared arena.
+// A sample is two LEB128 varints - change of reading (zigzag) and secs since the sample before - so typically 2 bytes, against 6 for 
+// an int and a long.  Latest reading & time held in full; older ones are worked back from them, newest first (see histGet)
+// The arena is whatever of readingHistory the stack blocks leave: they are allotted up from the bottom, regions down from the top
+const byte maxHistLogs = 8;                        // 19 bytes each; see RAM BUDGET
+const byte histBytesPerSample = 2;                 // Arena allotted per sample of 'hist'; more samples kept if changes are small
+byte *const histArena = (byte*) readingHistory;
+struct HISTLOG {
+  byte deviceIdx;
+  unsigned int start;                       // Region of arena, as bytes into readingHistory
+  unsigned int size;
+  unsigned int depth;                       // Most samples to keep, incl latest
+  unsigned int head;                        // Offset in region of byte after newest sample
+  unsigned int used;                        // Bytes held
+  unsigned int count;                       // Samples held in region (latest isn't)
+  int latest;                               // Latest reading
+  unsigned long latestAt;                   // and its time, secs (see histNow)
+} histLogs[maxHistLogs];
+byte numHistLogs = 0;
+unsigned int histArenaUsed = 0;                    // Bytes at the top of readingHistory allotted to regions
+unsigned int readingsFree = sizeof(readingHistory);      // Bytes of readingHistory between stack blocks and regions, while config is loaded
+unsigned long evalArray[maxEvals];                 // Union of bytes containing a, b, dest, exp; or len, ptr, dest, exp (for lists).  Choice determined by calcType
+unsigned int turnOffArray[maxEvals/16];            // Bit array indicating how to handle result of evaluation - 1 = if result == TRUE then write FALSE to destination
+byte argArray[maxArgs];                            // Ordered array of arguments to be evaluated for && or ||; args are indexes into evalArray 
+                                                   // maskPtr indexes the start argument; maskLen is the number of arguments
+
 
 const byte valRef = 0xf0;
 const byte valRegion = 0x00;  
@@ -153,6 +359,60 @@ const byte valSlowCapture = 3;               // Indicates temp sensor read trigg
 
 unsigned int (*getSensorReading[maxSensorTypes])(unsigned int pin, unsigned int handler);        // Array of function pointers to sensor readers, indexed by sensorType
 
+// Sensors of these types on a pin with a pin change interrupt aren't polled: each change is queued by the ISR and acted on by the next loop()
+// Must be active-low digital inputs, as getSensPresence
+const unsigned int indSensorEvent = (1 << 4) | (1 << 5);        // Motion (ePIR MD pin), Presence
+EVENTQUEUE sensorEvents;                        // Also for other interrupt-driven sources (eg MCP23S17BUS handlers) - see queueEvent
+
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+const byte pcPort[] = { PB, PJ, PK };            // Ports served by PCINT0_vect, PCINT1_vect & PCINT2_vect
+const byte pcShift[] = { 0, 1, 0 };              // PCMSK bit = port bit + shift (PJ0 is PCINT9)
+#else
+const byte pcPort[] = { PB, PC, PD };
+const byte pcShift[] = { 0, 0, 0 };
+#endif
+const byte numPCGroups = sizeof(pcPort);
+struct pcGroup {
+  volatile uint8_t *pinReg;                     // Input register of port
+  byte mask;                                    // Port bits with an event sensor
+  byte lastLevel;                               // Port as at last interrupt
+  byte deviceIdx[8];                            // Device on each port bit
+} pcGroups[numPCGroups];
+volatile boolean pcintLost = false;             // A change wasn't queued as sensorEvents was full; its bit is left out of lastLevel for pcintResync
+
+
+/************** CONFIG IMAGE ****************/
+// Once config.jso has been parsed everything it sets is saved to config.bin, so later restarts (eg after a watchdog reset) 
+// can restore it with a handful of block reads.  Image only used if made from the current config.jso and checksum matches
+
+const char configImageMagic[4] = { 'H', 'A', 'C', 'I' };
+const byte configImageVersion = 7;                 // Increment if the layout of anything in configImage changes
+
+struct configImageHeader {
+  char magic[4];
+  byte version;
+  uint32_t jsonSize;                               // Size and last write date/time of config.jso the image was made from
+  uint16_t jsonDate;
+  uint16_t jsonTime;
+  uint16_t payloadLen;                             // Total length of blocks - catches a change of maxDevices etc
+  uint16_t checksum;                               // Fletcher-16 of blocks
+};
+
+struct configImageBlock {
+  void *addr;
+  unsigned int len;
+};
+
+const configImageBlock configImage[] PROGMEM = { { mac, sizeof(mac) }, { ip, sizeof(ip) }, { &arduinoMe, sizeof(arduinoMe) }, { timeServer, sizeof(timeServer) },
+                                         { devRef, sizeof(devRef) }, { devArduino, sizeof(devArduino) }, { devPin, sizeof(devPin) }, { devHandler, sizeof(devHandler) },
+                                         { devPollFreq, sizeof(devPollFreq) }, { devStatus, sizeof(devStatus) }, { devStack, sizeof(devStack) }, 
+                                         { devTOSIdx, sizeof(devTOSIdx) }, { devWindow, sizeof(devWindow) }, { devFlags, sizeof(devFlags) }, { varReading, sizeof(varReading) }, 
+                                         { evalArray, sizeof(evalArray) }, { turnOffArray, sizeof(turnOffArray) }, { argArray, sizeof(argArray) }, 
+                                         { p_freqIdx, sizeof(p_freqIdx) }, { p_freqMarker, sizeof(p_freqMarker) }, { frequency, sizeof(frequency) },
+                                         { histLogs, sizeof(histLogs) }, { &numHistLogs, sizeof(numHistLogs) }, { &histArenaUsed, sizeof(histArenaUsed) },
+                                         { &numDevices, sizeof(numDevices) }, { &numVars, sizeof(numVars) }, { &numEvals, sizeof(numEvals) }, { &numArgs, sizeof(numArgs) } };
+const byte numConfigImageBlocks = sizeof(configImage) / sizeof(configImage[0]);
+
 
 /****************** DECISION STUFF ***************/
 
@@ -198,10 +458,51 @@ const byte valExpAND = 0x08;
 const byte valExpOR = 0x09;
 const byte valExpBTW = 0x0a;
 const byte valExpNotBTW = 0x0b;
+
+// Evals compiled by compileEvals into a program for a stack machine (codeRun), so makeDecisions doesn't decode evalArray each heartbeat
+// Each eval with a destination is a 'rule': evalIdx, dest, codeFlags, length of ops (2 bytes), ops..., opRet.  Nested evals (valCalcListE) are compiled inline
+// Binary ops share the values of valExp (non-list), so a plain eval's exp is emitted as is
+const int maxCode = 384;                  // Bytes of compiled evals; if exceeded, evals are interpreted by evalRun.  See RAM BUDGET
+const byte codeStackSize = 16;            // Max depth of codeRun stack
+const byte maxEvalNesting = 8;            // Max depth of evals within lists of evals
+const byte codeTurnOff = 0x01;            // codeFlags: write valOff if result TRUE
+const byte codeActOnResult = 0x02;        // codeFlags: only write if result TRUE (else always write)
+const byte codeTimed = 0x04;              // codeFlags: uses time; rerun each minute
+const byte codeAlways = 0x08;             // codeFlags: uses reading history (PREV, AV etc) or deps not built; run every heartbeat
+const byte codeHeader = 5;                // Bytes before ops of each rule
+
+const byte opBit = 0x10;                  // + deviceIdx; push latest on/off reading of device with StackMode = 0
+const byte opHist = 0x11;                 // + deviceIdx; push latest reading of device with StackMode = 1
+const byte opVar = 0x12;                  // + varIdx (MSB clear); push variable
+const byte opMap = 0x13;                  // + deviceIdx, type; push mapGet(deviceIdx, type) - PREV, AV, MX, MN & ROC
+const byte opTime = 0x14;                 // + valCalcYear..valCalcMinute; push part of current time
+const byte opNot = 0x15;                  // TOS = !TOS
+const byte opMax = 0x16;                  // Pop 2, push larger
+const byte opMin = 0x17;                  // Pop 2, push smaller
+const byte opDivN = 0x18;                 // + n; TOS = TOS / n
+const byte opAndThen = 0x19;              // + offset; if TOS == 0 skip forward offset bytes, else pop
+const byte opOrElse = 0x1a;               // + offset; if TOS != 0 skip forward offset bytes, else pop
+const byte opRet = 0x1b;                  // End of eval; result is TOS
+
+byte evalCode[maxCode];
+int codeLen = 0;                          // 0 = not compiled
+byte codeSp;                              // Stack depth while compiling
+byte codeRuleFlags;                       // codeTimed/codeAlways found while compiling a rule
+boolean codeFail;
+
+// Rules only rerun if an input has changed (or codeTimed/codeAlways).  Built by buildDeps from the compiled rules
+// depRule[depStart[slot]] to depRule[depStart[slot + 1] - 1] are the rules reading input slot; slot = deviceIdx, or maxDevices + var
+const byte maxInputs = maxDevices + maxVars;
+const byte maxDeps = 192;
+byte depStart[maxInputs + 1];
+byte depRule[maxDeps];
+byte ruleDirty[maxEvals / 8];             // Bit per rule, in program order
+byte lastMinute = 0xff;
                             
 
 /**************** OTHER STUFF *****************/
 uint32_t timestarted;                // For debugging file serve times
+volatile boolean heartbeatDue = false;        // Set by WAKEUP each heartBeatSecs
 const char charTokenStart = '<';
 const char charTokenEnd = '>';
 const byte heartBeatSecs = 1;
@@ -220,11 +521,24 @@ const byte offsetDay = 11;
 const byte offsetHour = 6;
 
 
-
-
+/************** RAM BUDGET ****************/
+// The Mega has 8K of RAM, and string literals are copied into it unless kept in flash - so they are, by PgmPrint, PSTR, 
+// PgmClientPrint & PgmSendLog.  Besides the tables above, Serial's and SdFat's buffers (1.1K), WAKEUP's bunks (0.7K) and the stack 
+// at its deepest (about 0.6K, serving ajax!L or a file under SdFat, with an interrupt on top) have to fit.  So maxDevices (17 bytes
+// each), maxReadings, maxEvals and the log's staging are kept down, and compiled rules, their deps, RUNSTATS and HISTLOGs are held 
+// to ramBudget between them - set by maxCode, maxDeps, maxStats and maxHistLogs.  The hist arena takes none of its own (see histAttach)
+//
+// setup() paints free RAM with ramPaint first; ramLowWater() finds how much of it the stack has never reached, ie free RAM at the
+// deepest call so far.  Reported at the end of setup() and by UDP command 'M'; under ramStackReserve at startup is too little stack
+const int ramBudget = 1536;
+const int ramStackReserve = 768;
+const byte ramPaint = 0xa5;
+typedef char ramBudgetCheck[(sizeof(evalCode) + sizeof(depStart) + sizeof(depRule) + sizeof(ruleDirty) + 
+                             sizeof(runStats) + sizeof(histLogs) <= ramBudget) ? 1 : -1];      // Won't compile if over budget
 
 
 void setup() {
+  ramPaintStack();
   Serial.begin(9600);
  
   PgmPrint("Free RAM: ");
@@ -245,28 +559,44 @@ void setup() {
   UdpArd.begin(UdpArdPort);
   
   // Set up pins & device handlers, incl Time, and start UDP for logging
+  wakeup.init();
+  sensorEvents.init();
   initialiseDevices();
   
   // Start up server
   WebServer.begin();  
   
-  Serial.println("Startup complete");
+  PROFILE_INIT();
+  wakeup.wakeMeAfter(heartbeatWake, -(heartBeatSecs * 1000L), NULL, TREAT_AS_ISR);      // Repeating
+  
+  PgmPrintln("Startup complete");
+  PgmPrint("Free RAM: ");
+  Serial.println(FreeRam());
+  PgmPrint("Free RAM at deepest: ");
+  Serial.println(ramLowWater());
+  if (FreeRam() < ramStackReserve) PgmPrintln("Low RAM - reduce maxDevices, maxReadings, maxCode etc");
 
 }
 
-void getConfig() {            // Read in config.jso file; also read by javascript in web client    
+void getConfig() {            // Restore from config.bin if made from current config.jso, else read in config.jso file (also read by javascript in web client) and save config.bin
   SdFile configFile;
+  dir_t configDir;
   
   if (configFile.open(root, "config.jso", O_READ)) {
-    loadIdentity (&configFile);          // Get information about the servers and identity of this arduino    
-    loadDevices (&configFile);           // Load physical device attributes    
-    loadVariables (&configFile);         // Load internal variables    
-    loadFreqs (&configFile);             // Get list of scanning frequencies and build optimised route for device scanning    
-    loadEvals (&configFile);             // Load evaluations    
+    configFile.dirEntry(&configDir);      // Size and date/time identify the version of config.jso
+    
+    if (loadConfigImage(&configDir)) PgmPrintln("Config restored from config.bin");
+    else {
+      loadConfig (&configFile);            // Servers & identity of this arduino, devices, variables, scanning frequencies & route, evaluations    
+      saveConfigImage(&configDir);
+    }
+    devHashBuild();
+    compileEvals();
+    histStart();
     configFile.close();
   }
   else {
-    Serial.println("No config file found");
+    PgmPrintln("No config file found");
   }
 }
 
@@ -274,8 +604,8 @@ void getConfig() {            // Read in config.jso file; also read by javascrip
 void loop() {
 
   // Regular heartbeat actions
-  if ( (millis() % (heartBeatSecs * 1000)) == 0 ) {
-      
+  if (heartbeatDue) {
+    heartbeatDue = false;  
     heartBeat += heartBeatSecs;    // Eventual overflow @ 32k not material
     
     #if DEBUGON
@@ -292,29 +622,84 @@ void loop() {
           case 'A':
           case 'a':    debugA = true; break;
           case 'N':
-          case 'n':    debugH = debugR = debugE = debugA = false; UdpLogPort = 0;
+          case 'n':    debugH = debugR = debugE = debugA = false; UdpLogPort = 0; break;
+          case 'M':
+          case 'm':    sprintf_P(logBuffer, PSTR("Free RAM = %d, at deepest = %d\n"), FreeRam(), ramLowWater()); sendLog(logBuffer); break;
+          #if DEBUGPROFILE
+          case 'P':
+          case 'p':    sendProfile(); break;
+          #endif
         }
       }
     #endif
   
     #if DEBUGHEARTBEAT
-      if (debugH) { sprintf (logBuffer, "Heartbeat = %d\n", heartBeat); sendLog(logBuffer); }
+      if (debugH) { sprintf_P(logBuffer, PSTR("Heartbeat = %d\n"), heartBeat); sendLog(logBuffer); }
     #endif
  
+    PROFILE_START(probeHeartbeat);
+    
     // Get the latest sensor information
+    PROFILE_START(probeSensors);
     checkSensors();
-    
+    PROFILE_STOP(probeSensors, heartBeat);
     
     // Decide what to do and if needed do it
-    if (makeDecisions()) takeAction();
+    decideAndAct();
+    
+    // Get part-filled block of reading log onto card
+    if (logStaged && (heartBeat % (logSyncFreq * heartBeatSecs) == 0)) logWriteBlock();
+    
+    PROFILE_STOP(probeHeartbeat, heartBeat);
   }
+  
+  // Sensor changes caught by interrupt - act on them now rather than at the next heartbeat
+  if (sensorEvents.available()) handleEvents();
+  if (pcintLost) pcintResync();        // Queue was full; changes still missing are queued for the next loop()
 
-  // See if any HTTP dialogue  
-  if (Client client = WebServer.available()) processHTTP(client);
+  // Take the HTTP dialogue a step further, if there is one
+  webService();
 } 
 
 
 
+void heartbeatWake(void *context) {      // WAKEUP sleeper; runs as ISR so just flags loop()
+  heartbeatDue = true;
+}
+
+void decideAndAct() {
+  PROFILE_START(probeDecisions);
+  boolean actionNeeded = makeDecisions();
+  PROFILE_STOP(probeDecisions, heartBeat);
+  
+  if (actionNeeded) {
+    PROFILE_START(probeActions);
+    takeAction();
+    PROFILE_STOP(probeActions, heartBeat);
+  }
+}
+
+void handleEvents() {        // Store readings queued by ISRs; only rules reading them rerun (see markChanged)
+  byte deviceIdx, firstIdx = 0;
+  unsigned int reading;
+  
+  PROFILE_START(probeEvents);
+  while (sensorEvents.get(deviceIdx, reading)) {
+    if (!firstIdx) firstIdx = deviceIdx;
+    stackPush(deviceIdx, reading);
+    statusPut(deviceIdx, valStatusStable);
+    #if DEBUGREADINGS
+      if (debugR) { PgmSendLog("Event "); printRef(deviceIdx); sprintf_P(logBuffer, PSTR(" reading = %d\n"), reading); sendLog(logBuffer); } 
+    #endif
+  }
+  decideAndAct();
+  PROFILE_STOP(probeEvents, firstIdx);
+}
+
+boolean queueEvent(byte deviceIdx, unsigned int reading) {      // New reading for deviceIdx from an ISR, eg an MCP23S17BUS handler.  False if queue full
+  return sensorEvents.put(deviceIdx, reading);
+}
+
 void checkSensors() {          // Get latest readings for all devices due this heartbeat; optimised to avoid trawling through all devices.  Repeat for slow-read devices
   int i, start, startnext, freqCode;
   char response[10];
@@ -326,206 +711,337 @@ void checkSensors() {          // Get latest readings for all devices due this h
       start = p_freqMarker[freqCode];            // Get start and end markers for this frequency
       startnext = p_freqMarker[freqCode + 1];
       for (i = start; i < startnext; i++) {
+        PROFILE_START(probeDeviceGet);
         deviceGet(p_freqIdx[i], false);  // Read all devices at this polling frequency (or trigger read for slow sensors)
+        PROFILE_STOP(probeDeviceGet, p_freqIdx[i]);
 //        if (onWatchList(p_freqIdx[i])) { Serial.println("In checkSensors - watch "); Serial.println(p_freqIdx[i]); }
       }
     }
     if ( (prevHeartBeat % frequency[freqCode]) == 0) {    // Check for any slow sensor reads triggered previously that have now arrived (eg temperature)
       start = p_freqMarker[freqCode];            // Get start and end markers for this frequency
       startnext = p_freqMarker[freqCode + 1];
-      for (i = start; i < startnext; i++) if (mapGet(p_freqIdx[i], valStatus) == valStatusPending)  deviceGet(p_freqIdx[i], true);   // Get delayed reading
+      for (i = start; i < startnext; i++) if (devStatus[p_freqIdx[i]] == valStatusPending)  deviceGet(p_freqIdx[i], true);   // Get delayed reading
     }
   }
   #if DEBUGHEARTBEAT
-    if (debugH) { sprintf (logBuffer, "Sensors checked in %dms\n", millis() - startMS); sendLog(logBuffer); }
+    if (debugH) { sprintf_P(logBuffer, PSTR("Sensors checked in %dms\n"), millis() - startMS); sendLog(logBuffer); }
   #endif
 }
 
 
 boolean makeDecisions() {        // Perform evalations and set target values if needed; flag if action needed
-  byte evalIdx, evalDest;
+  byte evalIdx, evalDest, codeFlags;
   unsigned int result;
   boolean actOn, actionNeeded = false;
+  boolean interpret = (codeLen == 0);
   unsigned long startMS = millis();
+  
+  #if DEBUGEVAL
+    if (debugE) interpret = true;                  // evalRun traces each step
+  #endif
     
-  for (evalIdx = 0; evalIdx < numEvals; evalIdx++) {
-    if (evalDest = evalGet(evalIdx, valDest)) {            // deviceIdx == 0 is noop (eval used in arg list only)
-    
-      result = evalRun(evalIdx, &actOn);
-    
-      if (actOn) {                            // Store result of evaluation and if different to existing set flag to indicate action needed (unless pin = noOp)
-        if (evalGet(evalIdx, valTurnOff)) result = valOff;
-        
-        do {
-          mapPut (evalDest, valCurr, result);
-          if (mapGet(evalDest, valPin) != pinNoOp && mapGet(evalDest, valPrev) != result) {
-            mapPut (evalDest, valStatus, valStatusTarget);
-            actionNeeded = true;
-          }
-          else mapPut(evalDest, valStatus, valStatusStable);
-          
-          #if DEBUGEVAL
-            if (debugE) {
-              sendLog("Dest = ");
-              if (evalGet(evalIdx, valTurnOff)) sendLog("~");
-              printRef(evalDest);      
-              sprintf(logBuffer, ", existing = %d, new = %d, pin = %d, status = %d\n", mapGet(evalDest, valCurr), result, mapGet(evalDest, valPin), mapGet(evalDest, valStatus));
-              sendLog(logBuffer);
-              if (mapGet(evalDest, valCascade)) sendLog("--> Cascade ");
-            }
-          #endif
-        } while (mapGet (evalDest++, valCascade));        // Cascade result if needed
+  if (interpret) {
+    for (evalIdx = 0; evalIdx < numEvals; evalIdx++) {
+      if (evalDest = evalGet(evalIdx, valDest)) {            // deviceIdx == 0 is noop (eval used in arg list only)
+      
+        PROFILE_START(probeEval);
+        result = evalRun(evalIdx, &actOn);
+        PROFILE_STOP(probeEval, evalIdx);
+      
+        if (actOn && evalStore(evalIdx, evalDest, result, evalGet(evalIdx, valTurnOff))) actionNeeded = true;
       }
     }
   }
+  else {
+    int pc = 0, next;
+    byte rule = 0, minuteNow = minute();
+    boolean newMinute = (minuteNow != lastMinute);
+    
+    lastMinute = minuteNow;
+    for (rule = 0; pc < codeLen; rule++, pc = next) {          // Rules in eval order, so a result feeds later rules this heartbeat and earlier ones next
+      codeFlags = evalCode[pc + 2];
+      next = pc + codeHeader + evalCode[pc + 3] + (evalCode[pc + 4] << 8);
+      
+      if (!(ruleDirty[rule >> 3] & (1 << (rule & 7))) && !(codeFlags & codeAlways) && !(newMinute && (codeFlags & codeTimed))) continue;     // Inputs unchanged
+      ruleDirty[rule >> 3] &= ~(1 << (rule & 7));
+      
+      evalIdx = evalCode[pc];
+      evalDest = evalCode[pc + 1];
+      pc += codeHeader;
+      
+      PROFILE_START(probeEval);
+      result = codeRun(&pc);
+      PROFILE_STOP(probeEval, evalIdx);
+      
+      if ((result || !(codeFlags & codeActOnResult)) && evalStore(evalIdx, evalDest, result, codeFlags & codeTurnOff)) actionNeeded = true;
+    }
+  }
 
   #if DEBUGHEARTBEAT
-    if (debugH) { sprintf (logBuffer, "Decisions made in %dms\n", millis() - startMS); sendLog(logBuffer); }
+    if (debugH) { sprintf_P(logBuffer, PSTR("Decisions made in %dms\n"), millis() - startMS); sendLog(logBuffer); }
   #endif
 
   return actionNeeded;
 }    
 
+boolean evalStore(byte evalIdx, byte evalDest, unsigned int result, boolean turnOff) {    // Store result of evaluation and if different to existing flag action needed (unless pin = noOp)
+  boolean actionNeeded = false;
+  
+  if (turnOff) result = valOff;
+  
+  do {
+    currPut (evalDest, result);
+    if (!(evalDest & mask8BitMSB)) {                  // Variables have no pin, status or cascade
+      if (devPin[evalDest] != pinNoOp && stackGet(evalDest, 1) != result) {
+        statusPut(evalDest, valStatusTarget);
+        actionNeeded = true;
+      }
+      else statusPut(evalDest, valStatusStable);
+    }
+    
+    #if DEBUGEVAL
+      if (debugE) {
+        PgmSendLog("Dest = ");
+        if (turnOff) PgmSendLog("~");
+        printRef(evalDest);      
+        sprintf_P(logBuffer, PSTR(", existing = %d, new = %d, pin = %d, status = %d\n"), mapGet(evalDest, valCurr), result, mapGet(evalDest, valPin), mapGet(evalDest, valStatus));
+        sendLog(logBuffer);
+        if (mapGet(evalDest, valCascade)) PgmSendLog("--> Cascade ");
+      }
+    #endif
+  } while (!(evalDest & mask8BitMSB) && devCascade(evalDest++));        // Cascade result if needed
+  
+  return actionNeeded;
+}
+
 
 void takeAction() {      // Issue device instructions based on devices with target values (status == valStatusTarget)
   byte deviceIdx;
   unsigned long startMS = millis(); 
   
   for (deviceIdx = 1; deviceIdx < numDevices; deviceIdx++) {      // Skip over NULL device
-    if (mapGet(deviceIdx, valStatus) == valStatusTarget) {
+    if (devStatus[deviceIdx] == valStatusTarget) {
       
       #if DEBUGACTIONS
         if (debugA) {
-          sprintf(logBuffer, "Set pin %d (", mapGet(deviceIdx, valPin));
+          sprintf_P(logBuffer, PSTR("Set pin %d ("), devPin[deviceIdx]);
           sendLog(logBuffer);
           printRef(deviceIdx);
-          sprintf(logBuffer, ") to %d\n", mapGet(deviceIdx, valCurr));
+          sprintf_P(logBuffer, PSTR(") to %d\n"), stackGet(deviceIdx, 0));
           sendLog(logBuffer);
         }
       #endif
       
-      if (mapGet(deviceIdx, valSensor)) sendLog("Trying to set a sensor\n");
+      if (devSensor(deviceIdx)) PgmSendLog("Trying to set a sensor\n");
       else {
-        if (mapGet(deviceIdx, valCurr) > 1) sendLog("Target neither 0 nor 1\n");
-        digitalWrite (mapGet(deviceIdx, valPin), mapGet(deviceIdx,valCurr));
-        mapPut(deviceIdx, valStatus, valStatusStable);
+        if (stackGet(deviceIdx, 0) > 1) PgmSendLog("Target neither 0 nor 1\n");
+        digitalWrite (devPin[deviceIdx], stackGet(deviceIdx, 0));
+        statusPut(deviceIdx, valStatusStable);
       }
     }
   } 
 
   #if DEBUGHEARTBEAT
-    if (debugH) { sprintf (logBuffer, "Actions taken in %dms\n", millis() - startMS); sendLog(logBuffer); }
+    if (debugH) { sprintf_P(logBuffer, PSTR("Actions taken in %dms\n"), millis() - startMS); sendLog(logBuffer); }
   #endif
 }
 
 
-void processHTTP(Client client)  {
-  char clientline[const_HTTP_BUFSIZ];
-  char URLline[const_HTTP_BUFSIZ];
-  int index = 0;
-  char *dataStart;
-  char mode = ' ';    // ' ' = normal, 'G' = GET, 'P' = waiting for blank line in POST, 'D' = waiting for data line in POST, 'X' = request complete
-  long int contLen;
+void webService() {          // Advance HTTP dialogue by a step - accept a request, read a chunk of it, send a slice of the reply, or answer a wait
+  if (webState == webIdle) {
+    if (!(webClient = WebServer.available())) return;
+    webState = webRequest;
+    webMode = ' ';
+    webLineLen = 0;
+    webETag[0] = 0;
+    webGzip = false;
+  }
+  else if (webState == webWaiting) {              // Nothing to do until a change or timeout; not profiled
+    if (!webClient.connected()) { webState = webIdle; return; }
+    if (!versionNewer(changeVersion, webSince) && (long) (millis() - webWaitUntil) < 0) return;
+  }
+  
+  PROFILE_START(probeWeb);
+  if (webState == webRequest) processHTTP(webClient);
+  else if (webState == webSending) webSendSlice();
+  else {
+    webState = webIdle;
+    serveBatch(webClient, NULL, webSince);      // Empty list if timed out
+  }
+  PROFILE_STOP(probeWeb, heartBeat);
+}
+
+void webWait(unsigned int since) {      // Hold ajax!W until anything changes after version since
+  webSince = since;
+  webWaitUntil = millis() + webPollSecs * 1000UL;
+  webState = webWaiting;
+}
+
+void processHTTP(Client client)  {          // Read up to webReadChunk bytes of request, and act on it once complete
+  char *buf;
   unsigned long startMS = millis(); 
   
-  while (client.connected() && mode != 'X') {
-    if (client.available()) { 
-      char c = client.read();
-              
-      switch (c) {
-        case '\n':
-          clientline[index] = 0;  
-          
-          if (index==0) {      // Blank line indicates end of request, unless it was a POST (in which case next line contains data, so keep alive)
-            switch (mode) {
-              case 'G':        // Was a GET; data is in the saved URLline
-                if (dataStart = strstr(URLline, "ajax!")) { handleAjaxGet (client, dataStart + 6, dataStart[5]); }      // Ajax Get: 'R'eading, 'T'ime, or 'P'ut
-                else if ((dataStart = strstr(URLline,"?")) != 0) { handleHTTPCmd(client,dataStart+1); }  // Was a GET after a Form submit;  handle the submitted text
-                else { handleHTTPGet(client, URLline); }                 // Normal GET
-                mode = 'X';
-                break;
-              case 'P':                                         // Finished POST headers, expect data in next line
-                mode = 'D';
-                break;
-              default:                           // Shouldn't happen?
-                Serial.println("No mode set");              
-                client.println("HTTP/1.1 200 OK");
-                client.println();
-                stopClient(client);
-                mode = 'X';
-            }
-          }
-          else {                                      // Not a blank line, check what's on it
-            if (strstr(clientline,"GET /") != 0) {              
-              mode = 'G';                            
-              strncpy (URLline,clientline,const_HTTP_BUFSIZ);    // Save line for later
-              echoLine(clientline); 
-            }
-            else if (strstr(clientline,"POST /") != 0) {
-              mode = 'P';                            // Got a POST; set mode & remember URL
-              strncpy (URLline,clientline,const_HTTP_BUFSIZ);
-              echoLine(clientline); 
-            }
-            else if (mode =='P' && (dataStart = strstr(clientline,"Content-Length:")) != 0) {    // Got the data length for a POST; remember it
-              dataStart += 16;      // Step over "Content-Length: " to start of numbers
-              contLen = atoi(dataStart);        // Get the content length
-              if (contLen > const_HTTP_BUFSIZ) contLen = const_HTTP_BUFSIZ;        // Can't cope with huge POSTs
-            }
-            
-            index = 0;
-          }
-          break;
-        case '\r':    // Ignore CR
-          break;
-        default:      // Add a character to the input buffer; if too large just truncate (enough info in first const_HTTP_BUFSIZ chars)
-          clientline[index] = c;
-          if (index < (const_HTTP_BUFSIZ-1)) index++;
-
-          if (mode == 'D' && index >= contLen) {    // If waiting for POST data, then process when got it all and refresh page
-            handleHTTPCmd(client,clientline);
-            strncpy (clientline,URLline,const_HTTP_BUFSIZ);    // Contains "POST /"
-            strncpy (clientline+1,"GET",3);                    // Replace with "GET"
-            handleHTTPGet(client,clientline+1);                    // ... and issue refresh, starting at 'G'
-            stopClient(client);
-            mode = 'X';
+  for (byte n = 0; n < webReadChunk && webState == webRequest && client.available(); n++) { 
+    char c = client.read();
+    
+    buf = (webMode == ' ') ? webURL : webLine;          // Request line is kept for routing; the rest overwrite each other
+    switch (c) {
+      case '\n':
+        buf[webLineLen] = 0;  
+        
+        if (webMode == ' ') {                       // Request line
+          if (webLineLen) webParseRequest();
+        }
+        else if (webLineLen == 0) {      // Blank line indicates end of request, unless it was a POST (in which case next line contains data, so keep alive)
+          switch (webMode) {
+            case 'G':        // Was a GET.  Handler may go on to send a file
+              webState = webIdle;
+              webRoute(client, webPath);
+              break;
+            case 'P':                                         // Finished POST headers, expect data in next line
+              webMode = 'D';
+              break;
+            default:                           // Shouldn't happen?
+              PgmPrintln("No mode set");              
+              PgmClientPrintln(client, "HTTP/1.1 200 OK");
+              client.println();
+              stopClient(client);
+              webState = webIdle;
           }
-      }    // Switch (c)
-    }    // Client.available
-  }    // Client.connected
+        }
+        else if (webMode == 'P' && strncmp_P(webLine, PSTR("Content-Length:"), 15) == 0) {    // Got the data length for a POST; remember it
+          webContLen = atoi(webLine + 15);
+          if (webContLen > const_HTTP_BUFSIZ - 1) webContLen = const_HTTP_BUFSIZ - 1;        // Can't cope with huge POSTs
+        }
+        else if (webMode == 'G' && strncmp_P(webLine, PSTR("If-None-Match: "), 15) == 0) {        // Browser has a copy; 304 if still current
+          strncpy(webETag, webLine + 15, sizeof(webETag) - 1);
+          webETag[sizeof(webETag) - 1] = 0;
+        }
+        else if (webMode == 'G' && strncmp_P(webLine, PSTR("Accept-Encoding:"), 16) == 0) webGzip = (strstr_P(webLine + 16, PSTR("gzip")) != 0);
+        webLineLen = 0;
+        break;
+      case '\r':    // Ignore CR
+        break;
+      default:      // Add a character to the input buffer; if too large just truncate (enough info in first const_HTTP_BUFSIZ chars)
+        buf[webLineLen] = c;
+        if (webLineLen < (const_HTTP_BUFSIZ-1)) webLineLen++;
+
+        if (webMode == 'D' && webLineLen >= webContLen) {    // If waiting for POST data, then process when got it all and refresh page
+          webLine[webLineLen] = 0;
+          webState = webIdle;
+          handleHTTPCmd(client, webLine);
+          handleHTTPGet(client, webPath);                    // ... and issue refresh
+          if (webState == webSending) webStopAfter = true;
+          else stopClient(client);
+        }
+    }    // Switch (c)
+  }
+  if (webState == webRequest && !client.connected()) webState = webIdle;      // Gone before request complete
   
   #if DEBUGHEARTBEAT
-    if (debugH) { sprintf (logBuffer, "Web checked in %dms\n", millis() - startMS); sendLog(logBuffer); }
+    if (debugH) { sprintf_P(logBuffer, PSTR("Web checked in %dms\n"), millis() - startMS); sendLog(logBuffer); }
   #endif
 }
 
+void webParseRequest() {        // Split request line in webURL in place - method sets webMode, webPath is path after '/' with " HTTP/1.1" dropped
+  char *mark = strchr(webURL, ' ');
+  
+  echoLine(webURL); 
+  if (strncmp_P(webURL, PSTR("GET "), 4) == 0) webMode = 'G';
+  else if (strncmp_P(webURL, PSTR("POST "), 5) == 0) webMode = 'P';
+  else webMode = 'X';
+  
+  if (!mark || mark[1] != '/') { webMode = 'X'; return; }
+  webPath = mark + 2;
+  if ((mark = strchr(webPath, ' ')) != 0) *mark = 0;
+}
+
+void webRoute(Client client, char *path) {      // Hand path to the first handler in webRoutes whose prefix it starts with
+  for (byte i = 0; i < numWebRoutes; i++) {
+    if (strncmp(path, webRoutes[i].prefix, webRoutes[i].len) == 0) { webRoutes[i].handler(client, path + webRoutes[i].len); return; }
+  }
+}
+
+void routeAjax(Client client, char *rest) {      // Ajax Get: 'R'eading, 'T'ime, 'P'ut, histor'Y', 'L'og, 'B'atch or 'W'ait
+  handleAjaxGet(client, rest + 1, rest[0]);
+}
+
+void routeFile(Client client, char *path) {      // File from card, or a form submitted with GET
+  char *query = strchr(path, '?');
+  
+  if (query) handleHTTPCmd(client, query + 1);
+  else handleHTTPGet(client, path);
+}
+
+SdFile *webDir(const char *name) {      // Open directory name in root, from webDirs if there; NULL if none
+  WEBDIR *entry;
+  SdFile dir;
+  
+  for (byte i = 0; i < maxWebDirs; i++) if (webDirs[i].dir.isOpen() && strcmp(webDirs[i].name, name) == 0) return &webDirs[i].dir;
+  
+  if (strlen(name) >= sizeof(entry->name) || !dir.open(root, name, O_READ)) return NULL;
+  if (!dir.isDir()) { dir.close(); return NULL; }
+  
+  entry = &webDirs[webDirNext];          // Only a directory that exists displaces another
+  webDirNext = (webDirNext + 1) % maxWebDirs;
+  if (entry->dir.isOpen()) entry->dir.close();
+  entry->dir = dir;
+  strcpy(entry->name, name);
+  return &entry->dir;
+}
+
+void webSendFile(SdFile *p_file, unsigned long length) {      // Send length bytes of open p_file from its current position, a slice per step; webSendSlice closes it
+  webFile = *p_file;
+  webRemaining = length;
+  webStopAfter = false;
+  webState = webSending;
+}
+
+void webSendSlice() {
+  byte readBuffer[const_SDCard_BUFSIZ];
+  int16_t byteCnt = 0;
+  
+  if (webRemaining && webClient.connected()) {
+    byteCnt = webFile.read(readBuffer, (webRemaining < const_SDCard_BUFSIZ) ? webRemaining : const_SDCard_BUFSIZ);
+    if (byteCnt > 0) {
+      webClient.write(readBuffer, byteCnt);
+      webRemaining -= byteCnt;
+      return;
+    }
+  }
+  webFile.close();                    // Sent, or client gone, or file short
+  if (webStopAfter) stopClient(webClient);
+  webState = webIdle;
+}
+
 // **************** Read physical device - support to CHECK SENSORS ***************************
 
 void deviceGet(int deviceIdx, boolean captureRead) {              // Read physical device and store in device map; captureRead set true if this is a follow-up for slow sensors
   unsigned int reading;
   
-  if (mapGet(deviceIdx,valArduino) != arduinoMe) {
-    sendLog("Get from other arduino");        // Code to be written
+  if (devArduino[deviceIdx] != arduinoMe) {
+    PgmSendLog("Get from other arduino");        // Code to be written
     return;
   }
   
-  if (mapGet(deviceIdx, valSensor)) {
-    reading = getSensorReading[mapGet(deviceIdx, valType)]
-                    (mapGet(deviceIdx, valPin), 
-                     (captureRead) ? valSlowCapture : mapGet(deviceIdx, valHandler));            // Invoke appropriate handler (slowCapture == true reads temp) and tell it where and how to read
+  if (devSensor(deviceIdx)) {
+    reading = getSensorReading[devType(deviceIdx)]
+                    (devPin[deviceIdx], 
+                     (captureRead) ? valSlowCapture : devHandler[deviceIdx]);            // Invoke appropriate handler (slowCapture == true reads temp) and tell it where and how to read
                      
     if ( isSlowSensor (deviceIdx) && captureRead == false) {      // Test if temp sensor and whether to use reading or wait until next time
-      mapPut (deviceIdx, valStatus, valStatusPending);  // Temp sensor and waiting - just put status 
+      statusPut(deviceIdx, valStatusPending);  // Temp sensor and waiting - just put status 
     }
     else {                                              // Either not a temp sensor, or have already triggered a read and now need to store captured read
-      mapPut(deviceIdx, valCurr, reading);
-      mapPut(deviceIdx, valStatus, valStatusStable);          
+      stackPush(deviceIdx, reading);
+      statusPut(deviceIdx, valStatusStable);          
       #if DEBUGREADINGS
-        if (debugR) { printRef(deviceIdx); sprintf (logBuffer, " pin = %d reading = %d\n", mapGet(deviceIdx, valPin), reading); sendLog(logBuffer); } 
+        if (debugR) { printRef(deviceIdx); sprintf_P(logBuffer, PSTR(" pin = %d reading = %d\n"), devPin[deviceIdx], reading); sendLog(logBuffer); } 
       #endif
     }
 
   }
-  else { sprintf(logBuffer, "Not sensor %d\n", deviceIdx); sendLog(logBuffer); }
+  else { sprintf_P(logBuffer, PSTR("Not sensor %d\n"), deviceIdx); sendLog(logBuffer); }
 }
 
 /********************* PERFORM EVALUATION - support to MAKE DECISIONS *********************/
@@ -533,6 +1049,9 @@ void deviceGet(int deviceIdx, boolean captureRead) {              // Read physic
 unsigned int evalRun (byte evalIdx, boolean *actOn) {
   byte evalCalc, evalExp, tempA, listElem;
   unsigned int result, evalA, evalB, tempResult;
+  boolean nestedActOn;
+  
+  if (!actOn) actOn = &nestedActOn;          // Nested eval; actOn not needed
   #if DEBUGEVAL
     char textString[10];
   #endif
@@ -549,50 +1068,50 @@ unsigned int evalRun (byte evalIdx, boolean *actOn) {
     #if DEBUGEVAL
       if (debugE) {
         getCalcChar (evalCalc, textString);
-        sprintf(logBuffer, "\nEvalIdx = %d %s %c args = %d\n--> Start", evalIdx, textString, getExpListChar (evalExp), argsLen);
+        sprintf_P(logBuffer, PSTR("\nEvalIdx = %d %s %c args = %d\n--> Start"), evalIdx, textString, getExpListChar (evalExp), argsLen);
         sendLog(logBuffer);
       }
     #endif
       
-    result = (evals) ? evalRun(argGet(argsPtr), NULL) : mapGet(argGet(argsPtr), valCurr);
+    result = (evals) ? evalRun(argGet(argsPtr), NULL) : currGet(argGet(argsPtr));
     
     switch (evalExp) {
       case valExpAvg:  
-        for (int i = 1; i < argsLen; i++) result += (evals) ? evalRun(argGet(argsPtr + i), NULL) : mapGet(argGet(argsPtr + i), valCurr);
+        for (int i = 1; i < argsLen; i++) result += (evals) ? evalRun(argGet(argsPtr + i), NULL) : currGet(argGet(argsPtr + i));
         result = result / argsLen;
         break;
       case valExpMax:
-        for (int i = 1; i < argsLen; i++) if (tempResult = (evals) ? evalRun(argGet(argsPtr + i), NULL) : mapGet(argGet(argsPtr + i), valCurr) > result) result = tempResult;
+        for (int i = 1; i < argsLen; i++) if ((tempResult = (evals) ? evalRun(argGet(argsPtr + i), NULL) : currGet(argGet(argsPtr + i))) > result) result = tempResult;
         break;        
       case valExpADD:
-        for (int i = 1; i < argsLen; i++) result += (evals) ? evalRun(argGet(argsPtr + i), NULL) : mapGet(argGet(argsPtr + i), valCurr);
+        for (int i = 1; i < argsLen; i++) result += (evals) ? evalRun(argGet(argsPtr + i), NULL) : currGet(argGet(argsPtr + i));
         break;
       case valExpMin:
-        for (int i = 1; i < argsLen; i++) if (tempResult = (evals) ? evalRun(argGet(argsPtr + i), NULL) : mapGet(argGet(argsPtr + i), valCurr) < result) result = tempResult;
+        for (int i = 1; i < argsLen; i++) if ((tempResult = (evals) ? evalRun(argGet(argsPtr + i), NULL) : currGet(argGet(argsPtr + i))) < result) result = tempResult;
         break;        
       case valExpMULT:
-        for (int i = 1; i < argsLen; i++) result *= (evals) ? evalRun(argGet(argsPtr + i), NULL) : mapGet(argGet(argsPtr + i), valCurr);
+        for (int i = 1; i < argsLen; i++) result *= (evals) ? evalRun(argGet(argsPtr + i), NULL) : currGet(argGet(argsPtr + i));
         break;
-      case valExpAND:   for (int i = 1; i < argsLen && result != 0; i++) { result = (evals) ? evalRun(argGet(argsPtr + i), NULL) : mapGet(argGet(argsPtr + i), valCurr); } break;           // For AND, quit on a false
-      case valExpOR:    for (int i = 1; i < argsLen && result == 0; i++) { result = (evals) ? evalRun(argGet(argsPtr + i), NULL) : mapGet(argGet(argsPtr + i), valCurr); } break;           // For OR, quit on a true
-      default:          Serial.print("Bad Exp");
+      case valExpAND:   for (int i = 1; i < argsLen && result != 0; i++) { result = (evals) ? evalRun(argGet(argsPtr + i), NULL) : currGet(argGet(argsPtr + i)); } break;           // For AND, quit on a false
+      case valExpOR:    for (int i = 1; i < argsLen && result == 0; i++) { result = (evals) ? evalRun(argGet(argsPtr + i), NULL) : currGet(argGet(argsPtr + i)); } break;           // For OR, quit on a true
+      default:          PgmPrint("Bad Exp");
     }
     
-    *actOn = (evalExp == valExpAND || evalExp == valExpOR) ? result : true;
+    *actOn = (evalExp == valExpAND || evalExp == valExpOR) ? (result != 0) : true;      // boolean is a byte; result alone would lose its high byte
     
     #if DEBUGEVAL
       if (debugE) {
-        sprintf(logBuffer, "\n--> End %s Result = %d ", textString, result);
+        sprintf_P(logBuffer, PSTR("\n--> End %s Result = %d "), textString, result);
         sendLog(logBuffer);
-        if (result == 0) sendLog("\n");
+        if (result == 0) PgmSendLog("\n");
       }
     #endif
   }
   else {              // High word holds A and B values
     // Arg A is either index to multiple variants of device or variable readings, or variants on current time.
     switch (evalCalc) {        // "&&", "||", "!", "CURR", "PREV", "AV", "MX", "MN", "ROC", "YR", "MTH", "DAY", "HR", "MIN"
-      case valCalcNOT:    evalA = !mapGet(tempA = evalGet (evalIdx, valA), valCurr); break;
-      case valCalcCURR:   evalA = mapGet(tempA = evalGet (evalIdx, valA), valCurr); break;
+      case valCalcNOT:    evalA = !currGet(tempA = evalGet (evalIdx, valA)); break;
+      case valCalcCURR:   evalA = currGet(tempA = evalGet (evalIdx, valA)); break;
       case valCalcPREV:   evalA = mapGet(tempA = evalGet (evalIdx, valA), valPrev); break;
       case valCalcAvg:    evalA = mapGet(tempA = evalGet (evalIdx, valA), valAvg); break;
       case valCalcMax:    evalA = mapGet(tempA = evalGet (evalIdx, valA), valMax); break;
@@ -603,11 +1122,11 @@ unsigned int evalRun (byte evalIdx, boolean *actOn) {
       case valCalcDay:    evalA = day(); break;         
       case valCalcHour:   evalA = hour(); break;
       case valCalcMinute: evalA = minute(); break;
-      default: Serial.print("Unrecognised calc mode, idx = "); Serial.println(evalIdx, HEX);
+      default: PgmPrint("Unrecognised calc mode, idx = "); Serial.println(evalIdx, HEX);
     }
    
     // Arg B is index to current value of either device or variable
-    evalB = mapGet(evalGet(evalIdx, valB), valCurr);   
+    evalB = currGet(evalGet(evalIdx, valB));   
 
     // Got arguments, now do evaluation -  "=", "!", ">", "<", "+", "-", "*", "/", '&', '|', '[', ']'
     switch (evalExp) {    
@@ -622,48 +1141,23 @@ unsigned int evalRun (byte evalIdx, boolean *actOn) {
       case valExpAND:    (*actOn) = result = evalA && evalB; break;
       case valExpOR:     (*actOn) = result = evalA || evalB; break;
       case valExpBTW: 
-      case valExpNotBTW:   {
-        unsigned int start, end, dhmValA = evalA, dhmValB = evalB, dhmDay = dhmGet(dhmValA, valDay), timeNow = dhmMake(5,22,30);
-        switch (dhmDay) {
-          case 0:        start = 1; end = 7; break;        // Daily
-          case 1:                                          // Sun
-          case 2:                                          // Mon
-          case 3:                                          // Tue
-          case 4:                                          // Wed
-          case 5:                                          // Thu
-          case 6:                                          // Fri
-          case 7:        start = end = dhmDay; break;      // Sat
-          case 8:        start = 2; end = 5; break;        // Mon-Thu
-          case 9:        start = 2; end = 6; break;        // Mon-Fri
-          case 10:       start = 7; end = 0; break;        // Weekend
-          default:       Serial.println("Bad dhmDay");
-        }
-        for (int i = start; i <= ((end) ? end : 7); i++) {
-          dhmPut (&dhmValA, valDay, i);
-          dhmPut (&dhmValB, valDay, i);
-          if (result = (timeNow >= dhmValA && timeNow <= dhmValB)) break;
-        }
-        if (end == 0 && result == 0) {                          // If Sun of weekend and dhmNow not on Sat
-          dhmPut (&dhmValA, valDay, 1);
-          dhmPut (&dhmValB, valDay, 1);
-          result = timeNow >= dhmValA && timeNow <= dhmValB;
-        }
-        }
+      case valExpNotBTW:
+        result = dhmBetween(evalA, evalB);
         (*actOn) = (evalExp == valExpNotBTW) ? result = (result == 0) : result;    // Swap logic if not between  
         break;
-      default:  Serial.print ("Bad eval"); Serial.println(evalExp, HEX);
+      default:  PgmPrint("Bad eval"); Serial.println(evalExp, HEX);
     }
     
     #if DEBUGEVAL
       if (debugE) {
         getCalcChar (evalCalc, textString);
-        sprintf(logBuffer, "\nEvalIdx = %d IF (%s ", evalIdx, textString);
+        sprintf_P(logBuffer, PSTR("\nEvalIdx = %d IF (%s "), evalIdx, textString);
         sendLog(logBuffer);
-        if (evalGet(evalIdx, valCalc) > valCalcROfC) sprintf(logBuffer,"%d %c",evalA, getExpChar(evalGet(evalIdx, valExp))); 
-        else { printRef(tempA); sprintf(logBuffer, " [%d] %c ", evalA, getExpChar(evalGet(evalIdx, valExp))); }
+        if (evalGet(evalIdx, valCalc) > valCalcROfC) sprintf_P(logBuffer, PSTR("%d %c"),evalA, getExpChar(evalGet(evalIdx, valExp))); 
+        else { printRef(tempA); sprintf_P(logBuffer, PSTR(" [%d] %c "), evalA, getExpChar(evalGet(evalIdx, valExp))); }
         sendLog(logBuffer);
         printRef(evalGet(evalIdx, valB)); 
-        sprintf(logBuffer, " [ %d]) Result = %d ", evalB, result);
+        sprintf_P(logBuffer, PSTR(" [ %d]) Result = %d "), evalB, result);
         sendLog(logBuffer);
       }
     #endif
@@ -673,22 +1167,271 @@ unsigned int evalRun (byte evalIdx, boolean *actOn) {
 
 
 
+/********************* COMPILED EVALUATION - used by MAKE DECISIONS unless tracing *********************/
+
+void compileEvals() {      // Compile evalArray into evalCode, once config loaded.  On failure codeLen = 0 and evals are interpreted
+  byte evalDest;
+  
+  codeLen = 0;
+  codeFail = false;
+  for (byte evalIdx = 0; evalIdx < numEvals && !codeFail; evalIdx++) {
+    if (evalDest = evalGet(evalIdx, valDest)) {
+      byte evalExp = evalGet(evalIdx, valExp);
+      boolean isList = (evalGet(evalIdx, valCalc) == valCalcListE || evalGet(evalIdx, valCalc) == valCalcListM);
+      int start = codeLen;
+      
+      codeEmit(evalIdx);
+      codeEmit(evalDest);
+      if (isList) codeEmit(((evalExp == valExpAND || evalExp == valExpOR) ? codeActOnResult : 0) | (evalGet(evalIdx, valTurnOff) ? codeTurnOff : 0));
+      else codeEmit(((evalExp == valExpADD || evalExp == valExpSUB || evalExp == valExpMULT || evalExp == valExpDIV) ? 0 : codeActOnResult) | (evalGet(evalIdx, valTurnOff) ? codeTurnOff : 0));
+      codeEmit(0);                  // Length, filled in below
+      codeEmit(0);
+      codeSp = 0;
+      codeRuleFlags = 0;
+      compileEval(evalIdx, 0);
+      codeEmit(opRet);
+      
+      if (!codeFail) {
+        evalCode[start + 2] |= codeRuleFlags;
+        evalCode[start + 3] = (codeLen - start - codeHeader) & 0xff;
+        evalCode[start + 4] = (codeLen - start - codeHeader) >> 8;
+      }
+    }
+  }
+  
+  if (codeFail) {
+    codeLen = 0;
+    PgmPrintln("Evals not compiled");
+  }
+  else {
+    if (!buildDeps()) PgmPrintln("Deps OF - evals run every heartbeat");
+    #if DEBUGPROFILE
+      PgmPrint("Evals compiled: ");
+      Serial.print(codeLen);
+      PgmPrint(" bytes, deps ");
+      Serial.println(depStart[maxInputs], DEC);
+    #endif
+  }
+  memset(ruleDirty, 0xff, sizeof(ruleDirty));     // Run everything first time
+}
+
+boolean buildDeps() {      // Index the rules reading each input, for markChanged; false (and all rules codeAlways) if too many
+  int pc, next, numDeps = 0;
+  byte rule, slot, i;
+  
+  memset(depStart, 0, sizeof(depStart));
+  for (byte pass = 0; pass < 2; pass++) {          // Count rules per input, then fill
+    for (pc = 0, rule = 0; pc < codeLen; rule++, pc = next) {
+      next = pc + codeHeader + evalCode[pc + 3] + (evalCode[pc + 4] << 8);
+      
+      for (pc += codeHeader; evalCode[pc] != opRet; ) {
+        switch (evalCode[pc++]) {
+          case opBit:
+          case opHist:      slot = evalCode[pc++]; break;
+          case opVar:       slot = maxDevices + evalCode[pc++]; break;
+          case opMap:       pc += 2; continue;            // History used; rule is codeAlways
+          case opTime:
+          case opDivN:
+          case opAndThen:
+          case opOrElse:    pc++; continue;
+          default:          continue;
+        }
+        if (pass == 0) {
+          if (numDeps++ == maxDeps) {
+            for (pc = 0; pc < codeLen; pc = next) {
+              evalCode[pc + 2] |= codeAlways;
+              next = pc + codeHeader + evalCode[pc + 3] + (evalCode[pc + 4] << 8);
+            }
+            memset(depStart, 0, sizeof(depStart));
+            return false;
+          }
+          depStart[slot + 1]++;
+        }
+        else depRule[depStart[slot]++] = rule;
+      }
+    }
+    
+    if (pass == 0) {      // Counts to starts
+      byte total = 0, count;
+      for (i = 0; i < maxInputs; i++) {
+        count = depStart[i + 1];
+        depStart[i] = total;
+        total += count;
+      }
+      depStart[maxInputs] = total;
+    }
+  }
+  for (i = maxInputs - 1; i > 0; i--) depStart[i] = depStart[i - 1];       // Fill moved each start on to the next; move back
+  depStart[0] = 0;
+  return true;
+}
+
+void markChanged (byte idx) {      // Reading of device or variable (MSB set) changed; flag rules that read it, and the browser
+  byte slot = (idx & mask8BitMSB) ? maxDevices + (idx & ~mask8BitMSB) : idx;
+  
+  for (byte i = depStart[slot]; i < depStart[slot + 1]; i++) ruleDirty[depRule[i] >> 3] |= 1 << (depRule[i] & 7);
+  versionBump(idx);
+}
+
+void statusPut (byte deviceIdx, byte status) {
+  if (devStatus[deviceIdx] == status) return;
+  devStatus[deviceIdx] = status;
+  versionBump(deviceIdx);
+}
+
+void versionBump (byte idx) {      // Device or variable (MSB set) changed; give it the next changeVersion
+  if (++changeVersion == 0) changeVersion = 1;          // 0 = never changed
+  idxVersion[(idx & mask8BitMSB) ? maxDevices + (idx & ~mask8BitMSB) : idx] = changeVersion;
+}
+
+boolean versionNewer (unsigned int version, unsigned int since) {      // Allows for wrap; good while client within 32k changes
+  return (since == 0) || (int) (version - since) > 0;
+}
+
+void compileEval (byte evalIdx, byte nesting) {      // Emit ops leaving the result of evalIdx on the stack
+  byte evalCalc, evalExp;
+  
+  if (nesting > maxEvalNesting || evalIdx >= numEvals) { codeFail = true; return; }
+  evalCalc = evalGet(evalIdx, valCalc);
+  evalExp = evalGet(evalIdx, valExp);
+  
+  if ((evalCalc == valCalcListE) || (evalCalc == valCalcListM)) {
+    unsigned int argsLen = evalGet(evalIdx, valLen);
+    unsigned int argsPtr = evalGet(evalIdx, valPtr);
+    int chain = -1;            // Last opAndThen/opOrElse offset still to patch; each holds the distance back to the previous (0 = none)
+    
+    if (argsLen == 0) { codeFail = true; return; }
+    for (unsigned int i = 0; i < argsLen && !codeFail; i++) {
+      if (i > 0 && (evalExp == valExpAND || evalExp == valExpOR)) {
+        codeEmit((evalExp == valExpAND) ? opAndThen : opOrElse);      // Short-circuit: quit AND on a false, OR on a true
+        codeEmit((chain < 0) ? 0 : codeLen - chain);
+        if (chain >= 0 && codeLen - 1 - chain > 255) codeFail = true;
+        chain = codeLen - 1;
+        codeStack(-1);
+      }
+      
+      if (evalCalc == valCalcListE) compileEval(argGet(argsPtr + i), nesting + 1);
+      else compileArg(argGet(argsPtr + i));
+      
+      if (i > 0) {
+        switch (evalExp) {
+          case valExpAvg:
+          case valExpADD:    codeEmit(valExpADD); codeStack(-1); break;
+          case valExpMax:    codeEmit(opMax); codeStack(-1); break;
+          case valExpMin:    codeEmit(opMin); codeStack(-1); break;
+          case valExpMULT:   codeEmit(valExpMULT); codeStack(-1); break;
+          case valExpAND:
+          case valExpOR:     break;
+          default:           codeFail = true;
+        }
+      }
+    }
+    if (evalExp == valExpAvg) { codeEmit(opDivN); codeEmit(argsLen); }
+    
+    while (chain >= 0 && !codeFail) {        // Point each short-circuit here
+      byte back = evalCode[chain];
+      
+      if (codeLen - 1 - chain > 255) codeFail = true;
+      evalCode[chain] = codeLen - 1 - chain;
+      chain = (back) ? chain - back : -1;
+    }
+  }
+  else {
+    switch (evalCalc) {
+      case valCalcNOT:    compileArg(evalGet(evalIdx, valA)); codeEmit(opNot); break;
+      case valCalcCURR:   compileArg(evalGet(evalIdx, valA)); break;
+      case valCalcPREV:   codeRuleFlags |= codeAlways; codeEmit(opMap); codeEmit(evalGet(evalIdx, valA)); codeEmit(valPrev); codeStack(1); break;
+      case valCalcAvg:    codeRuleFlags |= codeAlways; statsAttach(evalGet(evalIdx, valA)); codeEmit(opMap); codeEmit(evalGet(evalIdx, valA)); codeEmit(valAvg); codeStack(1); break;
+      case valCalcMax:    codeRuleFlags |= codeAlways; statsAttach(evalGet(evalIdx, valA)); codeEmit(opMap); codeEmit(evalGet(evalIdx, valA)); codeEmit(valMax); codeStack(1); break;
+      case valCalcMin:    codeRuleFlags |= codeAlways; statsAttach(evalGet(evalIdx, valA)); codeEmit(opMap); codeEmit(evalGet(evalIdx, valA)); codeEmit(valMin); codeStack(1); break;
+      case valCalcROfC:   codeRuleFlags |= codeAlways; statsAttach(evalGet(evalIdx, valA)); codeEmit(opMap); codeEmit(evalGet(evalIdx, valA)); codeEmit(valROC); codeStack(1); break;
+      case valCalcYear:
+      case valCalcMonth:
+      case valCalcDay:
+      case valCalcHour:
+      case valCalcMinute: codeRuleFlags |= codeTimed; codeEmit(opTime); codeEmit(evalCalc); codeStack(1); break;
+      default:            codeFail = true;
+    }
+    compileArg(evalGet(evalIdx, valB));
+    if (evalExp > valExpNotBTW) codeFail = true;
+    if (evalExp == valExpBTW || evalExp == valExpNotBTW) codeRuleFlags |= codeTimed;
+    codeEmit(evalExp);          // Binary ops share valExp values
+    codeStack(-1);
+  }
+}
+
+void compileArg (byte idx) {        // Emit op to push the latest reading of device or variable (MSB set), resolved now rather than each heartbeat
+  if (idx & mask8BitMSB) { codeEmit(opVar); codeEmit(idx & ~mask8BitMSB); }
+  else { codeEmit(devStackMode(idx) ? opHist : opBit); codeEmit(idx); }
+  codeStack(1);
+}
+
+void codeEmit (byte code) { if (codeLen < maxCode) evalCode[codeLen++] = code; else codeFail = true; }
+void codeStack (char depth) { codeSp += depth; if (codeSp >= codeStackSize) codeFail = true; }
+
+unsigned int codeRun (int *pc) {      // Run one compiled eval from *pc to its opRet; leaves *pc at the next eval.  Stack depth checked by compileEval
+  unsigned int stack[codeStackSize];
+  unsigned int *sp = stack;          // Entries below TOS
+  unsigned int tos = 0, temp;
+  byte *code = evalCode + *pc;
+  byte arg;
+  
+  for (;;) {
+    switch (*code++) {
+      case opBit:       *sp++ = tos; tos = (devStack[*code++] >> 7) & maskLSB; break;
+      case opHist:      arg = *code++; *sp++ = tos; tos = readingHistory[devStack[arg] * stackSize + devTOSIdx[arg]]; break;
+      case opVar:       *sp++ = tos; tos = varReading[*code++]; break;
+      case opMap:       arg = *code++; *sp++ = tos; tos = mapGet(arg, *code++); break;
+      case opTime:
+        *sp++ = tos;
+        switch (*code++) {
+          case valCalcYear:   tos = year(); break;
+          case valCalcMonth:  tos = month(); break;
+          case valCalcDay:    tos = day(); break;
+          case valCalcHour:   tos = hour(); break;
+          default:            tos = minute(); break;
+        }
+        break;
+      case opNot:       tos = !tos; break;
+      case valExpEQ:    tos = *--sp == tos; break;
+      case valExpNEQ:   tos = *--sp != tos; break;
+      case valExpGT:    tos = *--sp > tos; break;
+      case valExpLT:    tos = *--sp < tos; break;
+      case valExpADD:   tos = *--sp + tos; break;
+      case valExpSUB:   tos = *--sp - tos; break;
+      case valExpMULT:  tos = *--sp * tos; break;
+      case valExpDIV:   tos = *--sp / tos; break;
+      case valExpAND:   tos = *--sp && tos; break;
+      case valExpOR:    tos = *--sp || tos; break;
+      case valExpBTW:   tos = dhmBetween(*--sp, tos); break;
+      case valExpNotBTW: tos = !dhmBetween(*--sp, tos); break;
+      case opMax:       if ((temp = *--sp) > tos) tos = temp; break;
+      case opMin:       if ((temp = *--sp) < tos) tos = temp; break;
+      case opDivN:      tos /= *code++; break;
+      case opAndThen:   arg = *code++; if (tos == 0) code += arg; else tos = *--sp; break;
+      case opOrElse:    arg = *code++; if (tos != 0) code += arg; else tos = *--sp; break;
+      case opRet:       *pc = code - evalCode; return tos;
+      default:
+        PgmPrint("Bad op at "); Serial.println(code - 1 - evalCode);
+        *pc = codeLen;          // Abandon rest of this heartbeat
+        return 0;
+    }
+  }
+}
+
+
+
 // ***************************** WEB MANAGEMENT ********************************
 
-void handleAjaxGet(Client client, char* actionline, char type){        // Used to process Ajax GET; actionline points to first char after 'R', 'T' or 'P' - gets overwritten
+void handleAjaxGet(Client client, char* actionline, char type){        // Used to process Ajax GET; actionline points to first char after 'R', 'T', 'P', 'Y', 'L', 'B' or 'W' - gets overwritten
   char responseText[100];
   char element[const_Token_Bufsiz] = "";
   char *newVal;
-  const char str1[] = "{\"id\": \"";
-  const char str2[] = "\", \"reading\": \"";
-  const char str3[] = "\", \"status\": \"";
-  const char str4[] = "\"}";
-  byte deviceIdx, devStatus, timeHr, timeMin;
-  unsigned int devReading;
+  byte deviceIdx, readingStatus, timeHr, timeMin;
+  unsigned int devReading = 0;
   unsigned long timestarted = millis();
   
-  *strstr(actionline," HTTP") = 0;                      // Terminate string before " HTTP/1.1"
-  if ((newVal = strstr(actionline,"=")) != 0) {          // See if there is an assignment (type = 'P')
+  if ((newVal = strstr_P(actionline, PSTR("="))) != 0) {          // See if there is an assignment (type = 'P')
     devReading = atoi(newVal+1);                          // Save the new value
     *newVal = 0;                                        // And set new termination point
   }
@@ -696,114 +1439,140 @@ void handleAjaxGet(Client client, char* actionline, char type){        // Used t
   
   switch (type) {      
     case 'H':                                            // Heartbeat required
-      sprintf (responseText, "%s%s%s%u%s%d%s", str1, element, str2, heartBeat, str3, valStatusStable, str4);
+      sprintf_P(responseText, PSTR("{\"id\": \"%s\", \"reading\": \"%u\", \"status\": \"%d\"}"), element, heartBeat, valStatusStable);
       break;    
     case 'R':                                            // Reading required
       deviceIdx = getDeviceIdx(element);                    // Get index of element in device or variable array
       devReading = mapGet(deviceIdx, valCurr);
-      devStatus = mapGet(deviceIdx, valStatus);
-      sprintf (responseText, "%s%s%s%d%s%d%s", str1, element, str2, devReading, str3, devStatus, str4);
+      readingStatus = mapGet(deviceIdx, valStatus);
+      sprintf_P(responseText, PSTR("{\"id\": \"%s\", \"reading\": \"%d\", \"status\": \"%d\"}"), element, devReading, readingStatus);
       break;
     case 'T':                                            // Time required in format hh:mm
-      if (timeStatus() == timeSet) { devReading = (weekday() * pow(2, offsetDay)) + (hour() * pow(2, offsetHour)) + minute(); devStatus = valStatusStable; }
-      else { timeHr = millis()/1000/SECS_PER_HOUR; timeMin = millis()/1000/SECS_PER_MIN; devStatus = valStatusUnset; }
-      sprintf (responseText, "%s%s%s%d%s%d%s", str1, element, str2, devReading, str3, devStatus, str4);
+      if (timeStatus() == timeSet) { devReading = (weekday() * pow(2, offsetDay)) + (hour() * pow(2, offsetHour)) + minute(); readingStatus = valStatusStable; }
+      else { timeHr = millis()/1000/SECS_PER_HOUR; timeMin = millis()/1000/SECS_PER_MIN; readingStatus = valStatusUnset; }
+      sprintf_P(responseText, PSTR("{\"id\": \"%s\", \"reading\": \"%d\", \"status\": \"%d\"}"), element, devReading, readingStatus);
       break;
     case 'P':                                          // Put required
       deviceIdx = getDeviceIdx(element);                    // Get index of element in device or variable array
       mapPut(deviceIdx, valCurr, devReading);
-      mapPut(deviceIdx, valStatus, devStatus = valStatusStable);
-      sprintf (responseText, "%s%s%s%d%s%d%s", str1, element, str2, devReading, str3, devStatus, str4);
+      mapPut(deviceIdx, valStatus, readingStatus = valStatusStable);
+      sprintf_P(responseText, PSTR("{\"id\": \"%s\", \"reading\": \"%d\", \"status\": \"%d\"}"), element, devReading, readingStatus);
+      break;
+    case 'Y': {                                        // History required - 'Y<id>=n' gives reading n changes back, and its age in secs
+      int histReading = 0;
+      unsigned long histAt = histNow();
+      
+      deviceIdx = getDeviceIdx(element);
+      readingStatus = (histGet(deviceIdx, devReading, &histReading, &histAt)) ? valStatusStable : valStatusUnset;
+      sprintf_P(responseText, PSTR("{\"id\": \"%s\", \"reading\": \"%d\", \"status\": \"%d\", \"age\": \"%lu\"}"), element, histReading, readingStatus, histNow() - histAt);
       break;
-    default:      Serial.println("Unrecognised ajax GET");
+    }
+    case 'L':                                          // Reading log required - 'L<yyyymmdd>=h' gives blocks from hour h to end of day
+      serveLog(client, element, devReading);
+      return;
+    case 'B':                                          // Batch of readings required - 'B*', 'B~<version>' or 'B<id>,<id>,..'; list is too long for element
+      if (actionline[0] == '*') serveBatch(client, NULL, 0);
+      else if (actionline[0] == '~') serveBatch(client, NULL, strtoul(actionline + 1, NULL, 10));
+      else serveBatch(client, actionline, 0);
+      return;
+    case 'W': {                                        // Wait for changes - 'W<version>' gives changes since, once there are any or after webPollSecs
+      unsigned int since = strtoul(element, NULL, 10);
+      
+      if (versionNewer(changeVersion, since)) serveBatch(client, NULL, since);
+      else webWait(since);
+      return;
+    }
+    default:      PgmPrintln("Unrecognised ajax GET");
   }
 
-  client.println("HTTP/1.1 200 OK");
-  client.print("Server: Arduino/");
+  PgmClientPrintln(client, "HTTP/1.1 200 OK");
+  PgmClientPrint(client, "Server: Arduino/");
   client.println(arduinoMe);
-  client.println("Content-Type: text");
-  client.print("Content-Length: ");
+  PgmClientPrintln(client, "Content-Type: text");
+  PgmClientPrint(client, "Content-Length: ");
   client.println(strlen(responseText));    
   client.println();
   client.print(responseText); 
 }
 
 
-void handleHTTPGet(Client client, char* clientline) { 
-  SdFile file_a;
-  SdFile file_b;
-  SdFile *p_parent;
-  SdFile *p_child;
-  SdFile *p_temp;
+void handleHTTPGet(Client client, char* path) {        // path is after the '/'; gets overwritten
+  SdFile subDir[2];
+  SdFile file;
+  SdFile *p_parent = &root;
   char homePage[] = "index.htm"; 
-  char *filename;
+  char *filename = path;
   char *subDirMark;
-  char lcExtn[3];
+  char *dot;
+  char lcExtn[4];
+  byte level = 0;
+  SdFile *gzParent;
+  boolean gzipped = false;
   
   timestarted = millis();            // Start the clock running
   
-  // Initialise pointers to SdFile objects and set parent to root;  
-  p_parent = &file_a;
-  p_child = &file_b;
-  *p_parent = root;
+  if (!*filename) filename = homePage;            // If no file specified, then serve home page
   
-  // Housekeeping to standardise processing
-  if (strstr(clientline,"GET / ")) memcpy(clientline+5,homePage,strlen(homePage));  // If no file specified, then serve home page
-  strstr(clientline," HTTP/")[0] = 0;      // Place terminator after path/filename  
-  filename = clientline + 5;            // Step over the "GET /"
-  
-  // Traverse path
-  while ((subDirMark=strstr(filename,"/")) != 0) { 
+  // Traverse path; first level held open by webDir, any below opened afresh
+  while ((subDirMark = strchr(filename, '/')) != 0) { 
     subDirMark[0] = 0;
-    if ((*p_child).open(p_parent,filename,O_READ)) {
-      
-      // Close old parent and establish new
-      (*p_parent).close();      
-      p_temp = p_parent;        
-      p_parent = p_child;        // New (open) parent
-      p_child = p_temp;          // Closed SdFile object
-      
-      filename = subDirMark+1;
+    if (level == 0) p_parent = webDir(filename);
+    else if (subDir[level & 1].open(p_parent, filename, O_READ)) {
+      if (level > 1) (*p_parent).close();
+      p_parent = &subDir[level & 1];
+    }
+    else {
+      if (level > 1) (*p_parent).close();
+      p_parent = NULL;
     }
-    else reply404(client);
+    if (!p_parent) { reply404(client); return; }
+    level++;
+    filename = subDirMark+1;
   }
 
-  // Path traversed; now deal with file
-  if ((*p_child).open(p_parent, filename, O_READ)) {
-      memcpy(lcExtn,strstr(filename,".")+1,3);
-      stolower(lcExtn); 
-      serveHTTPFile(client,p_child,lcExtn);
-      (*p_child).close();
+  // Path traversed; now deal with file - or its gzipped copy in GZ/, made by Tools/gzroot.sh, if browser takes gzip
+  if (webGzip) {
+    SdFile gzDir;
+    
+    if (p_parent == &root) gzipped = (gzParent = webDir("GZ")) && file.open(gzParent, filename, O_READ);
+    else if (gzDir.open(p_parent, "GZ", O_READ)) {
+      gzipped = file.open(gzDir, filename, O_READ);
+      gzDir.close();
+    }
+  }
+  if (gzipped || file.open(p_parent, filename, O_READ)) {
+    dot = strrchr(filename, '.');
+    strncpy(lcExtn, (dot) ? dot + 1 : "", 3);
+    lcExtn[3] = 0;
+    stolower(lcExtn); 
+    serveHTTPFile(client, &file, lcExtn, gzipped);            // Hands file on to webSendFile, which closes it
   }
   else {
-    Serial.println("no file found");
+    PgmPrintln("no file found");
     reply404(client);
   }
-  (*p_parent).close();
-
+  if (level > 1) (*p_parent).close();
 }
 
 
 
 
-
-
 void handleHTTPCmd(Client client, char* actionline){        // Used to process POST and GET /? strings
   echoLine(actionline);
-  if (strstr(actionline,"=On")) {
+  if (strstr_P(actionline, PSTR("=On"))) {
     digitalWrite (ledPin,HIGH);
-    Serial.println("Switching heating on");
+    PgmPrintln("Switching heating on");
     ledState = 1;
   }
-  else if (strstr(actionline,"=Off")) {
+  else if (strstr_P(actionline, PSTR("=Off"))) {
     digitalWrite (ledPin,LOW);
-    Serial.println("Switching heating off");
+    PgmPrintln("Switching heating off");
     ledState = 0;
   } 
 }
 
 
-void serveHTTPFile(Client client, SdFile *p_file, char * extn) {
+void serveHTTPFile(Client client, SdFile *p_file, char * extn, boolean gzipped) {      // Headers, then hand p_file to webSendFile; 304 if browser's copy is current
   int16_t byteCnt;
   uint32_t fileSize;
   byte readBuffer[const_SDCard_BUFSIZ];
@@ -811,27 +1580,53 @@ void serveHTTPFile(Client client, SdFile *p_file, char * extn) {
   char token[const_Token_Bufsiz];  
   char tokResponse[10]; 
   int token_idx, firstValid;
+  char eTag[sizeof(webETag)];
+  char lastModified[32];
+  dir_t fileDir;
+  tmElements_t modified;
+  byte i;
+  
+  // Validators from directory entry: write date & time and size, so any change to the file changes the ETag
+  (*p_file).dirEntry(&fileDir);
+  fileSize = fileDir.fileSize;
+  sprintf_P(eTag, PSTR("\"%04x%04x-%lx\""), fileDir.lastWriteDate, fileDir.lastWriteTime, fileSize);
+  if (strcmp(eTag, webETag) == 0) {
+    (*p_file).close();
+    PgmClientPrintln(client, "HTTP/1.1 304 Not Modified");
+    PgmClientPrint(client, "ETag: ");
+    client.println(eTag);
+    client.println();
+    return;
+  }
+  modified.Year = CalendarYrToTm(1980 + (fileDir.lastWriteDate >> 9));          // FAT date & time; card has no zone, so taken as GMT
+  modified.Month = (fileDir.lastWriteDate >> 5) & 0x0f;
+  modified.Day = fileDir.lastWriteDate & 0x1f;
+  modified.Hour = fileDir.lastWriteTime >> 11;
+  modified.Minute = (fileDir.lastWriteTime >> 5) & 0x3f;
+  modified.Second = (fileDir.lastWriteTime & 0x1f) * 2;
+  strcpy(lastModified, dayShortStr(weekday(makeTime(modified))));            // dayShortStr & monthShortStr share a buffer
+  sprintf_P(lastModified + strlen(lastModified), PSTR(", %02d "), modified.Day);
+  strcat(lastModified, monthShortStr(modified.Month));
+  sprintf_P(lastModified + strlen(lastModified), PSTR(" %d %02d:%02d:%02d GMT"), tmYearToCalendar(modified.Year), modified.Hour, modified.Minute, modified.Second);
       
-  client.println("HTTP/1.1 200 OK");
+  PgmClientPrintln(client, "HTTP/1.1 200 OK");
   
-  client.print("Server: Arduino/");
+  PgmClientPrint(client, "Server: Arduino/");
   client.println(arduinoMe);
   
-  client.print("Content-Type: ");
-  if (strstr(extn, "htm") != 0)         client.println("text/html");
-  else if (strstr(extn, "css") != 0)    client.println("text/css");
-  else if (strstr(extn, "jpg") != 0)    client.println("image/jpeg");
-  else if (strstr(extn, "png") != 0)    client.println("image/png");
-  else if (strstr(extn, "gif") != 0)    client.println("image/gif");
-  else if (strstr(extn, "pdf") != 0)    client.println("image/pdf");
-  else if (strstr(extn, "ico") != 0)    client.println("image/x-icon");
-  else if (strstr(extn, "xml") != 0)    client.println("application/xml");
-  else if (strstr(extn, "jso") != 0)    client.println("application/json");
-  else if (strstr(extn, "js") != 0)     client.println("application/javascript");
-  else                                    client.println("text");
-  
-  fileSize = (*p_file).fileSize();
-  client.print("Content-Length: ");
+  PgmClientPrint(client, "Content-Type: ");
+  for (i = 0; i < numMimeTypes; i++) if (strcmp_P(extn, mimeTypes[i].extn) == 0) break;
+  if (i < numMimeTypes) clientPrint_P(client, mimeTypes[i].type, true);
+  else PgmClientPrintln(client, "text");
+  if (gzipped) PgmClientPrintln(client, "Content-Encoding: gzip");
+  PgmClientPrintln(client, "Vary: Accept-Encoding");
+  PgmClientPrintln(client, "Cache-Control: no-cache");          // Keep, but check ETag each time
+  PgmClientPrint(client, "ETag: ");
+  client.println(eTag);
+  PgmClientPrint(client, "Last-Modified: ");
+  client.println(lastModified);
+  
+  PgmClientPrint(client, "Content-Length: ");
   client.println(fileSize);
 //  if (strstr(extn, "jso") != 0) client.println(fileSize*1.1+100); else client.println(fileSize);    // If JSON file, may have token substitution, so add a bit to length
   client.println();
@@ -871,14 +1666,14 @@ void serveHTTPFile(Client client, SdFile *p_file, char * extn) {
             }
             break;
           default:
-            Serial.println("Unrecognised mode");
+            PgmPrintln("Unrecognised mode");
         }
       }
     }
   }
   else {
     */
-    while ((byteCnt=((*p_file).read(readBuffer,const_SDCard_BUFSIZ)))>0) client.write(readBuffer, byteCnt);    // Not serving .jso file; no pre-processing required
+    webSendFile(p_file, fileSize);    // Not serving .jso file; no pre-processing required
  // }
 }
 
@@ -892,17 +1687,17 @@ void processToken(char *token,char *strResponse) {
   
   switch (token[0]) {
     case 'T':          // Get time  
-      if (timeStatus() == timeSet) sprintf(strResponse,"%d:%02d:%02d",hour(), minute(), second());
-      else sprintf(strResponse,"%d:%02d:%02d",millis()/1000/SECS_PER_HOUR,millis()/1000/SECS_PER_MIN,millis()/1000);
+      if (timeStatus() == timeSet) sprintf_P(strResponse, PSTR("%d:%02d:%02d"),hour(), minute(), second());
+      else sprintf_P(strResponse, PSTR("%d:%02d:%02d"),millis()/1000/SECS_PER_HOUR,millis()/1000/SECS_PER_MIN,millis()/1000);
       break;
     case 'R':          // Get sensor reading
-      sprintf(strResponse,"%s",strLightOff);
+      sprintf_P(strResponse, PSTR("%s"),strLightOff);
       break;
     case 'S':          // Get sensor state
  //     printTemp(tempC[0],strResponse);
       break;
     case 'C':          // Set class
-      sprintf(strResponse,"%s",strAmber);
+      sprintf_P(strResponse, PSTR("%s"),strAmber);
       break;
     default:
       strResponse[0] = token[0];
@@ -914,290 +1709,356 @@ void processToken(char *token,char *strResponse) {
 
 /********************* GET CONFIG helper functions *******************/
 
-void loadIdentity (SdFile *configFile) {      // Get identity of arduinos and set identity of this one
-  char element[const_Token_Bufsiz];
-  byte arduino;
-
-  if (!getNextElement(configFile, "servers:", element)) Serial.println("Config error: no servers");   // ':' in tag indicates just position to the tag
-
-  while (getNextElement(configFile, "arduino", element) && (arduino = atoi(element) - 1) < maxArduinos) {
-    
-    getNextElement(configFile, "ip:", element);      // Get IP address of arduino
-    for (int i = 0; i < 4; i++) { getNextElement(configFile, "element", element); ip[arduino][i] =  atoi(element); } 
-    
-    getNextElement(configFile, "mac:", element);      // Get mac address
-    for (int i=0; i<6; i++) { getNextElement(configFile, "element", element); mac[arduino][i] = strtol(element, NULL, 16); }
+// config.jso is read in one pass: JSONSTREAM calls loadConfigElement for every value, and as every object/array 
+// opens & closes.  Each section (top level key, eg "devices") has its own handler, which stores the fields of 
+// a record as they arrive and finishes the record when its object closes.  As ever, "me" must come before the 
+// devices, variables & evals, the devices before the evals, and within a record "arduino" before the other 
+// fields and "calc" before the args 
+
+const byte sectServers = 0;
+const byte sectTimeserver = 1;
+const byte sectDevices = 2;
+const byte sectVariables = 3;
+const byte sectFrequencies = 4;
+const byte sectEvals = 5;
+const byte numSections = 6;
+const byte sectNone = 0xFF;
+const char sectionName[numSections][12] PROGMEM = { "servers", "timeserver", "devices", "variables", "frequencies", "evals" };
+
+struct configProgress {        // Where loadConfigElement has got to
+  byte section;
+  byte found;                  // Bit per section seen
+  boolean full;                // Current section has filled its table; ignore the rest of it
+  byte arduino;                // Arduino of current record
+  byte idx;                    // Next byte of ip, mac or timeserver
+  int deviceIdx, readingIdx, varIdx, evalIdx, argsIdx, freqIdx;
+  int calcIdx;
+  byte elemIdx;
+} config;
+
+void loadConfigElement (byte event, JSONSTREAM *json) {      // Callback from JSONSTREAM
+  const char *key = json->key();
+  byte depth = json->depth();
+
+  if (depth == 1 && event != JSON_VALUE) {      // Start or end of a section
+    if (event == JSON_START) {
+      config.section = sectNone;
+      for (byte i = 0; i < numSections; i++) if (strcmp_P(key, sectionName[i]) == 0) config.section = i;
+      if (config.section != sectNone) config.found |= 1 << config.section;
+      config.full = false;
+      config.idx = 0;
+    }
+    else {
+      if (config.section == sectDevices) { numDevices = config.deviceIdx; devHashBuild(); }      // Needed by getDeviceIdx for evals
+      if (config.section == sectVariables) numVars = config.varIdx;
+      config.section = sectNone;
+    }
+    return;
   }
   
-  getNextElement(configFile, "me", element);
-  arduinoMe = atoi(element) - 1;
-     
-  if (!getNextElement(configFile, "timeserver:", element)) Serial.println("Config error: no timeserver");
-  for (int i=0; i<4; i++) { getNextElement(configFile, "element", element); timeServer[i] = atoi(element); }
+  if (depth == 0) {                                // Top level values
+    if (event == JSON_VALUE && strcmp_P(key, PSTR("me")) == 0) arduinoMe = atoi(json->value()) - 1;
+    return;
+  }
+  
+  if (depth == 2 && event == JSON_START) config.arduino = 0xFF;      // New record; no arduino yet
+  
+  switch (config.section) {
+    case sectServers:      loadIdentity(event, json); break;
+    case sectTimeserver:   if (event == JSON_VALUE && config.idx < 4) timeServer[config.idx++] = atoi(json->value()); break;
+    case sectDevices:      loadDevices(event, json); break;
+    case sectVariables:    loadVariables(event, json); break;
+    case sectFrequencies:  if (event == JSON_VALUE && strcmp_P(key, PSTR("seconds")) == 0 && config.freqIdx < maxFreqs) frequency[config.freqIdx++] = atoi(json->value()); break;
+    case sectEvals:        loadEvals(event, json); break;
+  }
 }
 
-
-void loadDevices (SdFile *configFile) {      // Load up devices
-  char element[const_Token_Bufsiz];
-  char element2[const_Token_Bufsiz];
-  const unsigned int indSensorStackMode = (0xFF * 256) + B11001100;      // Flag for each sensorType - 1 - device gives readings; 0 - device is on/off   
+void loadIdentity (byte event, JSONSTREAM *json) {      // Get identity of arduinos
+  const char *inside = json->keyAt(json->depth());      // ip & mac may be plain arrays, or arrays of {"element": }
+  const char *element = json->value();
   
-  if (!getNextElement(configFile, "devices:", element)) Serial.println("Config error: no devices");
-  
-  mapPut(0, valRef, 0);        // NULL device; shouldn't be referenced
+  if (event == JSON_START && json->isArray()) config.idx = 0;      // Start of ip or mac
+  else if (event == JSON_VALUE) {
+    if (strcmp_P(json->key(), PSTR("arduino")) == 0) config.arduino = atoi(element) - 1;
+    else if (config.arduino < maxArduinos) {
+      if (strcmp_P(inside, PSTR("ip")) == 0 && config.idx < 4) ip[config.arduino][config.idx++] = atoi(element);
+      if (strcmp_P(inside, PSTR("mac")) == 0 && config.idx < 6) mac[config.arduino][config.idx++] = strtol(element, NULL, 16);
+    }
+  }
+}
 
-  int deviceIdx = 1;
-  int readingIdx = 0;
-    
-  while (getNextElement(configFile, "arduino", element) && deviceIdx < maxDevices) {
-    
-    byte arduino = atoi(element) - 1;
-    
-    // Ignore if not for this arduino
-    if (arduino == arduinoMe) {
-      getNextElement(configFile, "id", element);
-      strncpy (element2,element, const_Token_Bufsiz);
-      mapPut(deviceIdx, valRef, convertRefToBit(element));
-
-      mapPut(deviceIdx, valArduino, arduino);
-     
-      getNextElement(configFile, "pin", element);
-      mapPut(deviceIdx, valPin, atoi(element));
-      
-      getNextElement(configFile, "cascade", element);
-      mapPut(deviceIdx, valCascade, element[0] == 'Y' ? 1 : 0);
-      
-      getNextElement(configFile, "handler", element);
-      mapPut(deviceIdx, valHandler, atoi(element) - 1);
-              
-      getNextElement(configFile, "freq", element);
-      mapPut(deviceIdx, valPollFreq, atoi(element) - 1);
+void loadDevices (byte event, JSONSTREAM *json) {      // Load up devices
+  const unsigned int indSensorStackMode = (0xFF * 256) + B11001100;      // Flag for each sensorType - 1 - device gives readings; 0 - device is on/off   
+  int deviceIdx = config.deviceIdx;
+  const char *key = json->key();
+  const char *element = json->value();
+  
+  if (json->depth() != 2) return;
+  
+  switch (event) {
+    case JSON_VALUE:
+      if (strcmp_P(key, PSTR("arduino")) == 0) config.arduino = atoi(element) - 1;
+      else if (config.arduino != arduinoMe || config.full) return;      // Ignore if not for this arduino
+      else if (strcmp_P(key, PSTR("id")) == 0) mapPut(deviceIdx, valRef, convertRefToBit((char*) element));
+      else if (strcmp_P(key, PSTR("pin")) == 0) mapPut(deviceIdx, valPin, atoi(element));
+      else if (strcmp_P(key, PSTR("cascade")) == 0) mapPut(deviceIdx, valCascade, element[0] == 'Y' ? 1 : 0);
+      else if (strcmp_P(key, PSTR("handler")) == 0) mapPut(deviceIdx, valHandler, atoi(element) - 1);
+      else if (strcmp_P(key, PSTR("freq")) == 0) mapPut(deviceIdx, valPollFreq, atoi(element) - 1);
+      else if (strcmp_P(key, PSTR("window")) == 0) devWindow[deviceIdx] = constrain(atoi(element), 2, maxWindow);
+      else if (strcmp_P(key, PSTR("hist")) == 0) histAttach(deviceIdx, atoi(element));
+      else if (strcmp_P(key, PSTR("log")) == 0 && element[0] == 'Y') devFlags[deviceIdx] |= flagLog;
+      break;
+    case JSON_END: {
+      if (config.arduino != arduinoMe || config.full) return;
       
+      mapPut(deviceIdx, valArduino, config.arduino);
       mapPut(deviceIdx, valStatus, valStatusUnset);
       
       // Set pointers & clear reading history 
       unsigned int stackMode = mapGet(deviceIdx, valSensor) ? ((indSensorStackMode & (1 << mapGet(deviceIdx, valType))) != 0) : 0;
       mapPut (deviceIdx, valStackMode, stackMode);
       if (stackMode) {                                      // Longer readings, main array holds index into separate array
-        mapPut(deviceIdx, valStack, readingIdx);
+        if (devWindow[deviceIdx] == 0) devWindow[deviceIdx] = stackSize;
+        byte blocks = (devWindow[deviceIdx] + stackSize - 1) / stackSize;
+        unsigned int bytes = blocks * stackSize * sizeof(unsigned int);
+        if (bytes > readingsFree) { PgmPrintln("Hist OF"); config.full = true; return; }      // Would run into hist arena
+        mapPut(deviceIdx, valStack, config.readingIdx);
         mapPut(deviceIdx, valTOSIdx, 0);
-        for (int j = 0; j < stackSize; j++) stackPush(deviceIdx, 0);    // Write stackSize times to clear stack
-        if (++readingIdx * stackSize >= maxReadings) { Serial.println ("Hist OF"); readingIdx--; break;}
+        for (int j = 0; j < devWindow[deviceIdx]; j++) stackPush(deviceIdx, 0);    // Write window times to clear stack
+        config.readingIdx += blocks;
+        readingsFree -= bytes;
+      }
+      else {
+        mapPut(deviceIdx, valStack, 0);            // On/off history held as bitmap in main array
+        devWindow[deviceIdx] = 0;
       }
-      else mapPut(deviceIdx, valStack, 0);            // On/off history held as bitmap in main array
-      
-      if (++deviceIdx >= maxDevices) { Serial.println ("Dev OF"); deviceIdx--; break;}
       
+      if (++config.deviceIdx >= maxDevices) { PgmPrintln("Dev OF"); config.deviceIdx--; config.full = true; }
+      break;
     }
   }
-  numDevices = deviceIdx;
 }
 
-void loadVariables (SdFile *configFile) {      // Load up variables
-  char element[const_Token_Bufsiz];
-  char element2[const_Token_Bufsiz];      
+void loadVariables (byte event, JSONSTREAM *json) {      // Load up variables
+  const char *key = json->key();
+  char *element = (char*) json->value();
   
-  if (!getNextElement(configFile, "variables:", element)) Serial.println("Config error: no variables");
+  if (json->depth() != 2) return;
   
-  int varIdx = 0;
-    
-  while (getNextElement(configFile, "arduino", element) && varIdx < maxVars) {
-   
-    byte arduino = atoi(element) - 1;
-         
-    // Ignore if not for this arduino
-    if (arduino == arduinoMe) {
-      getNextElement(configFile, "id", element);
-      if ( element[0] = 'V' && varIdx == atoi(element + 2) ) {
+  switch (event) {
+    case JSON_VALUE:
+      if (strcmp_P(key, PSTR("arduino")) == 0) config.arduino = atoi(element) - 1;
+      else if (config.arduino != arduinoMe || config.full) return;      // Ignore if not for this arduino
+      else if (strcmp_P(key, PSTR("id")) == 0) {
+        if ( element[0] = 'V' && config.varIdx == atoi(element + 2) ) config.idx = 1;      // idx flags that val is expected
+        else { config.idx = 0; PgmPrint("Var out of seq: "); Serial.println(element); }
+      }
+      else if (strcmp_P(key, PSTR("val")) == 0 && config.idx) {
         char *colonPosn;
-        getNextElement(configFile, "val", element);
         if ( colonPosn = (char*)memchr(element, ':', const_Token_Bufsiz) ) {      // Got a time field in d:mm:ss format
           unsigned int dhmVal = 0;
           dhmPut (&dhmVal, valDay, atoi(element));
           dhmPut (&dhmVal, valHour, atoi(colonPosn + 1));
           colonPosn = (char*)memchr(colonPosn + 1, ':', const_Token_Bufsiz);
           dhmPut (&dhmVal, valMinute, atoi(colonPosn + 1));
-          mapPut(varIdx | mask8BitMSB, valCurr, dhmVal);
+          mapPut(config.varIdx | mask8BitMSB, valCurr, dhmVal);
         }
-        else mapPut(varIdx | mask8BitMSB, valCurr, atoi(element));
+        else mapPut(config.varIdx | mask8BitMSB, valCurr, atoi(element));
       }
-      else { Serial.print("Var out of seq: "); Serial.println(element); }
-
-      if (++varIdx >= maxVars) { Serial.println ("Vars OF"); varIdx--; break; }
-    }
+      break;
+    case JSON_END:
+      if (config.arduino != arduinoMe || config.full) return;
+      if (++config.varIdx >= maxVars) { PgmPrintln("Vars OF"); config.varIdx--; config.full = true; }
+      break;
   }
-  numVars = varIdx; 
 }
 
-void loadEvals (SdFile *configFile) {      // Load up evaluations
-  char element[const_Token_Bufsiz];
-  byte elemIdx;
+void loadEvals (byte event, JSONSTREAM *json) {      // Load up evaluations
+  int evalIdx = config.evalIdx;
+  int calcIdx = config.calcIdx;
+  boolean isList = calcIdx == valCalcListE || calcIdx == valCalcListM;
+  const char *key = json->key();
+  char *element = (char*) json->value();
   
-  if (!getNextElement(configFile, "evals:", element)) Serial.println("Config error: no evaluations");
+  if (event == JSON_VALUE && strcmp_P(key, PSTR("arduino")) == 0) { config.arduino = atoi(element) - 1; return; }
+  if (config.arduino != arduinoMe || config.full) return;      // Ignore if not for this arduino
   
-  int evalIdx = 0;
-  int argsIdx = 0;
-    
-  while (getNextElement(configFile, "arduino", element) && evalIdx < maxEvals) {
-    
-    byte arduino = atoi(element) - 1;
-    
-    // Ignore if not for this arduino
-    if (arduino == arduinoMe) {
-      int calcIdx;
-      getNextElement(configFile, "seq", element);
-      if ((atoi(element) - 1) != evalIdx) Serial.println("Eval out of seq "); 
-      
-      getNextElement(configFile, "calc", element); 
-      evalPut (evalIdx, valCalc, calcIdx = getCalcIdx (element));
- 
+  if (event == JSON_VALUE) {
+    if (strcmp_P(key, PSTR("seq")) == 0) {
+      if ((atoi(element) - 1) != evalIdx) PgmPrintln("Eval out of seq "); 
+    }
+    else if (strcmp_P(key, PSTR("calc")) == 0) {
+      evalPut (evalIdx, valCalc, config.calcIdx = calcIdx = getCalcIdx (element));
       switch (calcIdx) {
         case valCalcListE: 
         case valCalcListM:                // Is a list (of evaluations or map elements)   
-          evalPut(evalIdx, valPtr, argsIdx);             // Save pointer to start of evaluations
-            
-          // Load up list 
-          elemIdx = 0;
-          if (!getNextElement(configFile, "list:", element)) Serial.println("No elems");
-          while (getNextElement(configFile, "elem", element) && elemIdx < maxElems) {
-            argPut(argsIdx, (calcIdx == valCalcListE) ? atoi(element) - 1 : getDeviceIdx(element));
-            if (++argsIdx >= maxArgs) { Serial.println("Args OF"); argsIdx --; } else elemIdx++;
-          }
-          evalPut(evalIdx, valLen, elemIdx);      // Save number of elements
-          break;         
+          evalPut(evalIdx, valPtr, config.argsIdx);      // Save pointer to start of evaluations
+          config.elemIdx = 0;
+          break;
         case valCalcCURR:
         case valCalcPREV:
         case valCalcAvg:
         case valCalcMax:
         case valCalcMin:
-        case valCalcROfC:            // Arg A is device or variable ref in these calc types
-          getNextElement(configFile, "arga", element);
-          evalPut(evalIdx, valA, getDeviceIdx(element) );
-          // No break - drop through to pick up Arg B
-        case valCalcYear:        // Arg A not used for remaining args - is current year/month/day/hr/minute instead
+        case valCalcROfC:
+        case valCalcYear:
         case valCalcMonth:
         case valCalcDay:
         case valCalcHour:
-        case valCalcMinute:                 
-          // Arg B is device or variable ref
-          getNextElement(configFile, "argb", element);
-          evalPut(evalIdx, valB, getDeviceIdx(element));      
-          break;        
+        case valCalcMinute:
+          break;
         default:
-          Serial.println ("Invalid calc type"); 
+          PgmPrintln("Invalid calc type"); 
       }
-  
-      // Get expression
-      getNextElement(configFile, "exp", element);
-      evalPut (evalIdx, valExp, (calcIdx == valCalcListE || calcIdx == valCalcListM) ? getExpListIdx(element) : getExpIdx (element));
-
-      // Get destination
-      getNextElement(configFile, "dest", element);
+    }
+    else if (strcmp_P(key, PSTR("elem")) == 0 && isList && config.elemIdx < maxElems) {
+      argPut(config.argsIdx, (calcIdx == valCalcListE) ? atoi(element) - 1 : getDeviceIdx(element));
+      if (++config.argsIdx >= maxArgs) { PgmPrintln("Args OF"); config.argsIdx --; } else config.elemIdx++;
+    }
+    else if (strcmp_P(key, PSTR("arga")) == 0) {      // Arg A is device or variable ref for these calc types; current year/month/day/hr/minute for the rest
+      if (calcIdx == valCalcCURR || calcIdx == valCalcPREV || calcIdx == valCalcAvg || calcIdx == valCalcMax || calcIdx == valCalcMin || calcIdx == valCalcROfC) evalPut(evalIdx, valA, getDeviceIdx(element));
+    }
+    else if (strcmp_P(key, PSTR("argb")) == 0) {      // Arg B is device or variable ref
+      if (!isList) evalPut(evalIdx, valB, getDeviceIdx(element));
+    }
+    else if (strcmp_P(key, PSTR("exp")) == 0) evalPut (evalIdx, valExp, (isList) ? getExpListIdx(element) : getExpIdx (element));
+    else if (strcmp_P(key, PSTR("dest")) == 0) {
       if (element[0] == 'X') evalPut(evalIdx, valDest, 0);            // NULL dest - eval not to be used independently - only as part of arg list
       else {
         boolean turnOff = element[0] == '~';       // An '~' indicates set dest to Off, rather than to result of expression
         evalPut(evalIdx, valDest, getDeviceIdx((turnOff) ? element + 1 : element ));
         evalPut(evalIdx, valTurnOff, turnOff);
       }
-
-      if (++evalIdx >= maxEvals) evalIdx--;      
     }
   }
-
-  numEvals = evalIdx;
-  numArgs = argsIdx;
+  else if (event == JSON_END && json->depth() == 2) {      // End of eval
+    if (isList) {
+      if (config.elemIdx == 0) PgmPrintln("No elems");
+      evalPut(evalIdx, valLen, config.elemIdx);      // Save number of elements
+    }
+    config.calcIdx = -1;
+    if (++config.evalIdx >= maxEvals) { config.evalIdx--; config.full = true; }
+  }
 }
 
-void loadFreqs (SdFile *configFile) {      // Load up frequencies & optimised scanning route
-  char element[const_Token_Bufsiz];
-
-  // Get list of scanning frequencies
-  if (!getNextElement(configFile, "frequencies:", element)) Serial.println ("Config error: no frequencies");
-  for (int i=0; i < maxFreqs; i++) {
-    getNextElement(configFile, "seconds", element);
-    frequency[i] = atoi(element);
-  }
-  
-  // Prepare optimised route into deviceMap, ordered by frequency
+void loadFreqRoute () {      // Prepare optimised route into device arrays, ordered by frequency
   int latest = 0;
   for (int i=0; i < maxFreqs + 1; i++) p_freqMarker[i] = 0;
 
   for (int freqCode = 0; freqCode < maxFreqs; freqCode++) {
     for (int deviceIdx = 1; deviceIdx < numDevices; deviceIdx++) {
-      if (mapGet(deviceIdx, valPollFreq) == freqCode &&
-          mapGet(deviceIdx, valSensor) &&
-          mapGet(deviceIdx, valArduino) == arduinoMe) p_freqIdx[latest++] = deviceIdx;
+      if (devPollFreq[deviceIdx] == freqCode &&
+          devSensor(deviceIdx) &&
+          devArduino[deviceIdx] == arduinoMe &&
+          !isEventSensor(deviceIdx)) p_freqIdx[latest++] = deviceIdx;        // Event sensors queue their own changes
     }
     p_freqMarker[freqCode + 1] = latest;
   }
 }
+
+void loadConfig (SdFile *configFile) {      // Parse config.jso in one pass
+  JSONSTREAM json;
+  byte readBuffer[const_SDCard_BUFSIZ];
+  int byteCnt;
+  unsigned long bytes = 0;
+  unsigned long startedAt = micros();
+  
+  memset(&config, 0, sizeof(config));
+  config.section = sectNone;
+  config.deviceIdx = 1;
+  config.calcIdx = -1;
+  mapPut(0, valRef, 0);        // NULL device; shouldn't be referenced
   
-boolean getNextElement( SdFile *p_file, char *p_tag, char *p_element) {   // Helper function for getConfig routines; assumes valid JSON file
+  json.init(loadConfigElement);
+  while ((byteCnt = configFile->read(readBuffer, const_SDCard_BUFSIZ)) > 0) {
+    json.put(readBuffer, byteCnt);
+    bytes += byteCnt;
+  }
+  
+  for (byte i = 0; i < numSections; i++) if (!(config.found & (1 << i))) { PgmPrint("Config error: no "); SerialPrintln_P(sectionName[i]); }
+
+  numDevices = config.deviceIdx;
+  numVars = config.varIdx;
+  numEvals = config.evalIdx;
+  numArgs = config.argsIdx;
+  loadFreqRoute();
+  
+  #if DEBUGPROFILE
+    unsigned long taken = micros() - startedAt;
+    PgmPrint("Config parsed: ");
+    Serial.print(bytes);
+    PgmPrint(" bytes in ");
+    Serial.print(taken / 1000);
+    PgmPrint("ms, cycles/byte ");
+    Serial.println((bytes) ? taken * CYCLESPERUS / bytes : 0);
+  #endif
+}
   
-  static byte readBuffer[const_SDCard_BUFSIZ];      // Input buffer from file
-  static unsigned int byteCnt, buffer_idx;          // Number of bytes read in (normally buffer length, but not for final read), and index into current char
-  char mode = 's';          //  's' = scan for tag; 't' = process tag, 'r' = scan for element, 'e' = process element, '}' = found end struct, check for end of array; ']' = found end of array - quit; 'x' = got result
-  const byte tagBuffSiz = 30;
-  char tagBuff[tagBuffSiz];          // Holds the tag as read - to be tested against p_tag
-  boolean justTag;           // If true then return after positioning to the tag; ie, don't read the tag element
-  static byte arrayDepth;    // Current depth of array levels
-  static unsigned int scope[10];      // 0 if tag not found, else simplistic hash value of first tag in array
-  byte element_idx, tag_idx;
+boolean loadConfigImage (dir_t *configDir) {      // Restore everything loaded from config.jso; false if config.bin missing, out of date or corrupt
+  SdFile imageFile;
+  configImageHeader header;
+  unsigned int sum1 = 0, sum2 = 0, payloadLen = 0;
+  configImageBlock block;
+  boolean ok;
   
-  // If first time in, then initialise buffer
-  if (((*p_file).curPosition()) == 0) {
-    byteCnt=((*p_file).read(readBuffer,const_SDCard_BUFSIZ));   
-    buffer_idx = 0;
-    arrayDepth = 0;
-    scope[0] = 0;
+  for (byte i = 0; i < numConfigImageBlocks; i++) payloadLen += pgm_read_word(&configImage[i].len);
+  
+  if (!imageFile.open(root, "config.bin", O_READ)) return false;
+  
+  ok = imageFile.read(&header, sizeof(header)) == sizeof(header) &&
+       memcmp(header.magic, configImageMagic, sizeof(configImageMagic)) == 0 &&
+       header.version == configImageVersion &&
+       header.jsonSize == configDir->fileSize && header.jsonDate == configDir->lastWriteDate && header.jsonTime == configDir->lastWriteTime &&
+       header.payloadLen == payloadLen;
+  
+  if (ok) {
+    for (byte i = 0; ok && i < numConfigImageBlocks; i++) {
+      memcpy_P(&block, &configImage[i], sizeof(block));      // configImage is in flash
+      ok = imageFile.read(block.addr, block.len) == (int) block.len;
+      fletcher16((byte*) block.addr, block.len, &sum1, &sum2);
+    }
+    if (!ok || header.checksum != ((sum2 << 8) | sum1)) {      // Part loaded; clear out before falling back to config.jso
+      PgmPrintln("config.bin corrupt");
+      for (byte i = 0; i < numConfigImageBlocks; i++) { memcpy_P(&block, &configImage[i], sizeof(block)); memset(block.addr, 0, block.len); }
+      ok = false;
+    }
   }
+  imageFile.close();
   
-  justTag = strstr(p_tag,":") != 0;          // ':' indicates position just to the tag, not the element
- 
-  while (byteCnt > 0 && mode != 'x' && mode != ']') {
-    byte input = readBuffer[buffer_idx];
-
-    switch (mode) {
-      case 's':                                // Scanning mode
-        switch (input) {
-          case '"':    mode = 't'; memset(tagBuff, 0, tagBuffSiz); tag_idx = 0; break;  // Got the start of a tag; clear buffer and position to start
-          case '[':    scope[++arrayDepth] = 0; break;    // Clear hash at start of array
-          case '}':    mode = '}';                        // Found end of struct; check if another one to come (next char ','), or end of array (']')
-        }
-        break;      
-      case 't':                                    // Tag processing mode
-        if (input == '"') {        // End marker; check if correct tag
-          if (strncmp(tagBuff, p_tag, strlen(tagBuff)) == 0) mode = (justTag) ? 'x' : 'r';       // Tag matches; either finish or start looking for element
-          else mode = 's';                                // Wrong tag, keep scanning
-        }
-        else tagBuff[tag_idx++] = input;  // Add char to tag
-        break;
-      case 'r':                                // Scanning for element
-        if (input == '"') {
-          if (scope[arrayDepth] == 0) for (int i = 0; i < strlen(tagBuff); i++) scope[arrayDepth] = (scope[arrayDepth] << 1) + (byte)tagBuff[i];     // Simplistic hash of found tag (previous mode = 't')
-          mode = 'e';  // Value starts with next char
-          memset(p_element, 0, const_Token_Bufsiz);    // Clear buffer in readiness
-          element_idx = 0;
-        }
-        break;
-      case 'e':                                // Element processing
-        if (input == '"') mode = 'x'; else p_element[element_idx++] = input;   // Either got to end of element and terminate, or add char to element
-        break;
-      case '}':                                  // Checking what comes after end struct
-        if (input == ',') mode = 's';    // Another struct to come, resume scanning mode
-        if (input == ']') {             // End of array; break out if same tag previously found at this level, otherwise resume search
-          unsigned int newScope = 0;
-          for (int i = 0; i < (strlen(p_tag) - ((justTag) ? 1 : 0)); i++) newScope = (newScope << 1) + (byte)p_tag[i];     // Hash of current search
-          mode = (newScope == scope[arrayDepth--]) ? ']' : 's';         // Compare to previous search; ']' terminates WHILE, 's' resumes search     
-        }
-        break;
-    }   // switch (mode)
+  return ok;
+}
 
-    if (++buffer_idx >= byteCnt) { byteCnt=((*p_file).read(readBuffer, const_SDCard_BUFSIZ)); buffer_idx = 0;  
-    }  // If got to end of buffer, then read another one
-  }    // while
+void saveConfigImage (dir_t *configDir) {      // Save everything loaded from config.jso, marked with its size & date/time
+  SdFile imageFile;
+  configImageHeader header;
+  unsigned int sum1 = 0, sum2 = 0;
+  configImageBlock block;
+  
+  memcpy(header.magic, configImageMagic, sizeof(configImageMagic));
+  header.version = configImageVersion;
+  header.jsonSize = configDir->fileSize;
+  header.jsonDate = configDir->lastWriteDate;
+  header.jsonTime = configDir->lastWriteTime;
+  header.payloadLen = 0;
+  for (byte i = 0; i < numConfigImageBlocks; i++) {
+    memcpy_P(&block, &configImage[i], sizeof(block));
+    header.payloadLen += block.len;
+    fletcher16((byte*) block.addr, block.len, &sum1, &sum2);
+  }
+  header.checksum = (sum2 << 8) | sum1;
   
-  return mode == 'x';
+  // A part-written image fails its checksum next time, so no harm if this goes wrong
+  if (!imageFile.open(root, "config.bin", O_CREAT | O_WRITE | O_TRUNC)) { PgmPrintln("Can't write config.bin"); return; }
+  imageFile.write(&header, sizeof(header));
+  for (byte i = 0; i < numConfigImageBlocks; i++) { memcpy_P(&block, &configImage[i], sizeof(block)); imageFile.write(block.addr, block.len); }
+  imageFile.close();
+}
+
+void fletcher16 (byte *data, unsigned int len, unsigned int *sum1, unsigned int *sum2) {      // Running checksum; sums start at 0
+  while (len--) {
+    if ((*sum1 += *data++) >= 255) *sum1 -= 255;
+    if ((*sum2 += *sum1) >= 255) *sum2 -= 255;
+  }
 }
 
 // ******** Device map helper functions ******************
@@ -1206,55 +2067,11 @@ boolean getNextElement( SdFile *p_file, char *p_tag, char *p_element) {   // Hel
 unsigned int mapGet(byte deviceIdx, byte type) { unsigned int result = mapAccess (deviceIdx, type, NULL, readFlag); return result; }
 void mapPut(byte deviceIdx, byte type, unsigned int value) { mapAccess (deviceIdx, type, value, writeFlag); }
   
-// deviceMap ref ([0]) gives unique ref for device.  Decode format is an.nn.aaa, coded as follows (constants outside mapAccess to allow wider use)
-const unsigned int maskRef = (0xff * 256) + 0xff;                // Zero is NULL reference used to indicate evaluation not to write
-const unsigned int maskRegion = (B11100000 * 256) + 0x00;        // Up to 8 regions
-const unsigned int maskZone = (B00011100 * 256) + 0x00;      // Up to 8 zones per region.  NB: certain zones need rationalising
-const unsigned int maskLocation = (B00000011 * 256) + B11100000;  // Up to 32 locations per zone (0 reserved for whole zone).    NB: certain locations need rationalising
-const unsigned int maskSensor = B00010000;                               // 1 = sensor, 0 = actor
-const unsigned int maskDeviceType = 0x0f;                                // Up to 16 sensors & 16 actors
-const byte offsetRegion = 13;
-const byte offsetZone = 10;
-const byte offsetLocation = 5;
-const byte offsetSensor = 4;
-
-unsigned int mapAccess(byte deviceIdx, byte type, unsigned int value, int flag) {            // Get appropriate value out of deviceMap or varReading
-  static unsigned int deviceMap[3][maxDevices];      // [0] = coded device ref; [1] = device handler; [2] = state  //; [3] = history
-  static unsigned int varReading[maxVars];           // Same format as reading, but for internal variables (indexed by 7 bit variable number - maskVar)
-  
-  const byte deviceRefIdx = 0x00;
-  const byte deviceHandlerIdx = 0x01;
-  const byte deviceStateIdx = 0x02;
-  const byte maskDeviceMapIdx = 0x03;            // This &'ed with Type gives deviceRefIdx, deviceHandlerIdx, deviceStateIdx
-  
-  // deviceMap handler ([1]) tells how to access the physical device.  Decode as follows:
-  const unsigned int maskArduino = (B11100000 * 256) + 0x00;      // 3 bits, up to 8 Arduinos
-  const unsigned int maskPin = (B00011111 * 256) + B11000000;    // 7 bits, up to 128 pins/virtual pins.  Pin 127 is NOP
-  const unsigned int maskCascade = B00100000;                    // 1 = cascade this reading to the next deviceIdx; 0 = no cascade
-  const unsigned int maskHandler = B00011000;                    // 2 bits, up to 4 handler types per device type
-  const unsigned int maskFreq = B00000111;                    // 3 bits, up to 8 action frequencies
-  const byte offsetArduino = 13;
-  const byte offsetPin = 6;
-  const byte offsetCascade = 5;
-  const byte offsetHandler = 3;
-  
-  // deviceMap state([2]) holds the current status of the device.  Decode as follows:
-  const unsigned int maskStatus = (B11000000 * 256) + 0x00;            // 0 = stable; 1 = sensor reading pending; 2 = target; 3 = unset
-  const unsigned int maskStackMode = (B00100000 * 256) + 0x00;            // How to interpret Stack.  0 = bitmap, 1 = index
-  const unsigned int maskTOSIdx = (B00011100 * 256) + 0x00;            // 3 bits = 8 values, only applicable for StackMode = 1; gives offset on Stack * stackSize to latest reading in readingHistory
-  const unsigned int maskStack = 0xFF;                               // Stackmode = 0 - 8 bits of On/Off history (MSB = latest) for on/off device types (xTo, xF, xM, xP, P1, P2, P, p, D, L, R)
-                                                                    // Stackmode = 1 - 0-127 * stackSize as an index into readingHistory, with TOSIdx giving offset to current top of stack                                                                      
-  
-  const byte offsetStatus = 14;
-  const byte offsetStackMode = 13;
-  const byte offsetTOSIdx = 10; 
-  
-  byte deviceMapIdx = type & maskDeviceMapIdx;
-  unsigned int mask;
-  int offset, i, temp1, temp2;
+unsigned int mapAccess(byte deviceIdx, byte type, unsigned int value, int flag) {            // Get appropriate value out of device arrays or varReading
+  int i, temp1, temp2;
     
   if (deviceIdx & mask8BitMSB) {        // Variable
-    if ((deviceIdx &= ~mask8BitMSB) >= maxVars) Serial.println("Var out of bounds");    
+    if ((deviceIdx &= ~mask8BitMSB) >= maxVars) PgmPrintln("Var out of bounds");    
     switch (type) {
       case valRegion:     return 'V';
       case valArduino:    return arduinoMe;
@@ -1266,59 +2083,58 @@ unsigned int mapAccess(byte deviceIdx, byte type, unsigned int value, int flag)
       case valMax:
       case valMin:
       case valROC:
-      case valCurr:    if (flag == readFlag) return varReading [deviceIdx]; else { varReading [deviceIdx] = value; break; }
+      case valCurr:    if (flag == readFlag) return varReading [deviceIdx]; else { currPut(deviceIdx | mask8BitMSB, value); break; }
       default:
-        Serial.println("Unexpected var type");
+        PgmPrintln("Unexpected var type");
         return 0;
     }
   }
   else {
-    if (deviceIdx >= maxDevices) { Serial.print("Device "); Serial.print(deviceIdx); Serial.println(" out of bounds"); }
-    switch (type) {
-      case valRef:        mask = maskRef; offset = 0; break;
-      case valRegion:     mask = maskRegion; offset = offsetRegion; break;
-      case valZone:       mask = maskZone; offset = offsetZone; break; 
-      case valLocation:   mask = maskLocation; offset = offsetLocation; break;
-      case valSensor:     mask = maskSensor; offset = offsetSensor; break;
-      case valType:       mask = maskDeviceType; offset = 0; break;
-      case valArduino:    mask = maskArduino; offset = offsetArduino; break;
-      case valPin:        mask = maskPin; offset = offsetPin; break;
-      case valCascade:    mask = maskCascade; offset = offsetCascade; break;
-      case valHandler:    mask = maskHandler; offset = offsetHandler; break;
-      case valPollFreq:   mask = maskFreq; offset = 0; break;
-      case valStatus:     mask = maskStatus; offset = offsetStatus; break;
-      case valStackMode:  mask = maskStackMode; offset = offsetStackMode; break;
-      case valTOSIdx:     mask = maskTOSIdx; offset = offsetTOSIdx; break;
-      case valStack:      mask = maskStack; offset = 0; break;
-      case valCurr:    // GET - return latest reading.  PUT - Store reading on stack
-        if (flag == readFlag) return stackGet (deviceIdx, 0); else { stackPush (deviceIdx, value); return NULL; }
-      case valPrev: 
-        return stackGet (deviceIdx, 1);      // Only GET - return previous reading
-      case valAvg:  
-        temp1 = 0;
-        for (i = 0; i < 8; i++) temp1 += stackGet (deviceIdx, i);
-        return temp1/8;
-      case valMax:
-        temp1 = stackGet (deviceIdx, 0);
-        for (i = 1; i < 8; i++) if (temp2 = stackGet (deviceIdx, i) > temp1) temp1 = temp2;
-        return temp1;
-      case valMin:
-        temp1 = stackGet (deviceIdx, 0);
-        for (i = 1; i < 8; i++) if (temp2 = stackGet (deviceIdx, i) < temp1) temp1 = temp2;
-        return temp1;
-      case valROC:
-        temp1 = 0;
-        for (i = 1; i < 8; i++) temp1 += (stackGet (deviceIdx, i - 1) - (temp2 = stackGet (deviceIdx, i))) * 100 / temp2;
-        return temp1/8/100;
-      default: Serial.println("Unknown access type");
+    if (deviceIdx >= maxDevices) { PgmPrint("Device "); Serial.print(deviceIdx); PgmPrintln(" out of bounds"); }
+    if (flag == readFlag) {
+      switch (type) {
+        case valRef:        return devRef[deviceIdx];
+        case valRegion:     return (devRef[deviceIdx] & maskRegion) >> offsetRegion;
+        case valZone:       return (devRef[deviceIdx] & maskZone) >> offsetZone;
+        case valLocation:   return (devRef[deviceIdx] & maskLocation) >> offsetLocation;
+        case valSensor:     return devSensor(deviceIdx);
+        case valType:       return devType(deviceIdx);
+        case valArduino:    return devArduino[deviceIdx];
+        case valPin:        return devPin[deviceIdx];
+        case valCascade:    return devCascade(deviceIdx);
+        case valHandler:    return devHandler[deviceIdx];
+        case valPollFreq:   return devPollFreq[deviceIdx];
+        case valStatus:     return devStatus[deviceIdx];
+        case valStackMode:  return devStackMode(deviceIdx);
+        case valTOSIdx:     return devTOSIdx[deviceIdx];
+        case valStack:      return devStack[deviceIdx];
+        case valCurr:       return stackGet (deviceIdx, 0);      // Latest reading
+        case valPrev:       return stackGet (deviceIdx, 1);      // Previous reading
+        case valAvg:  
+        case valMax:
+        case valMin:
+        case valROC:        return statsGet (deviceIdx, type);
+        default: PgmPrintln("Unknown access type");
+      }
     }
-    
-    if (flag == readFlag) return (deviceMap[deviceMapIdx][deviceIdx] & mask ) >> offset;
     else {
-      deviceMap[deviceMapIdx][deviceIdx] &= ~mask;                          // Clear
-      deviceMap[deviceMapIdx][deviceIdx] |= ((value << offset) & mask);                // Store 
+      switch (type) {
+        case valRef:        devRef[deviceIdx] = value; break;
+        case valArduino:    devArduino[deviceIdx] = value; break;
+        case valPin:        devPin[deviceIdx] = value; break;
+        case valCascade:    if (value) devFlags[deviceIdx] |= flagCascade; else devFlags[deviceIdx] &= ~flagCascade; break;
+        case valHandler:    devHandler[deviceIdx] = value; break;
+        case valPollFreq:   devPollFreq[deviceIdx] = value; break;
+        case valStatus:     statusPut(deviceIdx, value); break;
+        case valStackMode:  if (value) devFlags[deviceIdx] |= flagStackMode; else devFlags[deviceIdx] &= ~flagStackMode; break;
+        case valTOSIdx:     devTOSIdx[deviceIdx] = value; break;
+        case valStack:      devStack[deviceIdx] = value; break;
+        case valCurr:       stackPush (deviceIdx, value); break;      // Store reading on stack
+        default: PgmPrintln("Unknown access type");
+      }
     }
   }
+  return 0;
 }
 
 /*************** Device reference and array utilities *********************/
@@ -1353,7 +2169,7 @@ unsigned int convertRef(char *device, unsigned int bitstring, byte type) {
   switch (type) {
     case valToInt:
       bitstring = 0;
-      if (device[0] == 'X') Serial.println("Null char");
+      if (device[0] == 'X') PgmPrintln("Null char");
       else {
         // Convert region ref.  Lots of casts to avoid "error: invalid operands of types 'unsigned int' and 'void*' to binary 'operator|'"
         bitstring |= ( (unsigned int) memchr(regionCodes, device[0], numRegionCodes) - (unsigned int) regionCodes ) << offsetRegion;    // 3 bit << 13 (MSB)
@@ -1402,7 +2218,7 @@ unsigned int convertRef(char *device, unsigned int bitstring, byte type) {
           else { device[6] = actorTypes[i]; device[7] = '\0'; }
         }
       }
-      else { device[0] = 'X'; device[1] = '\0'; Serial.println("Null bits"); }        // NULL device
+      else { device[0] = 'X'; device[1] = '\0'; PgmPrintln("Null bits"); }        // NULL device
       break;
     case valTestTemp:
       // Check if this is a temperature sensor
@@ -1416,17 +2232,33 @@ unsigned int convertRef(char *device, unsigned int bitstring, byte type) {
 }
 
 
-byte getDeviceIdx (char *deviceRefChar) {      // Returns variable (MSB = 1) or device (MSB = 0) index  
+byte getDeviceIdx (char *deviceRefChar) {      // Returns variable (MSB = 1) or device (MSB = 0) index; 0 (NULL device) if not found
   if (deviceRefChar[0] == 'V') {
     int varNum = atoi(deviceRefChar+2);
-    if (varNum > numVars) Serial.println("Vars out of range");
+    if (varNum > numVars) PgmPrintln("Vars out of range");
     return mask8BitMSB | varNum;
   }
   else {
-    byte deviceIdx;
     unsigned int deviceRefBits = convertRefToBit(deviceRefChar);
-    for (deviceIdx = 1; deviceIdx < numDevices; deviceIdx++) if(mapGet(deviceIdx, valRef) == deviceRefBits) return deviceIdx;
-    Serial.println("Device not found");
+    byte slot = devHashSlot(deviceRefBits);
+    
+    for (; devHash[slot]; slot = (slot + 1) & (devHashSize - 1)) if (devRef[devHash[slot]] == deviceRefBits) return devHash[slot];
+    PgmPrintln("Device not found");
+    return 0;
+  }
+}
+
+byte devHashSlot (unsigned int refBits) {      // Home slot in devHash; top bits of 16-bit multiplicative hash
+  return (byte) ((unsigned int) (refBits * 40503U) >> 8) & (devHashSize - 1);
+}
+
+void devHashBuild () {        // Index devices 1..numDevices-1 by devRef for getDeviceIdx
+  byte slot;
+  
+  memset(devHash, 0, sizeof(devHash));
+  for (byte deviceIdx = 1; deviceIdx < numDevices; deviceIdx++) {
+    for (slot = devHashSlot(devRef[deviceIdx]); devHash[slot]; slot = (slot + 1) & (devHashSize - 1)) ;      // Linear probe; never full
+    devHash[slot] = deviceIdx;
   }
 }
 
@@ -1444,16 +2276,16 @@ unsigned int stackGet (byte deviceIdx, unsigned int element) {
   if (onWatchList(deviceIdx) && element == 0) { 
     Serial.print(deviceIdx, HEX);
     printRef(deviceIdx);
-    Serial.print(" element = ");
+    PgmPrint(" element = ");
     Serial.print(element, HEX);
-    Serial.print(" result = 0x");
+    PgmPrint(" result = 0x");
     Serial.print(result, HEX);
     if (result > 32) {
-      Serial.print(" (");
+      PgmPrint(" (");
       Serial.print(result, DEC);
-      Serial.print(")");
+      PgmPrint(")");
     }
-    Serial.print(" B");
+    PgmPrint(" B");
     Serial.println(result, BIN);
   }
   */
@@ -1464,64 +2296,457 @@ unsigned int stackGet (byte deviceIdx, unsigned int element) {
 
 
 void stackPush (byte deviceIdx, unsigned int value) { 
+  boolean hasStats = devFlags[deviceIdx] & flagStats;
+  unsigned int oldest = (hasStats) ? stackGet(deviceIdx, devWindow[deviceIdx] - 1) : 0;      // About to drop out of window
+  
+  if (stackGet(deviceIdx, 0) != value) {
+    markChanged(deviceIdx);
+    if (devFlags[deviceIdx] & flagHist) histRecord(deviceIdx, value);
+    if (devFlags[deviceIdx] & flagLog) logReading(deviceIdx, value);
+  }
   stackAccess (deviceIdx, 0, value, writeFlag); 
+  if (hasStats) statsPush(deviceIdx, value, oldest);
+}
+
+// Latest reading of device or variable (MSB set) - the common case in evalRun, so bypasses mapAccess
+unsigned int currGet (byte idx) {
+  return (idx & mask8BitMSB) ? varReading[idx & ~mask8BitMSB] : stackGet(idx, 0);
+}
+
+void currPut (byte idx, unsigned int value) {
+  if (idx & mask8BitMSB) {
+    if (varReading[idx & ~mask8BitMSB] != value) markChanged(idx);
+    varReading[idx & ~mask8BitMSB] = value;
+  }
+  else stackPush(idx, value);
 }
   /*
   if (onWatchList(deviceIdx)) {
-    Serial.print("In stackPush - heartbeat ");
+    PgmPrint("In stackPush - heartbeat ");
     Serial.print(heartBeat);
-    Serial.print(" watch ");
+    PgmPrint(" watch ");
     Serial.print(deviceIdx);
-    Serial.print(" value = 0x");
+    PgmPrint(" value = 0x");
     Serial.print(value, HEX);
     if (value > 32) {
-      Serial.print(" (");
+      PgmPrint(" (");
       Serial.print(value, DEC);
-      Serial.print(")");
+      PgmPrint(")");
     }
-    Serial.print(" B");
+    PgmPrint(" B");
     Serial.println(value, BIN);
   }
   */
   
 
-unsigned int stackAccess (byte deviceIdx, unsigned int element, unsigned int value, byte flag) {          // Get element off or add element to stack (0 = TOS). NB: stacksize implied here as 8
+unsigned int stackAccess (byte deviceIdx, unsigned int element, unsigned int value, byte flag) {          // Get element off or add element to stack (0 = TOS). Bitmap holds 8; readingHistory holds devWindow
   unsigned int result;
-  static unsigned int readingHistory [maxReadings];          // Only used if StackMode == 1. Interpretation varies dependent on deviceType:
-                                                    // For xH is temperature(C) x 10 (+/-), so 25.3 = 253 (negative values cast to unsigned)
-                                                    // For xo/xL (open/light) is measured voltage of sensor x 100, so 5v = 500
-                                                    // For xb is ID of button
-                                                    // For time holds day:hour:minute psuedo codes see dhmAccess, with MSG == 1
-
-
-  byte stack = mapGet(deviceIdx, valStack);    // Holds 8 on/off readings if StackMode == 0, else pointer into readingHistory
+  byte stack = devStack[deviceIdx];    // Holds 8 on/off readings if StackMode == 0, else pointer into readingHistory
   
-  if (mapGet(deviceIdx, valStackMode)) {
+  if (devStackMode(deviceIdx)) {
     unsigned int index = stack * stackSize;
-    unsigned int offset = (mapGet(deviceIdx, valTOSIdx) + element) % stackSize;
+    byte window = devWindow[deviceIdx];
+    unsigned int offset = (devTOSIdx[deviceIdx] + element) % window;
     
     if (flag == readFlag) result = readingHistory [index + offset];
     else {
-       unsigned int newOffset = (offset % stackSize != 0) ? offset - 1 : offset + 7;    // If not at top of stack (non-zero) then decrement, else rotate round    
+       unsigned int newOffset = (offset != 0) ? offset - 1 : window - 1;    // If not at top of stack (non-zero) then decrement, else rotate round    
        readingHistory [index + newOffset] = value;      // Store reading (overwrites oldest)  
-       mapPut (deviceIdx, valTOSIdx, newOffset);
+       devTOSIdx[deviceIdx] = newOffset;
     }
   }
-  else if (flag == readFlag) result = ((stack << element) >> 7) & maskLSB; else mapPut (deviceIdx, valStack, (stack >> 1) | ((value & 1) << 7));
+  else if (flag == readFlag) result = ((stack << element) >> 7) & maskLSB; else devStack[deviceIdx] = (stack >> 1) | ((value & 1) << 7);
 
   return result;
 }
 
 
 
+// ******** Rolling statistics ******************
+// Slots are passed by number rather than RUNSTATS*, as the IDE puts function prototypes ahead of the struct
+
+void statsAttach (byte deviceIdx) {      // Keep AV, MX, MN & ROC of deviceIdx up to date from now on, starting from its current window
+  if ((deviceIdx & mask8BitMSB) || !devStackMode(deviceIdx) || (devFlags[deviceIdx] & flagStats)) return;      // Variable, or on/off bitmap - cheap to trawl
+  if (numStats == maxStats) { PgmPrintln("Stats OF"); return; }
+  
+  memset(&runStats[numStats], 0, sizeof(RUNSTATS));
+  runStats[numStats].deviceIdx = deviceIdx;
+  for (int age = devWindow[deviceIdx] - 1; age >= 0; age--) statsAdd(numStats, age);
+  numStats++;
+  devFlags[deviceIdx] |= flagStats;
+}
+
+byte statsFind (byte deviceIdx) {      // Slot of deviceIdx, or maxStats if none
+  byte slot;
+  
+  for (slot = 0; slot < numStats; slot++) if (runStats[slot].deviceIdx == deviceIdx) break;
+  return (slot < numStats) ? slot : maxStats;
+}
+
+void statsAdd (byte slot, byte age) {      // Bring reading age into sum, xSum and deques
+  RUNSTATS *st = &runStats[slot];
+  int reading = stackGet(st->deviceIdx, age);
+  byte seq = st->seq - age;
+  
+  st->sum += reading;
+  st->xSum += (long) (devWindow[st->deviceIdx] - 1 - age) * reading;
+  while (st->maxLen && (int) stackGet(st->deviceIdx, (byte)(st->seq - st->maxQ[(st->maxFirst + st->maxLen - 1) % maxWindow])) <= reading) st->maxLen--;
+  st->maxQ[(st->maxFirst + st->maxLen++) % maxWindow] = seq;
+  while (st->minLen && (int) stackGet(st->deviceIdx, (byte)(st->seq - st->minQ[(st->minFirst + st->minLen - 1) % maxWindow])) >= reading) st->minLen--;
+  st->minQ[(st->minFirst + st->minLen++) % maxWindow] = seq;
+}
+
+void statsPush (byte deviceIdx, unsigned int value, unsigned int oldest) {      // Reading just pushed; oldest has dropped out of window
+  byte slot = statsFind(deviceIdx), window = devWindow[deviceIdx];
+  RUNSTATS *st = &runStats[slot];
+  
+  if (slot == maxStats) return;
+  st->xSum -= st->sum - (int) oldest;              // Every other reading moves one x closer to oldest; oldest was at x = 0
+  st->sum -= (int) oldest;
+  st->seq++;
+  // Expire the front first: a full deque (a window of strictly falling or rising readings) would otherwise wrap past maxWindow
+  if (st->maxLen && (byte)(st->seq - st->maxQ[st->maxFirst]) >= window) { st->maxFirst = (st->maxFirst + 1) % maxWindow; st->maxLen--; }
+  if (st->minLen && (byte)(st->seq - st->minQ[st->minFirst]) >= window) { st->minFirst = (st->minFirst + 1) % maxWindow; st->minLen--; }
+  statsAdd(slot, 0);                               // Latest, at x = window - 1
+}
+
+unsigned int statsGet (byte deviceIdx, byte type) {      // AV, MX, MN or ROC (least squares slope, in 1/100ths of a reading per reading) over window
+  byte slot = (devFlags[deviceIdx] & flagStats) ? statsFind(deviceIdx) : maxStats;
+  RUNSTATS *st = (slot < maxStats) ? &runStats[slot] : NULL;
+  byte window = (devStackMode(deviceIdx)) ? devWindow[deviceIdx] : 8;
+  long sum = 0, xSum = 0;
+  int reading, result;
+  
+  if (st) {
+    switch (type) {
+      case valMax:  return stackGet(deviceIdx, (byte)(st->seq - st->maxQ[st->maxFirst]));
+      case valMin:  return stackGet(deviceIdx, (byte)(st->seq - st->minQ[st->minFirst]));
+    }
+    sum = st->sum;
+    xSum = st->xSum;
+  }
+  else {
+    result = stackGet(deviceIdx, 0);
+    for (byte age = 0; age < window; age++) {
+      reading = stackGet(deviceIdx, age);
+      sum += reading;
+      xSum += (long) (window - 1 - age) * reading;
+      if ((type == valMax) ? reading > result : reading < result) result = reading;
+    }
+    if (type == valMax || type == valMin) return result;
+  }
+  
+  if (type == valAvg) return sum / window;
+  
+  long xTotal = (long) window * (window - 1) / 2;                                   // Sum of x
+  long divisor = (long) window * window * ((long) window * window - 1) / 12;        // window * sum of x^2 - (sum of x)^2
+  return (((long long) window * xSum - (long long) xTotal * sum) * 100) / divisor;
+}
+
+// ******** Long history ******************
+
+void histAttach (byte deviceIdx, unsigned int depth) {      // Allot deviceIdx a region of the arena for depth samples, below those already allotted
+  unsigned int size = depth * histBytesPerSample;
+  
+  if (depth < 2 || (devFlags[deviceIdx] & flagHist)) return;
+  if (numHistLogs == maxHistLogs || depth > readingsFree / histBytesPerSample) { PgmPrintln("Hist arena OF"); return; }
+  
+  histArenaUsed += size;
+  readingsFree -= size;
+  memset(&histLogs[numHistLogs], 0, sizeof(HISTLOG));
+  histLogs[numHistLogs].deviceIdx = deviceIdx;
+  histLogs[numHistLogs].start = sizeof(readingHistory) - histArenaUsed;
+  histLogs[numHistLogs].size = size;
+  histLogs[numHistLogs].depth = depth;
+  numHistLogs++;
+  devFlags[deviceIdx] |= flagHist;
+}
+
+void histStart () {        // Empty every log, with the current reading as latest
+  for (byte i = 0; i < numHistLogs; i++) {
+    histLogs[i].head = histLogs[i].used = histLogs[i].count = 0;
+    histLogs[i].latest = stackGet(histLogs[i].deviceIdx, 0);
+    histLogs[i].latestAt = histNow();
+  }
+}
+
+unsigned long histNow () {      // Secs; time of day once set by NTP, else since startup
+  return (timeStatus() == timeSet) ? now() : millis() / 1000;
+}
+
+byte histFind (byte deviceIdx) {      // Log of deviceIdx, or maxHistLogs if none
+  byte i;
+  
+  if (deviceIdx & mask8BitMSB) return maxHistLogs;
+  for (i = 0; i < numHistLogs; i++) if (histLogs[i].deviceIdx == deviceIdx) break;
+  return (i < numHistLogs) ? i : maxHistLogs;
+}
+
+void histRecord (byte deviceIdx, unsigned int value) {      // Reading of deviceIdx has changed to value
+  byte slot = histFind(deviceIdx), sample[10], len = 0;
+  HISTLOG *h = &histLogs[slot];
+  unsigned long at = histNow(), field;
+  long change;
+  
+  if (slot == maxHistLogs) return;
+  
+  change = (long) (int) value - h->latest;
+  field = (change << 1) ^ (change >> 31);                 // Zigzag: small changes either way give small numbers
+  for (byte f = 0; f < 2; f++) {
+    do {
+      sample[len] = field & 0x7f;
+      field >>= 7;
+      if (field) sample[len] |= 0x80;                      // More to follow
+      len++;
+    } while (field);
+    field = (at > h->latestAt) ? at - h->latestAt : 0;
+  }
+  if (len > h->size) h->used = h->count = 0;              // Change too big for region; history restarts from here
+  else {
+    while (h->count && (h->count >= h->depth - 1 || h->size - h->used < len)) {      // Drop oldest until room
+      unsigned int tail = (h->head + h->size - h->used) % h->size, dropped = 0;
+      for (byte f = 0; f < 2; f++) while (histArena[h->start + (tail + dropped++) % h->size] & 0x80) ;
+      h->used -= dropped;
+      h->count--;
+    }
+    for (byte i = 0; i < len; i++) {
+      histArena[h->start + h->head] = sample[i];
+      h->head = (h->head + 1) % h->size;
+    }
+    h->used += len;
+    h->count++;
+  }
+  h->latest = (int) value;
+  h->latestAt = at;
+}
+
+boolean histGet (byte deviceIdx, unsigned int back, int *reading, unsigned long *at) {      // Reading & time back changes ago (0 = latest); false if not held
+  byte slot = histFind(deviceIdx);
+  HISTLOG *h = &histLogs[slot];
+  unsigned int pos, end, tail;
+  unsigned long field[2];
+  
+  if (slot == maxHistLogs || back > h->count) return false;
+  
+  *reading = h->latest;
+  *at = h->latestAt;
+  tail = (h->head + h->size - h->used) % h->size;
+  for (pos = h->head; back; back--) {          // Samples are read newest first, so each varint is read from its last byte back
+    for (char f = 1; f >= 0; f--) {
+      end = pos;
+      pos = (pos + h->size - 1) % h->size;                                                  // Last byte of varint
+      while (pos != tail && histArena[h->start + (pos + h->size - 1) % h->size] & 0x80) pos = (pos + h->size - 1) % h->size;      // Back to its first
+      field[f] = 0;
+      for (unsigned int i = pos, shift = 0; i != end; i = (i + 1) % h->size, shift += 7) field[f] |= (unsigned long) (histArena[h->start + i] & 0x7f) << shift;
+    }
+    *reading -= (long) (field[0] >> 1) ^ -(long) (field[0] & 1);
+    *at -= field[1];
+  }
+  return true;
+}
+
+// ******** Reading log ******************
+
+void logReading (byte deviceIdx, unsigned int value) {      // Stage change of reading in logStage; written if logStage or block full, or a new hour
+  time_t t;
+  LOGRECORD *rec;
+  
+  if (timeStatus() != timeSet) { logDropped++; return; }
+  t = now();
+  if (!logFile.isOpen() || day(t) != logIndex.day || month(t) != logIndex.month || year(t) != logIndex.year) {
+    if (!logOpen(t)) { logDropped++; return; }
+  }
+  
+  if (logBlock.count && (logBlock.count == logRecsPerBlock || hour(t) != logBlock.hour)) {      // Move on to next block
+    if (logStaged) logWriteBlock();
+    logBlock.seq++;
+    logBlock.count = 0;
+    logRecSum = 0;
+  }
+  else if (logStaged == logStageRecs) logWriteBlock();
+  if (!logFile.isOpen()) { logDropped++; return; }      // Card error in logWriteBlock
+  if (!logBlock.count) logBlock.hour = hour(t);
+  
+  rec = &logStage[logStaged++];
+  rec->at = t;
+  rec->ref = devRef[deviceIdx];
+  rec->reading = value;
+  logBlock.count++;
+  for (byte i = 0; i < sizeof(LOGRECORD); i++) logRecSum += ((byte*) rec)[i];
+}
+
+boolean logOpen (time_t t) {      // Finish with current day's file and open that for t, resuming after any blocks already there.  False if card error
+  SdFile logDir;
+  char filename[13];
+  
+  if (logFile.isOpen()) {
+    if (logStaged) logWriteBlock();
+    logFile.close();
+  }
+  memset(&logBlock, 0, sizeof(logBlock));
+  logStaged = 0;
+  logRecSum = 0;
+  
+  if (!logDir.open(root, "LOG", O_READ) && !logDir.makeDir(&root, "LOG")) { PgmPrintln("Can't make LOG"); return false; }
+  sprintf_P(filename, PSTR("%04d%02d%02d.BIN"), year(t), month(t), day(t));
+  if (!logFile.open(logDir, filename, O_RDWR | O_CREAT)) { PgmPrintln("Can't open log"); logDir.close(); return false; }
+  logDir.close();
+  
+  if (logFile.fileSize() >= logBlockSize && logFile.read(&logIndex, sizeof(logIndex)) == sizeof(logIndex) && memcmp_P(logIndex.magic, PSTR("HALG"), 4) == 0) {
+    logBlock.seq = (logFile.fileSize() + logBlockSize - 1) / logBlockSize;      // After any part-filled block
+  }
+  else {                              // New file; index padded out to a whole block
+    memset(&logIndex, 0, sizeof(logIndex));
+    memcpy_P(logIndex.magic, PSTR("HALG"), 4);
+    logIndex.version = logVersion;
+    logIndex.recordSize = sizeof(LOGRECORD);
+    logIndex.arduino = arduinoMe;
+    logIndex.recsPerBlock = logRecsPerBlock;
+    logIndex.year = year(t);
+    logIndex.month = month(t);
+    logIndex.day = day(t);
+    if (!logFile.seekSet(0) || logFile.write(&logIndex, sizeof(logIndex)) != sizeof(logIndex) || 
+        !logPad(logBlockSize - sizeof(logIndex)) || !logFile.sync()) {
+      PgmPrintln("Can't write log");
+      logFile.close();
+      return false;
+    }
+    logBlock.seq = 1;
+  }
+  return true;
+}
+
+void logWriteBlock () {      // Add logStage to its block - a new block appended whole, so no read needed - and index the block if first of its hour
+  unsigned long blockAt = (unsigned long) logBlock.seq * logBlockSize;
+  int stageBytes = logStaged * sizeof(LOGRECORD);
+  byte *p = (byte*) &logBlock;
+  unsigned int sum = logRecSum;                   // Rest of block is zeros
+  boolean ok;
+  
+  logBlock.magic = logBlockMagic;
+  logBlock.sum = 0;
+  for (byte i = 0; i < sizeof(logBlock); i++) sum += p[i];
+  logBlock.sum = sum;
+  
+  if (logFile.fileSize() <= blockAt) {            // Header, records & padding all go into SdFat's cache before the card is written
+    ok = logFile.seekSet(blockAt) && logFile.write(&logBlock, sizeof(logBlock)) == sizeof(logBlock) && 
+         logFile.write(logStage, stageBytes) == stageBytes && logPad(logBlockSize - sizeof(logBlock) - stageBytes);
+  }
+  else {                                          // Part-filled block: records after those already there, then the header with new count & sum
+    ok = logFile.seekSet(blockAt + sizeof(logBlock) + (logBlock.count - logStaged) * sizeof(LOGRECORD)) && 
+         logFile.write(logStage, stageBytes) == stageBytes &&
+         logFile.seekSet(blockAt) && logFile.write(&logBlock, sizeof(logBlock)) == sizeof(logBlock);
+  }
+  if (ok && !logIndex.hourBlock[logBlock.hour]) {
+    logIndex.hourBlock[logBlock.hour] = logBlock.seq;
+    ok = logFile.seekSet(0) && logFile.write(&logIndex, sizeof(logIndex)) == sizeof(logIndex);
+  }
+  if (ok && logFile.sync()) { logStaged = 0; return; }
+  PgmPrintln("Can't write log");
+  logDropped += logStaged;
+  logStaged = 0;
+  logFile.close();                    // Reopened at next reading
+}
+
+boolean logPad (int bytes) {      // Write zeros from the current position of logFile
+  byte zeros[32];
+  int n;
+  
+  memset(zeros, 0, sizeof(zeros));
+  for (; bytes > 0; bytes -= n) {
+    n = min(bytes, (int) sizeof(zeros));
+    if (logFile.write(zeros, n) != n) return false;
+  }
+  return true;
+}
+
+void serveBatch (Client client, char *list, unsigned int since) {      // Readings of list of ids, or if NULL of all devices & variables changed since version (0 = all), in one reply
+  char outBuffer[const_SDCard_BUFSIZ];    // as {"v":<changeVersion>,"r":[["id",reading,status],..]}
+  char entry[32];
+  char id[const_Token_Bufsiz];
+  int items, outLen;
+  unsigned long length;
+  byte idx;
+  char *p;
+  
+  if (!list) items = (numDevices - 1) + numVars;
+  else for (items = 1, p = list; *p; p++) if (*p == ',') { *p = 0; items++; }      // Split list in place
+  
+  for (byte pass = 0; pass < 2; pass++) {         // Measure for Content-Length, then send
+    if (pass == 1) {
+      PgmClientPrintln(client, "HTTP/1.1 200 OK");
+      PgmClientPrint(client, "Server: Arduino/");
+      client.println(arduinoMe);
+      PgmClientPrintln(client, "Content-Type: application/json");
+      PgmClientPrint(client, "Content-Length: ");
+      client.println(length);
+      client.println();
+    }
+    outLen = sprintf_P(outBuffer, PSTR("{\"v\":%u,\"r\":["), changeVersion);
+    length = outLen + 2;                          // ]}
+    p = list;
+    for (int i = 0, sent = 0; i < items; i++) {
+      if (!list) {
+        idx = (i < numDevices - 1) ? i + 1 : mask8BitMSB | (i - (numDevices - 1));
+        if (!versionNewer(idxVersion[(idx & mask8BitMSB) ? maxDevices + (idx & ~mask8BitMSB) : idx], since)) continue;
+        if (idx & mask8BitMSB) sprintf_P(id, PSTR("V.%d"), idx & ~mask8BitMSB);
+        else convertRefToChar(devRef[idx], id);
+      }
+      else {
+        strncpy(id, p, const_Token_Bufsiz - 1);
+        id[const_Token_Bufsiz - 1] = 0;
+        idx = getDeviceIdx(p);
+        p += strlen(p) + 1;
+      }
+      sprintf_P(entry, PSTR("%s[\"%.12s\",%d,%d]"), (sent++) ? "," : "", id, mapGet(idx, valCurr), mapGet(idx, valStatus));
+      
+      length += strlen(entry);
+      if (pass == 0) continue;
+      if (outLen + strlen(entry) > const_SDCard_BUFSIZ) { client.write((byte*) outBuffer, outLen); outLen = 0; }      // A packet per buffer, not per entry
+      memcpy(outBuffer + outLen, entry, strlen(entry));
+      outLen += strlen(entry);
+    }
+  }
+  if (outLen > const_SDCard_BUFSIZ - 2) { client.write((byte*) outBuffer, outLen); outLen = 0; }
+  outBuffer[outLen++] = ']';
+  outBuffer[outLen++] = '}';
+  client.write((byte*) outBuffer, outLen);
+}
+
+void serveLog (Client client, char *date, byte fromHour) {      // Blocks of LOG/<date>.BIN from first of fromHour to end, ie records from then to now; sent by webSendSlice
+  SdFile *logDir;
+  SdFile file;
+  LOGINDEX index;
+  char filename[13];
+  unsigned long start;
+  
+  if (logStaged) logWriteBlock();                 // Include latest readings
+  
+  if (strlen(date) != 8 || fromHour > 23 || !(logDir = webDir("LOG"))) { reply404(client); return; }
+  sprintf_P(filename, PSTR("%s.BIN"), date);
+  if (!file.open(logDir, filename, O_READ) || file.read(&index, sizeof(index)) != sizeof(index)) { file.close(); reply404(client); return; }
+  
+  start = file.fileSize();                         // Nothing logged since fromHour
+  for (byte h = fromHour; h < 24; h++) if (index.hourBlock[h]) { start = (unsigned long) index.hourBlock[h] * logBlockSize; break; }
+  
+  PgmClientPrintln(client, "HTTP/1.1 200 OK");
+  PgmClientPrint(client, "Server: Arduino/");
+  client.println(arduinoMe);
+  PgmClientPrintln(client, "Content-Type: application/octet-stream");
+  PgmClientPrint(client, "Content-Length: ");
+  client.println(file.fileSize() - start);
+  client.println();
+  
+  file.seekSet(start);
+  webSendFile(&file, file.fileSize() - start);
+}
+
 // ******** Evaluation array read/write ******************
 
 unsigned int evalGet (byte evalIdx, byte type) { return evalAccess (evalIdx, type, NULL, readFlag); }
 void evalPut (byte evalIdx, byte type, unsigned int value) { evalAccess (evalIdx, type, value, writeFlag); }
 
 unsigned int evalAccess(byte evalIdx, byte type, unsigned int value, int flag) {            // Get and Put values from evalArray
-  static unsigned long evalArray[maxEvals];                 // Union of bytes containing a, b, dest, exp; or len, ptr, dest, exp (for lists).  Choice determined by calcType
-  static unsigned int turnOffArray[maxEvals/16];            // Bit array indicating how to handle result of evaluation - 1 = if result == TRUE then write FALSE to destination
                                                      // Ensure long constants are explicitly typed - http://www.arduino.cc/cgi-bin/yabb2/YaBB.pl?num=1260807970
   const unsigned long maskA = 0xff000000UL;          // A = first argument, 8 bit index into deviceMap (MSB = 0), or variable (MSB = 1)
   const unsigned long maskB = 0x00ff0000UL;          // B = second argument, 8 bit index into deviceMap (MSB = 0), or variable (MSB = 1)
@@ -1541,7 +2766,7 @@ unsigned int evalAccess(byte evalIdx, byte type, unsigned int value, int flag) {
   unsigned long mask;
   unsigned int offset;
   
-  if (evalIdx > maxEvals) Serial.println("Evals out of bounds");
+  if (evalIdx > maxEvals) PgmPrintln("Evals out of bounds");
   
   switch (type) {
     case valA:       mask = maskA; offset = offsetA; break;
@@ -1552,7 +2777,7 @@ unsigned int evalAccess(byte evalIdx, byte type, unsigned int value, int flag) {
     case valDest:    mask = maskDest; offset = offsetDest; break; 
     case valCalc:    mask = maskCalc; offset = offsetCalc; break;
     case valExp:     mask = maskExp; offset = offsetExp; break;  
-    default: Serial.println("Unknown type (expUpdate)");
+    default: PgmPrintln("Unknown type (expUpdate)");
   }
   
   if (flag == readFlag) return (type == valTurnOff) ? (mask & turnOffArray[evalIdx / 16]) >> offset : (unsigned int) ((evalArray[evalIdx] & mask ) >> offset); 
@@ -1591,26 +2816,26 @@ unsigned int valTranslate(char *valTypeChar, unsigned int valTypeIdx, byte valCo
   switch (valConst) {
     case valCalc:
       switch (convType) {
-        case valToChar:  if (valTypeIdx > numCalcs) Serial.println("Calc idx OF"); else strcpy (valTypeChar, calcTypes[valTypeIdx]);   
-        case valToInt:   for (int j=0; j < numCalcs; j++) if (strstr(calcTypes[j], valTypeChar)) return j; Serial.println("Calc NF"); break;
-        default: Serial.println("Bad C");
+        case valToChar:  if (valTypeIdx > numCalcs) PgmPrintln("Calc idx OF"); else strcpy (valTypeChar, calcTypes[valTypeIdx]);   
+        case valToInt:   for (int j=0; j < numCalcs; j++) if (strstr(calcTypes[j], valTypeChar)) return j; PgmPrintln("Calc NF"); break;
+        default: PgmPrintln("Bad C");
       }
       break;
     case valExp:
       switch (convType) {
-        case valToChar:  if (valTypeIdx > numExps) Serial.println("Exp idx OF"); else return (unsigned int) expTypes[valTypeIdx];   
-        case valToInt:   for (int j=0; j < numExps; j++) if (expTypes[j] == valTypeChar[0]) return j; Serial.println("Exp NF"); break;
-        default: Serial.println("Bad E");
+        case valToChar:  if (valTypeIdx > numExps) PgmPrintln("Exp idx OF"); else return (unsigned int) expTypes[valTypeIdx];   
+        case valToInt:   for (int j=0; j < numExps; j++) if (expTypes[j] == valTypeChar[0]) return j; PgmPrintln("Exp NF"); break;
+        default: PgmPrintln("Bad E");
       }
       break;
     case valListExp:
       switch (convType) {
-        case valToChar:  if (valTypeIdx > numListExps) Serial.println("Exp list idx OF"); else return (unsigned int) listExpTypes[valTypeIdx];   
-        case valToInt:   for (int j=0; j < numListExps; j++) if (listExpTypes[j] == valTypeChar[0]) return j; Serial.println("List Exp NF"); break;
-        default: Serial.println("Bad LE");
+        case valToChar:  if (valTypeIdx > numListExps) PgmPrintln("Exp list idx OF"); else return (unsigned int) listExpTypes[valTypeIdx];   
+        case valToInt:   for (int j=0; j < numListExps; j++) if (listExpTypes[j] == valTypeChar[0]) return j; PgmPrintln("List Exp NF"); break;
+        default: PgmPrintln("Bad LE");
       }
       break;
-    default: Serial.println("Unknown valConst");
+    default: PgmPrintln("Unknown valConst");
   }
 }
 
@@ -1621,9 +2846,7 @@ byte argGet(unsigned int argIdx) { return argAccess (argIdx, NULL, readFlag); }
 void argPut(unsigned int argIdx, byte value) { argAccess (argIdx, value, writeFlag); }
 
 unsigned int argAccess(unsigned int argIdx, byte value, int flag) {            // Get and Put values from argArray
-  static byte argArray[maxArgs];                            // Ordered array of arguments to be evaluated for && or ||; args are indexes into evalArray 
-                                                            // maskPtr indexes the start argument; maskLen is the number of arguments
-  if (argIdx > maxArgs) Serial.println("Args out of bounds");
+  if (argIdx > maxArgs) PgmPrintln("Args out of bounds");
   
   if (flag == readFlag) return argArray[argIdx];
   else argArray[argIdx] = value;
@@ -1649,6 +2872,35 @@ unsigned int dhmMake(unsigned int dhmDay, unsigned int dhmHour, unsigned int dhm
   dhmPut(&result, valMinute, dhmMinute);
   return result;
 }
+unsigned int dhmBetween(unsigned int dhmValA, unsigned int dhmValB) {     // True if now is between A and B on any of the days given by A
+  unsigned int result = 0, start = 1, end = 0, dhmDay = dhmGet(dhmValA, valDay), timeNow = dhmNow();
+  
+  switch (dhmDay) {
+    case 0:        start = 1; end = 7; break;        // Daily
+    case 1:                                          // Sun
+    case 2:                                          // Mon
+    case 3:                                          // Tue
+    case 4:                                          // Wed
+    case 5:                                          // Thu
+    case 6:                                          // Fri
+    case 7:        start = end = dhmDay; break;      // Sat
+    case 8:        start = 2; end = 5; break;        // Mon-Thu
+    case 9:        start = 2; end = 6; break;        // Mon-Fri
+    case 10:       start = 7; end = 0; break;        // Weekend
+    default:       PgmPrintln("Bad dhmDay"); return 0;
+  }
+  for (int i = start; i <= ((end) ? end : 7); i++) {
+    dhmPut (&dhmValA, valDay, i);
+    dhmPut (&dhmValB, valDay, i);
+    if (result = (timeNow >= dhmValA && timeNow <= dhmValB)) break;
+  }
+  if (end == 0 && result == 0) {                          // If Sun of weekend and dhmNow not on Sat
+    dhmPut (&dhmValA, valDay, 1);
+    dhmPut (&dhmValB, valDay, 1);
+    result = timeNow >= dhmValA && timeNow <= dhmValB;
+  }
+  return result;
+}
 
 unsigned int dhmAccess(unsigned int *dhmVal, byte type, unsigned int value, int flag) {            // Get and Put values from evalArray
   unsigned int mask, offset;
@@ -1659,10 +2911,10 @@ unsigned int dhmAccess(unsigned int *dhmVal, byte type, unsigned int value, int
   const unsigned int maskMin = B111111;                            // 6 bits: 0-59 are minutes
   
   switch (type) {
-    case valDay:   mask = maskDay; offset = offsetDay; if (value > 10) Serial.println("Day > 10"); break;
-    case valHour:  mask = maskHour; offset = offsetHour; if (value > 23) Serial.println("Hour > 23"); break; 
-    case valMinute:   mask = maskMin; offset = 0; if (value > 59) Serial.println("Mins > 59"); break;
-    default: Serial.print("Unknown type (DHM) = "); Serial.println(type, HEX);
+    case valDay:   mask = maskDay; offset = offsetDay; if (value > 10) PgmPrintln("Day > 10"); break;
+    case valHour:  mask = maskHour; offset = offsetHour; if (value > 23) PgmPrintln("Hour > 23"); break; 
+    case valMinute:   mask = maskMin; offset = 0; if (value > 59) PgmPrintln("Mins > 59"); break;
+    default: PgmPrint("Unknown type (DHM) = "); Serial.println(type, HEX);
   }
   
   if (flag == readFlag) return (unsigned int) (((*dhmVal) & mask ) >> offset);
@@ -1689,7 +2941,7 @@ void initialiseDevices() {
           tempSensor[tempSensorIdx].begin();      // Initialise One-Wire and set resolution of each device
           numTempSensors = tempSensor[tempSensorIdx].getDeviceCount();  
           if (numTempSensors > MAXTEMPDEVICES) {
-            Serial.print("Max temp devices per pin exceeded - found: ");
+            PgmPrint("Max temp devices per pin exceeded - found: ");
             Serial.println(numTempSensors);
             numTempSensors = MAXTEMPDEVICES;
           }
@@ -1697,11 +2949,11 @@ void initialiseDevices() {
             if(tempSensor[tempSensorIdx].getAddress(tempDeviceAddress[tempSensorIdx], i)) { 
               tempSensor[tempSensorIdx].setResolution(tempDeviceAddress[tempSensorIdx], TEMPERATURE_PRECISION);
             }
-            else Serial.print("Unable to get address");
+            else PgmPrint("Unable to get address");
           } 
           tempSensor[tempSensorIdx].setWaitForConversion(false);      // Allows async operation to speed things up
           
-          if (tempSensorIdx < maxTempSensors) tempSensorIdx++; else Serial.println("Temp sensor limit reached");
+          if (tempSensorIdx < maxTempSensors) tempSensorIdx++; else PgmPrintln("Temp sensor limit reached");
         }
         else pinMode(mapGet(deviceIdx, valPin), INPUT);      // All other sensors are inputs (digital or analogue)
       }
@@ -1718,6 +2970,9 @@ void initialiseDevices() {
   getSensorReading[5] = getSensPresence;
   getSensorReading[6] = getSensIButton;
   for (int i=7; i < maxSensorTypes; i++) getSensorReading[i] = getSensOpen;
+  
+  // Event sensors: take the current reading, then catch each change by interrupt
+  for (deviceIdx = 1; deviceIdx < numDevices; deviceIdx++) if (isEventSensor(deviceIdx)) attachEventSensor(deviceIdx);
    
   // Initialise time  
   setSyncInterval(const_NTPRefreshInterval);
@@ -1766,8 +3021,8 @@ unsigned int getSensLight (unsigned int pin, unsigned int handler) {
   return (unsigned int) analogValue;
 }
 
-unsigned int getSensMotion (unsigned int pin, unsigned int handler) {
-  return 1;
+unsigned int getSensMotion (unsigned int pin, unsigned int handler) {      // ePIR MD pin - low on motion
+  return (unsigned int) digitalRead(pin) == 0;
 }
 
 unsigned int getSensPresence (unsigned int pin, unsigned int handler) {
@@ -1785,11 +3040,90 @@ unsigned int getSensOpen (unsigned int pin, unsigned int handler) {
 }
 
 
+// ************* Event sensors - pin change interrupts *****************
+
+char pcintGroup(byte pin) {        // Which of PCINT0_vect..PCINT2_vect serves pin; -1 if none
+  byte port = digitalPinToPort(pin);
+  
+  for (byte group = 0; group < numPCGroups; group++) {
+    if (port == pcPort[group]) return ((byte)(digitalPinToBitMask(pin) << pcShift[group])) ? group : -1;      // PJ7 has no PCINT
+  }
+  return -1;
+}
+
+boolean isEventSensor (byte deviceIdx) {
+  return devSensor(deviceIdx) && devArduino[deviceIdx] == arduinoMe && devPin[deviceIdx] != pinNoOp &&
+         (indSensorEvent & (1 << devType(deviceIdx))) && pcintGroup(devPin[deviceIdx]) >= 0;
+}
+
+void attachEventSensor (byte deviceIdx) {
+  byte pin = devPin[deviceIdx], group = pcintGroup(pin), bitMask = digitalPinToBitMask(pin), bit = 0;
+  struct pcGroup *g = &pcGroups[group];
+  byte oldSREG = SREG;
+  
+  while (!(bitMask & (1 << bit))) bit++;
+  stackPush(deviceIdx, getSensorReading[devType(deviceIdx)](pin, devHandler[deviceIdx]));
+  statusPut(deviceIdx, valStatusStable);
+  
+  cli();
+  g->pinReg = portInputRegister(digitalPinToPort(pin));
+  g->deviceIdx[bit] = deviceIdx;
+  g->mask |= bitMask;
+  g->lastLevel = *g->pinReg;
+  (&PCMSK0)[group] |= bitMask << pcShift[group];        // PCMSK0..2 are consecutive
+  PCIFR = 1 << group;                                   // Clear any stale flag
+  PCICR |= 1 << group;
+  SREG = oldSREG;
+}
+
+void pcintService(byte group) {        // Queue a reading for each event sensor in group that has changed
+  struct pcGroup *g = &pcGroups[group];
+  byte level = *g->pinReg;
+  byte changed = (level ^ g->lastLevel) & g->mask;
+  
+  g->lastLevel = level;
+  for (byte bit = 0; changed; bit++, changed >>= 1) {
+    if ((changed & 1) && !sensorEvents.put(g->deviceIdx[bit], (level & (1 << bit)) == 0)) {    // Active low
+      g->lastLevel ^= 1 << bit;                          // Still differs, so pcintResync queues it
+      pcintLost = true;
+    }
+  }
+}
+
+void pcintResync() {        // Queue the changes pcintService couldn't, once handleEvents has emptied sensorEvents
+  byte oldSREG = SREG;
+  
+  pcintLost = false;
+  for (byte group = 0; group < numPCGroups; group++) {
+    if (!pcGroups[group].mask) continue;
+    cli();
+    pcintService(group);
+    SREG = oldSREG;
+  }
+}
+
+ISR(PCINT0_vect) { pcintService(0); }
+ISR(PCINT1_vect) { pcintService(1); }
+ISR(PCINT2_vect) { pcintService(2); }
+
+
+void clientPrint_P(Client client, PGM_P str, boolean newLine) {        // A packet per 32 bytes, so headers go whole
+  char chunk[32];
+  byte len;
+  char c;
+
+  do {
+    for (len = 0; len < sizeof(chunk) && (c = pgm_read_byte(str)); len++, str++) chunk[len] = c;
+    if (len) client.write((uint8_t*) chunk, len);
+  } while (c);
+  if (newLine) client.println();
+}
+
 void reply404(Client client) {
-  client.println("HTTP/1.1 404 Not Found");
-  client.println("Content-Type: text/html");
+  PgmClientPrintln(client, "HTTP/1.1 404 Not Found");
+  PgmClientPrintln(client, "Content-Type: text/html");
   client.println();
-  client.println("<h2>File Not Found!</h2>");
+  PgmClientPrintln(client, "<h2>File Not Found!</h2>");
 }
 
 void stopClient(Client client) {
@@ -1814,6 +3148,29 @@ void stolower(char *s) {
             *s = 'a' + (*s - 'A');
 }
 
+// ************* RAM use - see RAM BUDGET *****************
+
+void ramPaintStack() {        // Fill free RAM, from the end of the heap to just below this frame, with ramPaint
+  extern int __bss_end;
+  extern int *__brkval;
+  byte *p = (__brkval) ? (byte*) __brkval : (byte*) &__bss_end;
+  byte *sp = (byte*) &p;
+  
+  while (p < sp - 16) *p++ = ramPaint;
+}
+
+int ramLowWater() {        // Paint still untouched above the heap - free RAM at the deepest the stack has been since ramPaintStack
+  extern int __bss_end;
+  extern int *__brkval;
+  byte *p = (__brkval) ? (byte*) __brkval : (byte*) &__bss_end;
+  byte *sp = (byte*) &p;
+  int n = 0;
+  
+  while (p + n < sp && p[n] == ramPaint) n++;
+  return n;
+}
+
+
 /***************** TIME STUFF - FROM TimeNTP *****************/
 
 void digitalClockDisplay(time_t tm){
@@ -1821,18 +3178,18 @@ void digitalClockDisplay(time_t tm){
  Serial.print(hour(tm));
  printDigits(minute(tm));
  printDigits(second(tm));
- Serial.print(" ");
+ PgmPrint(" ");
  Serial.print(day(tm));
- Serial.print(" ");
+ PgmPrint(" ");
  Serial.print(month(tm));
- Serial.print(" ");
+ PgmPrint(" ");
  Serial.print(year(tm));
  Serial.println();
 }
 
 void printDigits(int digits){
  // utility function for digital clock display: prints preceding colon and leading 0
- Serial.print(":");
+ PgmPrint(":");
  if(digits < 10) Serial.print('0');
  Serial.print(digits);
 }
@@ -1863,10 +3220,10 @@ unsigned long getNtpTime() {
       epoch = secsSince1900 - seventyYears;
       
       // do some credibility tests
-      if (epoch < secsSince1970 || epoch > secsToExpiry) { epoch = 0; sendLog("Wild time"); }   // Basic test - check it's after this software was built and before the end of time
+      if (epoch < secsSince1970 || epoch > secsToExpiry) { epoch = 0; PgmSendLog("Wild time"); }   // Basic test - check it's after this software was built and before the end of time
       else if (epoch <= prevEpoch && ++numGoes < 8) {       // Fine-grain test - check it's after the previous time, but only give it 8 goes just in case a previous reading was artifically high
         epoch = prevEpoch + (unsigned long)const_NTPRefreshInterval; 
-        sendLog("Time travel"); 
+        PgmSendLog("Time travel"); 
       }  
       else {        // Assume the time is valid
         // Set previous time to now
@@ -1876,7 +3233,7 @@ unsigned long getNtpTime() {
     }
   }
   
-  if (epoch == 0) Serial.println("No response from timeserver");
+  if (epoch == 0) PgmPrintln("No response from timeserver");
   return epoch;   // return 0 if unable to get the time
 }  
 
@@ -1914,7 +3271,7 @@ void printTemp(float tempC, char *s) {
     int tempCInt = int(tempC);
     int tempCFrac = int(tempC * 100) - (tempCInt * 100);
   
-    sprintf(s,"%d.%02d c",tempCInt,tempCFrac);
+    sprintf_P(s, PSTR("%d.%02d c"),tempCInt,tempCFrac);
 }
   
 void switchRelay(int ledPin) {
@@ -1922,12 +3279,12 @@ void switchRelay(int ledPin) {
 
      if (ledState == 1) {
           digitalWrite(ledPin,LOW);
-          Serial.println("Switching heating off");
+          PgmPrintln("Switching heating off");
           ledState = 0;
         }
         else {
           digitalWrite (ledPin,HIGH);
-          Serial.println("Switching heating on");
+          PgmPrintln("Switching heating on");
           ledState = 1;
         }
         return;
@@ -1991,4 +3348,32 @@ void printRef (byte deviceIdx) {
 
   void sendLog (char *buffer) { 
     UdpLog.sendPacket (buffer, logIP, UdpLogPort);
-  }
+  }
+
+#if DEBUGPROFILE
+void sendProfile() {          // Report each probe in uS - count, mean, max (with tag of slowest) & 50/90/99th percentiles - then reset
+  const char *probeNames[numProbes] = { "Beat", "Sens", "Deci", "Act", "Dev", "Eval", "Web", "Evnt" };
+  PROFILER::PROBE *p;
+  
+  for (byte probe = 0; probe < numProbes; probe++) {
+    p = &profiler.probes[probe];
+    if (p->count == 0) continue;
+    sprintf_P(logBuffer, PSTR("%s n=%lu av=%lu mx=%lu #%u\n"), probeNames[probe], p->count, 
+            (unsigned long)(p->total / p->count) / CYCLESPERUS, p->max / CYCLESPERUS, p->maxTag);
+    sendLog(logBuffer);
+    sprintf_P(logBuffer, PSTR("%s 50/90/99%%=%lu/%lu/%lu\n"), probeNames[probe], profiler.percentile(probe, 50) / CYCLESPERUS, 
+            profiler.percentile(probe, 90) / CYCLESPERUS, profiler.percentile(probe, 99) / CYCLESPERUS);
+    sendLog(logBuffer);
+  }
+  
+  // Worst heartbeat as share of the heartbeat budget
+  sprintf_P(logBuffer, PSTR("Beat max = %lu%% of %ds\n"), profiler.probes[probeHeartbeat].max / (F_CPU / 100) / heartBeatSecs, heartBeatSecs);
+  sendLog(logBuffer);
+  sprintf_P(logBuffer, PSTR("Events dropped = %u\n"), sensorEvents.overflows());
+  sendLog(logBuffer);
+  sprintf_P(logBuffer, PSTR("Log dropped = %u\n"), logDropped);
+  sendLog(logBuffer);
+  
+  for (byte probe = 0; probe < numProbes; probe++) profiler.reset(probe);
+}
+#endif
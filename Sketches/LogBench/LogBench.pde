@@ -0,0 +1,109 @@
+/* Benchmark of SD card writes for the reading log against the 100-byte reads used to serve files
+
+  Writes benchBlocks blocks to BENCH.BIN the way logWriteBlock does in Controller - seekSet to a block boundary,
+  write a whole 512-byte block, then sync - and rewrites one block in place, as happens to a part-filled block
+  every logSyncFreq heartbeats.  The file is then read back with const_SDCard_BUFSIZ (100-byte) reads, as
+  serveHTTPFile and serveLog do, and again with 512-byte reads.
+
+  Each step reports over Serial:
+    - KB/s:      sustained rate over the step
+    - slowest:   the longest single seekSet/write/sync or read, in uS
+
+  Uses the same card setup as Controller (SPI_FULL_SPEED, CS on pin 4).  BENCH.BIN is left on the card
+
+**************************/
+
+
+#include <SdFat.h>
+#include <SdFatUtil.h>
+
+const int blockSize = 512;
+const int benchBlocks = 200;                  // 100KB; about 4 days of one reading a minute
+const int smallRead = 100;                    // const_SDCard_BUFSIZ in Controller
+
+Sd2Card card;
+SdVolume volume;
+SdFile root;
+SdFile benchFile;
+byte buffer[blockSize];
+
+unsigned long stepStarted;                    // micros() at start of step
+unsigned long slowest;                        // uS; slowest call this step
+
+void setup(void) {
+  Serial.begin(9600);
+  PgmPrint("Free RAM: ");
+  Serial.println(FreeRam());
+
+  if (!card.init(SPI_FULL_SPEED, 4) || !volume.init(&card) || !root.openRoot(&volume)) { Serial.println("SD init failed"); return; }
+  if (!benchFile.open(root, "BENCH.BIN", O_RDWR | O_CREAT | O_TRUNC)) { Serial.println("Can't open BENCH.BIN"); return; }
+  for (int i = 0; i < blockSize; i++) buffer[i] = i;
+
+  // Append, as each block is filled
+  startStep();
+  for (int block = 0; block < benchBlocks; block++) {
+    unsigned long callStarted = micros();
+    benchFile.seekSet((unsigned long) block * blockSize);
+    benchFile.write(buffer, blockSize);
+    benchFile.sync();
+    endCall(callStarted);
+  }
+  report("Append 512 + sync", (unsigned long) benchBlocks * blockSize);
+
+  // Rewrite last block in place, as a part-filled block is kept on the card
+  startStep();
+  for (int i = 0; i < benchBlocks; i++) {
+    unsigned long callStarted = micros();
+    benchFile.seekSet((unsigned long) (benchBlocks - 1) * blockSize);
+    benchFile.write(buffer, blockSize);
+    benchFile.sync();
+    endCall(callStarted);
+  }
+  report("Rewrite 512 + sync", (unsigned long) benchBlocks * blockSize);
+
+  readStep("Read 100", smallRead);
+  readStep("Read 512", blockSize);
+
+  benchFile.close();
+  Serial.println("Done");
+}
+
+void readStep(const char *name, int readSize) {
+  unsigned long bytes = 0;
+  int16_t byteCnt;
+
+  benchFile.seekSet(0);
+  startStep();
+  do {
+    unsigned long callStarted = micros();
+    byteCnt = benchFile.read(buffer, readSize);
+    endCall(callStarted);
+    if (byteCnt > 0) bytes += byteCnt;
+  } while (byteCnt > 0);
+  report(name, bytes);
+}
+
+void startStep() {
+  slowest = 0;
+  stepStarted = micros();
+}
+
+void endCall(unsigned long callStarted) {
+  unsigned long took = micros() - callStarted;
+
+  if (took > slowest) slowest = took;
+}
+
+void report(const char *name, unsigned long bytes) {
+  unsigned long tookMS = (micros() - stepStarted) / 1000 + 1;
+
+  Serial.print(name);
+  Serial.print(": ");
+  Serial.print(bytes * 1000 / 1024 / tookMS);
+  Serial.print(" KB/s, slowest = ");
+  Serial.print(slowest);
+  Serial.println("us");
+}
+
+void loop(void) {
+}
@@ -14,6 +14,10 @@
  *	  Error only material at very short durations (1us == 16-1 clockticks, so 0.937us)
  *  - Amended DDR assignment (in pwm()) to reflect Mega
  *  - Amended read() to replace switch statement with array lookup
+ *  - Added startTicking() to run free in normal mode, with overflows extending the count to 32 bits (ticks()),
+ *    and setCompare() to raise the compare A interrupt at a given count - used by WAKEUP for absolute wake times
+ *  - Added attachOverflowInterrupt() to call a function on each overflow when free-running, without touching the period
+ *  - ticks() and setCompare() keep SREG in a local, as both can be called from an ISR as well as the main program
  *  This is free software. You can redistribute it and/or modify it under
  *  the terms of Creative Commons Attribution 3.0 United States License. 
  *  To view a copy of this license, visit http://creativecommons.org/licenses/by/3.0/us/ 
@@ -32,7 +36,13 @@ TimerOne Timer1;              // preinstatiate
 
 ISR(TIMER1_OVF_vect)          // interrupt service routine that wraps a user defined function supplied by attachInterrupt
 {
-  Timer1.isrCallback();
+  Timer1.overflows++;                                   // AR - extends count when free-running
+  if (Timer1.isrCallback) Timer1.isrCallback();
+}
+
+ISR(TIMER1_COMPA_vect)        // AR - wraps function supplied by attachCompareInterrupt
+{
+  Timer1.compareCallback();
 }
 
 
@@ -142,6 +152,62 @@ void TimerOne::start()  				// AR modified
 }
 
 
+void TimerOne::startTicking()          // AR added - free-running count in normal mode, prescale TICKPRESCALE
+{
+  oldSREG = SREG;
+  cli();
+  TCCR1A = 0;                           // Normal mode, output pins disconnected
+  TCCR1B = 0;                           // Stop the clock while setting up
+  TCNT1 = 0;
+  overflows = 0;
+  TIFR1 = _BV(TOV1) | _BV(OCF1A);       // Clear any stale flags
+  TIMSK1 = _BV(TOIE1);                  // Overflow interrupt extends the count
+  clockSelectBits = _BV(CS11) | _BV(CS10);   // prescale by /64
+  TCCR1B = clockSelectBits;
+  SREG = oldSREG;
+}
+
+unsigned long TimerOne::ticks()         // AR added - 32 bit count since startTicking()
+{
+  unsigned int high, low;
+  char sreg = SREG;                     // Not oldSREG - an ISR calling this between save and cli() would leave interrupts off
+  
+  cli();
+  high = overflows;
+  low = TCNT1;
+  if ((TIFR1 & _BV(TOV1)) && low < 0x8000) high++;        // Overflowed but not yet serviced (interrupts are off)
+  SREG = sreg;
+  
+  return ((unsigned long)high << 16) | low;
+}
+
+void TimerOne::attachOverflowInterrupt(void (*isr)())    // AR added - unlike attachInterrupt(), leaves period and mode alone
+{
+  isrCallback = isr;
+}
+
+void TimerOne::attachCompareInterrupt(void (*isr)())     // AR added
+{
+  compareCallback = isr;
+}
+
+void TimerOne::setCompare(unsigned int count)            // AR added - raise compare A interrupt when low word of ticks() reaches count
+{
+  char sreg = SREG;
+  
+  cli();
+  OCR1A = count;
+  TIFR1 = _BV(OCF1A);                   // Clear any match already flagged
+  TIMSK1 |= _BV(OCIE1A);
+  SREG = sreg;
+}
+
+void TimerOne::detachCompareInterrupt()                  // AR added
+{
+  TIMSK1 &= ~_BV(OCIE1A);
+}
+
+
 void TimerOne::stop()
 {
   TCCR1B &= ~(_BV(CS10) | _BV(CS11) | _BV(CS12));          // clears all clock selects bits
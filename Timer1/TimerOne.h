@@ -5,6 +5,8 @@
  *  Modified June 2009 by Michael Polli and Jesse Tane to fix a bug in setPeriod() which caused the timer to stop
  *  Modified June 2011 by Lex Talionis to add a function to read the timer
  *  Modified Oct 2011 by Andrew Richards to add startBottom() function
+ *  Modified by Andrew Richards to add free-running 32 bit tick count and compare-match interrupt
+ *  Modified by Andrew Richards to add overflow callback when free-running
  *
  *  This is free software. You can redistribute it and/or modify it under
  *  the terms of Creative Commons Attribution 3.0 United States License. 
@@ -20,6 +22,7 @@
 #include <avr/interrupt.h>
 
 #define RESOLUTION 65536    // Timer1 is 16 bit
+#define TICKPRESCALE 64     // Prescale when free-running (startTicking); 4us per tick @ 16MHz
 
 class TimerOne
 {
@@ -29,6 +32,7 @@ class TimerOne
     unsigned int pwmPeriod;
     unsigned char clockSelectBits;
     char oldSREG;
+    volatile unsigned int overflows;      // Overflows since startTicking(); high word of ticks()
 
     // methods
     void initialize(long microseconds=1000000);
@@ -43,7 +47,14 @@ class TimerOne
     void detachInterrupt();
     void setPeriod(long microseconds);
     void setPwmDuty(char pin, int duty);
+    void startTicking();
+    unsigned long ticks();
+    void attachOverflowInterrupt(void (*isr)());
+    void attachCompareInterrupt(void (*isr)());
+    void setCompare(unsigned int count);
+    void detachCompareInterrupt();
     void (*isrCallback)();
+    void (*compareCallback)();
     
   private:
   
@@ -0,0 +1,43 @@
+#!/bin/sh
+# gzroot - precompress the web root for the Controller sketch
+#
+# Usage:   gzroot.sh <web root>          eg the mounted SD card, or the folder copied to it
+#
+# For each text file (htm, css, js, jso, xml, ico) writes a gzipped copy of the same name in a GZ folder
+# alongside it - index.htm -> GZ/index.htm, css/site.css -> css/GZ/site.css - as 8.3 names leave no room
+# for a .gz extension.  handleHTTPGet sends the copy, with Content-Encoding: gzip, to browsers that accept it.
+# Copies no smaller than the original are dropped, as are copies whose original has gone.
+#
+# Rerun after any change to the web root, or browsers will be sent the old copy.  LOG is left alone
+
+if [ $# -ne 1 ] || [ ! -d "$1" ]; then
+  echo "Usage: gzroot.sh <web root>" >&2
+  exit 2
+fi
+
+find "$1" -type d ! -name GZ ! -path "*/GZ/*" ! -name LOG ! -path "*/LOG/*" | while read -r dir; do
+  for file in "$dir"/*; do
+    [ -f "$file" ] || continue
+    name=$(basename "$file")
+    case $(echo "$name" | tr 'A-Z' 'a-z') in
+      *.htm|*.css|*.js|*.jso|*.xml|*.ico) ;;
+      *) continue ;;
+    esac
+
+    mkdir -p "$dir/GZ"
+    gzip -9 -n -c "$file" > "$dir/GZ/$name"
+    if [ $(wc -c < "$dir/GZ/$name") -ge $(wc -c < "$file") ]; then
+      rm "$dir/GZ/$name"
+    else
+      echo "$file: $(wc -c < "$file") -> $(wc -c < "$dir/GZ/$name")"
+    fi
+  done
+
+  if [ -d "$dir/GZ" ]; then
+    for copy in "$dir/GZ"/*; do
+      [ -f "$copy" ] && [ ! -f "$dir/$(basename "$copy")" ] && rm "$copy"
+    done
+    rmdir "$dir/GZ" 2>/dev/null
+  fi
+done
+exit 0
@@ -0,0 +1,3 @@
+/* Host emulation of the Arduino 0022 core's WConstants.h - see hostemu.h.  Constants are all in WProgram.h here */
+
+#include "WProgram.h"
@@ -0,0 +1,149 @@
+/* Host emulation of the Arduino 0022 core (WProgram.h, wiring.h and HardwareSerial.h) - see hostemu.h
+
+  Enough of the core for the libraries to build natively.  Timing comes from the cycle clock: millis() and micros()
+  read it and delay() runs it on (timers and interrupts included).  Pins are the port, DDR and PIN bytes of
+  avr/io.h, mapped as on the Mega.  Serial goes to stdout.  No other core function costs any cycles
+*/
+
+#ifndef WProgram_h
+#define WProgram_h
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "binary.h"
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+#define true 0x1
+#define false 0x0
+
+#define PI 3.1415926535897932384626433832795
+#define HALF_PI 1.5707963267948966192313216916398
+#define TWO_PI 6.283185307179586476925286766559
+#define DEG_TO_RAD 0.017453292519943295769236907684886
+#define RAD_TO_DEG 57.295779513082320876798154814105
+
+#define SERIAL  0x0
+#define DISPLAY 0x1
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define INTERNAL1V1 2
+#define INTERNAL2V56 3
+#define DEFAULT 1
+#define EXTERNAL 0
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+#define BYTE 0
+
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#define abs(x) ((x)>0?(x):-(x))
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+#define radians(deg) ((deg)*DEG_TO_RAD)
+#define degrees(rad) ((rad)*RAD_TO_DEG)
+#define sq(x) ((x)*(x))
+
+#define interrupts() sei()
+#define noInterrupts() cli()
+
+#define clockCyclesPerMicrosecond() ( F_CPU / 1000000L )
+#define clockCyclesToMicroseconds(a) ( (a) / clockCyclesPerMicrosecond() )
+#define microsecondsToClockCycles(a) ( (a) * clockCyclesPerMicrosecond() )
+
+#define lowByte(w) ((uint8_t) ((w) & 0xff))
+#define highByte(w) ((uint8_t) ((w) >> 8))
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) (bitvalue ? bitSet(value, bit) : bitClear(value, bit))
+#define bit(b) (1UL << (b))
+
+typedef unsigned int word;
+typedef uint8_t boolean;
+typedef uint8_t byte;
+
+uint16_t makeWord(uint16_t w);
+uint16_t makeWord(byte h, byte l);
+#define word(...) makeWord(__VA_ARGS__)
+
+void pinMode(uint8_t, uint8_t);
+void digitalWrite(uint8_t, uint8_t);
+int digitalRead(uint8_t);
+int analogRead(uint8_t);
+void analogWrite(uint8_t, int);
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long);
+void delayMicroseconds(unsigned int us);
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout = 1000000L);
+
+void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t val);
+uint8_t shiftIn(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder);
+
+void attachInterrupt(uint8_t, void (*)(void), int mode);
+void detachInterrupt(uint8_t);
+
+long random(long);
+long random(long, long);
+void randomSeed(unsigned int);
+long map(long, long, long, long, long);
+
+class HardwareSerial {
+public:
+  void begin(long);
+  void end();
+  int available(void);
+  int peek(void);
+  int read(void);
+  void flush(void);
+  void write(uint8_t);
+  void write(const char *str);
+  void write(const uint8_t *buffer, size_t size);
+
+  void print(const char[]);
+  void print(char, int = BYTE);
+  void print(unsigned char, int = BYTE);
+  void print(int, int = DEC);
+  void print(unsigned int, int = DEC);
+  void print(long, int = DEC);
+  void print(unsigned long, int = DEC);
+  void print(double, int = 2);
+
+  void println(const char[]);
+  void println(char, int = BYTE);
+  void println(unsigned char, int = BYTE);
+  void println(int, int = DEC);
+  void println(unsigned int, int = DEC);
+  void println(long, int = DEC);
+  void println(unsigned long, int = DEC);
+  void println(double, int = 2);
+  void println(void);
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+extern HardwareSerial Serial3;
+
+#endif
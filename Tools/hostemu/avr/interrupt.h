@@ -0,0 +1,18 @@
+/* Host emulation of <avr/interrupt.h> - see hostemu.h
+
+  ISR() gives the vector C linkage under its avr-libc name, so the model in hostemu.cpp finds it and runs it
+  when its flag and enable are set and SREG's I bit is.  cli() and sei() are charged a cycle each
+*/
+
+#ifndef HostEmu_interrupt_h
+#define HostEmu_interrupt_h
+
+#include <avr/io.h>
+
+void cli();
+void sei();
+
+#define ISR(vector) extern "C" void vector(void); void vector(void)
+#define SIGNAL(vector) ISR(vector)
+
+#endif
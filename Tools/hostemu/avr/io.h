@@ -0,0 +1,571 @@
+/* Host emulation of <avr/io.h> for an ATmega2560 (Arduino Mega) - see hostemu.h
+
+  SREG and the SPI, Timer1 and Timer5 registers are HOSTREG8/HOSTREG16 objects, so each read or write is charged
+  to the cycle clock and passed to the peripheral model in hostemu.cpp.  Ports, DDRs and PINs are plain bytes, as
+  SpiDevice.h takes references to them; writes to the PORTs are still caught, so chip selects can be followed
+*/
+
+#ifndef HostEmu_io_h
+#define HostEmu_io_h
+
+#include <stdint.h>
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+#ifndef __AVR_ATmega2560__
+#define __AVR_ATmega2560__
+#endif
+
+#define _BV(bit) (1 << (bit))
+
+// ****************  MODELLED REGISTERS  ****************
+// Ids index the model's tables; 16 bit registers follow the 8 bit ones
+
+enum {
+  HOSTSREG, HOSTSPCR, HOSTSPSR, HOSTSPDR, HOSTGTCCR,
+  HOSTTCCR1A, HOSTTCCR1B, HOSTTCCR1C, HOSTTIMSK1, HOSTTIFR1,
+  HOSTTCCR5A, HOSTTCCR5B, HOSTTCCR5C, HOSTTIMSK5, HOSTTIFR5,
+  HOSTTCNT1, HOSTICR1, HOSTOCR1A, HOSTOCR1B, HOSTOCR1C,
+  HOSTTCNT5, HOSTICR5, HOSTOCR5A, HOSTOCR5B, HOSTOCR5C,
+  HOSTNUMREGS
+};
+
+unsigned int hostRegRead(uint8_t id);				// Charge the access, then read
+void hostRegWrite(uint8_t id, unsigned int value);	// Charge the access, then write
+
+class HOSTREG8 {
+public:
+  explicit HOSTREG8(uint8_t id) : _id(id) {}
+  operator uint8_t() const { return hostRegRead(_id); }
+  HOSTREG8 &operator=(uint8_t value) { hostRegWrite(_id, value); return *this; }
+  HOSTREG8 &operator=(const HOSTREG8 &reg) { hostRegWrite(_id, (uint8_t)reg); return *this; }
+  HOSTREG8 &operator|=(int bits) { hostRegWrite(_id, hostRegRead(_id) | bits); return *this; }		// Read then write, as in/ori/out
+  HOSTREG8 &operator&=(int bits) { hostRegWrite(_id, hostRegRead(_id) & bits); return *this; }
+  HOSTREG8 &operator^=(int bits) { hostRegWrite(_id, hostRegRead(_id) ^ bits); return *this; }
+private:
+  uint8_t _id;
+};
+
+class HOSTREG16 {
+public:
+  explicit HOSTREG16(uint8_t id) : _id(id) {}
+  operator uint16_t() const { return hostRegRead(_id); }
+  HOSTREG16 &operator=(uint16_t value) { hostRegWrite(_id, value); return *this; }
+  HOSTREG16 &operator=(const HOSTREG16 &reg) { hostRegWrite(_id, (uint16_t)reg); return *this; }
+  HOSTREG16 &operator+=(uint16_t value) { hostRegWrite(_id, hostRegRead(_id) + value); return *this; }
+  HOSTREG16 &operator-=(uint16_t value) { hostRegWrite(_id, hostRegRead(_id) - value); return *this; }
+private:
+  uint8_t _id;
+};
+
+// Defined as themselves, so #ifdef tests (eg #ifdef TCNT5) work as with avr-libc
+extern HOSTREG8 SREG, SPCR, SPSR, SPDR, GTCCR;
+extern HOSTREG8 TCCR1A, TCCR1B, TCCR1C, TIMSK1, TIFR1, TCCR5A, TCCR5B, TCCR5C, TIMSK5, TIFR5;
+extern HOSTREG16 TCNT1, ICR1, OCR1A, OCR1B, OCR1C, TCNT5, ICR5, OCR5A, OCR5B, OCR5C;
+#define SREG SREG
+#define SPCR SPCR
+#define SPSR SPSR
+#define SPDR SPDR
+#define GTCCR GTCCR
+#define TCCR1A TCCR1A
+#define TCCR1B TCCR1B
+#define TCCR1C TCCR1C
+#define TIMSK1 TIMSK1
+#define TIFR1 TIFR1
+#define TCCR5A TCCR5A
+#define TCCR5B TCCR5B
+#define TCCR5C TCCR5C
+#define TIMSK5 TIMSK5
+#define TIFR5 TIFR5
+#define TCNT1 TCNT1
+#define ICR1 ICR1
+#define OCR1A OCR1A
+#define OCR1B OCR1B
+#define OCR1C OCR1C
+#define TCNT5 TCNT5
+#define ICR5 ICR5
+#define OCR5A OCR5A
+#define OCR5B OCR5B
+#define OCR5C OCR5C
+
+// SREG
+#define SREG_I 7
+
+// SPI
+#define SPIE 7
+#define SPE 6
+#define DORD 5
+#define MSTR 4
+#define CPOL 3
+#define CPHA 2
+#define SPR1 1
+#define SPR0 0
+#define SPIF 7
+#define WCOL 6
+#define SPI2X 0
+
+// General timer control
+#define TSM 7
+#define PSRASY 1
+#define PSRSYNC 0
+
+// Timers 1 & 5 (Timer5 bits named as for Timer1)
+#define COM1A1 7
+#define COM1A0 6
+#define COM1B1 5
+#define COM1B0 4
+#define COM1C1 3
+#define COM1C0 2
+#define WGM11 1
+#define WGM10 0
+#define ICNC1 7
+#define ICES1 6
+#define WGM13 4
+#define WGM12 3
+#define CS12 2
+#define CS11 1
+#define CS10 0
+#define ICIE1 5
+#define OCIE1C 3
+#define OCIE1B 2
+#define OCIE1A 1
+#define TOIE1 0
+#define ICF1 5
+#define OCF1C 3
+#define OCF1B 2
+#define OCF1A 1
+#define TOV1 0
+#define COM5A1 7
+#define COM5A0 6
+#define COM5B1 5
+#define COM5B0 4
+#define COM5C1 3
+#define COM5C0 2
+#define WGM51 1
+#define WGM50 0
+#define ICNC5 7
+#define ICES5 6
+#define WGM53 4
+#define WGM52 3
+#define CS52 2
+#define CS51 1
+#define CS50 0
+#define ICIE5 5
+#define OCIE5C 3
+#define OCIE5B 2
+#define OCIE5A 1
+#define TOIE5 0
+#define ICF5 5
+#define OCF5C 3
+#define OCF5B 2
+#define OCF5A 1
+#define TOV5 0
+
+// Vector numbers, as in avr-libc; used to pick ISR statistics (hostIsrStats)
+#define TIMER1_COMPA_vect_num 17
+#define TIMER1_COMPB_vect_num 18
+#define TIMER1_COMPC_vect_num 19
+#define TIMER1_OVF_vect_num 20
+#define SPI_STC_vect_num 24
+#define TIMER5_COMPA_vect_num 47
+#define TIMER5_COMPB_vect_num 48
+#define TIMER5_COMPC_vect_num 49
+#define TIMER5_OVF_vect_num 50
+
+// ****************  PORTS  ****************
+// Indexed by the core's port numbers (PA = 1 .. PL = 12; no port I).  PORTs are kept on a page of their own, which
+// hostemu.cpp watches for writes
+
+extern volatile uint8_t hostPortPage[];
+extern volatile uint8_t hostDdrRegs[];
+extern volatile uint8_t hostPinRegs[];
+
+#define PORTA (hostPortPage[1])
+#define DDRA (hostDdrRegs[1])
+#define PINA (hostPinRegs[1])
+#define PORTB (hostPortPage[2])
+#define DDRB (hostDdrRegs[2])
+#define PINB (hostPinRegs[2])
+#define PORTC (hostPortPage[3])
+#define DDRC (hostDdrRegs[3])
+#define PINC (hostPinRegs[3])
+#define PORTD (hostPortPage[4])
+#define DDRD (hostDdrRegs[4])
+#define PIND (hostPinRegs[4])
+#define PORTE (hostPortPage[5])
+#define DDRE (hostDdrRegs[5])
+#define PINE (hostPinRegs[5])
+#define PORTF (hostPortPage[6])
+#define DDRF (hostDdrRegs[6])
+#define PINF (hostPinRegs[6])
+#define PORTG (hostPortPage[7])
+#define DDRG (hostDdrRegs[7])
+#define PING (hostPinRegs[7])
+#define PORTH (hostPortPage[8])
+#define DDRH (hostDdrRegs[8])
+#define PINH (hostPinRegs[8])
+#define PORTJ (hostPortPage[10])
+#define DDRJ (hostDdrRegs[10])
+#define PINJ (hostPinRegs[10])
+#define PORTK (hostPortPage[11])
+#define DDRK (hostDdrRegs[11])
+#define PINK (hostPinRegs[11])
+#define PORTL (hostPortPage[12])
+#define DDRL (hostDdrRegs[12])
+#define PINL (hostPinRegs[12])
+
+#define PORTA0 0
+#define PORTA1 1
+#define PORTA2 2
+#define PORTA3 3
+#define PORTA4 4
+#define PORTA5 5
+#define PORTA6 6
+#define PORTA7 7
+#define DDA0 0
+#define DDA1 1
+#define DDA2 2
+#define DDA3 3
+#define DDA4 4
+#define DDA5 5
+#define DDA6 6
+#define DDA7 7
+#define PINA0 0
+#define PINA1 1
+#define PINA2 2
+#define PINA3 3
+#define PINA4 4
+#define PINA5 5
+#define PINA6 6
+#define PINA7 7
+#define PA0 0
+#define PA1 1
+#define PA2 2
+#define PA3 3
+#define PA4 4
+#define PA5 5
+#define PA6 6
+#define PA7 7
+#define PORTB0 0
+#define PORTB1 1
+#define PORTB2 2
+#define PORTB3 3
+#define PORTB4 4
+#define PORTB5 5
+#define PORTB6 6
+#define PORTB7 7
+#define DDB0 0
+#define DDB1 1
+#define DDB2 2
+#define DDB3 3
+#define DDB4 4
+#define DDB5 5
+#define DDB6 6
+#define DDB7 7
+#define PINB0 0
+#define PINB1 1
+#define PINB2 2
+#define PINB3 3
+#define PINB4 4
+#define PINB5 5
+#define PINB6 6
+#define PINB7 7
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PORTC0 0
+#define PORTC1 1
+#define PORTC2 2
+#define PORTC3 3
+#define PORTC4 4
+#define PORTC5 5
+#define PORTC6 6
+#define PORTC7 7
+#define DDC0 0
+#define DDC1 1
+#define DDC2 2
+#define DDC3 3
+#define DDC4 4
+#define DDC5 5
+#define DDC6 6
+#define DDC7 7
+#define PINC0 0
+#define PINC1 1
+#define PINC2 2
+#define PINC3 3
+#define PINC4 4
+#define PINC5 5
+#define PINC6 6
+#define PINC7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PC7 7
+#define PORTD0 0
+#define PORTD1 1
+#define PORTD2 2
+#define PORTD3 3
+#define PORTD4 4
+#define PORTD5 5
+#define PORTD6 6
+#define PORTD7 7
+#define DDD0 0
+#define DDD1 1
+#define DDD2 2
+#define DDD3 3
+#define DDD4 4
+#define DDD5 5
+#define DDD6 6
+#define DDD7 7
+#define PIND0 0
+#define PIND1 1
+#define PIND2 2
+#define PIND3 3
+#define PIND4 4
+#define PIND5 5
+#define PIND6 6
+#define PIND7 7
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+#define PORTE0 0
+#define PORTE1 1
+#define PORTE2 2
+#define PORTE3 3
+#define PORTE4 4
+#define PORTE5 5
+#define PORTE6 6
+#define PORTE7 7
+#define DDE0 0
+#define DDE1 1
+#define DDE2 2
+#define DDE3 3
+#define DDE4 4
+#define DDE5 5
+#define DDE6 6
+#define DDE7 7
+#define PINE0 0
+#define PINE1 1
+#define PINE2 2
+#define PINE3 3
+#define PINE4 4
+#define PINE5 5
+#define PINE6 6
+#define PINE7 7
+#define PE0 0
+#define PE1 1
+#define PE2 2
+#define PE3 3
+#define PE4 4
+#define PE5 5
+#define PE6 6
+#define PE7 7
+#define PORTF0 0
+#define PORTF1 1
+#define PORTF2 2
+#define PORTF3 3
+#define PORTF4 4
+#define PORTF5 5
+#define PORTF6 6
+#define PORTF7 7
+#define DDF0 0
+#define DDF1 1
+#define DDF2 2
+#define DDF3 3
+#define DDF4 4
+#define DDF5 5
+#define DDF6 6
+#define DDF7 7
+#define PINF0 0
+#define PINF1 1
+#define PINF2 2
+#define PINF3 3
+#define PINF4 4
+#define PINF5 5
+#define PINF6 6
+#define PINF7 7
+#define PF0 0
+#define PF1 1
+#define PF2 2
+#define PF3 3
+#define PF4 4
+#define PF5 5
+#define PF6 6
+#define PF7 7
+#define PORTG0 0
+#define PORTG1 1
+#define PORTG2 2
+#define PORTG3 3
+#define PORTG4 4
+#define PORTG5 5
+#define PORTG6 6
+#define PORTG7 7
+#define DDG0 0
+#define DDG1 1
+#define DDG2 2
+#define DDG3 3
+#define DDG4 4
+#define DDG5 5
+#define DDG6 6
+#define DDG7 7
+#define PING0 0
+#define PING1 1
+#define PING2 2
+#define PING3 3
+#define PING4 4
+#define PING5 5
+#define PING6 6
+#define PING7 7
+#define PG0 0
+#define PG1 1
+#define PG2 2
+#define PG3 3
+#define PG4 4
+#define PG5 5
+#define PG6 6
+#define PG7 7
+#define PORTH0 0
+#define PORTH1 1
+#define PORTH2 2
+#define PORTH3 3
+#define PORTH4 4
+#define PORTH5 5
+#define PORTH6 6
+#define PORTH7 7
+#define DDH0 0
+#define DDH1 1
+#define DDH2 2
+#define DDH3 3
+#define DDH4 4
+#define DDH5 5
+#define DDH6 6
+#define DDH7 7
+#define PINH0 0
+#define PINH1 1
+#define PINH2 2
+#define PINH3 3
+#define PINH4 4
+#define PINH5 5
+#define PINH6 6
+#define PINH7 7
+#define PH0 0
+#define PH1 1
+#define PH2 2
+#define PH3 3
+#define PH4 4
+#define PH5 5
+#define PH6 6
+#define PH7 7
+#define PORTJ0 0
+#define PORTJ1 1
+#define PORTJ2 2
+#define PORTJ3 3
+#define PORTJ4 4
+#define PORTJ5 5
+#define PORTJ6 6
+#define PORTJ7 7
+#define DDJ0 0
+#define DDJ1 1
+#define DDJ2 2
+#define DDJ3 3
+#define DDJ4 4
+#define DDJ5 5
+#define DDJ6 6
+#define DDJ7 7
+#define PINJ0 0
+#define PINJ1 1
+#define PINJ2 2
+#define PINJ3 3
+#define PINJ4 4
+#define PINJ5 5
+#define PINJ6 6
+#define PINJ7 7
+#define PJ0 0
+#define PJ1 1
+#define PJ2 2
+#define PJ3 3
+#define PJ4 4
+#define PJ5 5
+#define PJ6 6
+#define PJ7 7
+#define PORTK0 0
+#define PORTK1 1
+#define PORTK2 2
+#define PORTK3 3
+#define PORTK4 4
+#define PORTK5 5
+#define PORTK6 6
+#define PORTK7 7
+#define DDK0 0
+#define DDK1 1
+#define DDK2 2
+#define DDK3 3
+#define DDK4 4
+#define DDK5 5
+#define DDK6 6
+#define DDK7 7
+#define PINK0 0
+#define PINK1 1
+#define PINK2 2
+#define PINK3 3
+#define PINK4 4
+#define PINK5 5
+#define PINK6 6
+#define PINK7 7
+#define PK0 0
+#define PK1 1
+#define PK2 2
+#define PK3 3
+#define PK4 4
+#define PK5 5
+#define PK6 6
+#define PK7 7
+#define PORTL0 0
+#define PORTL1 1
+#define PORTL2 2
+#define PORTL3 3
+#define PORTL4 4
+#define PORTL5 5
+#define PORTL6 6
+#define PORTL7 7
+#define DDL0 0
+#define DDL1 1
+#define DDL2 2
+#define DDL3 3
+#define DDL4 4
+#define DDL5 5
+#define DDL6 6
+#define DDL7 7
+#define PINL0 0
+#define PINL1 1
+#define PINL2 2
+#define PINL3 3
+#define PINL4 4
+#define PINL5 5
+#define PINL6 6
+#define PINL7 7
+#define PL0 0
+#define PL1 1
+#define PL2 2
+#define PL3 3
+#define PL4 4
+#define PL5 5
+#define PL6 6
+#define PL7 7
+
+#endif
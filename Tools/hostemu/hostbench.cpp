@@ -0,0 +1,418 @@
+/* hostbench - time the libraries' interrupt paths on the host, in simulated cycles
+
+  Build (from Tools/hostemu):
+    g++ -std=gnu++98 -O2 -I. -I../../Wakeup -I../../Timer1 -I../../SPI -I../../Mcp23s17 -I../../HomeAutom -o hostbench \
+        hostbench.cpp hostemu.cpp ../../Wakeup/Wakeup.cpp ../../Timer1/TimerOne.cpp ../../SPI/SpiQueue.cpp ../../Mcp23s17/Mcp23s17.cpp \
+        ../../HomeAutom/HomeAutom.cpp
+  Usage:   hostbench
+
+  MCP23S17::intValid() is run against a fake chip on the SPI bus for each way an interrupt can turn out, at the
+  SPI clocks the Controller might use.  Each result is checked, and the first is also timed through PROFILER (on
+  the emulated Timer5) as a cross-check of the clock.  WAKEUP::timerISR() is timed from its Timer1 compare
+  interrupt with a batch of sleepers falling due together, and the cost of an idle WAKEUP and of the shortest
+  repeating sleeper allowed is measured over a second.  It is timed again waking one sleeper a tick with 0 to
+  MAXSLEEPERS - 1 others asleep, and MAXSLEEPERS one-shot sleepers that put themselves back to sleep for random
+  times must each wake on time and in order of deadline.  As the Calibration example, a sleeper toggles every
+  10mS for 6 simulated hours - past the wrap of Timer1's 32 bit count - with more sleepers added each hour, while
+  loop() holds interrupts off for up to driftHoldUs at random moments (as other interrupts and critical sections
+  would).  The jitter of each interval and the worst drift from 10mS x toggles are reported each hour; drift
+  must stay within the jitter.  As the Priority example, a 1000uS frame sleeper competes with 0 to 8 busy
+  TREAT_AS_ISR sleepers of busyMicros each, at the same priority and then above them.  timerISR must stay within
+  ISRBUDGET plus one busy sleeper, and sleepers that would start over budget must be deferred to runAnyPending()
+  and not dropped.  With priority the frame must be no later than that, and earlier than without once sleepers
+  are deferred.  It can't be on time: busy sleepers armed a tick ahead of it fall due in an interrupt of their own  SPIQUEUE::transferISR() is timed sending two queued transfers
+  to a pair of echo devices, whose replies must come back intact.  Exit status is 1 if any check fails
+
+  Cycles are as counted by hostemu (see hostemu.h): register accesses, SPI bytes and interrupt entry/exit, not the
+  code between them.  So these are floors, good for comparing one version of a library with the next
+**************************/
+
+#include <stdio.h>
+
+#include "hostemu.h"
+#include "SpiDevice.h"
+#include "SpiQueue.h"
+#include "Mcp23s17.h"
+#include "Wakeup.h"
+#include "HomeAutom.h"
+
+const byte mcpSS = 49;                          // Port L, so chip select writes take the non-atomic path as on the Controller
+const byte mcpNumRegs = 0x16;                   // IODIRA to OLATB, BANK = 0
+const byte mcpIOCON = 0x0A;
+const byte mcpINTF = 0x0E;
+const byte mcpINTCAP = 0x10;
+const byte mcpGPIO = 0x12;
+const byte mcpOLAT = 0x14;
+
+PROFILER profiler;                              // As in the sketch; the library doesn't define one
+
+byte mcpRegs[mcpNumRegs];
+byte mcpAddr;
+byte mcpPhase;                                  // 0 = opcode, 1 = address, 2 = data
+boolean mcpReading;
+int failures = 0;
+
+byte fakeMcp(byte mosi, boolean first) {        // MCP23S17 with sequential addressing; hardware address ignored (HAEN off)
+  byte miso = 0xFF;
+
+  if (first) mcpPhase = 0;
+  switch (mcpPhase) {
+    case 0: mcpReading = mosi & 1; break;
+    case 1: mcpAddr = mosi % mcpNumRegs; break;
+    default:
+      if (mcpReading) {
+        miso = mcpRegs[mcpAddr];
+        if ((mcpAddr & ~1) == mcpINTCAP || (mcpAddr & ~1) == mcpGPIO) mcpRegs[mcpINTF + (mcpAddr & 1)] = 0;   // Clears the interrupt for that port
+      }
+      else if ((mcpAddr & ~1) == mcpIOCON) mcpRegs[mcpIOCON] = mcpRegs[mcpIOCON + 1] = mosi;
+      else if ((mcpAddr & ~1) == mcpGPIO) mcpRegs[mcpAddr] = mcpRegs[mcpOLAT + (mcpAddr & 1)] = mosi;
+      else if ((mcpAddr & ~1) != mcpINTF && (mcpAddr & ~1) != mcpINTCAP) mcpRegs[mcpAddr] = mosi;
+      mcpAddr = (mcpAddr + 1) % mcpNumRegs;
+  }
+  if (mcpPhase < 2) mcpPhase++;
+
+  return miso;
+}
+
+void check(boolean ok, const char *what) {
+  if (ok) return;
+  printf("  FAILED: %s\n", what);
+  failures++;
+}
+
+unsigned long timeIntValid(MCP23S17 &chip, uint16_t flags, uint16_t captured, uint16_t expect, const char *what) {
+  unsigned long long started;
+  uint16_t valid;
+
+  chip.intEnable(0);
+  chip.intEnable(1);
+  mcpRegs[mcpINTF] = flags & 0xFF;
+  mcpRegs[mcpINTF + 1] = flags >> 8;
+  mcpRegs[mcpINTCAP] = captured & 0xFF;
+  mcpRegs[mcpINTCAP + 1] = captured >> 8;
+
+  started = hostCycles();
+  valid = chip.intValid();
+  started = hostCycles() - started;
+
+  check(valid == expect, what);
+  check(mcpRegs[mcpINTF] == 0 || flags == 0, "INTF not cleared");
+  return started;
+}
+
+void benchIntValid() {
+  const struct { byte div; const char *name; } clocks[] = { { SPI_CLOCK_DIV2, "DIV2" }, { SPI_CLOCK_DIV4, "DIV4" }, { SPI_CLOCK_DIV16, "DIV16" } };
+  MCP23S17 chip;
+  unsigned long none, change, rose, fell;
+
+  printf("MCP23S17::intValid(), cycles (uS):\n");
+  printf("  SPI clock   no flags        ONCHANGE        RISING, rose    RISING, fell\n");
+
+  for (byte c = 0; c < sizeof(clocks) / sizeof(clocks[0]); c++) {
+    hostInit();
+    memset(mcpRegs, 0, sizeof(mcpRegs));
+    hostSpiAttach(mcpSS, fakeMcp);
+    SPIBUS::begin();
+    SPIBUS::config(SPI_MODE0, clocks[c].div);
+    chip.beginInt(mcpSS, LOW);
+    chip.intMode(0, ONCHANGE);
+    chip.intMode(1, RISING);
+
+    none = timeIntValid(chip, 0x0000, 0x0000, 0x0000, "no flags gave a valid interrupt");
+    change = timeIntValid(chip, 0x0001, 0x0001, 0x0001, "ONCHANGE not valid");
+    rose = timeIntValid(chip, 0x0002, 0x0002, 0x0002, "RISING, rose not valid");
+    fell = timeIntValid(chip, 0x0002, 0x0000, 0x0000, "RISING, fell was valid");
+    printf("  %-8s  %5lu (%5.1f)   %5lu (%5.1f)   %5lu (%5.1f)   %5lu (%5.1f)\n", clocks[c].name,
+           none, none / (double) CYCLESPERUS, change, change / (double) CYCLESPERUS,
+           rose, rose / (double) CYCLESPERUS, fell, fell / (double) CYCLESPERUS);
+
+    if (c == 0) {                               // PROFILER, on Timer5, should see the same (less its own overhead)
+      profiler.init();
+      mcpRegs[mcpINTF] = 0;
+      profiler.start(0);
+      chip.intValid();
+      profiler.stop(0);
+      check(profiler.probes[0].max + 32 >= none && profiler.probes[0].max <= none + 32, "PROFILER disagrees with the cycle clock");
+    }
+  }
+}
+
+void sleeperNull(void *context) {
+}
+
+void benchTimerISR() {
+  const byte batches[] = { 1, 4, 8, 16, MAXSLEEPERS - 1 };
+  HOSTISRSTATS compare, overflow;
+  unsigned long long started;
+
+  printf("\nWAKEUP::timerISR(), TREAT_AS_ISR sleepers due together, cycles (uS):\n");
+  printf("  sleepers    interrupts  worst            total\n");
+  for (byte b = 0; b < sizeof(batches); b++) {
+    hostInit();
+    wakeup.init();
+    for (byte i = 0; i < batches[b]; i++) check(wakeup.wakeMeAfterMicros(sleeperNull, 1000, NULL, TREAT_AS_ISR), "sleeper refused");
+    hostIsrStats(TIMER1_COMPA_vect_num, compare, true);
+    delay(2);
+    hostIsrStats(TIMER1_COMPA_vect_num, compare, true);
+    check(wakeup.freeSlots() == MAXSLEEPERS, "sleepers not all woken");
+    printf("  %-10d  %-10lu  %5lu (%5.1f)    %5llu\n", batches[b], compare.count, compare.max, compare.max / (double) CYCLESPERUS, compare.total);
+  }
+
+  // Idle: one sleeper far off, so only overflows
+  hostInit();
+  wakeup.init();
+  wakeup.wakeMeAfter(sleeperNull, 5000, NULL, TREAT_AS_ISR);
+  hostIsrStats(TIMER1_OVF_vect_num, overflow, true);
+  delay(1000);
+  hostIsrStats(TIMER1_OVF_vect_num, overflow, true);
+  printf("\nIdle WAKEUP: %lu overflow interrupts per second, %lu cycles each\n", overflow.count, overflow.max);
+
+  // Shortest repeating sleeper: share of the CPU left to loop()
+  hostInit();
+  wakeup.init();
+  check(!wakeup.wakeMeAfterMicros(sleeperNull, -(MINREPEAT * USPERTICK - USPERTICK), NULL, TREAT_AS_ISR), "repeat under MINREPEAT accepted");
+  check(wakeup.wakeMeAfterMicros(sleeperNull, -(MINREPEAT * USPERTICK), NULL, TREAT_AS_ISR), "repeat of MINREPEAT refused");
+  hostIsrStats(TIMER1_COMPA_vect_num, compare, true);
+  started = hostCycles();
+  delay(1000);
+  hostIsrStats(TIMER1_COMPA_vect_num, compare, true);
+  printf("Repeating every %luuS: %lu interrupts per second, %.1f%% of the CPU\n", (unsigned long) (MINREPEAT * USPERTICK), compare.count,
+         100.0 * compare.total / (hostCycles() - started));
+}
+
+const int heapWakes = 2000;
+unsigned long long heapDue[MAXSLEEPERS];        // Cycle count each sleeper is due at
+unsigned long long heapLastDue;
+long heapEarliest, heapLatest;                  // Cycles from due to woken
+int heapWoken, heapOutOfOrder;
+
+void sleeperHeap(void *context);
+
+void heapArm(byte i) {
+  long ms = 1 + rand() % 3000;
+
+  heapDue[i] = hostCycles() + ms * (F_CPU / 1000);
+  check(wakeup.wakeMeAfter(sleeperHeap, ms, (void *) (long) i, TREAT_AS_ISR), "sleeper refused");
+}
+
+void sleeperHeap(void *context) {               // Notes how late it is, then sleeps again for a random time
+  byte i = (long) context;
+  long late = (long) (hostCycles() - heapDue[i]);
+
+  if (late < heapEarliest) heapEarliest = late;
+  if (late > heapLatest) heapLatest = late;
+  if (heapDue[i] + CYCLESPERUS * USPERTICK < heapLastDue) heapOutOfOrder++;     // Deadlines fall on whole ticks
+  heapLastDue = heapDue[i];
+  if (++heapWoken <= heapWakes - MAXSLEEPERS) heapArm(i);
+}
+
+void benchSleepers() {
+  HOSTISRSTATS compare;
+
+  printf("\nWAKEUP::timerISR(), one sleeper due each 1000uS with others asleep, over 10 secs:\n");
+  printf("  asleep      interrupts  worst cycles\n");
+  for (byte asleep = 0; asleep < MAXSLEEPERS; asleep += (asleep) ? 8 : 7) {
+    hostInit();
+    wakeup.init();
+    for (byte i = 0; i < asleep; i++) check(wakeup.wakeMeAfter(sleeperNull, MAXSLEEP - i * 1000L, NULL, TREAT_AS_ISR), "sleeper refused");
+    check(wakeup.wakeMeAfterMicros(sleeperNull, -1000, NULL, TREAT_AS_ISR), "sleeper refused");
+    hostIsrStats(TIMER1_COMPA_vect_num, compare, true);
+    delay(10000);
+    hostIsrStats(TIMER1_COMPA_vect_num, compare, true);
+    check(wakeup.freeSlots() == (unsigned int) (MAXSLEEPERS - 1 - asleep), "sleeper asleep was woken");
+    printf("  %-10d  %-10lu  %5lu\n", asleep, compare.count, compare.max);
+  }
+
+  hostInit();
+  wakeup.init();
+  srand(1);
+  heapEarliest = heapLatest = heapWoken = heapOutOfOrder = 0;
+  heapLastDue = 0;
+  for (byte i = 0; i < MAXSLEEPERS; i++) heapArm(i);
+  while (wakeup.freeSlots() < MAXSLEEPERS) delay(1000);
+  check(heapWoken == heapWakes, "sleepers not all woken");
+  check(heapOutOfOrder == 0, "sleepers woken out of order of deadline");
+  check(heapEarliest > -(long) (CYCLESPERUS * USPERTICK) && heapLatest < (long) (10 * CYCLESPERUS), "sleeper woken more than a tick early or 10uS late");
+  printf("%d sleepers re-arming at random for %d wakes: %d out of order, woken %.1f to %.1f uS after deadline\n", MAXSLEEPERS,
+         heapWoken, heapOutOfOrder, heapEarliest / (double) CYCLESPERUS, heapLatest / (double) CYCLESPERUS);
+}
+
+const long driftPeriod = 10;                   // mS; as Calibration
+const byte driftHours = 6;                      // Timer1.ticks() wraps after 4.77 hours
+const int driftHoldUs = 20;                     // Longest loop() holds interrupts off
+const int driftGapUs = 4000;                    // Longest between holds
+unsigned long driftToggles;
+unsigned long long driftIdeal, driftPrev;      // Cycle count at which latest toggle was due, and of the previous toggle
+long driftJitter, driftWorst;                   // Cycles; largest deviation of an interval, and of a toggle from where it's due
+
+void sleeperToggle(void *context) {             // As Calibration's sleeperPin2, timed on the cycle clock rather than micros(); no pin
+  unsigned long long now = hostCycles();
+  long interval;
+
+  if (driftToggles++ == 0) driftIdeal = now;
+  else {
+    driftIdeal += driftPeriod * (F_CPU / 1000);
+    interval = (long) (now - driftPrev) - driftPeriod * (F_CPU / 1000);
+    if (labs(interval) > driftJitter) driftJitter = labs(interval);
+    if (labs((long) (now - driftIdeal)) > driftWorst) driftWorst = labs((long) (now - driftIdeal));
+  }
+  driftPrev = now;
+}
+
+void benchDrift() {
+  const byte sleeperSteps[] = { 1, 8, 16, 24, MAXSLEEPERS - 1, MAXSLEEPERS - 1 };
+  WAKEUPSTATS stats;
+  long worstJitter = 0;
+  byte numSleepers = 1;
+
+  printf("\nWAKEUP drift, a sleeper every %ldmS as Calibration, interrupts held off for up to %duS (uS):\n", driftPeriod, driftHoldUs);
+  printf("  hours  sleepers  toggles    jitter  drift\n");
+  hostInit();
+  wakeup.init();
+  srand(2);
+  driftToggles = 0;
+  driftJitter = driftWorst = 0;
+  check(wakeup.wakeMeAfter(sleeperToggle, -driftPeriod, NULL, TREAT_AS_ISR), "sleeper refused");
+
+  for (byte hour = 0; hour < driftHours; hour++) {
+    unsigned long long hourEnd = hostCycles() + 3600ULL * F_CPU;
+
+    while (numSleepers < sleeperSteps[hour] && wakeup.wakeMeAfter(sleeperNull, -(1000 + numSleepers), NULL, TREAT_AS_ISR)) numSleepers++;
+    while (hostCycles() < hourEnd) {
+      cli();
+      hostSpend(rand() % (driftHoldUs * CYCLESPERUS));
+      sei();
+      hostSpend(rand() % (driftGapUs * CYCLESPERUS));
+    }
+    printf("  %-5d  %-8d  %-9lu  %6.1f  %6.1f\n", hour + 1, numSleepers, driftToggles, driftJitter / (double) CYCLESPERUS,
+           driftWorst / (double) CYCLESPERUS);
+    if (driftJitter > worstJitter) worstJitter = driftJitter;
+    check(driftWorst <= worstJitter, "drift beyond jitter");
+    check(driftToggles + 1 >= (hour + 1) * 3600000UL / driftPeriod && driftToggles <= (hour + 1) * 3600000UL / driftPeriod, "toggles missed");
+    driftJitter = driftWorst = 0;
+  }
+  wakeup.getStats(stats);
+  check(stats.pendingOverflows == 0, "pending queue overflowed");
+}
+
+const long framePeriod = 1000;                 // uS; as Priority
+const int busyMicros = 60;
+byte frameBusy, framePriority;
+unsigned long long frameDue;                    // Cycle count
+long frameLate;                                 // Cycles; latest frame this step
+
+void sleeperBusy(void *context) {
+  delayMicroseconds(busyMicros);
+}
+
+void sleeperFrame(void *context) {              // As Priority: busy sleepers put to sleep first, so they're ahead on the heap
+  long late = (long) (hostCycles() - frameDue);
+
+  if (late > frameLate) frameLate = late;
+  for (byte i = 0; i < frameBusy; i++) wakeup.wakeMeAfterMicros(sleeperBusy, framePeriod, NULL, TREAT_AS_ISR);
+  frameDue = hostCycles() + framePeriod * CYCLESPERUS;
+  wakeup.wakeMeAfterMicros(sleeperFrame, framePeriod, NULL, TREAT_AS_ISR, framePriority);
+}
+
+void benchPriority() {
+  const struct { byte numBusy, framePriority; } steps[] = { {0, 0}, {2, 0}, {2, 255}, {4, 0}, {4, 255}, {8, 0}, {8, 255} };
+  WAKEUPSTATS stats;
+  unsigned long long stepEnd;
+  long samePriorityLate = 0;
+
+  printf("\nWAKEUP priorities, a %ldus frame against busy sleepers of %duS, ISRBUDGET %duS, 5 secs each (uS):\n", framePeriod,
+         busyMicros, ISRBUDGET);
+  printf("  busy  priority  late     isrPeak  deferred  dropped\n");
+  for (byte s = 0; s < sizeof(steps) / sizeof(steps[0]); s++) {
+    hostInit();
+    wakeup.init();
+    frameBusy = steps[s].numBusy;
+    framePriority = steps[s].framePriority;
+    frameLate = 0;
+    frameDue = hostCycles() + framePeriod * CYCLESPERUS;
+    check(wakeup.wakeMeAfterMicros(sleeperFrame, framePeriod, NULL, TREAT_AS_ISR, framePriority), "sleeper refused");
+    stepEnd = hostCycles() + 5ULL * F_CPU;
+    while (hostCycles() < stepEnd) {            // loop(), as Priority
+      wakeup.runAnyPending();
+      hostSpend(CYCLESPERUS);
+    }
+    wakeup.getStats(stats);
+
+    printf("  %-4d  %-8d  %7.1f  %-7u  %-8u  %u\n", frameBusy, framePriority, frameLate / (double) CYCLESPERUS, stats.isrPeak,
+           stats.deferred, stats.pendingOverflows);
+    if (!framePriority) samePriorityLate = frameLate;
+    else {
+      check(frameLate <= (long) ((ISRBUDGET + busyMicros + 2 * USPERTICK) * CYCLESPERUS), "frame with priority over ISRBUDGET plus a busy sleeper late");
+      check(!stats.deferred || frameLate < samePriorityLate, "frame with priority no earlier than without");
+    }
+    check(stats.isrPeak <= ISRBUDGET + busyMicros + 2 * USPERTICK, "timerISR over ISRBUDGET plus a busy sleeper");
+    check((stats.deferred > 0) == ((frameBusy - 1) * busyMicros >= ISRBUDGET), "deferred when within budget, or not when over");
+    check(stats.pendingOverflows == 0, "pending queue overflowed");
+  }
+}
+
+const byte echoSS[] = { 48, 47 };               // Port L, as mcpSS
+const byte echoLen = 16;
+byte echoLast;
+int echoCallbacks;
+
+byte fakeEcho(byte mosi, boolean first) {       // Answers each byte with the one before, inverted; 0xFF first
+  byte miso = (first) ? 0xFF : ~echoLast;
+
+  echoLast = mosi;
+  return miso;
+}
+
+void echoDone(SPIXFER *xfer) {
+  echoCallbacks++;
+}
+
+void benchSpiQueue() {
+  SPIXFER xfer[2];
+  byte tx[2][echoLen], rx[2][echoLen];
+  HOSTISRSTATS stc;
+  unsigned long long started, elapsed;
+  boolean intact = true;
+
+  printf("\nSPIQUEUE::transferISR(), 2 transfers of %d bytes queued together at DIV16:\n", echoLen);
+  hostInit();
+  for (byte d = 0; d < 2; d++) {
+    hostSpiAttach(echoSS[d], fakeEcho);
+    pinMode(echoSS[d], OUTPUT);
+    digitalWrite(echoSS[d], HIGH);
+    for (byte i = 0; i < echoLen; i++) tx[d][i] = d * 0x40 + i;
+  }
+  SPIBUS::begin();
+  SPIBUS::config(SPI_MODE0, SPI_CLOCK_DIV16);
+  echoCallbacks = 0;
+  hostIsrStats(SPI_STC_vect_num, stc, true);
+
+  started = hostCycles();
+  for (byte d = 0; d < 2; d++) check(spiQueue.queue(&xfer[d], echoSS[d], tx[d], rx[d], echoLen, echoDone), "transfer refused");
+  while (!spiQueue.isIdle()) hostSpend(8);       // waitIdle() spins on memory the model can't see change
+  elapsed = hostCycles() - started;
+  hostIsrStats(SPI_STC_vect_num, stc, true);
+
+  for (byte d = 0; d < 2; d++) {
+    check(xfer[d].done, "transfer not done");
+    for (byte i = 0; i < echoLen; i++) if (rx[d][i] != ((i == 0) ? 0xFF : (byte) ~tx[d][i - 1])) intact = false;
+  }
+  check(intact, "replies not as sent");
+  check(echoCallbacks == 2, "callbacks not made");
+  check(stc.count == 2 * echoLen, "not an interrupt per byte");
+  check(!(SPCR & _BV(SPIE)), "SPI interrupt left on");
+  printf("  %lu interrupts, worst %lu cycles (%.1f uS), %.0f%% of the %llu cycles taken\n", stc.count, stc.max,
+         stc.max / (double) CYCLESPERUS, 100.0 * stc.total / elapsed, elapsed);
+}
+
+int main() {
+  benchIntValid();
+  benchTimerISR();
+  benchSleepers();
+  benchDrift();
+  benchPriority();
+  benchSpiQueue();
+
+  if (failures) printf("\n%d checks failed\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,651 @@
+/* hostemu - model of the ATmega2560 registers, timers and SPI behind the host headers, and the core functions
+
+  See hostemu.h for what is modelled and what is counted
+*/
+
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+
+#include "hostemu.h"
+#include "pins_arduino.h"
+
+#define HOSTPAGE 4096							// PORTs are kept alone on a page, so writes to it can be caught
+#define HOSTNUMPORTS 13							// Port numbers 0 (NOT_A_PORT) to 12 (PL)
+#define HOSTNUMPINS 70
+#define HOSTPORTCOST 2							// Cycles for a port write, as sbi/cbi
+#define HOSTISRCOST 5							// Cycles to take a vector (3 byte PC), and for reti
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__i386__))
+#define HOSTWATCH 1								// Port writes caught by write-protecting their page, then single-stepping the write
+#define HOSTTRAPFLAG 0x100						// EFLAGS TF
+#else
+#define HOSTWATCH 0								// Port writes seen at the next register access
+#endif
+
+
+// ****************  CLOCK  ****************
+
+static unsigned long long hostClock;			// Cycles since hostInit()
+
+static void advance(unsigned long cycles);
+static void service();
+
+
+// ****************  REGISTERS  ****************
+
+HOSTREG8 SREG(HOSTSREG), SPCR(HOSTSPCR), SPSR(HOSTSPSR), SPDR(HOSTSPDR), GTCCR(HOSTGTCCR);
+HOSTREG8 TCCR1A(HOSTTCCR1A), TCCR1B(HOSTTCCR1B), TCCR1C(HOSTTCCR1C), TIMSK1(HOSTTIMSK1), TIFR1(HOSTTIFR1);
+HOSTREG8 TCCR5A(HOSTTCCR5A), TCCR5B(HOSTTCCR5B), TCCR5C(HOSTTCCR5C), TIMSK5(HOSTTIMSK5), TIFR5(HOSTTIFR5);
+HOSTREG16 TCNT1(HOSTTCNT1), ICR1(HOSTICR1), OCR1A(HOSTOCR1A), OCR1B(HOSTOCR1B), OCR1C(HOSTOCR1C);
+HOSTREG16 TCNT5(HOSTTCNT5), ICR5(HOSTICR5), OCR5A(HOSTOCR5A), OCR5B(HOSTOCR5B), OCR5C(HOSTOCR5C);
+
+// Cycles per access: in/out for I/O space, lds/sts for extended I/O, two of those for 16 bit
+static const uint8_t regCost[HOSTNUMREGS] = { 1, 1, 1, 1, 1,  2, 2, 2, 2, 1,  2, 2, 2, 2, 1,  4, 4, 4, 4, 4,  4, 4, 4, 4, 4 };
+
+static uint8_t sreg;
+static uint8_t gtccr;
+
+
+// ****************  TIMERS  ****************
+// Timer1 and Timer5.  Flags are set on the tick that takes the count to the compare value, TOP (overflow in normal
+// mode) or BOTTOM (overflow in mode 8)
+
+struct HOSTTIMER {
+  uint8_t tccrA, tccrB, timsk, tifr;
+  uint16_t tcnt, icr;
+  uint16_t ocr[3];								// A, B, C
+  boolean down;									// Counting down from TOP (mode 8)
+  unsigned int residue;							// Cycles towards the next tick
+};
+static HOSTTIMER timers[2];
+
+static const unsigned int prescales[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };	// By CSn2:0; 0 = stopped (or external clock)
+
+static boolean timerMode8(const HOSTTIMER &t) {		// Phase & frequency correct, TOP = ICRn
+  return ((t.tccrB >> WGM12) & 3) == 2 && (t.tccrA & 3) == 0;
+}
+
+static unsigned long timerToMatch(uint16_t tcnt, uint16_t ocr) {		// Ticks until a normal mode count reaches ocr
+  uint16_t ticks = ocr - tcnt;
+
+  return (ticks) ? ticks : 0x10000UL;
+}
+
+static void timerRun(HOSTTIMER &t, unsigned long cycles) {
+  unsigned int prescale = prescales[t.tccrB & 7];
+  unsigned long ticks;
+
+  if (prescale == 0) return;
+  ticks = (t.residue + cycles) / prescale;
+  t.residue = (t.residue + cycles) % prescale;
+  if (ticks == 0) return;
+
+  if (timerMode8(t)) {
+	  if (t.icr == 0) return;
+	  if (ticks > 2UL * t.icr) {					// Whole periods pass; every flag is set
+		  t.tifr |= _BV(TOV1);
+		  for (uint8_t i = 0; i < 3; i++) if (t.ocr[i] <= t.icr) t.tifr |= _BV(OCF1A + i);
+		  ticks %= 2UL * t.icr;
+	  }
+	  while (ticks--) {
+		  if (t.down) {
+			  if (--t.tcnt == 0) {
+				  t.down = false;
+				  t.tifr |= _BV(TOV1);
+			  }
+		  }
+		  else if (++t.tcnt >= t.icr) t.down = true;
+		  for (uint8_t i = 0; i < 3; i++) if (t.tcnt == t.ocr[i]) t.tifr |= _BV(OCF1A + i);
+	  }
+  }
+  else {
+	  for (uint8_t i = 0; i < 3; i++) if (ticks >= timerToMatch(t.tcnt, t.ocr[i])) t.tifr |= _BV(OCF1A + i);
+	  if (ticks >= 0x10000UL - t.tcnt) t.tifr |= _BV(TOV1);
+	  t.tcnt += ticks;
+  }
+}
+
+static unsigned long timerNext(const HOSTTIMER &t) {		// Cycles until a flag might next be set
+  unsigned int prescale = prescales[t.tccrB & 7];
+  unsigned long ticks;
+
+  if (prescale == 0) return ULONG_MAX;
+  if (timerMode8(t)) ticks = 1;
+  else {
+	  ticks = 0x10000UL - t.tcnt;
+	  for (uint8_t i = 0; i < 3; i++) if (timerToMatch(t.tcnt, t.ocr[i]) < ticks) ticks = timerToMatch(t.tcnt, t.ocr[i]);
+  }
+  return ticks * prescale - t.residue;
+}
+
+
+// ****************  SPI  ****************
+// Master only.  A byte written to SPDR is exchanged with the device whose slave select is low when it completes
+
+static struct {
+  uint8_t spcr, spsr;
+  uint8_t rx;									// Last byte received, read from SPDR
+  uint8_t tx;									// Byte being sent
+  boolean busy;
+  boolean flagRead;								// SPSR read with SPIF set; SPIF clears at the next SPDR access
+  unsigned long long doneAt;					// hostClock at which the byte in progress completes
+  unsigned int latency;							// Cycles per byte; 0 = from the divider
+} spi;
+
+struct HOSTSPIDEV {
+  uint8_t port, mask;							// Slave select
+  uint8_t (*device)(uint8_t mosi, boolean first);
+  boolean first;								// Slave select has been high since the last byte
+};
+static HOSTSPIDEV spiDevs[HOSTMAXSPI];
+static uint8_t numSpiDevs;
+
+static unsigned int spiByteCycles() {
+  static const uint8_t dividers[4] = { 4, 16, 64, 128 };		// By SPR1:0; halved by SPI2X
+
+  if (spi.latency) return spi.latency;
+  return 8 * dividers[spi.spcr & 3] / ((spi.spsr & _BV(SPI2X)) ? 2 : 1);
+}
+
+static void spiRun() {
+  if (!spi.busy || hostClock < spi.doneAt) return;
+
+  spi.busy = false;
+  spi.rx = 0xFF;								// MISO floats high if nothing selected
+  for (uint8_t i = 0; i < numSpiDevs; i++) {
+	  if (!(hostPortPage[spiDevs[i].port] & spiDevs[i].mask)) {
+		  spi.rx = spiDevs[i].device(spi.tx, spiDevs[i].first);
+		  spiDevs[i].first = false;
+		  break;
+	  }
+  }
+  spi.spsr |= _BV(SPIF);
+}
+
+static void spiWrite(uint8_t data) {
+  if (spi.flagRead) {
+	  spi.spsr &= ~(_BV(SPIF) | _BV(WCOL));
+	  spi.flagRead = false;
+  }
+  if (!(spi.spcr & _BV(SPE))) return;
+  if (spi.busy) {
+	  spi.spsr |= _BV(WCOL);
+	  return;
+  }
+  spi.tx = data;
+  spi.busy = true;
+  spi.doneAt = hostClock + spiByteCycles();
+}
+
+static uint8_t spiRead() {
+  if (spi.flagRead) {
+	  spi.spsr &= ~(_BV(SPIF) | _BV(WCOL));
+	  spi.flagRead = false;
+  }
+  return spi.rx;
+}
+
+
+// ****************  PORTS  ****************
+
+volatile uint8_t hostPortPage[HOSTPAGE] __attribute__((aligned(HOSTPAGE)));
+volatile uint8_t hostDdrRegs[HOSTNUMPORTS];
+volatile uint8_t hostPinRegs[HOSTNUMPORTS];
+
+// Mega pin mapping (as SpiDevice.h): port number and bit of each digital pin
+static const uint8_t pinPorts[HOSTNUMPINS] = {
+  PE, PE, PE, PE, PG, PE, PH, PH, PH, PH, PB, PB, PB, PB, PJ, PJ, PH, PH, PD, PD, PD, PD, PA, PA, PA, PA, PA, PA, PA, PA,
+  PC, PC, PC, PC, PC, PC, PC, PC, PD, PG, PG, PG, PL, PL, PL, PL, PL, PL, PL, PL, PB, PB, PB, PB, PF, PF, PF, PF, PF, PF,
+  PF, PF, PK, PK, PK, PK, PK, PK, PK, PK };
+static const uint8_t pinBits[HOSTNUMPINS] = {
+  0, 1, 4, 5, 5, 3, 3, 4, 5, 6, 4, 5, 6, 7, 1, 0, 1, 0, 3, 2, 1, 0, 0, 1, 2, 3, 4, 5, 6, 7,
+  7, 6, 5, 4, 3, 2, 1, 0, 7, 2, 1, 0, 7, 6, 5, 4, 3, 2, 1, 0, 3, 2, 1, 0, 0, 1, 2, 3, 4, 5,
+  6, 7, 0, 1, 2, 3, 4, 5, 6, 7 };
+
+uint8_t hostPinPort(uint8_t pin) { return (pin < HOSTNUMPINS) ? pinPorts[pin] : NOT_A_PORT; }
+uint8_t hostPinMask(uint8_t pin) { return (pin < HOSTNUMPINS) ? _BV(pinBits[pin]) : 0; }
+
+static void portsCheck() {						// Note slave selects that have gone high since last time
+  for (uint8_t i = 0; i < numSpiDevs; i++) {
+	  if (hostPortPage[spiDevs[i].port] & spiDevs[i].mask) spiDevs[i].first = true;
+  }
+}
+
+#if HOSTWATCH
+static volatile boolean portStepping;			// Between a port write's fault and its trap
+
+static void portFault(int sig, siginfo_t *info, void *context) {		// Write to the PORT page: let it through, and trap after it
+  volatile uint8_t *addr = (volatile uint8_t *) info->si_addr;
+
+  if (addr < hostPortPage || addr >= hostPortPage + HOSTPAGE) {		// A real fault; retried without this handler
+	  signal(SIGSEGV, SIG_DFL);
+	  return;
+  }
+  mprotect((void *) hostPortPage, HOSTPAGE, PROT_READ | PROT_WRITE);
+  ((ucontext_t *) context)->uc_mcontext.gregs[REG_EFL] |= HOSTTRAPFLAG;
+  portStepping = true;
+}
+
+static void portTrap(int sig, siginfo_t *info, void *context) {		// Port written
+  if (!portStepping) {
+	  signal(SIGTRAP, SIG_DFL);
+	  raise(SIGTRAP);
+	  return;
+  }
+  ((ucontext_t *) context)->uc_mcontext.gregs[REG_EFL] &= ~HOSTTRAPFLAG;
+  portStepping = false;
+  advance(HOSTPORTCOST);						// Sees the write in portsCheck
+  mprotect((void *) hostPortPage, HOSTPAGE, PROT_READ);
+}
+
+static void portWatch(boolean on) {
+  static boolean installed = false;
+  struct sigaction action;
+
+  if (!installed) {
+	  memset(&action, 0, sizeof(action));
+	  action.sa_flags = SA_SIGINFO;
+	  action.sa_sigaction = portFault;
+	  sigaction(SIGSEGV, &action, NULL);
+	  action.sa_sigaction = portTrap;
+	  sigaction(SIGTRAP, &action, NULL);
+	  installed = true;
+  }
+  mprotect((void *) hostPortPage, HOSTPAGE, (on) ? PROT_READ : PROT_READ | PROT_WRITE);
+}
+#else
+static void portWatch(boolean on) {}
+#endif
+
+
+// ****************  INTERRUPTS  ****************
+// Vectors the libraries may define.  Weak, so those not linked in are NULL
+
+extern "C" {
+  void TIMER1_COMPA_vect(void) __attribute__((weak));
+  void TIMER1_COMPB_vect(void) __attribute__((weak));
+  void TIMER1_COMPC_vect(void) __attribute__((weak));
+  void TIMER1_OVF_vect(void) __attribute__((weak));
+  void SPI_STC_vect(void) __attribute__((weak));
+  void TIMER5_COMPA_vect(void) __attribute__((weak));
+  void TIMER5_COMPB_vect(void) __attribute__((weak));
+  void TIMER5_COMPC_vect(void) __attribute__((weak));
+  void TIMER5_OVF_vect(void) __attribute__((weak));
+}
+
+struct HOSTVECTOR {
+  uint8_t num;
+  void (*isr)(void);
+  uint8_t *flags, flagBit;						// Flag, cleared as the vector is taken
+  uint8_t *enables, enableBit;
+  HOSTISRSTATS stats;
+};
+
+static HOSTVECTOR vectors[] = {					// In priority order
+  { TIMER1_COMPA_vect_num, TIMER1_COMPA_vect, &timers[0].tifr, OCF1A, &timers[0].timsk, OCIE1A },
+  { TIMER1_COMPB_vect_num, TIMER1_COMPB_vect, &timers[0].tifr, OCF1B, &timers[0].timsk, OCIE1B },
+  { TIMER1_COMPC_vect_num, TIMER1_COMPC_vect, &timers[0].tifr, OCF1C, &timers[0].timsk, OCIE1C },
+  { TIMER1_OVF_vect_num, TIMER1_OVF_vect, &timers[0].tifr, TOV1, &timers[0].timsk, TOIE1 },
+  { SPI_STC_vect_num, SPI_STC_vect, &spi.spsr, SPIF, &spi.spcr, SPIE },
+  { TIMER5_COMPA_vect_num, TIMER5_COMPA_vect, &timers[1].tifr, OCF5A, &timers[1].timsk, OCIE5A },
+  { TIMER5_COMPB_vect_num, TIMER5_COMPB_vect, &timers[1].tifr, OCF5B, &timers[1].timsk, OCIE5B },
+  { TIMER5_COMPC_vect_num, TIMER5_COMPC_vect, &timers[1].tifr, OCF5C, &timers[1].timsk, OCIE5C },
+  { TIMER5_OVF_vect_num, TIMER5_OVF_vect, &timers[1].tifr, TOV5, &timers[1].timsk, TOIE5 }
+};
+static const uint8_t numVectors = sizeof(vectors) / sizeof(vectors[0]);
+
+static void service() {							// Take any interrupts due, highest priority first
+  HOSTVECTOR *v;
+  unsigned long long entered;
+  unsigned long taken;
+
+  while (sreg & _BV(SREG_I)) {
+	  for (v = vectors; v < vectors + numVectors; v++) {
+		  if ((*v->flags & _BV(v->flagBit)) && (*v->enables & _BV(v->enableBit))) break;
+	  }
+	  if (v == vectors + numVectors) return;
+
+	  entered = hostClock;
+	  *v->flags &= ~_BV(v->flagBit);
+	  if (v->flags == &spi.spsr) spi.flagRead = false;
+	  if (!v->isr) {								// On the target, a jump to __bad_interrupt and so a reset
+		  fprintf(stderr, "hostemu: interrupt %d enabled with no ISR\n", v->num);
+		  *v->enables &= ~_BV(v->enableBit);
+		  continue;
+	  }
+
+	  sreg &= ~_BV(SREG_I);
+	  advance(HOSTISRCOST);
+	  v->isr();
+	  advance(HOSTISRCOST);
+	  sreg |= _BV(SREG_I);
+
+	  taken = hostClock - entered;
+	  v->stats.count++;
+	  v->stats.total += taken;
+	  if (taken > v->stats.max) v->stats.max = taken;
+  }
+}
+
+
+// ****************  REGISTER ACCESS  ****************
+
+static void advance(unsigned long cycles) {		// Run the clock on; flags may be set, but no interrupts are taken
+  portsCheck();
+  hostClock += cycles;
+  timerRun(timers[0], cycles);
+  timerRun(timers[1], cycles);
+  spiRun();
+}
+
+unsigned int hostRegRead(uint8_t id) {
+  unsigned int value = 0;
+
+  advance(regCost[id]);
+  if (id >= HOSTTCCR1A && id <= HOSTTIFR5) {
+	  HOSTTIMER &t = timers[(id - HOSTTCCR1A) / 5];
+	  switch ((id - HOSTTCCR1A) % 5) {
+		  case 0: value = t.tccrA; break;
+		  case 1: value = t.tccrB; break;
+		  case 2: value = 0; break;				// TCCRnC: force output compare; reads as 0
+		  case 3: value = t.timsk; break;
+		  case 4: value = t.tifr; break;
+	  }
+  }
+  else if (id >= HOSTTCNT1) {
+	  HOSTTIMER &t = timers[(id - HOSTTCNT1) / 5];
+	  switch ((id - HOSTTCNT1) % 5) {
+		  case 0: value = t.tcnt; break;
+		  case 1: value = t.icr; break;
+		  default: value = t.ocr[(id - HOSTTCNT1) % 5 - 2]; break;
+	  }
+  }
+  else switch (id) {
+	  case HOSTSREG: value = sreg; break;
+	  case HOSTSPCR: value = spi.spcr; break;
+	  case HOSTSPSR:
+		  value = spi.spsr;
+		  if (value & _BV(SPIF)) spi.flagRead = true;
+		  break;
+	  case HOSTSPDR: value = spiRead(); break;
+	  case HOSTGTCCR: value = gtccr; break;
+  }
+  service();
+
+  return value;
+}
+
+void hostRegWrite(uint8_t id, unsigned int value) {
+  advance(regCost[id]);
+  if (id >= HOSTTCCR1A && id <= HOSTTIFR5) {
+	  HOSTTIMER &t = timers[(id - HOSTTCCR1A) / 5];
+	  switch ((id - HOSTTCCR1A) % 5) {
+		  case 0: t.tccrA = value; break;
+		  case 1: t.tccrB = value; break;
+		  case 2: break;
+		  case 3: t.timsk = value; break;
+		  case 4: t.tifr &= ~value; break;		// Flags cleared by writing 1
+	  }
+  }
+  else if (id >= HOSTTCNT1) {
+	  HOSTTIMER &t = timers[(id - HOSTTCNT1) / 5];
+	  switch ((id - HOSTTCNT1) % 5) {
+		  case 0: t.tcnt = value; break;
+		  case 1: t.icr = value; break;
+		  default: t.ocr[(id - HOSTTCNT1) % 5 - 2] = value; break;
+	  }
+  }
+  else switch (id) {
+	  case HOSTSREG: sreg = value; break;
+	  case HOSTSPCR: spi.spcr = value; break;
+	  case HOSTSPSR: spi.spsr = (spi.spsr & ~_BV(SPI2X)) | (value & _BV(SPI2X)); break;
+	  case HOSTSPDR: spiWrite(value); break;
+	  case HOSTGTCCR:
+		  if (value & _BV(PSRSYNC)) timers[0].residue = timers[1].residue = 0;	// Prescaler reset; shared by Timers 1, 3, 4 & 5
+		  gtccr = value & _BV(TSM);
+		  break;
+  }
+  service();
+}
+
+void cli() {
+  advance(1);
+  sreg &= ~_BV(SREG_I);
+}
+
+void sei() {
+  advance(1);
+  sreg |= _BV(SREG_I);
+  service();
+}
+
+
+// ****************  HOST INTERFACE  ****************
+
+void hostInit() {
+  portWatch(false);
+  memset((void *) hostPortPage, 0, HOSTNUMPORTS);
+  memset((void *) hostDdrRegs, 0, HOSTNUMPORTS);
+  memset((void *) hostPinRegs, 0, HOSTNUMPORTS);
+
+  hostClock = 0;
+  sreg = _BV(SREG_I);							// As left by the core's init(), before setup()
+  gtccr = 0;
+  memset(timers, 0, sizeof(timers));
+  memset(&spi, 0, sizeof(spi));
+  numSpiDevs = 0;
+  for (uint8_t i = 0; i < numVectors; i++) memset(&vectors[i].stats, 0, sizeof(vectors[i].stats));
+
+  portWatch(true);
+}
+
+unsigned long long hostCycles() {
+  return hostClock;
+}
+
+static unsigned long step(unsigned long most) {	// Runs on no further than the next event, then takes any interrupts due
+  unsigned long cycles = most, next;
+
+  for (uint8_t i = 0; i < 2; i++) if ((next = timerNext(timers[i])) < cycles) cycles = next;
+  if (spi.busy && spi.doneAt > hostClock && spi.doneAt - hostClock < cycles) cycles = spi.doneAt - hostClock;
+  if (cycles == 0) cycles = 1;
+
+  advance(cycles);
+  service();
+  return cycles;
+}
+
+void hostSpend(unsigned long cycles) {			// Interrupts taken on the way add to the cycles spent, as they would to the work
+  while (cycles) cycles -= step(cycles);
+}
+
+void hostSpiLatency(unsigned int cycles) {
+  spi.latency = cycles;
+}
+
+boolean hostSpiAttach(uint8_t ssPin, uint8_t (*device)(uint8_t mosi, boolean first)) {
+  if (numSpiDevs >= HOSTMAXSPI || hostPinPort(ssPin) == NOT_A_PORT) return false;
+
+  spiDevs[numSpiDevs].port = hostPinPort(ssPin);
+  spiDevs[numSpiDevs].mask = hostPinMask(ssPin);
+  spiDevs[numSpiDevs].device = device;
+  spiDevs[numSpiDevs].first = true;
+  numSpiDevs++;
+
+  return true;
+}
+
+void hostPinInput(uint8_t pin, uint8_t level) {
+  uint8_t port = hostPinPort(pin);
+
+  if (port == NOT_A_PORT) return;
+  if (level) hostPinRegs[port] |= hostPinMask(pin);
+  else hostPinRegs[port] &= ~hostPinMask(pin);
+}
+
+void hostIsrStats(uint8_t vectorNum, HOSTISRSTATS &stats, boolean reset) {
+  for (uint8_t i = 0; i < numVectors; i++) {
+	  if (vectors[i].num != vectorNum) continue;
+	  stats = vectors[i].stats;
+	  if (reset) memset(&vectors[i].stats, 0, sizeof(vectors[i].stats));
+	  return;
+  }
+  memset(&stats, 0, sizeof(stats));
+}
+
+
+// ****************  CORE  ****************
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  uint8_t port = hostPinPort(pin);
+
+  if (port == NOT_A_PORT) return;
+  if (mode == OUTPUT) hostDdrRegs[port] |= hostPinMask(pin);
+  else hostDdrRegs[port] &= ~hostPinMask(pin);
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  uint8_t port = hostPinPort(pin);
+
+  if (port == NOT_A_PORT) return;
+  if (val == LOW) hostPortPage[port] &= ~hostPinMask(pin);
+  else hostPortPage[port] |= hostPinMask(pin);
+}
+
+int digitalRead(uint8_t pin) {					// An output reads back what it drives
+  uint8_t port = hostPinPort(pin);
+  volatile uint8_t *reg;
+
+  if (port == NOT_A_PORT) return LOW;
+  reg = (hostDdrRegs[port] & hostPinMask(pin)) ? &hostPortPage[port] : &hostPinRegs[port];
+  return (*reg & hostPinMask(pin)) ? HIGH : LOW;
+}
+
+int analogRead(uint8_t pin) { return 0; }
+
+void analogWrite(uint8_t pin, int val) {
+  pinMode(pin, OUTPUT);
+  digitalWrite(pin, (val < 128) ? LOW : HIGH);
+}
+
+unsigned long millis() { return hostClock / (F_CPU / 1000); }
+unsigned long micros() { return hostClock / (F_CPU / 1000000L); }
+static void spendUntil(unsigned long long until) {	// Unlike hostSpend(), interrupts taken on the way count against the wait
+  while (hostClock < until) step(until - hostClock);
+}
+
+void delay(unsigned long ms) { spendUntil(hostClock + ms * (F_CPU / 1000)); }
+void delayMicroseconds(unsigned int us) { spendUntil(hostClock + us * (F_CPU / 1000000L)); }
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout) { return 0; }
+
+void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t val) {
+  for (uint8_t i = 0; i < 8; i++) {
+	  digitalWrite(dataPin, (bitOrder == LSBFIRST) ? !!(val & (1 << i)) : !!(val & (1 << (7 - i))));
+	  digitalWrite(clockPin, HIGH);
+	  digitalWrite(clockPin, LOW);
+  }
+}
+
+uint8_t shiftIn(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder) {
+  uint8_t value = 0;
+
+  for (uint8_t i = 0; i < 8; i++) {
+	  digitalWrite(clockPin, HIGH);
+	  if (bitOrder == LSBFIRST) value |= digitalRead(dataPin) << i;
+	  else value |= digitalRead(dataPin) << (7 - i);
+	  digitalWrite(clockPin, LOW);
+  }
+  return value;
+}
+
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode) {}	// External interrupts aren't modelled
+void detachInterrupt(uint8_t interruptNum) {}
+
+long random(long howbig) { return (howbig) ? rand() % howbig : 0; }
+long random(long howsmall, long howbig) { return (howsmall >= howbig) ? howsmall : random(howbig - howsmall) + howsmall; }
+void randomSeed(unsigned int seed) { if (seed != 0) srand(seed); }
+long map(long x, long in_min, long in_max, long out_min, long out_max) { return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min; }
+
+uint16_t makeWord(uint16_t w) { return w; }
+uint16_t makeWord(byte h, byte l) { return (h << 8) | l; }
+
+
+// ****************  SERIAL  ****************
+// All four go to stdout, unless turned off by hostSerialEcho(); nothing is ever received
+
+HardwareSerial Serial, Serial1, Serial2, Serial3;
+static boolean serialEcho = true;
+
+static void serialOut(const char *str, size_t len) {
+  if (serialEcho) fwrite(str, 1, len, stdout);
+}
+
+static void serialOut(char c) {
+  serialOut(&c, 1);
+}
+
+void hostSerialEcho(boolean on) {
+  serialEcho = on;
+}
+
+static void printNumber(unsigned long n, int base) {
+  char buf[8 * sizeof(long) + 1];
+  char *str = &buf[sizeof(buf) - 1];
+
+  *str = '\0';
+  if (base < 2) base = 10;
+  do {
+	  unsigned long m = n;
+	  n /= base;
+	  char c = m - base * n;
+	  *--str = (c < 10) ? c + '0' : c + 'A' - 10;
+  } while (n);
+  serialOut(str, strlen(str));
+}
+
+static void printSigned(long n, int base) {
+  if (base == DEC && n < 0) {
+	  serialOut('-');
+	  printNumber(-n, base);
+  }
+  else if (base == BYTE) serialOut((char) n);
+  else printNumber(n, base);
+}
+
+void HardwareSerial::begin(long speed) {}
+void HardwareSerial::end() {}
+int HardwareSerial::available(void) { return 0; }
+int HardwareSerial::peek(void) { return -1; }
+int HardwareSerial::read(void) { return -1; }
+void HardwareSerial::flush(void) { if (serialEcho) fflush(stdout); }
+void HardwareSerial::write(uint8_t c) { serialOut((char) c); }
+void HardwareSerial::write(const char *str) { serialOut(str, strlen(str)); }
+void HardwareSerial::write(const uint8_t *buffer, size_t size) { serialOut((const char *) buffer, size); }
+
+void HardwareSerial::print(const char str[]) { write(str); }
+void HardwareSerial::print(char c, int base) { printSigned(c, base); }
+void HardwareSerial::print(unsigned char b, int base) { if (base == BYTE) serialOut((char) b); else printNumber(b, base); }
+void HardwareSerial::print(int n, int base) { printSigned(n, base); }
+void HardwareSerial::print(unsigned int n, int base) { if (base == BYTE) serialOut((char) n); else printNumber(n, base); }
+void HardwareSerial::print(long n, int base) { printSigned(n, base); }
+void HardwareSerial::print(unsigned long n, int base) { if (base == BYTE) serialOut((char) n); else printNumber(n, base); }
+void HardwareSerial::print(double n, int digits) {
+  char buf[64];
+
+  serialOut(buf, snprintf(buf, sizeof(buf), "%.*f", digits, n));
+}
+
+void HardwareSerial::println(void) { serialOut("\r\n", 2); }
+void HardwareSerial::println(const char c[]) { print(c); println(); }
+void HardwareSerial::println(char c, int base) { print(c, base); println(); }
+void HardwareSerial::println(unsigned char b, int base) { print(b, base); println(); }
+void HardwareSerial::println(int n, int base) { print(n, base); println(); }
+void HardwareSerial::println(unsigned int n, int base) { print(n, base); println(); }
+void HardwareSerial::println(long n, int base) { print(n, base); println(); }
+void HardwareSerial::println(unsigned long n, int base) { print(n, base); println(); }
+void HardwareSerial::println(double n, int digits) { print(n, digits); println(); }
@@ -0,0 +1,49 @@
+/* hostemu - build the libraries natively on Linux, and time them in simulated AVR cycles
+
+  A stand-in for the Arduino 0022 core and avr-libc headers (WProgram.h, WConstants.h, wiring_private.h,
+  pins_arduino.h, avr/io.h, avr/interrupt.h, avr/pgmspace.h), modelling an ATmega2560 at 16MHz:
+    - a cycle clock, run on by each register access, hostSpend() and delay()
+    - SREG, with cli()/sei() and interrupts run (in vector priority order) whenever the I bit is set
+    - SPI: SPCR/SPSR/SPDR with SPIF, WCOL and the SPI interrupt; each byte takes 8 SPI clocks at the divider set,
+      or a latency given by hostSpiLatency().  Devices are attached on a slave select pin (hostSpiAttach)
+    - Timers 1 and 5: prescalers, normal mode and mode 8 (phase & frequency correct, TOP = ICR1), compare A/B/C,
+      overflow, their flags and interrupts.  Other modes count as normal mode
+    - ports: writes to PORTx are caught as they happen (x86 Linux; elsewhere at the next register access), so
+      chip selects are followed and charged as sbi/cbi
+
+  What's counted: register accesses (1 cycle for I/O space, 2 for extended, 4 for 16 bit), port writes (2),
+  cli/sei (1), interrupt entry and reti (5 each), SPI transfers and whatever is charged with hostSpend().  Code
+  between them costs nothing, so figures are a floor for register-bound paths such as MCP23S17::intValid() and
+  WAKEUP::timerISR(), not a prediction for computation.  On the host int is 32 bits and long 64, so code relying
+  on AVR widths (eg 16 bit int overflow) may behave differently
+
+  Build, eg for Wakeup (from Tools/hostemu):
+    g++ -std=gnu++98 -I. -I../../Wakeup -I../../Timer1 -o prog prog.cpp hostemu.cpp ../../Wakeup/Wakeup.cpp ../../Timer1/TimerOne.cpp
+
+  and call hostInit() before anything else.  See hostbench.cpp
+*/
+
+#ifndef HostEmu_h
+#define HostEmu_h
+
+#include "WProgram.h"
+
+#define HOSTMAXSPI 4							// Devices attached to the SPI bus
+
+struct HOSTISRSTATS {							// Returned by hostIsrStats(); cycles from vector to reti inclusive
+  unsigned long count;
+  unsigned long long total;
+  unsigned long max;
+};
+
+void hostInit();								// Resets the clock, registers, pins and devices.  Must be called first
+unsigned long long hostCycles();				// Cycles since hostInit()
+void hostSpend(unsigned long cycles);			// Charge cycles for work the model can't see; timers run on and interrupts are taken
+void hostSpiLatency(unsigned int cycles);		// Cycles per SPI byte; 0 (the default) = 8 SPI clocks at the divider in SPCR/SPSR
+boolean hostSpiAttach(uint8_t ssPin, uint8_t (*device)(uint8_t mosi, boolean first));	// Device answers each byte sent while ssPin is low; first =
+												// first since ssPin was last high.  False if HOSTMAXSPI already attached
+void hostSerialEcho(boolean on);				// Serial output to stdout (the default), or dropped
+void hostPinInput(uint8_t pin, uint8_t level);	// Level read back by digitalRead/PINx for an input pin
+void hostIsrStats(uint8_t vectorNum, HOSTISRSTATS &stats, boolean reset = false);	// By avr-libc vector number, eg TIMER1_COMPA_vect_num
+
+#endif
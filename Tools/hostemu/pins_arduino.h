@@ -0,0 +1,41 @@
+/* Host emulation of the Arduino 0022 core's pins_arduino.h for the Mega (1280/2560) - see hostemu.h */
+
+#ifndef Pins_Arduino_h
+#define Pins_Arduino_h
+
+#include <avr/io.h>
+
+#define NOT_A_PIN 0
+#define NOT_A_PORT 0
+
+#define PA 1
+#define PB 2
+#define PC 3
+#define PD 4
+#define PE 5
+#define PF 6
+#define PG 7
+#define PH 8
+#define PJ 10
+#define PK 11
+#define PL 12
+
+#define NOT_ON_TIMER 0
+
+const static uint8_t SS   = 53;
+const static uint8_t MOSI = 51;
+const static uint8_t MISO = 50;
+const static uint8_t SCK  = 52;
+
+uint8_t hostPinPort(uint8_t pin);				// Port number of a digital pin (PA .. PL), or NOT_A_PORT
+uint8_t hostPinMask(uint8_t pin);				// Bit of the pin on its port
+
+#define digitalPinToPort(P) hostPinPort(P)
+#define digitalPinToBitMask(P) hostPinMask(P)
+#define digitalPinToTimer(P) NOT_ON_TIMER
+#define analogInPinToBit(P) (P)
+#define portOutputRegister(P) (&hostPortPage[P])
+#define portInputRegister(P) (&hostPinRegs[P])
+#define portModeRegister(P) (&hostDdrRegs[P])
+
+#endif
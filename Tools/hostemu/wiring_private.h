@@ -0,0 +1,15 @@
+/* Host emulation of the Arduino 0022 core's wiring_private.h - see hostemu.h */
+
+#ifndef WiringPrivate_h
+#define WiringPrivate_h
+
+#include "WProgram.h"
+
+#ifndef cbi
+#define cbi(sfr, bit) ((sfr) &= ~_BV(bit))
+#endif
+#ifndef sbi
+#define sbi(sfr, bit) ((sfr) |= _BV(bit))
+#endif
+
+#endif
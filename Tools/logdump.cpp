@@ -0,0 +1,116 @@
+/* logdump - check and list reading logs written by the Controller sketch
+
+  Build:   g++ -o logdump logdump.cpp
+  Usage:   logdump [-c] file...          -c = check only, no listing
+
+  Each file is either a whole day's log copied from the card (LOG/YYYYMMDD.BIN, or GET /LOG/YYYYMMDD.BIN), which
+  starts with its LOGINDEX block, or a range served by ajax!L<yyyymmdd>=<hour>, which is LOGBLOCKs only.
+
+  Checks that every block is whole with the right magic and sum, blocks are in sequence with hours in order, each
+  record is in its block's hour (and day, if the index is there) and in time order, and the index points to the first
+  block of each hour.  Records are listed as CSV: time, arduino, ref (hex), reading.  Problems are reported to stderr
+  and give exit status 1
+
+  Layout (little-endian, as written by the Mega) - see READING LOG in Controller.pde:
+    LOGINDEX  magic "HALG", version, recordSize, arduino, recsPerBlock, year (2), month, day, hourBlock[24] (2 each)
+    LOGBLOCK  magic 0x4c42 (2), hour, count, seq (2), sum (2), then count x LOGRECORD of at (4), ref (2), reading (2)
+
+**************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+const int logBlockSize = 512;
+const int logBlockHeader = 8;
+const int logRecordSize = 8;
+const unsigned int logBlockMagic = 0x4c42;
+const int logVersion = 1;
+
+bool checkOnly = false;
+int problems = 0;
+
+unsigned int get16(const unsigned char *p) { return p[0] | (p[1] << 8); }
+unsigned long get32(const unsigned char *p) { return get16(p) | ((unsigned long) get16(p + 2) << 16); }
+
+void problem(const char *filename, long block, const char *what) {
+  fprintf(stderr, "%s: block %ld: %s\n", filename, block, what);
+  problems++;
+}
+
+void dumpFile(const char *filename) {
+  FILE *f = fopen(filename, "rb");
+  unsigned char block[logBlockSize];
+  unsigned int hourBlock[24];
+  bool indexed = false, firstInHour[24];
+  int arduino = -1, year = 0, month = 0, day = 0, lastHour = -1;
+  long blockNum = 0, lastSeq = -1;
+  unsigned long lastAt = 0;
+  size_t n;
+
+  if (!f) { perror(filename); problems++; return; }
+  memset(firstInHour, 0, sizeof(firstInHour));
+
+  while ((n = fread(block, 1, logBlockSize, f)) > 0) {
+    if (n != logBlockSize) { problem(filename, blockNum, "part block at end"); break; }
+
+    if (blockNum == 0 && memcmp(block, "HALG", 4) == 0) {        // Index
+      indexed = true;
+      if (block[4] != logVersion) problem(filename, 0, "unknown version");
+      if (block[5] != logRecordSize) problem(filename, 0, "unexpected record size");
+      arduino = block[6];
+      year = get16(block + 8);
+      month = block[10];
+      day = block[11];
+      for (int h = 0; h < 24; h++) hourBlock[h] = get16(block + 12 + h * 2);
+      blockNum++;
+      continue;
+    }
+
+    unsigned int sum = 0;
+    int hour = block[2], count = block[3];
+    long seq = get16(block + 4);
+
+    for (int i = 0; i < logBlockSize; i++) if (i != 6 && i != 7) sum += block[i];
+    if (get16(block) != logBlockMagic) { problem(filename, blockNum, "bad magic"); blockNum++; continue; }
+    if ((sum & 0xffff) != get16(block + 6)) problem(filename, blockNum, "bad sum");
+    if (count > (logBlockSize - logBlockHeader) / logRecordSize) { problem(filename, blockNum, "bad count"); count = 0; }
+    if (hour > 23) { problem(filename, blockNum, "bad hour"); hour = 23; }
+    if (indexed && seq != blockNum) problem(filename, blockNum, "out of place");
+    if (lastSeq >= 0 && seq != lastSeq + 1) problem(filename, blockNum, "out of sequence");
+    if (hour < lastHour) problem(filename, blockNum, "hour out of order");
+    if (indexed && hour != lastHour) {
+      firstInHour[hour] = true;
+      if (hourBlock[hour] != seq) problem(filename, blockNum, "not indexed as first of hour");
+    }
+    lastSeq = seq;
+    lastHour = hour;
+
+    for (int r = 0; r < count; r++) {
+      const unsigned char *rec = block + logBlockHeader + r * logRecordSize;
+      time_t at = get32(rec);
+      struct tm *tm = gmtime(&at);
+
+      if (tm->tm_hour != hour) problem(filename, blockNum, "record outside hour");
+      if (indexed && (tm->tm_year + 1900 != year || tm->tm_mon + 1 != month || tm->tm_mday != day)) problem(filename, blockNum, "record outside day");
+      if ((unsigned long) at < lastAt) problem(filename, blockNum, "record out of time order");
+      lastAt = at;
+      if (!checkOnly) printf("%04d-%02d-%02d %02d:%02d:%02d,%d,%04x,%d\n", tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
+                             tm->tm_hour, tm->tm_min, tm->tm_sec, arduino, get16(rec + 4), (short) get16(rec + 6));
+    }
+    blockNum++;
+  }
+
+  if (indexed) for (int h = 0; h < 24; h++) if (hourBlock[h] && !firstInHour[h]) problem(filename, hourBlock[h], "indexed but not first of hour");
+  fclose(f);
+}
+
+int main(int argc, char **argv) {
+  int i = 1;
+
+  if (i < argc && strcmp(argv[i], "-c") == 0) { checkOnly = true; i++; }
+  if (i == argc) { fprintf(stderr, "Usage: logdump [-c] file...\n"); return 2; }
+  for (; i < argc; i++) dumpFile(argv[i]);
+  if (problems) fprintf(stderr, "%d problems\n", problems);
+  return problems ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+/* evaltest - check the compiled evals (codeRun) against the interpreter (evalRun) on random eval sets
+
+  Build (from Tools/sketchtest):
+    ./sketchpart.sh ../../Sketches/Controller.pde "PROFILING" "DEVICE STUFF" "DECISION STUFF" "OTHER STUFF" "Rolling statistics" \
+        "Long history" -- mapGet mapPut mapAccess stackGet stackPush stackAccess currGet currPut statusPut versionBump \
+        evalGet evalPut evalAccess argGet argPut argAccess dhmGet dhmPut dhmAccess dhmMake dhmBetween dhmNow \
+        statsAttach statsFind statsAdd statsPush statsGet histNow histRecord histFind histGet \
+        evalRun evalStore markChanged compileEvals compileEval compileArg codeEmit codeStack codeRun buildDeps > evaltest.inc
+    g++ -std=gnu++98 -I. -I../hostemu -I../../HomeAutom -o evaltest evaltest.cpp ../hostemu/hostemu.cpp ../../HomeAutom/HomeAutom.cpp
+  Usage:   evaltest [trials]                 default 3000
+
+  Each trial fills 20 devices (every third with StackMode = 1) and 10 variables with random readings, makes 12 random
+  evals - plain, lists of devices/variables and lists of earlier evals, some with destinations - and compiles them.
+  Then every compiled rule is run by codeRun and its eval by evalRun, and the results and whether each would write
+  are compared.  Mismatches are listed (the first few) and give exit status 1
+
+**************************/
+
+#include "sketchtest.h"
+#include "evaltest.inc"
+
+const int testDevices = 20;
+const int testVars = 10;
+const int testEvals = 12;
+const int maxShown = 5;
+
+byte randomInput() {                               // Device or variable
+  return (rand() % 2) ? 1 + rand() % (testDevices - 1) : mask8BitMSB | rand() % testVars;
+}
+
+void randomConfig() {
+  const byte calcs[] = { valCalcNOT, valCalcCURR, valCalcPREV, valCalcAvg, valCalcMax, valCalcMin, valCalcROfC, valCalcHour, valCalcMinute };
+  const byte listExps[] = { valExpAvg, valExpMax, valExpADD, valExpMin, valExpMULT, valExpAND, valExpOR };
+  byte exp;
+
+  numDevices = testDevices;
+  numVars = testVars;
+  for (byte d = 1; d < testDevices; d++) {
+    devRef[d] = rand() & 0xffff;
+    devFlags[d] = (d % 3 == 0) ? flagStackMode : 0;
+    devWindow[d] = stackSize;
+    devStack[d] = (d % 3 == 0) ? d : rand() & 0xff;
+    devTOSIdx[d] = rand() % stackSize;
+  }
+  for (int i = 0; i < maxReadings; i++) readingHistory[i] = rand() % 50;
+  for (byte v = 0; v < testVars; v++) varReading[v] = rand() % 50;
+
+  memset(evalArray, 0, sizeof(evalArray));
+  memset(turnOffArray, 0, sizeof(turnOffArray));
+  numEvals = testEvals;
+  numArgs = 0;
+  for (byte e = 0; e < testEvals; e++) {
+    int kind = (e == 0) ? 0 : rand() % 3;        // Plain, list of devices/variables, list of evals
+    if (kind == 0) {
+      evalPut(e, valCalc, calcs[rand() % sizeof(calcs)]);
+      evalPut(e, valA, randomInput());
+      evalPut(e, valB, randomInput());
+      exp = rand() % (valExpNotBTW + 1);
+      if (exp == valExpDIV) exp = valExpADD;       // No divide by zero
+      evalPut(e, valExp, exp);
+    }
+    else {
+      byte len = 1 + rand() % 4;
+      evalPut(e, valCalc, (kind == 2) ? valCalcListE : valCalcListM);
+      evalPut(e, valPtr, numArgs);
+      evalPut(e, valLen, len);
+      for (byte i = 0; i < len; i++) argArray[numArgs++] = (kind == 2) ? rand() % e : randomInput();
+      evalPut(e, valExp, listExps[rand() % sizeof(listExps)]);
+    }
+    evalPut(e, valDest, (e < 4) ? 0 : 1 + rand() % (testDevices - 1));
+  }
+}
+
+int main(int argc, char **argv) {
+  int trials = (argc > 1) ? atoi(argv[1]) : 3000;
+  int compiled = 0, rules = 0, mismatches = 0;
+  int pc;
+  byte evalIdx, flags;
+  unsigned int viaCode, viaEval;
+  boolean actCode, actEval;
+
+  hostInit();
+  hostSerialEcho(false);                         // The sketch's own complaints about random configs (eg Stats OF)
+  srand(1);
+  testNow = 1792195200L + 22 * 3600L + 30 * 60;    // Thu 15 Oct 2026 22:30
+  testTimeStatus = timeSet;
+
+  for (int t = 0; t < trials; t++) {
+    randomConfig();
+    compileEvals();
+    if (!codeLen) continue;                        // Didn't fit; evalRun would be used
+    compiled++;
+
+    for (pc = 0; pc < codeLen; ) {
+      evalIdx = evalCode[pc];
+      flags = evalCode[pc + 2];
+      pc += codeHeader;
+      viaCode = codeRun(&pc);
+      actCode = viaCode || !(flags & codeActOnResult);
+      viaEval = evalRun(evalIdx, &actEval);
+      actEval = actEval != 0;                      // boolean is a byte, as on the Arduino
+      rules++;
+      if (viaCode != viaEval || actCode != actEval) {
+        if (mismatches++ < maxShown) printf("trial %d eval %d (calc %d, exp %d): codeRun %u%s, evalRun %u%s\n", t, evalIdx,
+                                             evalGet(evalIdx, valCalc), evalGet(evalIdx, valExp),
+                                             viaCode, actCode ? "" : " (no write)", viaEval, actEval ? "" : " (no write)");
+      }
+    }
+  }
+
+  printf("%d of %d eval sets compiled, %d rules run both ways, %d mismatches\n", compiled, trials, rules, mismatches);
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,143 @@
+/* histtest - check the long history kept in the hist arena (histRecord/histGet) against a plain list of changes, and that
+              the arena and the stack blocks sharing readingHistory stay out of each other's way
+
+  Build (from Tools/sketchtest):
+    ./sketchpart.sh ../../Sketches/Controller.pde "PROFILING" "DEVICE STUFF" "DECISION STUFF" "OTHER STUFF" "Rolling statistics" \
+        "Long history" -- mapGet mapPut mapAccess stackGet stackPush stackAccess currGet currPut statusPut versionBump \
+        markChanged statsAttach statsFind statsAdd statsPush statsGet histAttach histStart histNow histRecord histFind histGet \
+        dhmGet dhmPut dhmAccess > histtest.inc
+    g++ -std=gnu++98 -I. -I../hostemu -I../../HomeAutom -o histtest histtest.cpp ../hostemu/hostemu.cpp ../../HomeAutom/HomeAutom.cpp
+  Usage:   histtest [readings]               default 100000
+
+  Readings are allotted as loadDevices does: devices 1-5 are given 'hist' of 2, 3, 10, 50 and 200, each followed by a
+  stack block, then one of 5000 (which mustn't fit), then filler devices take stack blocks until readingHistory is full.
+  Each reading goes to a device at random - mostly small changes, some large (so a sample needs more than 2 bytes),
+  some no change - with the clock moved on by up to an hour.  After each, a few samples back from the latest are read
+  by histGet and compared with the list; samples beyond the depth must be refused, and the one before the latest held
+  (but for a hist of 2, whose region a large change overflows).  The latest reading of every filler device is checked
+  too.  Mismatches give exit status 1
+
+**************************/
+
+#include "sketchtest.h"
+#include "histtest.inc"
+
+const unsigned int testDepths[] = { 2, 3, 10, 50, 200 };
+const byte numTestDevices = sizeof(testDepths) / sizeof(testDepths[0]);
+const int refSize = 256;                           // > deepest + back tried beyond it
+const int maxShown = 5;
+
+struct REFLOG {                                    // Every change of a device, newest at [(count - 1) % refSize]
+  long count;
+  int reading[refSize];
+  unsigned long at[refSize];
+} ref[numTestDevices + 1];
+
+byte numBlocks = 0;                               // config.readingIdx
+byte numFillers = 0;
+unsigned int fillerLatest[maxDevices];
+
+boolean allotStack(byte deviceIdx) {               // As loadDevices, with a window of stackSize
+  unsigned int bytes = stackSize * sizeof(unsigned int);
+
+  if (bytes > readingsFree) return false;
+  devFlags[deviceIdx] |= flagStackMode;
+  devWindow[deviceIdx] = stackSize;
+  devStack[deviceIdx] = numBlocks++;
+  devTOSIdx[deviceIdx] = 0;
+  readingsFree -= bytes;
+  return true;
+}
+
+void refAdd(byte deviceIdx) {
+  REFLOG *r = &ref[deviceIdx];
+
+  r->reading[r->count % refSize] = (int) stackGet(deviceIdx, 0);
+  r->at[r->count % refSize] = histNow();
+  r->count++;
+}
+
+int main(int argc, char **argv) {
+  long readings = (argc > 1) ? atol(argv[1]) : 100000;
+  long checks = 0;
+  int mismatches = 0, reading;
+  byte deviceIdx;
+  unsigned int back, value;
+  unsigned long at;
+
+  hostInit();
+  hostSerialEcho(false);                           // Hist arena OF, expected
+  srand(5);
+  testNow = 1792195200L;                           // Thu 15 Oct 2026 00:00
+  testTimeStatus = timeSet;
+
+  for (deviceIdx = 1; deviceIdx <= numTestDevices; deviceIdx++) {
+    histAttach(deviceIdx, testDepths[deviceIdx - 1]);
+    allotStack(deviceIdx);
+  }
+  histAttach(numTestDevices + 1, 5000);
+  if (devFlags[numTestDevices + 1] & flagHist) { printf("hist of 5000 allotted in %d bytes\n", (int) sizeof(readingHistory)); return 1; }
+  for (deviceIdx = numTestDevices + 2; deviceIdx < maxDevices && allotStack(deviceIdx); deviceIdx++) numFillers++;
+  numDevices = deviceIdx;
+  if (numHistLogs != numTestDevices) { printf("%d of %d hists allotted\n", numHistLogs, numTestDevices); return 1; }
+
+  histStart();
+  for (deviceIdx = 1; deviceIdx <= numTestDevices; deviceIdx++) refAdd(deviceIdx);
+
+  for (long r = 0; r < readings; r++) {
+    testNow += rand() % ((r % 7) ? 60 : 3600);
+    if (rand() % 4 == 0) {                         // Filler
+      deviceIdx = numTestDevices + 2 + rand() % numFillers;
+      fillerLatest[deviceIdx] = rand() & 0xffff;
+      stackPush(deviceIdx, fillerLatest[deviceIdx]);
+      continue;
+    }
+
+    deviceIdx = 1 + rand() % numTestDevices;
+    switch (rand() % 10) {
+      case 0: case 1: case 2: case 3: case 4: case 5:
+        value = stackGet(deviceIdx, 0) + rand() % 21 - 10; break;
+      case 6: case 7: case 8:
+        value = rand() & 0xffff; break;
+      default:
+        value = stackGet(deviceIdx, 0);
+    }
+    if (value != stackGet(deviceIdx, 0)) {
+      stackPush(deviceIdx, value);
+      refAdd(deviceIdx);
+    }
+    else stackPush(deviceIdx, value);
+
+    for (byte k = 0; k < 3; k++) {
+      REFLOG *rl;
+
+      deviceIdx = 1 + rand() % numTestDevices;
+      rl = &ref[deviceIdx];
+      back = rand() % (testDepths[deviceIdx - 1] + 3);
+      checks++;
+      if (!histGet(deviceIdx, back, &reading, &at)) {
+        if (back < 2 && back < rl->count && testDepths[deviceIdx - 1] > 2 && mismatches++ < maxShown) printf("reading %ld: %d back %u not held\n", r, deviceIdx, back);
+      }
+      else if (back >= testDepths[deviceIdx - 1] || back >= rl->count) {
+        if (mismatches++ < maxShown) printf("reading %ld: %d back %u held, beyond depth %u\n", r, deviceIdx, back, testDepths[deviceIdx - 1]);
+      }
+      else {
+        long i = (rl->count - 1 - back) % refSize;
+        if ((short) reading != (short) rl->reading[i] || at != rl->at[i]) {
+          if (mismatches++ < maxShown) printf("reading %ld: %d back %u is %d at %lu, changed to %d at %lu\n", r, deviceIdx, back,
+                                               reading, at, rl->reading[i], rl->at[i]);
+        }
+      }
+    }
+  }
+
+  for (deviceIdx = numTestDevices + 2; deviceIdx < numDevices; deviceIdx++) {
+    checks++;
+    if (stackGet(deviceIdx, 0) != fillerLatest[deviceIdx] && mismatches++ < maxShown)
+      printf("filler %d is %u, not %u\n", deviceIdx, stackGet(deviceIdx, 0), fillerLatest[deviceIdx]);
+  }
+
+  printf("%ld readings to %d hists (%u bytes) and %d fillers, %ld checks, %d mismatches\n", readings, numHistLogs, histArenaUsed,
+         numFillers, checks, mismatches);
+  return mismatches ? 1 : 0;
+}
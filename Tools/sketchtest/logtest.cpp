@@ -0,0 +1,210 @@
+/* logtest - check the day files written by the reading log (logReading) against the readings given it
+
+  Build (from Tools/sketchtest):
+    ./sketchpart.sh ../../Sketches/Controller.pde "PROFILING" "SDCARD STUFF" "READING LOG" "DEVICE STUFF" -- \
+        logReading logOpen logWriteBlock logPad > logtest.inc
+    g++ -std=gnu++98 -I. -I../hostemu -I../../HomeAutom -o logtest logtest.cpp ../hostemu/hostemu.cpp ../../HomeAutom/HomeAutom.cpp
+  Usage:   logtest [readings]                default 20000
+
+  Readings of random devices are logged from Thu 15 Oct 2026 22:30, mostly a few secs apart (so blocks fill) but with
+  gaps of up to 15 mins (so hours and days are skipped).  Between readings the staged records are written now and then,
+  as loop() does every logSyncFreq heartbeats, and the Arduino is reset now and then, losing them.  SdFat's SdFile is
+  modelled here, on files in memory.  At the end each day file is checked as logdump would - index, magic, sums,
+  sequence, hours, padding - and the records in all of them must be the readings logged, less those lost on reset, in
+  order.  Problems are listed (the first few) and give exit status 1.  Sizes are the host's: a record is 16 bytes, so
+  a block holds logRecsPerBlock = 31 of them
+
+**************************/
+
+#include <map>
+#include <string>                                  // Ahead of Arduino's min & max
+#include <vector>
+#include <stddef.h>
+#define SKETCHTEST_LOG
+#include "sketchtest.h"
+
+// ******** SdFat, as used by the reading log: files and directories held in memory, by path
+#define O_READ 0x01
+#define O_RDWR 0x03
+#define O_CREAT 0x10
+
+std::map<std::string, std::string> cardFiles;
+std::map<std::string, boolean> cardDirs;
+
+class Sd2Card { };
+class SdVolume { };
+
+class SdFile {
+public:
+  SdFile() : _pos(0), _open(false), _dir(false) { }
+  void openRoot() { _path = ""; _open = _dir = true; }
+  uint8_t open(SdFile &dir, const char *name, uint8_t oflag) {
+    std::string path = dir._path + "/" + name;
+
+    if (_open || !dir._open || !dir._dir) return false;
+    if (cardDirs.count(path)) _dir = true;
+    else if (cardFiles.count(path) || (oflag & O_CREAT)) { cardFiles[path]; _dir = false; }
+    else return false;
+    _path = path;
+    _pos = 0;
+    _open = true;
+    return true;
+  }
+  uint8_t makeDir(SdFile *dir, const char *name) {
+    std::string path = dir->_path + "/" + name;
+
+    if (_open || cardDirs.count(path) || cardFiles.count(path)) return false;
+    cardDirs[path] = true;
+    _path = path;
+    _open = _dir = true;
+    return true;
+  }
+  int16_t read(void *buf, uint16_t len) {
+    std::string &data = cardFiles[_path];
+
+    if (!_open || _dir) return -1;
+    if (len > data.size() - _pos) len = data.size() - _pos;
+    memcpy(buf, data.data() + _pos, len);
+    _pos += len;
+    return len;
+  }
+  int16_t write(const void *buf, uint16_t len) {
+    std::string &data = cardFiles[_path];
+
+    if (!_open || _dir) return -1;
+    if (_pos + len > data.size()) data.resize(_pos + len);
+    data.replace(_pos, len, (const char*) buf, len);
+    _pos += len;
+    return len;
+  }
+  uint8_t seekSet(uint32_t pos) {
+    if (!_open || pos > fileSize()) return false;
+    _pos = pos;
+    return true;
+  }
+  uint32_t fileSize() { return _dir ? 0 : cardFiles[_path].size(); }
+  uint8_t sync() { return _open; }
+  void close() { _open = false; }
+  boolean isOpen() { return _open; }
+private:
+  std::string _path;
+  uint32_t _pos;
+  boolean _open, _dir;
+};
+
+#include "logtest.inc"
+
+// ******** Readings and checks
+const byte testDevices = 10;
+const int maxShown = 5;
+
+std::vector<LOGRECORD> logged;                     // Readings given logReading, less those lost on reset
+int problems = 0;
+
+void problem(const std::string &filename, long block, const char *what) {
+  if (problems++ < maxShown) printf("%s: block %ld: %s\n", filename.c_str(), block, what);
+}
+
+void resetArduino() {                              // Staged records are lost; globals start as the sketch's
+  logged.resize(logged.size() - logStaged);
+  logFile.close();
+  memset(&logIndex, 0, sizeof(logIndex));
+  memset(&logBlock, 0, sizeof(logBlock));
+  logStaged = 0;
+  logRecSum = 0;
+}
+
+long checkFile(const std::string &filename, const std::string &data, long first) {      // Records found, or -1
+  LOGINDEX index;
+  LOGBLOCK header;
+  const LOGRECORD *rec;
+  const byte *block;
+  unsigned int sum;
+  int lastHour = -1;
+  long found = 0;
+  char name[32];
+  time_t t;
+
+  if (data.size() < (size_t) logBlockSize || data.size() % logBlockSize) { problem(filename, 0, "not whole blocks"); return -1; }
+  memcpy(&index, data.data(), sizeof(index));
+  t = logged[first].at;
+  sprintf(name, "/LOG/%04d%02d%02d.BIN", year(t), month(t), day(t));
+  if (filename != name) { problem(filename, 0, "not the day of the next reading"); return -1; }
+  if (memcmp(index.magic, "HALG", 4) || index.version != logVersion || index.recordSize != sizeof(LOGRECORD) ||
+      index.recsPerBlock != logRecsPerBlock || (int) index.year != year(t) || index.month != month(t) || index.day != day(t) ||
+      index.arduino != arduinoMe)
+    problem(filename, 0, "index wrong");
+
+  for (long b = 1; b < (long) (data.size() / logBlockSize); b++) {
+    block = (const byte*) data.data() + b * logBlockSize;
+    memcpy(&header, block, sizeof(header));
+    sum = 0;
+    for (int i = 0; i < logBlockSize; i++) sum += block[i];
+    for (size_t i = 0; i < sizeof(header.sum); i++) sum -= block[offsetof(LOGBLOCK, sum) + i];
+    if (header.magic != logBlockMagic) problem(filename, b, "bad magic");
+    if ((unsigned int) (sum & 0xffff) != (header.sum & 0xffff)) problem(filename, b, "bad sum");
+    if (header.seq != b) problem(filename, b, "out of sequence");
+    if (!header.count || header.count > logRecsPerBlock) { problem(filename, b, "bad count"); continue; }
+    if (header.hour < lastHour) problem(filename, b, "hour goes back");
+    if (header.hour != lastHour && index.hourBlock[header.hour] != b) problem(filename, b, "not indexed as first of its hour");
+    for (int h = lastHour + 1; h < header.hour; h++) if (index.hourBlock[h]) problem(filename, b, "hour with no blocks indexed");
+    lastHour = header.hour;
+    for (size_t i = sizeof(header) + header.count * sizeof(LOGRECORD); i < (size_t) logBlockSize; i++)
+      if (block[i]) { problem(filename, b, "not padded with zeros"); break; }
+
+    rec = (const LOGRECORD*) (block + sizeof(header));
+    for (int r = 0; r < header.count; r++, found++) {
+      if (hour(rec[r].at) != header.hour || day(rec[r].at) != index.day) problem(filename, b, "record not in block's hour");
+      if (first + found >= (long) logged.size() || memcmp(&rec[r], &logged[first + found], sizeof(LOGRECORD))) {
+        problem(filename, b, "record not the reading logged");
+        return -1;
+      }
+    }
+  }
+  for (int h = lastHour + 1; h < 24; h++) if (index.hourBlock[h]) problem(filename, 0, "hour with no blocks indexed");
+  return found;
+}
+
+int main(int argc, char **argv) {
+  long readings = (argc > 1) ? atol(argv[1]) : 20000;
+  long checked = 0, found;
+  int resets = 0, writes = 0;
+  byte deviceIdx;
+  unsigned int value;
+
+  hostInit();
+  hostSerialEcho(false);
+  srand(4);
+  testNow = 1792195200L + 22 * 3600L + 30 * 60;    // Thu 15 Oct 2026 22:30
+  testTimeStatus = timeSet;
+  root.openRoot();
+  for (byte d = 1; d <= testDevices; d++) devRef[d] = 0x1000 * d + rand() % 0x1000;
+
+  for (long r = 0; r < readings; r++) {
+    testNow += (rand() % 10) ? rand() % 6 : rand() % 900;
+    deviceIdx = 1 + rand() % testDevices;
+    value = rand() & 0xffff;
+    logReading(deviceIdx, value);
+    LOGRECORD rec = { (unsigned long) testNow, devRef[deviceIdx], value };
+    logged.push_back(rec);
+    if (rand() % 20 == 0 && logStaged) { logWriteBlock(); writes++; }      // logSyncFreq heartbeats on
+    if (rand() % 500 == 0) { resetArduino(); resets++; }
+  }
+  if (logStaged) logWriteBlock();
+  if (logDropped) { printf("%u readings dropped\n", logDropped); problems++; }
+
+  for (std::map<std::string, std::string>::iterator f = cardFiles.begin(); f != cardFiles.end(); f++) {
+    if (checked >= (long) logged.size()) { problem(f->first, 0, "no readings left for file"); break; }
+    found = checkFile(f->first, f->second, checked);
+    if (found < 0) break;
+    checked += found;
+  }
+  if (checked != (long) logged.size()) {
+    printf("%ld of %ld readings kept are on the card\n", checked, (long) logged.size());
+    problems++;
+  }
+
+  printf("%ld readings, %d resets, %d early writes: %d day files, %ld records checked, %d problems\n",
+         readings, resets, writes, (int) cardFiles.size(), checked, problems);
+  return problems ? 1 : 0;
+}
@@ -0,0 +1,176 @@
+/* ruletest - check that rerunning only the rules whose inputs changed (markChanged/ruleDirty) gives the same readings
+              as running every rule each heartbeat
+
+  Build (from Tools/sketchtest):
+    ./sketchpart.sh ../../Sketches/Controller.pde "PROFILING" "DEVICE STUFF" "DECISION STUFF" "OTHER STUFF" "Rolling statistics" \
+        "Long history" -- mapGet mapPut mapAccess stackGet stackPush stackAccess currGet currPut statusPut versionBump \
+        evalGet evalPut evalAccess argGet argPut argAccess dhmGet dhmPut dhmAccess dhmMake dhmBetween dhmNow \
+        statsAttach statsFind statsAdd statsPush statsGet histNow histRecord histFind histGet \
+        evalRun evalStore markChanged makeDecisions compileEvals compileEval compileArg codeEmit codeStack codeRun buildDeps > ruletest.inc
+    g++ -std=gnu++98 -I. -I../hostemu -I../../HomeAutom -o ruletest ruletest.cpp ../hostemu/hostemu.cpp ../../HomeAutom/HomeAutom.cpp
+  Usage:   ruletest [trials]                 default 500
+
+  Each trial makes 30 random evals over 20 devices and 10 variables, as evaltest, but with latest readings only (CURR
+  and NOT, so no rule is codeAlways) and each rule writing a destination of its own - devices 11-19, variables 5-9 - so
+  the order rules run in can't change the outcome.  Then for 20 heartbeats a few of devices 1-10 and variables 0-4 are
+  given new readings, and makeDecisions is run twice from the same state: compiled, so only dirty rules rerun, and
+  interpreted (codeLen = 0), so every rule runs.  The latest reading of every device and variable must match after
+  each.  Mismatches give exit status 1
+
+**************************/
+
+#include "sketchtest.h"
+#include "ruletest.inc"
+
+const int testDevices = 20;
+const int testVars = 10;
+const int testEvals = 30;
+const int testHeartbeats = 20;
+const int maxShown = 5;
+
+struct SNAPSHOT {                                  // Everything makeDecisions reads or writes
+  byte devStack[maxDevices];
+  byte devTOSIdx[maxDevices];
+  byte devStatus[maxDevices];
+  unsigned int readingHistory[maxReadings];
+  unsigned int varReading[maxVars];
+  byte ruleDirty[maxEvals / 8];
+};
+
+void save(SNAPSHOT &snap) {
+  memcpy(snap.devStack, devStack, sizeof(devStack));
+  memcpy(snap.devTOSIdx, devTOSIdx, sizeof(devTOSIdx));
+  memcpy(snap.devStatus, devStatus, sizeof(devStatus));
+  memcpy(snap.readingHistory, readingHistory, sizeof(readingHistory));
+  memcpy(snap.varReading, varReading, sizeof(varReading));
+  memcpy(snap.ruleDirty, ruleDirty, sizeof(ruleDirty));
+}
+
+void restore(SNAPSHOT &snap) {
+  memcpy(devStack, snap.devStack, sizeof(devStack));
+  memcpy(devTOSIdx, snap.devTOSIdx, sizeof(devTOSIdx));
+  memcpy(devStatus, snap.devStatus, sizeof(devStatus));
+  memcpy(readingHistory, snap.readingHistory, sizeof(readingHistory));
+  memcpy(varReading, snap.varReading, sizeof(varReading));
+  memcpy(ruleDirty, snap.ruleDirty, sizeof(ruleDirty));
+}
+
+byte randomInput() {                               // Device or variable
+  return (rand() % 2) ? 1 + rand() % (testDevices - 1) : mask8BitMSB | rand() % testVars;
+}
+
+byte ruleDest(byte evalIdx) {                      // Own destination, or none (nested only)
+  if (evalIdx < 4) return 0;
+  if (evalIdx < 13) return evalIdx + 7;            // Devices 11-19
+  if (evalIdx < 18) return mask8BitMSB | (evalIdx - 8);      // Variables 5-9
+  return 0;
+}
+
+void randomConfig() {
+  const byte listExps[] = { valExpAvg, valExpMax, valExpADD, valExpMin, valExpMULT, valExpAND, valExpOR };
+  byte exp;
+
+  numDevices = testDevices;
+  numVars = testVars;
+  for (byte d = 1; d < testDevices; d++) {
+    devRef[d] = 0;
+    devPin[d] = pinNoOp;
+    devFlags[d] = (d % 3 == 0) ? flagStackMode : 0;
+    devWindow[d] = stackSize;
+    devStack[d] = (d % 3 == 0) ? d : rand() & 0xff;
+    devTOSIdx[d] = rand() % stackSize;
+  }
+  for (int i = 0; i < maxReadings; i++) readingHistory[i] = rand() % 4;
+  for (byte v = 0; v < testVars; v++) varReading[v] = rand() % 4;
+
+  memset(evalArray, 0, sizeof(evalArray));
+  memset(turnOffArray, 0, sizeof(turnOffArray));
+  numEvals = testEvals;
+  numArgs = 0;
+  for (byte e = 0; e < testEvals; e++) {
+    int kind = (e == 0) ? 0 : rand() % 3;        // Plain, list of devices/variables, list of evals
+    if (kind == 0) {
+      evalPut(e, valCalc, (rand() % 2) ? valCalcCURR : valCalcNOT);
+      evalPut(e, valA, randomInput());
+      evalPut(e, valB, randomInput());
+      exp = rand() % (valExpOR + 1);
+      if (exp == valExpDIV) exp = valExpEQ;        // No divide by zero
+      evalPut(e, valExp, exp);
+    }
+    else {
+      byte len = 1 + rand() % 4;
+      evalPut(e, valCalc, (kind == 2) ? valCalcListE : valCalcListM);
+      evalPut(e, valPtr, numArgs);
+      evalPut(e, valLen, len);
+      for (byte i = 0; i < len; i++) argArray[numArgs++] = (kind == 2) ? rand() % e : randomInput();
+      evalPut(e, valExp, listExps[rand() % sizeof(listExps)]);
+    }
+    evalPut(e, valDest, ruleDest(e));
+  }
+}
+
+int main(int argc, char **argv) {
+  int trials = (argc > 1) ? atoi(argv[1]) : 500;
+  int heartbeats = 0, mismatches = 0, compiledLen, rules;
+  long dirtyRuns = 0, fullRuns = 0;
+  byte changes, who[3];
+  unsigned int value[3];
+  SNAPSHOT incremental, full;
+
+  hostInit();
+  hostSerialEcho(false);
+  srand(2);
+  testNow = 1792195200L + 22 * 3600L + 30 * 60;    // Thu 15 Oct 2026 22:30; minute never changes, so codeTimed rules aren't rerun
+  testTimeStatus = timeSet;
+
+  for (int t = 0; t < trials; t++) {
+    randomConfig();
+    compileEvals();
+    if (!codeLen) continue;
+    compiledLen = codeLen;
+    for (int pc = rules = 0; pc < codeLen; pc += codeHeader + evalCode[pc + 3] + (evalCode[pc + 4] << 8)) rules++;
+    save(incremental);
+    save(full);
+
+    for (int hb = 0; hb < testHeartbeats; hb++) {
+      changes = rand() % 3;
+      for (byte i = 0; i < changes; i++) {
+        who[i] = (rand() % 2) ? 1 + rand() % 10 : mask8BitMSB | rand() % 5;
+        value[i] = rand() % 4;
+      }
+
+      restore(incremental);
+      for (byte i = 0; i < changes; i++) currPut(who[i], value[i]);
+      for (int r = 0; r < rules; r++) if (ruleDirty[r >> 3] & (1 << (r & 7))) dirtyRuns++;
+      codeLen = compiledLen;
+      makeDecisions();
+      save(incremental);
+
+      restore(full);
+      for (byte i = 0; i < changes; i++) currPut(who[i], value[i]);
+      codeLen = 0;                                 // Interpret: every rule, every time
+      makeDecisions();
+      save(full);
+      codeLen = compiledLen;
+      fullRuns += rules;
+      heartbeats++;
+
+      for (byte idx = 1; idx < testDevices + testVars; idx++) {
+        byte ref = (idx < testDevices) ? idx : mask8BitMSB | (idx - testDevices);
+        unsigned int reading;
+
+        restore(incremental);
+        reading = currGet(ref);
+        restore(full);
+        if (currGet(ref) != reading) {
+          if (mismatches++ < maxShown) printf("trial %d heartbeat %d: %s %d is %u rerunning dirty rules, %u running all\n", t, hb,
+                                               (ref & mask8BitMSB) ? "variable" : "device", ref & ~mask8BitMSB, reading, currGet(ref));
+          break;
+        }
+      }
+    }
+  }
+
+  printf("%d heartbeats, %ld rules rerun as dirty against %ld run in full, %d mismatches\n", heartbeats, dirtyRuns, fullRuns, mismatches);
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,88 @@
+#!/bin/sh
+# sketchpart - copy sections and functions out of a sketch, so the host tests can build them as they are
+#
+# Usage:   sketchpart.sh <sketch> <section>... -- <function>... > part.inc
+#          eg sketchpart.sh ../../Sketches/Controller.pde "DEVICE STUFF" -- mapGet mapPut > part.inc
+#
+# A section runs from the banner naming it (eg /**** DEVICE STUFF ****/ or // **** Rolling statistics ****) to the next
+# banner; its declarations are copied, but not the functions defined in it.  Functions, from a definition starting in
+# column 0, are copied whole if named, and declared ahead of them as the IDE would.  Output is the sections, then the
+# declarations, then the functions, each in sketch order.  A section or function not found gives exit status 1
+
+if [ $# -lt 2 ] || [ ! -f "$1" ]; then
+  echo "Usage: sketchpart.sh <sketch> <section>... -- <function>..." >&2
+  exit 2
+fi
+sketch=$1
+shift
+
+sections=""
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+  sections="$sections|$1"
+  shift
+done
+[ "$1" = "--" ] && shift
+
+awk -v sections="${sections#|}" -v funcs="$*" '
+BEGIN {
+  quote = "";                                         # Inside a literal, or /* */ comment, while counting braces
+  comment = 0;
+  numSections = split(sections, sectionList, "|");
+  numFuncs = split(funcs, funcList, " ");
+  for (i = 1; i <= numFuncs; i++) wanted[funcList[i]] = 1;
+}
+
+/^\/\*\*\*+ .*\*\/$/ || /^\/\/ \*\*\*+ / {             # Banner: starts or ends a section
+  inSection = 0;
+  for (i = 1; i <= numSections; i++) if (index($0, sectionList[i])) { inSection = 1; found[sectionList[i]] = 1; }
+}
+
+depth == 0 && !/^inline / && (/^[A-Za-z_][A-Za-z0-9_ *]*[ *][A-Za-z_][A-Za-z0-9_]* *\(/ || /^(ISR|SIGNAL) *\(/) && !/;[ \t]*(\/\/.*)?$/ {
+  name = $0;                                          # Function definition; copied only if asked for
+  sub(/ *\(.*/, "", name);
+  sub(/.*[ *]/, "", name);
+  inFunc = 1;
+  keep = wanted[name];
+  if (keep) {
+    found[name] = 1;
+    proto = $0;
+    sub(/[ \t]*\{.*/, ";", proto);
+    protos = protos proto "\n";
+  }
+}
+
+inFunc {
+  if (keep) body = body $0 "\n";
+  for (i = 1; i <= length($0); i++) {              # Count braces outside literals and comments
+    c = substr($0, i, 1);
+    if (comment) {
+      if (c == "*" && substr($0, i + 1, 1) == "/") { comment = 0; i++; }
+    }
+    else if (quote) {
+      if (c == "\\") i++;
+      else if (c == quote) quote = "";
+    }
+    else if (c == "\"" || c == "\047") quote = c;
+    else if (c == "/" && substr($0, i + 1, 1) == "/") break;
+    else if (c == "/" && substr($0, i + 1, 1) == "*") { comment = 1; i++; }
+    else if (c == "{") { opened++; depth++; }
+    else if (c == "}") depth--;
+  }
+  if (opened && depth == 0) {
+    inFunc = 0;
+    opened = 0;
+    if (keep) body = body "\n";
+  }
+  next;
+}
+
+inSection { text = text $0 "\n"; }
+
+END {
+  bad = 0;
+  for (i = 1; i <= numSections; i++) if (!found[sectionList[i]]) { print "sketchpart: no section " sectionList[i] > "/dev/stderr"; bad = 1; }
+  for (i = 1; i <= numFuncs; i++) if (!found[funcList[i]]) { print "sketchpart: no function " funcList[i] > "/dev/stderr"; bad = 1; }
+  printf "%s\n%s\n%s", text, protos, body;
+  exit bad;
+}
+' "$sketch"
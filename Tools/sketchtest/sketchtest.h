@@ -0,0 +1,73 @@
+/* sketchtest - what the parts of the Controller sketch copied out by sketchpart.sh need from the rest of it
+
+  Include ahead of the part, then call hostInit() before anything else.  The Arduino core is the host emulation in
+  Tools/hostemu; HomeAutom is the library itself.  Debug tracing and profiling are compiled out, and time of day is
+  whatever the test sets in testNow
+
+**************************/
+
+#ifndef SketchTest_h
+#define SketchTest_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hostemu.h"
+#include "pins_arduino.h"
+#include "HomeAutom.h"
+
+#define DEBUGON 0
+#define DEBUGHEARTBEAT 0
+#define DEBUGREADINGS 0
+#define DEBUGEVAL 0
+#define DEBUGACTIONS 0
+#define DEBUGPROFILE 0
+
+#define UDP_TX_PACKET_MAX_SIZE 24                  // As Udp.h
+
+char logBuffer[UDP_TX_PACKET_MAX_SIZE];
+boolean debugH = false;
+boolean debugR = false;
+boolean debugE = false;
+boolean debugA = false;
+#ifndef SKETCHTEST_ETHERNET                        // Else defined by the ETHERNET STUFF section
+byte arduinoMe = 0;
+#endif
+
+// SdFatUtil: literals printed from flash, which on the host is ordinary memory
+#define PgmPrint(x) Serial.print(x)
+#define PgmPrintln(x) Serial.println(x)
+
+// Time library, on the host's time_t: settable clock, secs since 1/1/1970
+const int timeNotSet = 0;
+const int timeSet = 2;
+time_t testNow = 0;
+int testTimeStatus = timeNotSet;
+
+time_t now() { return testNow; }
+int timeStatus() { return testTimeStatus; }
+int year(time_t t) { return gmtime(&t)->tm_year + 1900; }
+int month(time_t t) { return gmtime(&t)->tm_mon + 1; }
+int day(time_t t) { return gmtime(&t)->tm_mday; }
+int weekday(time_t t) { return gmtime(&t)->tm_wday + 1; }
+int hour(time_t t) { return (t / 3600) % 24; }
+int minute(time_t t) { return (t / 60) % 60; }
+int second(time_t t) { return t % 60; }
+int year() { return year(now()); }
+int month() { return month(now()); }
+int day() { return day(now()); }
+int weekday() { return weekday(now()); }
+int hour() { return hour(now()); }
+int minute() { return minute(now()); }
+int second() { return second(now()); }
+
+// Rest of the sketch
+void sendLog(const char *buffer) { }
+void printRef(byte deviceIdx) { }
+#ifndef SKETCHTEST_LOG                             // Else copied from the READING LOG section
+void logReading(byte deviceIdx, unsigned int value) { }
+#endif
+
+#endif
@@ -0,0 +1,82 @@
+/* statstest - check the rolling AV, MX, MN & ROC kept in RUNSTATS slots against a trawl of the window
+
+  Build (from Tools/sketchtest):
+    ./sketchpart.sh ../../Sketches/Controller.pde "PROFILING" "DEVICE STUFF" "DECISION STUFF" "OTHER STUFF" "Rolling statistics" \
+        "Long history" -- mapGet mapPut mapAccess stackGet stackPush stackAccess currGet currPut statusPut versionBump \
+        markChanged statsAttach statsFind statsAdd statsPush statsGet histNow histRecord histFind histGet \
+        dhmGet dhmPut dhmAccess > statstest.inc
+    g++ -std=gnu++98 -I. -I../hostemu -I../../HomeAutom -o statstest statstest.cpp ../hostemu/hostemu.cpp ../../HomeAutom/HomeAutom.cpp
+  Usage:   statstest [readings]              default 20000
+
+  Devices 1-4 have windows of 2, 5, 12 and 32 readings, filled at random and then given a RUNSTATS slot.  Each
+  reading is pushed to one of them at random, and AV, MX, MN & ROC of that device are read through mapGet twice: from
+  its slot, and with flagStats cleared, so statsGet trawls the window as it does for devices without a slot.  Then
+  the maxWindow device is given three windows of strictly falling readings and three of strictly rising ones, which
+  fill its max (min) deque.  Any difference, or a deque longer than the window, is listed (the first few) and gives
+  exit status 1.  Readings are -1000 to 999, so negative readings (cast to unsigned, as temperatures are) are covered
+
+**************************/
+
+#include "sketchtest.h"
+#include "statstest.inc"
+
+const byte testWindows[] = { 2, 5, 12, maxWindow };           // No more than maxStats
+const byte numTestDevices = sizeof(testWindows);
+const int maxShown = 5;
+
+long checks = 0;
+int mismatches = 0;
+
+unsigned int randomReading() {
+  return (unsigned int) (rand() % 2000 - 1000);
+}
+
+void pushAndCheck(const char *run, long r, byte deviceIdx, unsigned int reading) {      // Slot must agree with a trawl
+  const byte types[] = { valAvg, valMax, valMin, valROC };
+  const char *typeNames[] = { "AV", "MX", "MN", "ROC" };
+  RUNSTATS *st = &runStats[statsFind(deviceIdx)];
+  unsigned int kept, trawled;
+
+  stackPush(deviceIdx, reading);
+  for (byte t = 0; t < sizeof(types); t++) {
+    kept = mapGet(deviceIdx, types[t]);
+    devFlags[deviceIdx] &= ~flagStats;
+    trawled = mapGet(deviceIdx, types[t]);
+    devFlags[deviceIdx] |= flagStats;
+    checks++;
+    if (kept != trawled && mismatches++ < maxShown) printf("%s reading %ld, window %d: %s is %d kept, %d trawled\n", run, r,
+                                                           devWindow[deviceIdx], typeNames[t], (int) (short) kept, (int) (short) trawled);
+  }
+  if ((st->maxLen > devWindow[deviceIdx] || st->minLen > devWindow[deviceIdx]) && mismatches++ < maxShown)
+    printf("%s reading %ld, window %d: deques hold %d and %d\n", run, r, devWindow[deviceIdx], st->maxLen, st->minLen);
+}
+
+int main(int argc, char **argv) {
+  long readings = (argc > 1) ? atol(argv[1]) : 20000;
+  byte deviceIdx, block = 0;
+
+  hostInit();
+  hostSerialEcho(false);
+  srand(3);
+
+  for (deviceIdx = 1; deviceIdx <= numTestDevices; deviceIdx++) {
+    devFlags[deviceIdx] = flagStackMode;
+    devWindow[deviceIdx] = testWindows[deviceIdx - 1];
+    devStack[deviceIdx] = block;                   // Whole multiples of stackSize
+    block += (devWindow[deviceIdx] + stackSize - 1) / stackSize;
+    devTOSIdx[deviceIdx] = 0;
+    for (byte i = 0; i < devWindow[deviceIdx]; i++) stackPush(deviceIdx, randomReading());
+  }
+  numDevices = numTestDevices + 1;
+  for (deviceIdx = 1; deviceIdx <= numTestDevices; deviceIdx++) statsAttach(deviceIdx);
+  if (numStats != numTestDevices) { printf("%d of %d devices given a RUNSTATS slot\n", numStats, numTestDevices); return 1; }
+
+  for (long r = 0; r < readings; r++) pushAndCheck("random", r, 1 + rand() % numTestDevices, randomReading());
+
+  for (int r = 0; r < 3 * maxWindow; r++) pushAndCheck("falling", r, numTestDevices, 500 - r);      // testWindows ends with maxWindow
+  for (int r = 0; r < 3 * maxWindow; r++) pushAndCheck("rising", r, numTestDevices, (unsigned int) (-500 + r));
+
+  printf("%ld readings over windows of 2 to %d, then %d falling and rising, %ld checks, %d mismatches\n", readings, maxWindow,
+         6 * maxWindow, checks, mismatches);
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,225 @@
+/* webtest - check the HTTP state machine (webService) against browsers that trickle their requests, hang up or wait
+
+  Build (from Tools/sketchtest):
+    ./sketchpart.sh ../../Sketches/Controller.pde "PROFILING" "ETHERNET STUFF" "SDCARD STUFF" "DEVICE STUFF" "OTHER STUFF" -- \
+        versionNewer webService webWait processHTTP webParseRequest webRoute routeAjax routeFile webSendFile webSendSlice \
+        stopClient echoLine clientPrint_P > webtest.inc
+    g++ -std=gnu++98 -I. -I../hostemu -I../../HomeAutom -o webtest webtest.cpp ../hostemu/hostemu.cpp ../../HomeAutom/HomeAutom.cpp
+  Usage:   webtest
+
+  Each dialogue is one request, sent a byte every few ms (or all at once) to the sketch's own webService, called once
+  per ms as loop() would.  Ethernet's Client and Server and SdFat's SdFile are modelled here; the handlers that need
+  the card, readings or pins (handleHTTPGet, handleAjaxGet, handleHTTPCmd, serveBatch) are stubs that note what they
+  were asked for, and handleHTTPGet sends a file of fileSize bytes.  Each dialogue must end with the handlers asked
+  for the right things, the whole file sent and the connection stopped or left as the browser expects; and no step
+  may read more than webReadChunk bytes or send more than const_SDCard_BUFSIZ.  Failures are listed and give exit
+  status 1
+
+**************************/
+
+#include <string>                                  // Ahead of Arduino's min & max
+#define SKETCHTEST_ETHERNET
+#include "sketchtest.h"
+
+// ******** Ethernet (0022) & SdFat, as used by the web code: one browser, whose request arrives a byte every peerGap ms
+#define MAX_SOCK_NUM 4
+
+std::string peerIn, peerOut, calls;
+size_t peerPos;
+unsigned long peerGap, peerNextAt;
+boolean peerOpen;
+int peerStops;
+unsigned int stepReads, stepWrites;
+
+class Client {
+public:
+  Client(uint8_t sock) : _sock(sock) { }
+  operator bool() { return _sock != MAX_SOCK_NUM; }
+  int available() { return (peerPos < peerIn.size() && millis() >= peerNextAt) ? 1 : 0; }
+  int read() {
+    stepReads++;
+    peerNextAt = millis() + peerGap;
+    return peerIn[peerPos++];
+  }
+  uint8_t connected() { return peerOpen || available(); }
+  void print(const char *s) { peerOut += s; }
+  void println(const char *s = "") { peerOut += s; peerOut += "\r\n"; }
+  void write(const uint8_t *buf, size_t len) {
+    stepWrites += len;
+    peerOut.append((const char*) buf, len);
+  }
+  void stop() { peerOpen = false; peerStops++; }
+private:
+  uint8_t _sock;
+};
+
+class Server {
+public:
+  Server(uint16_t port) { }
+  Client available() { return Client((peerPos < peerIn.size() && millis() >= peerNextAt) ? 0 : MAX_SOCK_NUM); }
+};
+
+class UdpClass { };
+class Sd2Card { };
+class SdVolume { };
+
+class SdFile {                                     // A file of size bytes, byte n being n % 251
+public:
+  SdFile() : _pos(0), _size(0), _open(false) { }
+  void openFake(unsigned long size) { _pos = 0; _size = size; _open = true; }
+  int16_t read(void *buf, uint16_t len) {
+    if (!_open) return -1;
+    if (len > _size - _pos) len = _size - _pos;
+    for (uint16_t i = 0; i < len; i++) ((byte*) buf)[i] = (_pos + i) % 251;
+    _pos += len;
+    return len;
+  }
+  void close() { _open = false; }
+  boolean isOpen() { return _open; }
+private:
+  unsigned long _pos, _size;
+  boolean _open;
+};
+
+// As the IDE puts prototypes ahead of the sketch, for webRoutes and the stubs below
+void routeAjax(Client client, char *rest);
+void routeFile(Client client, char *path);
+void handleHTTPGet(Client client, char* path);
+void handleAjaxGet(Client client, char* actionline, char type);
+void handleHTTPCmd(Client client, char* actionline);
+void serveBatch(Client client, char *list, unsigned int since);
+
+#include "webtest.inc"
+
+// ******** Rest of the sketch
+const unsigned long fileSize = 5000;
+SdFile testFile;
+unsigned long testStarted;                         // millis() dialogue began
+
+void handleHTTPGet(Client client, char* path) {
+  calls += " get ";
+  calls += path;
+  if (webGzip) calls += " (gzip)";
+  client.println("HTTP/1.1 200 OK");
+  client.println();
+  testFile.openFake(fileSize);
+  webSendFile(&testFile, fileSize);
+}
+
+void handleAjaxGet(Client client, char* actionline, char type) {
+  calls += " ajax ";
+  calls += type;
+  calls += actionline;
+  if (type == 'W') {                               // As the sketch
+    unsigned int since = strtoul(actionline, NULL, 10);
+    if (versionNewer(changeVersion, since)) serveBatch(client, NULL, since);
+    else webWait(since);
+  }
+}
+
+void handleHTTPCmd(Client client, char* actionline) {
+  calls += " cmd ";
+  calls += actionline;
+}
+
+void serveBatch(Client client, char *list, unsigned int since) {
+  char text[32];
+
+  sprintf(text, " batch %u at %lus", since, (millis() - testStarted) / 1000);
+  calls += text;
+  client.println("[]");
+}
+
+// ******** Dialogues
+struct DIALOGUE {
+  const char *name;
+  const char *request;
+  unsigned long gap;                               // ms between bytes
+  boolean hangUp;                                  // Browser gives up once request sent
+  unsigned long changeAt;                          // ms after start to bump changeVersion; 0 = never
+  const char *calls;                               // Handlers asked for, in order
+  boolean fileSent;
+  int stops;                                       // Times connection stopped by the sketch
+};
+
+const DIALOGUE dialogues[] = {
+  { "GET, trickled", "GET /index.htm HTTP/1.1\r\nHost: 192.168.7.177\r\nAccept-Encoding: gzip, deflate\r\n\r\n", 3, false, 0,
+    " get index.htm (gzip)", true, 0 },
+  { "GET, all at once", "GET /index.htm HTTP/1.1\r\nHost: 192.168.7.177\r\nUser-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\nAccept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n\r\n",
+    0, false, 0, " get index.htm", true, 0 },
+  { "ajax reading", "GET /ajax!R1234 HTTP/1.1\r\n\r\n", 3, false, 0, " ajax R1234", false, 0 },
+  { "command", "GET /?led=On HTTP/1.1\r\n\r\n", 3, false, 0, " cmd led=On", false, 0 },
+  { "form by GET", "GET /form.htm?led=On HTTP/1.1\r\n\r\n", 3, false, 0, " cmd led=On", false, 0 },
+  { "form by POST", "POST /form.htm HTTP/1.1\r\nContent-Length: 7\r\n\r\nled=Off", 3, false, 0, " cmd led=Off get form.htm", true, 1 },
+  { "wait, change", "GET /ajax!W5 HTTP/1.1\r\n\r\n", 3, false, 2000, " ajax W5 batch 5 at 2s", false, 0 },
+  { "wait, timeout", "GET /ajax!W5 HTTP/1.1\r\n\r\n", 3, false, 0, " ajax W5 batch 5 at 10s", false, 0 },
+  { "wait, hang up", "GET /ajax!W5 HTTP/1.1\r\n\r\n", 3, true, 0, " ajax W5", false, 0 },
+  { "hang up mid-request", "GET /index.htm HT", 3, true, 0, "", false, 0 },
+};
+const byte numDialogues = sizeof(dialogues) / sizeof(dialogues[0]);
+const unsigned long maxMs = 15000;
+
+int failures = 0;
+
+void check(boolean ok, const DIALOGUE *d, const char *what) {
+  if (ok) return;
+  printf("%s: %s\n", d->name, what);
+  failures++;
+}
+
+boolean fileIntact(const std::string &out) {      // Body after the blank line is the whole file
+  size_t body = out.find("\r\n\r\n");
+
+  if (body == std::string::npos || out.size() - (body + 4) != fileSize) return false;
+  for (unsigned long i = 0; i < fileSize; i++) if ((byte) out[body + 4 + i] != i % 251) return false;
+  return true;
+}
+
+int main() {
+  unsigned int mostRead = 0, mostSent = 0;
+  long passes = 0;
+
+  hostInit();
+  hostSerialEcho(false);
+
+  for (byte i = 0; i < numDialogues; i++) {
+    const DIALOGUE *d = &dialogues[i];
+
+    peerIn = d->request;
+    peerOut = calls = "";
+    peerPos = peerNextAt = 0;
+    peerGap = d->gap;
+    peerOpen = true;
+    peerStops = 0;
+    changeVersion = 5;
+    webState = webIdle;                            // Whatever a failed dialogue left
+    testStarted = millis();
+
+    while (millis() - testStarted < maxMs) {
+      if (d->changeAt && millis() - testStarted == d->changeAt) changeVersion++;
+      if (d->hangUp && peerPos == peerIn.size() && millis() >= peerNextAt + 100) peerOpen = false;
+      stepReads = stepWrites = 0;
+      webService();
+      passes++;
+      if (stepReads > mostRead) mostRead = stepReads;
+      if (stepWrites > mostSent) mostSent = stepWrites;
+      if (webState == webIdle && peerPos == peerIn.size() && (!d->hangUp || !peerOpen)) break;
+      hostSpend(F_CPU / 1000);
+    }
+
+    if (calls != d->calls) {
+      printf("%s: handlers asked for '%s', not '%s'\n", d->name, calls.c_str(), d->calls);
+      failures++;
+    }
+    check(webState == webIdle, d, "not idle at end");
+    check(peerPos == peerIn.size(), d, "request not all read");
+    check(!d->fileSent || fileIntact(peerOut), d, "file not sent whole");
+    check(peerStops == d->stops, d, "connection not stopped as expected");
+  }
+  if (mostRead > webReadChunk) { printf("a step read %u bytes, more than webReadChunk\n", mostRead); failures++; }
+  if (mostSent > const_SDCard_BUFSIZ) { printf("a step sent %u bytes, more than const_SDCard_BUFSIZ\n", mostSent); failures++; }
+
+  printf("%d dialogues in %ld steps, most read in a step %u, most sent %u, %d failures\n", numDialogues, passes, mostRead, mostSent, failures);
+  return failures ? 1 : 0;
+}
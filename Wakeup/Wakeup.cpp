@@ -18,28 +18,60 @@
 			response to a poll by the main program calling runAnyPending()
 	
 	Comments use a lighthearted analogy of 'sleepers' in 'bunks'.  New sleepers are put in the first free bunk
-	starting from the bottom (index 0).  When a sleeper wakes and leaves, the topmost sleeper is moved to the 
-	newly-vacant bunk, thus optimising access to free bunks above
+	and stay there until woken.  A separate rota (a min-heap on wake time) keeps the lightest sleeper on top, so
+	each heartbeat only looks at the sleepers actually due, and adding or waking a sleeper costs O(log n)
+	however many bunks are occupied
+	
+	Timekeeping uses Timer1 running free at 4uS per tick (16MHz), extended to 32 bits by counting overflows.  Each
+	sleeper holds the absolute count at which to wake and the compare register is set for the lightest one, so
+	nothing is decremented on a heartbeat.  A repeating sleeper's next wake is exactly one period after its last, 
+	so timing errors don't accumulate however long it runs
+	
+	There is no fixed heartbeat: the compare interrupt only fires when a sleeper is due.  If the lightest sleeper
+	is more than one wrap of the 16 bit count (262mS) away the compare is left off, and the overflow interrupt 
+	(needed anyway to extend the count) sets it during the wrap in which the sleeper falls due.  So when idle
+	WAKEUP costs one short overflow interrupt every 262mS and nothing more
+
+	Woken normal sleepers are passed from timerISR to runAnyPending() through a ring buffer.  Each end has only 
+	one writer and the indices are single bytes, so runAnyPending() works through the queue without ever 
+	disabling interrupts.  
+	
+	TREAT_AS_ISR sleepers woken together are run by timerISR highest priority first.  Once the interrupt has 
+	taken ISRBUDGET uS, any still to run are put on the pending queue instead (as are any beyond MAXRUNNOW), 
+	so a time-critical sleeper isn't held up behind routine ones.  The first to run is never deferred
 	
 	Functions available
     -------------------
     
     - init                 Must be called before first use of WAKEUP class
-    - wakeMeAfter          Request a nominated function to be called in the future. Returns false if not slots free.  Arguments:
+    - wakeMeAfter          Request a nominated function to be called in the future. Returns false if no slots free or delay
+                           out of range.  Arguments:
         - sleeper          The function to be called
-        - ms               The delay, in mS
+        - ms               The delay, in mS (max MAXSLEEP, about 2.2 hours).  If negative then repeats
         - context          A pointer to data providing the called function with the context for the call
         - treatAsISR       A flag indicating whether the function is to be called as an extended Interrupt Service Routine
                            (fast, but limited processing allowed) or as a normal function in response to a poll by the main
                            programme (speed of response depends on polling frequency, but much more can be done safely
+        - priority         Optional, default 0.  Of TREAT_AS_ISR sleepers woken together, highest runs first.  No effect on
+                           normal sleepers, which run in the order woken
+    - wakeMeAfterMicros    As wakeMeAfter, with the delay in uS (max MAXSLEEPMICROS, about 33 mins), rounded up to a whole 
+                           Timer1 tick (4uS @ 16MHz).  A repeating period under MINREPEAT ticks (200uS) is refused
     - runAnyPending        Called by the main program (frequently) to allow normal sleepers to run (once they've woken)
     - freeSlots            Returns the number of sleeper slots left    
+    - getStats             Fills a WAKEUPSTATS with the number of normal sleepers dropped because the pending queue was
+                           full, the most ever waiting at once, the number of TREAT_AS_ISR sleepers deferred to the
+                           pending queue and the longest time spent in timerISR.  Optionally resets them
     
 	
 	Version history
 	---------------
 	
 	Version 1.0 Oct 2011 - Initial release, Andrew Richards
+	Version 1.1 - Sleepers woken from a min-heap ordered on wake time, in place of a scan of every bunk
+	Version 1.2 - Wake times are absolute deadlines on Timer1's free-running count; no drift or CODEOVERHEAD
+	Version 1.3 - Pending queue is a lock-free ring, so runAnyPending() never disables interrupts; getStats() added
+	Version 1.4 - Tickless: compare set only for the actual next deadline, with long gaps chained through the overflow interrupt
+	Version 1.5 - wakeMeAfterMicros() added; TREAT_AS_ISR sleepers run in priority order, within ISRBUDGET
 	
 	Licensing
 	---------
@@ -67,136 +99,263 @@
 
 void WAKEUP::init() {
   _numSleepers = 0;			// No sleepers
-  _numPending = 0;
+  _pendHead = _pendTail = 0;	// Nothing pending
+  _stats.pendingOverflows = 0;
+  _stats.pendingPeak = 0;
+  _stats.deferred = 0;
+  _stats.isrPeak = 0;
   _inISR = false;
-  Timer1.initialize();
+  _armed = false;
+  for (unsigned int i = 0; i < MAXSLEEPERS; i++) _heap[i] = i;		// All bunks free
+  Timer1.attachCompareInterrupt(timerISRWrapper);
+  Timer1.attachOverflowInterrupt(overflowISRWrapper);
+  Timer1.startTicking();
+}
+
+
+
+boolean WAKEUP::wakeMeAfter( void (*sleeper)(void*), long ms, void *context, boolean treatAsISR, byte priority) {
+  
+  // Check the time requested
+  if (ms == 0 || ms > MAXSLEEP || ms < -MAXSLEEP) return false;
+  
+  return putToSleep(sleeper, ms * TICKSPERMS, context, treatAsISR, priority);
 }
 
 
+boolean WAKEUP::wakeMeAfterMicros( void (*sleeper)(void*), long us, void *context, boolean treatAsISR, byte priority) {
+  
+  // Check the time requested, then round up to whole ticks keeping the sign
+  if (us == 0 || us > MAXSLEEPMICROS || us < -MAXSLEEPMICROS) return false;
+  
+  if (us > 0) return putToSleep(sleeper, (us + USPERTICK - 1) / USPERTICK, context, treatAsISR, priority);
+  else return putToSleep(sleeper, -((-us + USPERTICK - 1) / USPERTICK), context, treatAsISR, priority);
+}
+
 
-boolean WAKEUP::wakeMeAfter( void (*sleeper)(void*), long ms, void *context, boolean treatAsISR) {
-  unsigned long timeSinceLast;
+boolean WAKEUP::putToSleep( void (*sleeper)(void*), long ticks, void *context, boolean treatAsISR, byte priority) {
+  unsigned int bunk;
+  byte oldSREG;
    
-  // Check the time requested and if there is a free bunk to store the sleeper
-  if (ms == 0 || _numSleepers >= MAXSLEEPERS) return false;
+  // Check if there is a free bunk to store the sleeper, and that a repeating sleeper leaves time for anything else
+  if (_numSleepers >= MAXSLEEPERS) return false;
+  if (ticks < 0 && -ticks < MINREPEAT) return false;
  
-  _oldSREG = SREG;
+  oldSREG = SREG;
   cli();
   
-  // If any already sleeping, then get the count from start of heartbeat and deduct from all active timers
-  if (_numSleepers > 0 && (timeSinceLast = getElapsed()) > 0) {
-    for (int i = 0; i < _numSleepers; i++) _bunks[i].timeToWake -= timeSinceLast; 
-  }
-
-  // Put new sleeper into top bunk and set alarm clock
-  _bunks[_numSleepers].sleepDuration = ms;					// Save the delay to inform timerISR
-  _bunks[_numSleepers].callback = sleeper;					// Put sleeper into bunk
-  _bunks[_numSleepers].treatAsISR = treatAsISR;				// Interrupt on wake or put on pending queue
-  _bunks[_numSleepers].context = context;					// Save its context
-  _bunks[_numSleepers].timeToWake = (ms > 0) ? ms : -ms;	// Set the delay 
+  // Put new sleeper into first free bunk and set alarm clock
+  bunk = _heap[_numSleepers];
+  _bunks[bunk].sleepTicks = ticks;							// Save the delay to inform timerISR
+  _bunks[bunk].callback = sleeper;							// Put sleeper into bunk
+  _bunks[bunk].treatAsISR = treatAsISR;						// Interrupt on wake or put on pending queue
+  _bunks[bunk].priority = priority;
+  _bunks[bunk].context = context;							// Save its context
+  _bunks[bunk].wakeAt = Timer1.ticks() + ((ticks > 0) ? ticks : -ticks);		// Set the alarm 
 
-  _numSleepers++; 
+  siftUp(_numSleepers++);									// Move up the heap past any heavier sleepers
   
-  SREG = _oldSREG;  
-      
-  startHeartbeat();    // Set counter going with an appropriate heartbeat
+  if (_heap[0] == bunk) startHeartbeat();    				// Only need to reset the alarm if now the lightest sleeper
+  
+  SREG = oldSREG;  
      
   return true;  
 }
 
 
-void WAKEUP::startHeartbeat() {      // Set heartbeat to longest required to wake lightest sleeper
-  _heartbeat = MAXHEARTBEAT;
+void WAKEUP::startHeartbeat() {      // Set compare to wake lightest sleeper - always at top of heap.  Must be at least one sleeper
+  unsigned long now, target;
+  byte oldSREG;
   
-  _oldSREG = SREG;
+  oldSREG = SREG;
   cli();
-  for (int i = 0; i < _numSleepers; i++) {
-	  if (_bunks[i].timeToWake > 0 && _bunks[i].timeToWake < _heartbeat) _heartbeat = _bunks[i].timeToWake;
+  
+  now = Timer1.ticks();
+  target = _bunks[_heap[0]].wakeAt;
+  
+  if ((long)(target - now) >= RESOLUTION) {		// Low word would match before the wrap it's due in; leave it to overflowISR
+	  Timer1.detachCompareInterrupt();
+	  _armed = false;
   }
-  SREG = _oldSREG;
-
-  Timer1.start();
-  Timer1.attachInterrupt(timerISRWrapper, _heartbeat * 1000 - (_numSleepers * CODEOVERHEAD));
+  else {
+	  // Compare fires only on an exact match, so ensure the target is still ahead of the count once set
+	  do {
+		  if ((long)(target - now) < MINHEARTBEAT) target = now + MINHEARTBEAT;
+		  Timer1.setCompare((unsigned int)target);
+	  } while ((long)(target - (now = Timer1.ticks())) <= 0);
+	  _armed = true;
+  }
+  
+  SREG = oldSREG;
 }
 
 
 void WAKEUP::stopHeartbeat() {
-  Timer1.stop();
-}
-
-unsigned long WAKEUP::getElapsed() {
-  return Timer1.read() / 1000;
+  Timer1.detachCompareInterrupt();
+  _armed = false;
 }
 
 unsigned int WAKEUP::freeSlots() {
   return MAXSLEEPERS - _numSleepers;
 }
 
+void WAKEUP::getStats(WAKEUPSTATS &stats, boolean reset) {
+  byte oldSREG;
+  
+  oldSREG = SREG;
+  cli();								// Overflow count is two bytes, so take a consistent copy
+  stats.pendingOverflows = _stats.pendingOverflows;
+  stats.pendingPeak = _stats.pendingPeak;
+  stats.deferred = _stats.deferred;
+  stats.isrPeak = _stats.isrPeak;
+  if (reset) {
+	  _stats.pendingOverflows = 0;
+	  _stats.pendingPeak = 0;
+	  _stats.deferred = 0;
+	  _stats.isrPeak = 0;
+  }
+  SREG = oldSREG;
+}
+
 void WAKEUP::runAnyPending() {
 	void (*callback)(void*);
 	void *context;
+	byte tail, slot;
 	
 	// Provided this isn't being called from sleeper running under timerISR, then process all pending sleepers
-	if (_inISR == false) while (_numPending > 0) {			// Queue could grow dynamically as new sleepers awake	
-		_oldSREG = SREG;					
-		cli();							
-		_numPending--;					// timerISR can change, so disable interrupts & take snapshot here
-		callback = _pending[_numPending].callback;	
-		context = _pending[_numPending].context;
-		SREG = _oldSREG;
+	// No need to disable interrupts: timerISR only ever adds at _pendHead and won't reuse a slot until _pendTail has passed it
+	if (_inISR == false) while ((tail = _pendTail) != _pendHead) {	// Queue could grow dynamically as new sleepers awake	
+		slot = tail & (MAXPENDING - 1);
+		callback = _pending[slot].callback;	
+		context = _pending[slot].context;
+		_pendTail = tail + 1;			// Slot free for reuse; sleeper may call runAnyPending() itself, so move on first
 		
 		callback(context);				// Call sleeper as normal function call - take as long as you like
 	}
 }
 
+// **************  Heap of sleepers, ordered on wake time  *************
+// Called with interrupts disabled.  Wake times are compared as a signed difference so Timer1.ticks() can wrap (after ~4.7 hours)
+
+boolean WAKEUP::wakesBefore(unsigned int a, unsigned int b) {
+  return (long)(_bunks[_heap[a]].wakeAt - _bunks[_heap[b]].wakeAt) < 0;
+}
+
+void WAKEUP::siftUp(unsigned int pos) {
+  unsigned int parent, bunk;
+  
+  while (pos > 0 && wakesBefore(pos, parent = (pos - 1) / 2)) {
+	  bunk = _heap[pos];
+	  _heap[pos] = _heap[parent];
+	  _heap[parent] = bunk;
+	  pos = parent;
+  }
+}
+
+void WAKEUP::siftDown(unsigned int pos) {
+  unsigned int child, bunk;
+  
+  while ((child = pos * 2 + 1) < _numSleepers) {
+	  if (child + 1 < _numSleepers && wakesBefore(child + 1, child)) child++;		// Take the lighter of the two children
+	  if (!wakesBefore(child, pos)) break;
+	  bunk = _heap[pos];
+	  _heap[pos] = _heap[child];
+	  _heap[child] = bunk;
+	  pos = child;
+  }
+}
+
 // **************  Interrupt Service Routine  *************
 
 void WAKEUP::timerISR() {							// Runs every heartbeat 
-  unsigned int runNowPtr = MAXPENDING;		                // Pointer to top end of _pending to use as temporary scratchpad
+  unsigned int bunk;
+  byte numRunNow = 0, i, priority;
+  boolean treatAsISR;
+  void (*callback)(void*);
+  void *context;
+  unsigned long start, now;
+  
+  start = now = Timer1.ticks();
   
-  for (int i = 0; i < _numSleepers; i++) {
+  // Only the sleeper on top of the heap need be looked at; keep going until it isn't due
+  // Count read once, so each repeating sleeper is woken at most once per interrupt; any falling due meanwhile wait for the next
+  while (_numSleepers > 0 && (long)(_bunks[bunk = _heap[0]].wakeAt - now) <= 0) {  
+
+	  // Take the sleeper out of its bunk before the bunk can be freed
+	  callback = _bunks[bunk].callback;
+	  context = _bunks[bunk].context;
+	  treatAsISR = _bunks[bunk].treatAsISR;
+	  priority = _bunks[bunk].priority;
 	  
-	// If countdown has finished then put on pending queue and shuffle bunks (if needed)
-	if ((_bunks[i].timeToWake -= _heartbeat) <= 0) {  
-
-		  // Put in pending queue, either to wake in a few moments or from main program using runAnyPending
-		  // If runAnyPending not run fast enough then bottom-up and top-down queues may clash, so check
-		  if (_bunks[i].treatAsISR == TREAT_AS_ISR) {				// Wake later in this function
-  			  if (--runNowPtr <= _numPending) runNowPtr++;
-			  _pending[runNowPtr].callback = _bunks[i].callback;
-			  _pending[runNowPtr].context = _bunks[i].context;
-		  }
-		  else {													// Wake in response to runAnyPending
-			  _pending[_numPending].callback = _bunks[i].callback;
-			  _pending[_numPending].context = _bunks[i].context;
-			  if (++_numPending >= runNowPtr) _numPending--;			
+	  // If one-shot then move the last sleeper in the heap to the top and free the bunk; if repeating then reset its alarm
+      if (_bunks[bunk].sleepTicks > 0) {						// Positive number means one-shot
+	      _numSleepers--;			
+	      _heap[0] = _heap[_numSleepers];
+	      _heap[_numSleepers] = bunk;							// Bunk now free
+      }
+      else {
+	      _bunks[bunk].wakeAt -= _bunks[bunk].sleepTicks;		// Repeating sleeper, next wake exactly one period on, so no drift
+	      if ((long)(_bunks[bunk].wakeAt - now) <= 0) _bunks[bunk].wakeAt = now - _bunks[bunk].sleepTicks;	// Fallen behind; don't try to catch up
+      }
+      siftDown(0);
+      
+      if (treatAsISR == TREAT_AS_NORMAL) {			// Wake in response to runAnyPending
+		  queuePending(callback, context);
+		  continue;
+	  }
+	  
+	  // Wake later in this function, in priority order (ties in order woken).  If no room then lowest priority is deferred
+	  if (numRunNow == MAXRUNNOW) {
+		  if (_stats.deferred != 0xFFFF) _stats.deferred++;
+		  if (_runNow[MAXRUNNOW - 1].priority >= priority) {
+			  queuePending(callback, context);
+			  continue;
 		  }
-		  
-		  // If others left after one-shot sleeper removed, take sleeper in topmost bunk and move to the newly-vacant bunk
-	      if (_bunks[i].sleepDuration > 0) {					// Positive number means one-shot
-		      _numSleepers--;			
-	      	  if (_numSleepers > 0) {				// Move topmost sleeper into this bunk (v rarely might be the same one, but safe so ignore)
-			      _bunks[i].callback = _bunks[_numSleepers].callback;
-			      _bunks[i].treatAsISR = _bunks[_numSleepers].treatAsISR;
-			      _bunks[i].sleepDuration = _bunks[_numSleepers].sleepDuration;
-			      _bunks[i].timeToWake = _bunks[_numSleepers].timeToWake;
-			      _bunks[i].context = _bunks[_numSleepers].context;
-			      i--;								// Decrement counter to ensure this sleeper isn't missed
-		      }
-	      }
-	      else _bunks[i].timeToWake -=_bunks[i].sleepDuration;			// Repeating sleeper, just reset countdown
-        
-    }
+		  queuePending(_runNow[MAXRUNNOW - 1].callback, _runNow[MAXRUNNOW - 1].context);
+		  numRunNow--;
+	  }
+	  for (i = numRunNow++; i > 0 && _runNow[i - 1].priority < priority; i--) _runNow[i] = _runNow[i - 1];
+	  _runNow[i].callback = callback;
+	  _runNow[i].context = context;
+	  _runNow[i].priority = priority;
   }
   
   // Start the heartbeat if sleepers left
-  if (_numSleepers == 0) stopHeartbeat(); startHeartbeat();
+  if (_numSleepers == 0) stopHeartbeat(); else startHeartbeat();
   
   // Run the TREAT_AS_ISR sleepers that were woken - be quick (and block runAnyPending() from being run)
+  // Heap is in order, so they can safely go back to sleep if they want.  Once over budget, leave the rest for runAnyPending
   _inISR = true;
-  for (int i = runNowPtr; i < MAXPENDING; i++) _pending[i].callback(_pending[i].context);
+  for (i = 0; i < numRunNow; i++) {
+	  if (i > 0 && Timer1.ticks() - start > ISRBUDGET / USPERTICK) {
+		  if (_stats.deferred != 0xFFFF) _stats.deferred++;
+		  queuePending(_runNow[i].callback, _runNow[i].context);
+	  }
+	  else _runNow[i].callback(_runNow[i].context);
+  }
   _inISR = false;
   
+  now = (Timer1.ticks() - start) * USPERTICK;
+  if (now > _stats.isrPeak) _stats.isrPeak = (now > 0xFFFF) ? 0xFFFF : now;
+}
+
+void WAKEUP::queuePending(void (*callback)(void*), void *context) {
+  byte head, waiting;
+  
+  head = _pendHead;
+  waiting = head - _pendTail;
+  if (waiting >= MAXPENDING) {								// runAnyPending not run fast enough; drop it
+	  if (_stats.pendingOverflows != 0xFFFF) _stats.pendingOverflows++;
+	  return;
+  }
+  _pending[head & (MAXPENDING - 1)].callback = callback;
+  _pending[head & (MAXPENDING - 1)].context = context;
+  _pendHead = head + 1;										// Only now visible to runAnyPending
+  if (++waiting > _stats.pendingPeak) _stats.pendingPeak = waiting;
+}
+
+void WAKEUP::overflowISR() {						// Runs every wrap of Timer1 (262mS) - keep it short
+  if (_armed == false && _numSleepers > 0) startHeartbeat();	// Compare set once lightest sleeper is due within the next wrap
 }
 
 
@@ -206,3 +365,7 @@ void timerISRWrapper() {  // http://www.parashift.com/c++-faq-lite/pointers-to-m
   wakeup.timerISR();
 }
 
+void overflowISRWrapper() {
+  wakeup.overflowISR();
+}
+
@@ -10,6 +10,11 @@
 	---------------
 	
 	Version 1.0 Oct 2011 - Initial release, Andrew Richards
+	Version 1.1 - Sleepers woken from a min-heap ordered on wake time, in place of a scan of every bunk
+	Version 1.2 - Wake times are absolute deadlines on Timer1's free-running count; no drift or CODEOVERHEAD
+	Version 1.3 - Pending queue is a lock-free ring, so runAnyPending() never disables interrupts; getStats() added
+	Version 1.4 - Tickless: compare set only for the actual next deadline, with long gaps chained through the overflow interrupt
+	Version 1.5 - wakeMeAfterMicros() added; TREAT_AS_ISR sleepers run in priority order, within ISRBUDGET
 	
 	Licencing
 	---------
@@ -33,48 +38,84 @@
 #define Wakeup_h
 
 #include "WProgram.h"
+#include "TimerOne.h"
 
-#define MAXSLEEPERS 32							// Max 64k, but unworkable (out of memory and would take too long). Tested with 256; 16-32 generally enough
-#define MAXPENDING 32							// Needs to be large enough to hold max number of sleepers woken in one go, assuming prompt clearance by runAnyPending()
-#define MAXHEARTBEAT 8350						// in ms.  Round down from absolute max of 8,388,480 us
-#define CODEOVERHEAD 8 							// Logic analyser-determined to allow for duration of WAKEUP code; calibrated @ 10mS with 8 sleepers
+#define MAXSLEEPERS 32							// Max 64k, but limited by RAM (18 bytes per sleeper).  Cost of each wake grows only as log2(MAXSLEEPERS)
+#define MAXPENDING 32							// Power of 2, max 128.  Normal sleepers woken but not yet run by runAnyPending(); any more are dropped (and counted)
+#define MAXRUNNOW 8							// TREAT_AS_ISR sleepers run in one interrupt.  Any more woken together go on the pending queue, lowest priority first
+#define ISRBUDGET 200							// in uS.  Once exceeded, TREAT_AS_ISR sleepers still to run go on the pending queue
+#define MAXSLEEP 8000000L						// in ms.  Round down from 2^31 ticks - deadlines must stay within half the range of the 32 bit count
+#define MAXSLEEPMICROS 2000000000L				// in uS.  Limited by a long, not the count
+#define MINHEARTBEAT 2							// in ticks.  Least lead on the compare register to be sure of a match
+#define MINREPEAT 50							// in ticks (200uS @ 16MHz).  Shortest repeating period; any less and timerISR would leave no time for loop()
+#define TICKSPERMS (F_CPU / TICKPRESCALE / 1000)	// Timer1 ticks per mS
+#define USPERTICK (TICKPRESCALE / (F_CPU / 1000000L))	// uS per Timer1 tick - resolution of wakeMeAfterMicros
+
+#if (MAXPENDING & (MAXPENDING - 1)) || MAXPENDING > 128
+#error MAXPENDING must be a power of 2 no greater than 128
+#endif
 
 const boolean TREAT_AS_ISR = true;
 const boolean TREAT_AS_NORMAL = false;
 
+struct WAKEUPSTATS {							// Returned by getStats()
+  unsigned int pendingOverflows;				// Normal sleepers dropped because the pending queue was full
+  byte pendingPeak;								// Most normal sleepers seen waiting on the pending queue at once
+  unsigned int deferred;						// TREAT_AS_ISR sleepers put on the pending queue for want of time (ISRBUDGET) or room (MAXRUNNOW)
+  unsigned int isrPeak;							// Longest time spent in timerISR, in uS
+};
+
 class WAKEUP {
 public:
   void init();									// Must be called at startup
-  boolean wakeMeAfter( void (*sleeper)(void*), long ms, void *context, boolean treatAsISR);	// Function to wake after expiry of ms.  If ms is negative then cycle repeats, else one-shot	
+  boolean wakeMeAfter( void (*sleeper)(void*), long ms, void *context, boolean treatAsISR, byte priority = 0);	// Function to wake after expiry of ms.  If ms is negative then cycle repeats, else one-shot	
+  boolean wakeMeAfterMicros( void (*sleeper)(void*), long us, void *context, boolean treatAsISR, byte priority = 0);	// As wakeMeAfter, but in uS
   void runAnyPending();							// Called by the main program to run any pending sleepers
   unsigned int freeSlots();						// Returns number of bunks available
-  void timerISR();								// Called every _heartbeat.  Must be public to allow call by timerISRWrapper()
+  void getStats(WAKEUPSTATS &stats, boolean reset = false);	// Copies out the pending queue and ISR statistics, optionally resetting them
+  void timerISR();								// Called on Timer1 compare match.  Must be public to allow call by timerISRWrapper()
+  void overflowISR();							// Called on Timer1 overflow.  Must be public to allow call by overflowISRWrapper()
  
 private:
   // Methods
-  void startHeartbeat();						// Starts timer based on shortest time to wake
-  void stopHeartbeat();							// Stops timer (when no sleepers)
-  unsigned long getElapsed();					// Duration in mS since last heartbeat
+  boolean putToSleep( void (*sleeper)(void*), long ticks, void *context, boolean treatAsISR, byte priority);	// Common to wakeMeAfter & wakeMeAfterMicros
+  void queuePending(void (*callback)(void*), void *context);	// Put woken sleeper on pending queue for runAnyPending.  Called from timerISR
+  void startHeartbeat();						// Sets compare to wake lightest sleeper, if due before Timer1's count next wraps
+  void stopHeartbeat();							// Stops compare interrupt (when no sleepers); Timer1 keeps counting
+  boolean wakesBefore(unsigned int a, unsigned int b);	// True if sleeper at heap position a is due before sleeper at position b
+  void siftUp(unsigned int pos);				// Restore heap order after the wake time at pos has been brought forward
+  void siftDown(unsigned int pos);				// Restore heap order after the wake time at pos has been put back
 
   // Properties - many can be changed via an ISR, so need to be volatile
-  byte _oldSREG;								// Temporary store of status register
   boolean _inISR;								// Blocks use of runAnyPending by sleepers running under ISR
-  volatile unsigned long _heartbeat;			// mS frequency of checking timeToWake 
+  volatile boolean _armed;						// True if compare set for lightest sleeper; if not then overflowISR will set it
   
   volatile unsigned int _numSleepers;			// Number of sleepers - if zero then turn off heartbeat
   struct _bunk {								// 'Bunk' holding sleeper or empty
 	void (*callback)(void*);					// Callback function ('sleeper')
 	boolean treatAsISR;							// True if callback to be immediate (as ISR).  False if to be put on pending queue
-  	long sleepDuration;							// Requested delay in mS; if negative then repeating
-  	long timeToWake;							// Loaded with _sleepDuration and then decremented by time since last heartbeat
+	byte priority;								// Highest runs first of TREAT_AS_ISR sleepers woken together, and last to be deferred
+  	long sleepTicks;							// Requested delay in Timer1 ticks; if negative then repeating
+  	unsigned long wakeAt;						// Value of Timer1.ticks() at which to wake
   	void *context;								// For sleeper to interpret as appropriate when woken
-  }  volatile _bunks[MAXSLEEPERS];				// Dynamically reshuffled for performance - first _numSleepers slots are always valid
+  }  volatile _bunks[MAXSLEEPERS];				// Sleepers stay in the same bunk until woken; order of waking is held in _heap
+  volatile unsigned int _heap[MAXSLEEPERS];		// Bunk numbers.  First _numSleepers form a min-heap on wakeAt (lightest sleeper at [0]); remainder are free bunks
 
-  volatile unsigned int _numPending;			// Updated in ISR and non-ISR code     
+  // Pending queue is a ring with one writer each end, so no locking: timerISR only moves _pendHead and runAnyPending
+  // only moves _pendTail.  Both are single bytes (so read and written atomically) and run freely, wrapping at 256
+  volatile byte _pendHead;						// Count of sleepers put on queue by timerISR
+  volatile byte _pendTail;						// Count of sleepers taken off queue by runAnyPending
   struct _pend {								// A sleeper that has been woken and is ready to go
 	void (*callback)(void*);					
 	void *context;
-  } volatile _pending[MAXPENDING];				// Top end also used as temporary scratchpad by timerISR
+  } volatile _pending[MAXPENDING];				// Entry for count n is at [n % MAXPENDING]
+  volatile WAKEUPSTATS _stats;					// Updated only by timerISR
+  
+  struct _run {									// TREAT_AS_ISR sleeper woken and waiting to run in this interrupt
+	void (*callback)(void*);
+	void *context;
+	byte priority;
+  } _runNow[MAXRUNNOW];							// Used only by timerISR, held in priority order
 
   	
 };
@@ -82,6 +123,7 @@ private:
 extern WAKEUP wakeup;
 
 extern void timerISRWrapper();
+extern void overflowISRWrapper();
 
 #endif
 
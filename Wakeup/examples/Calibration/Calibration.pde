@@ -9,6 +9,13 @@
   Num sleepers:                1          8            32            64          128            256
   Actual toggle speed (ms)   10.03      10.03        10.03          10.02        10.01          9.99
   
+  From version 1.2 wake times are absolute deadlines on Timer1's free-running count, so there is no CODEOVERHEAD
+  to calibrate.  Instead each toggle is timed against micros() (Timer0, same crystal) and every 10 secs the sketch
+  reports over Serial:
+    - jitter: the largest deviation of any one interval from the 10ms target, in uS (interrupt latency)
+    - drift:  how far the latest toggle is from where 10ms x number of toggles says it should be, in uS
+  Drift should stay within the jitter however many hours the sketch is left running.  More sleepers are added 
+  at each report (1, 8, 32, 64, 128, 256, as many as MAXSLEEPERS allows), each repeating at just over 1 sec
 
 
 **************************/
@@ -18,39 +25,86 @@
 #include "Wakeup.h"
 #include "TimerOne.h"
 
+const long togglePeriod = 10;                 // mS between toggles of pin2
+const long reportPeriod = 10000;              // mS between reports
+
 volatile int flipflop = HIGH;
+volatile unsigned long numToggles = 0;
+volatile unsigned long idealToggle;           // micros() at which latest toggle should have happened
+volatile unsigned long prevToggle;            // micros() at previous toggle
+volatile long maxJitter = 0;                  // uS; largest deviation of one interval since last report
+volatile long drift = 0;                      // uS; latest toggle less ideal time
+
+const int sleeperSteps[] = { 1, 8, 32, 64, 128, 256 };
+const int numSteps = sizeof(sleeperSteps) / sizeof(sleeperSteps[0]);
+int step = 0;
+int numSleepers = 1;                          // sleeperPin2
 
 void setup(void) {
   Serial.begin(9600);
   pinMode(2,OUTPUT);
   
   wakeup.init();
-  wakeup.wakeMeAfter(sleeperPin2, -10, NULL, true);                                     // Toggle pin2 every 10ms
-  delay(1000);
-  for (int i = 0; i < 7; i++) wakeup.wakeMeAfter(sleeperNull, 10000, NULL, TREAT_AS_ISR);  // 8 sleepers 
-  delay(1000);
-  for (int i = 0; i < 24; i++) wakeup.wakeMeAfter(sleeperNull, 10000, NULL, TREAT_AS_ISR);   // 32 sleepers
-  delay(1000);
-  for (int i = 0; i < 32; i++) wakeup.wakeMeAfter(sleeperNull, 10000, NULL, TREAT_AS_ISR);   // 64 sleepers
-  delay(1000);
-  for (int i = 0; i < 64; i++) wakeup.wakeMeAfter(sleeperNull, 10000, NULL, TREAT_AS_ISR);   // 128 sleepers
-  delay(1000);
-  for (int i = 0; i < 128; i++) wakeup.wakeMeAfter(sleeperNull, 10000, NULL, TREAT_AS_ISR);   // 256 sleepers
-
-
+  wakeup.wakeMeAfter(sleeperPin2, -togglePeriod, NULL, TREAT_AS_ISR);          // Toggle pin2 every 10ms
+  wakeup.wakeMeAfter(sleeperReport, -reportPeriod, NULL, TREAT_AS_NORMAL);      // Report every 10 secs
+  numSleepers++;
 }
 
 void sleeperPin2(void *context) {
+  unsigned long now = micros();
+  long interval;
+  
   digitalWrite(2, flipflop ^= 1);
+  
+  if (numToggles++ == 0) idealToggle = now;             // First toggle sets the baseline
+  else {
+    idealToggle += togglePeriod * 1000;
+    interval = (long)(now - prevToggle) - togglePeriod * 1000;
+    if (abs(interval) > maxJitter) maxJitter = abs(interval);
+    drift = (long)(now - idealToggle);                  // Differences survive micros() wrapping every 71 mins
+  }
+  prevToggle = now;
 }  
 
+void sleeperReport(void *context) {
+  long jitter, latestDrift;
+  unsigned long toggles;
+  WAKEUPSTATS stats;
+  byte oldSREG = SREG;
+  
+  cli();                                        // Snapshot and reset
+  jitter = maxJitter;
+  latestDrift = drift;
+  toggles = numToggles;
+  maxJitter = 0;
+  SREG = oldSREG;
+  wakeup.getStats(stats);
+  
+  Serial.print(millis() / 60000);
+  Serial.print(" mins, sleepers = ");
+  Serial.print(numSleepers);
+  Serial.print(", toggles = ");
+  Serial.print(toggles);
+  Serial.print(", jitter = ");
+  Serial.print(jitter);
+  Serial.print("us, drift = ");
+  Serial.print(latestDrift);
+  Serial.print("us, pending peak = ");
+  Serial.print(stats.pendingPeak, DEC);
+  Serial.print(", dropped = ");
+  Serial.println(stats.pendingOverflows);
+  
+  // Load up with more sleepers for the next period
+  if (step < numSteps) {
+    while (numSleepers < sleeperSteps[step] && wakeup.wakeMeAfter(sleeperNull, -(1000 + numSleepers), NULL, TREAT_AS_ISR)) numSleepers++;
+    step++;
+  }
+}
+
 void sleeperNull(void *context) {
 } 
 
 
 void loop() {
+  wakeup.runAnyPending();
 }
-
-
-
-
@@ -0,0 +1,101 @@
+/* Benchmark of WAKEUP priorities and ISR budget
+
+  A 'frame' sleeper wakes every 1000uS (via wakeMeAfterMicros) and each time puts a number of 'busy' sleepers
+  to sleep for the same period, each of which takes busyMicros to run.  All are TREAT_AS_ISR, and the busy ones
+  are put to sleep first, so without priority they're woken ahead of the frame in the same interrupt.
+
+  Each step runs for 5 secs, then reports over Serial:
+    - late:      the largest lateness of the frame sleeper, in uS
+    - isrPeak:   the longest time spent in timerISR, in uS
+    - deferred:  TREAT_AS_ISR sleepers sent to the pending queue for want of time (ISRBUDGET) or room (MAXRUNNOW)
+    - dropped:   sleepers lost because the pending queue was full
+
+  Steps cover 0, 2, 4 & 8 busy sleepers, each with the frame at priority 0 (same as the busy ones) and then 255.
+  With priority 255 the frame runs first of the sleepers woken with it, but busy sleepers armed a tick or so ahead
+  of it fall due in an interrupt of their own and run first.  So it can be late by up to ISRBUDGET plus one busy
+  sleeper however many there are, and should be earlier than at priority 0 once sleepers are deferred.  isrPeak
+  should stay within ISRBUDGET plus one busy sleeper.  Tools/hostemu/hostbench runs the same steps on the host.
+  NB: resolution of micros() is 4uS
+
+**************************/
+
+
+
+#include "Wakeup.h"
+#include "TimerOne.h"
+
+const long framePeriod = 1000;                // uS between frames
+const long reportPeriod = 5000;               // mS per step
+const int busyMicros = 60;                    // uS taken by each busy sleeper
+
+struct step {
+  byte numBusy;
+  byte framePriority;
+} const steps[] = { {0, 0}, {2, 0}, {2, 255}, {4, 0}, {4, 255}, {8, 0}, {8, 255} };
+const int numSteps = sizeof(steps) / sizeof(steps[0]);
+int stepNum = 0;
+
+volatile byte numBusy;
+volatile byte framePriority;
+volatile unsigned long frameDue;              // micros() at which frame should wake
+volatile long maxLate = 0;                    // uS; latest frame since last report
+
+void setup(void) {
+  Serial.begin(9600);
+
+  wakeup.init();
+  numBusy = steps[0].numBusy;
+  framePriority = steps[0].framePriority;
+  frameDue = micros() + framePeriod;
+  wakeup.wakeMeAfterMicros(sleeperFrame, framePeriod, NULL, TREAT_AS_ISR, framePriority);
+  wakeup.wakeMeAfter(sleeperReport, -reportPeriod, NULL, TREAT_AS_NORMAL);      // Next step every 5 secs
+}
+
+void sleeperFrame(void *context) {
+  long late = (long)(micros() - frameDue);
+
+  if (late > maxLate) maxLate = late;
+
+  // Busy sleepers first, so they're ahead of the frame on the heap
+  for (byte i = 0; i < numBusy; i++) wakeup.wakeMeAfterMicros(sleeperBusy, framePeriod, NULL, TREAT_AS_ISR);
+  frameDue = micros() + framePeriod;
+  wakeup.wakeMeAfterMicros(sleeperFrame, framePeriod, NULL, TREAT_AS_ISR, framePriority);
+}
+
+void sleeperBusy(void *context) {
+  delayMicroseconds(busyMicros);
+}
+
+void sleeperReport(void *context) {
+  long late;
+  WAKEUPSTATS stats;
+  byte oldSREG = SREG;
+
+  cli();                                        // Snapshot and reset
+  late = maxLate;
+  maxLate = 0;
+  SREG = oldSREG;
+  wakeup.getStats(stats, true);
+
+  Serial.print("busy = ");
+  Serial.print(steps[stepNum].numBusy, DEC);
+  Serial.print(", priority = ");
+  Serial.print(steps[stepNum].framePriority, DEC);
+  Serial.print(", late = ");
+  Serial.print(late);
+  Serial.print("us, isrPeak = ");
+  Serial.print(stats.isrPeak);
+  Serial.print("us, deferred = ");
+  Serial.print(stats.deferred);
+  Serial.print(", dropped = ");
+  Serial.println(stats.pendingOverflows);
+
+  // Set up the next step; takes effect at the next frame
+  if (++stepNum == numSteps) stepNum = 0;
+  numBusy = steps[stepNum].numBusy;
+  framePriority = steps[stepNum].framePriority;
+}
+
+void loop(void) {
+  wakeup.runAnyPending();
+}